@@ -50,6 +50,9 @@ struct encode_state;
 /* the space required for slice tail. */
 #define SLICE_TAIL			16
 
+/* the space required to record the end of a slice: MI_FLUSH_DW + MI_STORE_REGISTER_MEM */
+#define SLICE_END_RECORD		36
+
 
 #define MFC_BATCHBUFFER_AVC_INTRA       0
 #define MFC_BATCHBUFFER_AVC_INTER       1
@@ -389,6 +392,13 @@ intel_avc_slice_insert_packed_data(VADriverContextP ctx,
                              int slice_index,
                              struct intel_batchbuffer *slice_batch);
 
+extern void
+intel_avc_slice_end_record(VADriverContextP ctx,
+                           struct encode_state *encode_state,
+                           struct intel_encoder_context *encoder_context,
+                           int slice_index,
+                           struct intel_batchbuffer *slice_batch);
+
 extern
 Bool gen9_mfc_context_init(VADriverContextP ctx, struct intel_encoder_context *encoder_context);
 
@@ -39,6 +39,7 @@
 #include "i965_drv_video.h"
 #include "i965_encoder.h"
 #include "i965_encoder_utils.h"
+#include "i965_encoder_stats.h"
 #include "gen6_mfc.h"
 #include "gen6_vme.h"
 #include "gen9_mfc.h"
@@ -473,17 +474,49 @@ static int intel_mfc_brc_postpack_vbr(struct encode_state *encode_state,
     return sts;
 }
 
+static int intel_mfc_brc_stats_frame_type(int slice_type)
+{
+    switch (slice_type) {
+    case SLICE_TYPE_I:
+        return INTEL_ENC_STATS_FRAME_I;
+    case SLICE_TYPE_P:
+        return INTEL_ENC_STATS_FRAME_P;
+    default:
+        return INTEL_ENC_STATS_FRAME_B;
+    }
+}
+
 int intel_mfc_brc_postpack(struct encode_state *encode_state,
                            struct intel_encoder_context *encoder_context,
                            int frame_bits)
 {
+    struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+    VAEncSliceParameterBufferH264 *pSliceParameter = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[0]->buffer;
+    int slice_type = intel_avc_enc_slice_type_fixup(pSliceParameter->slice_type);
+    int qp = mfc_context->brc.qp_prime_y[0][slice_type];
+    int sts;
+
     switch (encoder_context->rate_control_mode) {
     case VA_RC_CBR:
-        return intel_mfc_brc_postpack_cbr(encode_state, encoder_context, frame_bits);
+        sts = intel_mfc_brc_postpack_cbr(encode_state, encoder_context, frame_bits);
+        break;
     case VA_RC_VBR:
-        return intel_mfc_brc_postpack_vbr(encode_state, encoder_context, frame_bits);
+        sts = intel_mfc_brc_postpack_vbr(encode_state, encoder_context, frame_bits);
+        break;
+    default:
+        assert(0 && "Invalid RC mode");
+        return BRC_NO_HRD_VIOLATION;
     }
-    assert(0 && "Invalid RC mode");
+
+    /* Only the picture that goes out is recorded, not the ones re-encoded */
+    if (encoder_context->stats && encoder_context->layer.num_layers == 1 &&
+        sts != BRC_UNDERFLOW && sts != BRC_OVERFLOW)
+        intel_enc_stats_frame_done(encoder_context->stats,
+                                   intel_mfc_brc_stats_frame_type(slice_type),
+                                   qp,
+                                   frame_bits);
+
+    return sts;
 }
 
 static void intel_mfc_hrd_context_init(struct encode_state *encode_state,
@@ -555,6 +588,24 @@ void intel_mfc_brc_prepare(struct encode_state *encode_state,
         /*Programing HRD control */
         if (encoder_context->brc.need_reset)
             intel_mfc_hrd_context_init(encode_state, encoder_context);    
+
+        /* Second pass of a two-pass encode, the QP comes from the plan */
+        if (encoder_context->stats && encoder_context->layer.num_layers == 1) {
+            struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
+            VAEncSliceParameterBufferH264 *pSliceParameter = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[0]->buffer;
+            int slice_type = intel_avc_enc_slice_type_fixup(pSliceParameter->slice_type);
+            int qp;
+
+            if (encoder_context->brc.need_reset)
+                intel_enc_stats_plan(encoder_context->stats, mfc_context->brc.bits_per_frame[0]);
+
+            if (intel_enc_stats_frame_qp(encoder_context->stats,
+                                         intel_mfc_brc_stats_frame_type(slice_type),
+                                         MAX(1, encoder_context->brc.min_qp),
+                                         51,
+                                         &qp))
+                mfc_context->brc.qp_prime_y[0][slice_type] = qp;
+        }
     }
 }
 
@@ -665,6 +716,55 @@ void intel_mfc_avc_pipeline_header_programing(VADriverContextP ctx,
     }
 }
 
+/* The end of each slice is only recorded by the PAK of gen8+ */
+static int
+intel_avc_slice_end_enabled(VADriverContextP ctx,
+                            struct encode_state *encode_state,
+                            struct intel_encoder_context *encoder_context)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+
+    return (encoder_context->slice_segments &&
+            i965->gpe_table.mi_flush_dw &&
+            i965->gpe_table.mi_store_register_mem &&
+            encode_state->num_slice_params_ext <= I965_CODEDBUFFER_MAX_SLICES);
+}
+
+/*
+ * Write the number of bytes output so far into slice_end[] of the coded
+ * buffer header once the slice is flushed out of the PAK, see
+ * i965_coded_buffer_split_slices()
+ */
+void
+intel_avc_slice_end_record(VADriverContextP ctx,
+                           struct encode_state *encode_state,
+                           struct intel_encoder_context *encoder_context,
+                           int slice_index,
+                           struct intel_batchbuffer *slice_batch)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_gpe_table *gpe = &i965->gpe_table;
+    struct gpe_mi_flush_dw_parameter mi_flush_dw_param;
+    struct gpe_mi_store_register_mem_parameter mi_store_reg_mem_param;
+
+    if (!intel_avc_slice_end_enabled(ctx, encode_state, encoder_context))
+        return;
+
+    BEGIN_BCS_BATCH(slice_batch, SLICE_END_RECORD / 4);
+
+    memset(&mi_flush_dw_param, 0, sizeof(mi_flush_dw_param));
+    gpe->mi_flush_dw(ctx, slice_batch, &mi_flush_dw_param);
+
+    memset(&mi_store_reg_mem_param, 0, sizeof(mi_store_reg_mem_param));
+    mi_store_reg_mem_param.bo = encode_state->coded_buf_object->buffer_store->bo;
+    mi_store_reg_mem_param.offset = offsetof(struct i965_coded_buffer_segment, slice_end) +
+        slice_index * sizeof(unsigned int);
+    mi_store_reg_mem_param.mmio_offset = MFC_BITSTREAM_BYTECOUNT_FRAME_REG;
+    gpe->mi_store_register_mem(ctx, slice_batch, &mi_store_reg_mem_param);
+
+    ADVANCE_BCS_BATCH(slice_batch);
+}
+
 VAStatus intel_mfc_avc_prepare(VADriverContextP ctx, 
                                struct encode_state *encode_state,
                                struct intel_encoder_context *encoder_context)
@@ -805,6 +905,19 @@ VAStatus intel_mfc_avc_prepare(VADriverContextP ctx,
     coded_buffer_segment = (struct i965_coded_buffer_segment *)bo->virtual;
     coded_buffer_segment->mapped = 0;
     coded_buffer_segment->codec = encoder_context->codec;
+    coded_buffer_segment->num_slices = 0;
+
+    if (intel_avc_slice_end_enabled(ctx, encode_state, encoder_context)) {
+        if (!obj_buffer->slice_segments)
+            obj_buffer->slice_segments = calloc(I965_CODEDBUFFER_MAX_SLICES - 1, sizeof(VACodedBufferSegment));
+
+        if (obj_buffer->slice_segments) {
+            coded_buffer_segment->num_slices = encode_state->num_slice_params_ext;
+            memset(coded_buffer_segment->slice_end, 0xff,
+                   coded_buffer_segment->num_slices * sizeof(coded_buffer_segment->slice_end[0]));
+        }
+    }
+
     dri_bo_unmap(bo);
 
     return vaStatus;
@@ -1095,6 +1208,152 @@ void intel_vme_vp8_update_mbmv_cost(VADriverContextP ctx,
     }
 }
 
+void
+intel_vme_batchbuffer_setup(VADriverContextP ctx,
+                            struct gen6_vme_context *vme_context,
+                            int width_in_mbs, int height_in_mbs)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_buffer_surface *batchbuffer = &vme_context->vme_batchbuffer;
+    int num_blocks = width_in_mbs * height_in_mbs + 1;
+
+    /*
+     * Mapping a buffer the GPU may still be reading for a refill would
+     * stall, so it is replaced by a new one, filled from scratch. Whether
+     * the old commands could be reused is only known once the buffer is
+     * bound to the surface state, too late to swap it.
+     */
+    if (batchbuffer->bo && batchbuffer->num_blocks == num_blocks &&
+        !drm_intel_bo_busy(batchbuffer->bo))
+        return;
+
+    dri_bo_unreference(batchbuffer->bo);
+    batchbuffer->num_blocks = num_blocks;
+    batchbuffer->size_block = 64; /* 4 OWORDs */
+    batchbuffer->pitch = 16;
+    batchbuffer->bo = dri_bo_alloc(i965->intel.bufmgr,
+                                   "VME batchbuffer",
+                                   batchbuffer->num_blocks * batchbuffer->size_block,
+                                   0x1000);
+    vme_context->vme_batch_valid = false;
+}
+
+/* Store the first unit and the unit count of every slice the VME batch
+ * walks into layout, if not NULL, and return the number of slices.
+ */
+static int
+intel_vme_batch_slice_layout(struct encode_state *encode_state,
+                             const struct intel_vme_batch_key *key,
+                             unsigned int *layout)
+{
+    int num_slices = 0;
+    int s, j;
+
+    for (s = 0; s < encode_state->num_slice_params_ext; s++) {
+        struct buffer_store *slice_params = encode_state->slice_params_ext[s];
+
+        if (key->codec == CODEC_H264 || key->codec == CODEC_H264_MVC) {
+            VAEncSliceParameterBufferH264 *slice_param = (VAEncSliceParameterBufferH264 *)slice_params->buffer;
+
+            if (layout) {
+                layout[2 * num_slices] = slice_param->macroblock_address;
+                layout[2 * num_slices + 1] = slice_param->num_macroblocks;
+            }
+            num_slices++;
+        } else if (key->codec == CODEC_HEVC) {
+            VAEncSliceParameterBufferHEVC *slice_param = (VAEncSliceParameterBufferHEVC *)slice_params->buffer;
+
+            if (layout) {
+                layout[2 * num_slices] = slice_param->slice_segment_address;
+                layout[2 * num_slices + 1] = slice_param->num_ctu_in_slice;
+            }
+            num_slices++;
+        } else if (key->codec == CODEC_MPEG2 && !key->walker) {
+            VAEncSliceParameterBufferMPEG2 *slice_param = (VAEncSliceParameterBufferMPEG2 *)slice_params->buffer;
+
+            for (j = 0; j < slice_params->num_elements; j++) {
+                if (layout) {
+                    layout[2 * num_slices] = slice_param[j].macroblock_address;
+                    layout[2 * num_slices + 1] = slice_param[j].num_macroblocks;
+                }
+                num_slices++;
+            }
+        }
+    }
+
+    return num_slices;
+}
+
+/* Check whether the VME batch built for a previous picture can be run
+ * again as is. If not, the caller refills it. A NULL key always asks for
+ * a refill, e.g. when the commands carry per MB QPs.
+ */
+bool
+intel_vme_batchbuffer_reusable(VADriverContextP ctx,
+                               struct gen6_vme_context *vme_context,
+                               struct encode_state *encode_state,
+                               const struct intel_vme_batch_key *key)
+{
+    int num_slices = 0;
+
+    if (key) {
+        num_slices = intel_vme_batch_slice_layout(encode_state, key, NULL);
+
+        if (num_slices > vme_context->vme_batch_max_slices) {
+            /* Room for the stored layout plus the one to compare */
+            unsigned int *slices = realloc(vme_context->vme_batch_slices,
+                                           num_slices * 4 * sizeof(*slices));
+
+            if (slices) {
+                vme_context->vme_batch_slices = slices;
+                vme_context->vme_batch_max_slices = num_slices;
+            } else
+                key = NULL;
+
+            vme_context->vme_batch_valid = false;
+        }
+    }
+
+    if (key) {
+        unsigned int *slices = vme_context->vme_batch_slices;
+        unsigned int *layout = NULL;
+        int size = num_slices * 2 * sizeof(*slices);
+
+        if (num_slices) {
+            layout = slices + 2 * vme_context->vme_batch_max_slices;
+            intel_vme_batch_slice_layout(encode_state, key, layout);
+        }
+
+        if (vme_context->vme_batch_valid &&
+            vme_context->vme_batch_num_slices == num_slices &&
+            !memcmp(&vme_context->vme_batch_key, key, sizeof(*key)) &&
+            (!num_slices || !memcmp(slices, layout, size)))
+            return true;
+
+        vme_context->vme_batch_key = *key;
+        vme_context->vme_batch_num_slices = num_slices;
+        if (num_slices)
+            memcpy(slices, layout, size);
+        vme_context->vme_batch_valid = true;
+    } else
+        vme_context->vme_batch_valid = false;
+
+    return false;
+}
+
+void
+intel_vme_batchbuffer_destroy(struct gen6_vme_context *vme_context)
+{
+    dri_bo_unreference(vme_context->vme_batchbuffer.bo);
+    vme_context->vme_batchbuffer.bo = NULL;
+
+    free(vme_context->vme_batch_slices);
+    vme_context->vme_batch_slices = NULL;
+    vme_context->vme_batch_num_slices = 0;
+    vme_context->vme_batch_max_slices = 0;
+    vme_context->vme_batch_valid = false;
+}
+
 #define		MB_SCOREBOARD_A		(1 << 0)
 #define		MB_SCOREBOARD_B		(1 << 1)
 #define		MB_SCOREBOARD_C		(1 << 2)
@@ -46,10 +46,13 @@
 #define GEN6_VC1_ADVANCED_PROFILE       2
 #define GEN6_VC1_RESERVED_PROFILE       3
 
+struct gen_bo_pool;
+
 struct gen6_vc1_surface
 {
     dri_bo *dmv;
     int picture_type;
+    struct gen_bo_pool *bo_pool;
 };
 
 struct hw_context;
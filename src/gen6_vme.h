@@ -51,6 +51,22 @@
 struct encode_state;
 struct intel_encoder_context;
 
+/* What the MEDIA_OBJECT commands of a VME batch were built from, besides
+ * the slice layout. Kept free of padding so that it can be memcmp'ed.
+ */
+struct intel_vme_batch_key
+{
+    int codec;
+    int walker;
+    int mb_width;
+    int mb_height;
+    int mbs_per_unit;           /* MBs per slice address unit, e.g. per CTB */
+    int kernel;
+    unsigned int flags;         /* transform_8x8_mode_flag */
+    int qp;
+    unsigned int quality_level;
+};
+
 struct gen6_vme_context
 {
     struct i965_gpe_context gpe_context;
@@ -62,6 +78,12 @@ struct gen6_vme_context
     struct i965_buffer_surface vme_output;
     struct i965_buffer_surface vme_batchbuffer;
 
+    /* The batch is rebuilt only when its key or slice layout changes */
+    struct intel_vme_batch_key vme_batch_key;
+    unsigned int *vme_batch_slices;     /* first unit and unit count per slice */
+    int vme_batch_num_slices;
+    int vme_batch_max_slices;
+    bool vme_batch_valid;
 
     void (*vme_surface2_setup)(VADriverContextP ctx,
                                struct i965_gpe_context *gpe_context,
@@ -171,6 +193,20 @@ gen7_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
 extern void 
 gen7_vme_scoreboard_init(VADriverContextP ctx, struct gen6_vme_context *vme_context);
 
+extern void
+intel_vme_batchbuffer_setup(VADriverContextP ctx,
+                            struct gen6_vme_context *vme_context,
+                            int width_in_mbs, int height_in_mbs);
+
+extern bool
+intel_vme_batchbuffer_reusable(VADriverContextP ctx,
+                               struct gen6_vme_context *vme_context,
+                               struct encode_state *encode_state,
+                               const struct intel_vme_batch_key *key);
+
+extern void
+intel_vme_batchbuffer_destroy(struct gen6_vme_context *vme_context);
+
 extern void
 intel_vme_mpeg2_state_setup(VADriverContextP ctx,
                             struct encode_state *encode_state,
@@ -75,6 +75,7 @@ gen75_vpp_vebox(VADriverContextP ctx,
      }
 
      proc_ctx->vpp_vebox_ctx->pipeline_param  = pipeline_param;
+     proc_ctx->vpp_vebox_ctx->statistics = proc_ctx->statistics;
      proc_ctx->vpp_vebox_ctx->surface_input_object = proc_ctx->surface_pipeline_input_object;
      proc_ctx->vpp_vebox_ctx->surface_output_object  = proc_ctx->surface_render_output_object;
 
@@ -229,6 +230,7 @@ gen75_proc_picture(VADriverContextP ctx,
     VAStatus status;
 
     proc_ctx->pipeline_param = pipeline_param;
+    proc_ctx->statistics = proc_st->statistics;
 
     if (proc_st->current_render_target == VA_INVALID_SURFACE ||
         pipeline_param->surface == VA_INVALID_SURFACE) {
@@ -603,6 +605,18 @@ error:
     return status;
 }
 
+static VAStatus
+gen75_proc_get_status(VADriverContextP ctx,
+                      struct hw_context *hw_context,
+                      void *buffer)
+{
+    struct i965_proc_statistics_segment *statistics_segment = buffer;
+
+    gen75_vebox_get_statistics(ctx, statistics_segment);
+
+    return VA_STATUS_SUCCESS;
+}
+
 static void 
 gen75_proc_context_destroy(void *hw_context)
 {
@@ -633,6 +647,7 @@ gen75_proc_context_init(VADriverContextP ctx,
     assert(proc_context);
     proc_context->base.destroy = gen75_proc_context_destroy;
     proc_context->base.run     = gen75_proc_picture;
+    proc_context->base.get_status = gen75_proc_get_status;
 
     proc_context->vpp_vebox_ctx    = NULL;
     proc_context->vpp_fmt_cvt_ctx  = NULL;
@@ -41,6 +41,7 @@ struct intel_video_process_context
     struct hw_context          *vpp_fmt_cvt_ctx;
 
     VAProcPipelineParameterBuffer* pipeline_param;
+    struct buffer_store *statistics;
 
     struct object_surface *surface_render_output_object;
     struct object_surface *surface_pipeline_input_object;
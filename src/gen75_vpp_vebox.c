@@ -117,6 +117,39 @@ vpp_surface_scaling(VADriverContextP ctx, struct object_surface *src_obj_surf,
     return va_status;
 }
 
+static VAStatus
+vpp_surface_scaling_convert(VADriverContextP ctx, struct object_surface *src_obj_surf,
+    struct object_surface *dst_obj_surf, uint32_t flags)
+{
+    VARectangle src_rect, dst_rect;
+    src_rect.x = 0;
+    src_rect.y = 0;
+    src_rect.width  = src_obj_surf->orig_width;
+    src_rect.height = src_obj_surf->orig_height;
+
+    dst_rect.x = 0;
+    dst_rect.y = 0;
+    dst_rect.width  = dst_obj_surf->orig_width;
+    dst_rect.height = dst_obj_surf->orig_height;
+
+    struct i965_surface src_surface, dst_surface;
+    src_surface.base  = (struct object_base *)src_obj_surf;
+    src_surface.type  = I965_SURFACE_TYPE_SURFACE;
+    src_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+    dst_surface.base  = (struct object_base *)dst_obj_surf;
+    dst_surface.type  = I965_SURFACE_TYPE_SURFACE;
+    dst_surface.flags = I965_SURFACE_FLAG_FRAME;
+
+    /* the PP load/save kernels resize while converting, so this is one pass */
+    return i965_image_scaling_processing(ctx,
+                                         &src_surface,
+                                         &src_rect,
+                                         &dst_surface,
+                                         &dst_rect,
+                                         flags);
+}
+
 static VAStatus
 vpp_sharpness_filtering(VADriverContextP ctx,
     struct intel_vebox_context *proc_ctx)
@@ -852,6 +885,7 @@ void hsw_veb_iecp_csc_transform_table(VADriverContextP ctx, struct intel_vebox_c
     }else if((proc_ctx->fourcc_input  == VA_FOURCC_NV12 ||
               proc_ctx->fourcc_input  == VA_FOURCC_YV12 ||
               proc_ctx->fourcc_input  == VA_FOURCC_YUY2 ||
+              proc_ctx->fourcc_input  == VA_FOURCC_UYVY ||
               proc_ctx->fourcc_input  == VA_FOURCC_AYUV) &&
               proc_ctx->fourcc_output == VA_FOURCC_RGBA) {
          tran_coef[0] = 1.164;
@@ -1014,6 +1048,7 @@ void hsw_veb_surface_state(VADriverContextP ctx, struct intel_vebox_context *pro
 
     assert(obj_surf->fourcc == VA_FOURCC_NV12 ||
            obj_surf->fourcc == VA_FOURCC_YUY2 ||
+           obj_surf->fourcc == VA_FOURCC_UYVY ||
            obj_surf->fourcc == VA_FOURCC_AYUV ||
            obj_surf->fourcc == VA_FOURCC_RGBA);
 
@@ -1027,6 +1062,11 @@ void hsw_veb_surface_state(VADriverContextP ctx, struct intel_vebox_context *pro
         surface_pitch = obj_surf->width * 2; 
         is_uv_interleaved = 0;
         half_pitch_chroma = 0;
+    } else if (obj_surf->fourcc == VA_FOURCC_UYVY) {
+        surface_format = YCRCB_SWAPY;
+        surface_pitch = obj_surf->width * 2;
+        is_uv_interleaved = 0;
+        half_pitch_chroma = 0;
     } else if (obj_surf->fourcc == VA_FOURCC_AYUV) {
         surface_format = PACKED_444A_8;
         surface_pitch = obj_surf->width * 4; 
@@ -1079,17 +1119,145 @@ void hsw_veb_surface_state(VADriverContextP ctx, struct intel_vebox_context *pro
     ADVANCE_VEB_BATCH(batch);
 }
 
+static unsigned int
+gen75_vebox_statistics_block_size(struct intel_vebox_context *proc_ctx)
+{
+    struct object_surface *obj_surface = proc_ctx->frame_store[FRAME_IN_CURRENT].obj_surface;
+    unsigned int width64 = ALIGN(proc_ctx->width_input, 64);
+
+    if (width64 > obj_surface->orig_width)
+        width64 = obj_surface->orig_width;
+
+    return width64 * ALIGN(obj_surface->orig_height, 4) / 4;
+}
+
+/* Let VEBOX write the statistics straight behind the header of the
+ * application statistics buffer, if there is one */
+static dri_bo *
+gen75_vebox_statistics_bo(struct intel_vebox_context *proc_ctx,
+    unsigned int *offset)
+{
+    if (proc_ctx->statistics && proc_ctx->statistics->bo) {
+        *offset = I965_PROC_STATISTICS_HEADER_SIZE;
+        return proc_ctx->statistics->bo;
+    }
+
+    *offset = 0;
+    return proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo;
+}
+
+static VAStatus
+gen75_vebox_ensure_statistics(VADriverContextP ctx,
+    struct intel_vebox_context *proc_ctx)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct buffer_store * const statistics = proc_ctx->statistics;
+    struct i965_proc_statistics_segment *statistics_segment;
+    unsigned int block_size, frame_size;
+    dri_bo *bo;
+
+    if (!statistics || !statistics->bo)
+        return VA_STATUS_SUCCESS;
+
+    block_size = gen75_vebox_statistics_block_size(proc_ctx);
+    frame_size = VEB_STATISTICS_NUM_SLICES *
+        (VEB_STATISTICS_FRAME_SIZE + VEB_STATISTICS_HISTOGRAM_SIZE);
+
+    if (statistics->bo->size < I965_PROC_STATISTICS_HEADER_SIZE + block_size + frame_size) {
+        bo = dri_bo_alloc(i965->intel.bufmgr, "Statistics buffer",
+            I965_PROC_STATISTICS_HEADER_SIZE + block_size + frame_size, 64);
+        if (!bo)
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+        dri_bo_unreference(statistics->bo);
+        statistics->bo = bo;
+    }
+
+    dri_bo_map(statistics->bo, 1);
+    if (!statistics->bo->virtual)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    statistics_segment = statistics->bo->virtual;
+    memset(statistics_segment, 0, sizeof(*statistics_segment));
+    statistics_segment->pending = 1;
+    statistics_segment->flags = VA_PROC_STATISTICS_HISTOGRAM;
+    if (proc_ctx->is_dn_enabled)
+        statistics_segment->flags |= VA_PROC_STATISTICS_NOISE;
+    if (proc_ctx->is_di_enabled)
+        statistics_segment->flags |= VA_PROC_STATISTICS_FIELD_MOTION;
+
+    statistics_segment->frame_offset = block_size;
+    statistics_segment->slice_pitch = VEB_STATISTICS_FRAME_SIZE;
+    statistics_segment->histogram_offset = block_size +
+        VEB_STATISTICS_NUM_SLICES * VEB_STATISTICS_FRAME_SIZE;
+    statistics_segment->histogram_pitch = VEB_STATISTICS_HISTOGRAM_SIZE;
+    statistics_segment->num_slices = VEB_STATISTICS_NUM_SLICES;
+
+    /* parts with a single VEBOX slice leave the second copy untouched */
+    memset((unsigned char *)statistics->bo->virtual + I965_PROC_STATISTICS_HEADER_SIZE + block_size,
+        0, frame_size);
+
+    dri_bo_unmap(statistics->bo);
+
+    return VA_STATUS_SUCCESS;
+}
+
+void
+gen75_vebox_get_statistics(VADriverContextP ctx,
+    struct i965_proc_statistics_segment *statistics_segment)
+{
+    VAProcStatisticsI965 * const stats = &statistics_segment->base;
+    const unsigned char * const surface =
+        (unsigned char *)statistics_segment + I965_PROC_STATISTICS_HEADER_SIZE;
+    const unsigned int *frame, *histogram;
+    unsigned int i, j;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->flags = statistics_segment->flags;
+
+    /* Each VEBOX slice accumulates its own part of the picture */
+    for (i = 0; i < statistics_segment->num_slices; i++) {
+        frame = (const unsigned int *)(surface + statistics_segment->frame_offset +
+            i * statistics_segment->slice_pitch);
+        histogram = (const unsigned int *)(surface + statistics_segment->histogram_offset +
+            i * statistics_segment->histogram_pitch);
+
+        if (stats->flags & VA_PROC_STATISTICS_HISTOGRAM) {
+            for (j = 0; j < ARRAY_ELEMS(stats->histogram); j++)
+                stats->histogram[j] += histogram[j];
+        }
+
+        if (stats->flags & VA_PROC_STATISTICS_NOISE) {
+            for (j = 0; j < 3; j++) {
+                stats->noise_sum[j] += frame[VEB_STATISTICS_GNE_OFFSET / 4 + j];
+                stats->noise_count[j] += frame[VEB_STATISTICS_GNE_OFFSET / 4 + 3 + j];
+            }
+        }
+
+        if (stats->flags & VA_PROC_STATISTICS_FIELD_MOTION) {
+            for (j = 0; j < ARRAY_ELEMS(stats->field_motion); j++)
+                stats->field_motion[j] += frame[VEB_STATISTICS_FMD_OFFSET / 4 + j];
+        }
+    }
+
+    statistics_segment->pending = 0;
+}
+
 void hsw_veb_dndi_iecp_command(VADriverContextP ctx, struct intel_vebox_context *proc_ctx)
 {
     struct intel_batchbuffer *batch = proc_ctx->batch;
     unsigned char frame_ctrl_bits = 0;
     struct object_surface *obj_surface = proc_ctx->frame_store[FRAME_IN_CURRENT].obj_surface;
     unsigned int width64 = ALIGN(proc_ctx->width_input, 64);
+    unsigned int statistics_offset;
+    dri_bo *statistics_bo;
 
     assert(obj_surface);
     if (width64 > obj_surface->orig_width)
         width64 = obj_surface->orig_width;
 
+    statistics_bo = gen75_vebox_statistics_bo(proc_ctx, &statistics_offset);
+
     /* s1:update the previous and current input */
 /*    tempFrame = proc_ctx->frame_store[FRAME_IN_PREVIOUS];
     proc_ctx->frame_store[FRAME_IN_PREVIOUS] = proc_ctx->frame_store[FRAME_IN_CURRENT]; ;
@@ -1134,8 +1302,8 @@ void hsw_veb_dndi_iecp_command(VADriverContextP ctx, struct intel_vebox_context
               proc_ctx->frame_store[FRAME_OUT_PREVIOUS].obj_surface->bo,
               I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);
     OUT_RELOC(batch,
-              proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo,
-              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);
+              statistics_bo,
+              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, statistics_offset | frame_ctrl_bits);
 
     ADVANCE_VEB_BATCH(batch);
 }
@@ -1231,7 +1399,10 @@ gen75_vebox_ensure_surfaces_storage(VADriverContextP ctx,
             proc_ctx->filters_mask |= VPP_IECP_CSC_TRANSFORM;
         } else if (output_fourcc == VA_FOURCC_RGBA &&
                    (input_fourcc == VA_FOURCC_NV12 ||
-                    input_fourcc == VA_FOURCC_P010)) {
+                    input_fourcc == VA_FOURCC_P010 ||
+                    input_fourcc == VA_FOURCC_YUY2 ||
+                    input_fourcc == VA_FOURCC_UYVY ||
+                    input_fourcc == VA_FOURCC_AYUV)) {
             proc_ctx->filters_mask |= VPP_IECP_CSC_TRANSFORM;
         }
     }
@@ -1467,6 +1638,7 @@ VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
 
       } else if(obj_surf_input->fourcc ==  VA_FOURCC_AYUV ||
                 obj_surf_input->fourcc ==  VA_FOURCC_YUY2 ||
+                obj_surf_input->fourcc ==  VA_FOURCC_UYVY ||
                 obj_surf_input->fourcc ==  VA_FOURCC_NV12 ||
                 obj_surf_input->fourcc ==  VA_FOURCC_P010){
 
@@ -1502,12 +1674,19 @@ VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
         obj_surf_output->fourcc ==  VA_FOURCC_I420 ||
         obj_surf_output->fourcc ==  VA_FOURCC_IMC1 ||
         obj_surf_output->fourcc ==  VA_FOURCC_IMC3 ||
-        obj_surf_output->fourcc ==  VA_FOURCC_RGBA ||
         obj_surf_output->fourcc ==  VA_FOURCC_BGRA) {
 
         proc_ctx->format_convert_flags |= POST_FORMAT_CONVERT;
+    } else if(obj_surf_output->fourcc ==  VA_FOURCC_RGBA) {
+        /* The IECP CSC stage writes RGBA from 8-bit YUV. The sharpness
+         * kernel only works on NV12, and a resized picture is converted
+         * while scaling instead */
+        if (obj_surf_input->fourcc == VA_FOURCC_P010 ||
+            (proc_ctx->filters_mask & VPP_SHARP_MASK))
+            proc_ctx->format_convert_flags |= POST_FORMAT_CONVERT;
     } else if(obj_surf_output->fourcc ==  VA_FOURCC_AYUV ||
               obj_surf_output->fourcc ==  VA_FOURCC_YUY2 ||
+              obj_surf_output->fourcc ==  VA_FOURCC_UYVY ||
               obj_surf_output->fourcc ==  VA_FOURCC_NV12 ||
               obj_surf_output->fourcc ==  VA_FOURCC_P010) {
 
@@ -1537,25 +1716,6 @@ VAStatus hsw_veb_pre_format_convert(VADriverContextP ctx,
        }
      }   
 
-     if(proc_ctx->format_convert_flags & POST_SCALING_CONVERT){
-       if(proc_ctx->surface_output_scaled_object == NULL){
-             va_status = i965_CreateSurfaces(ctx,
-                                            proc_ctx->width_output,
-                                            proc_ctx->height_output,
-                                            VA_RT_FORMAT_YUV420,
-                                            1,
-                                            &(proc_ctx->surface_output_scaled));
-             assert(va_status == VA_STATUS_SUCCESS);
-             obj_surf_output_vebox = SURFACE(proc_ctx->surface_output_scaled);
-             assert(obj_surf_output_vebox);
-
-             if (obj_surf_output_vebox) {
-                 proc_ctx->surface_output_scaled_object = obj_surf_output_vebox;
-                 i965_check_alloc_surface_bo(ctx, obj_surf_output_vebox, 1, VA_FOURCC_NV12, SUBSAMPLE_YUV420);
-             }
-       }
-     } 
-    
      return VA_STATUS_SUCCESS;
 }
 
@@ -1583,17 +1743,17 @@ hsw_veb_post_format_convert(VADriverContextP ctx,
 
     } else if(proc_ctx->format_convert_flags & POST_SCALING_CONVERT) {
         VAProcPipelineParameterBuffer * const pipe = proc_ctx->pipeline_param;
-       /* scaling, convert and copy NV12 to YV12/IMC3/IMC2/RGBA output*/
         assert(obj_surface->fourcc == VA_FOURCC_NV12);
-     
-        /* first step :surface scaling */
-        vpp_surface_scaling(ctx, obj_surface,
-            proc_ctx->surface_output_scaled_object, pipe->filter_flags);
 
-        /* second step: color format convert and copy to output */
-        obj_surface = proc_ctx->surface_output_object;
-
-	va_status = vpp_surface_convert(ctx, proc_ctx->surface_output_scaled_object, obj_surface);
+        if (proc_ctx->surface_output_object->fourcc == VA_FOURCC_NV12) {
+            /* scale NV12 straight into the output */
+            va_status = vpp_surface_scaling(ctx, obj_surface,
+                proc_ctx->surface_output_object, pipe->filter_flags);
+        } else {
+            /* scale and convert NV12 to the output format in one pass */
+            va_status = vpp_surface_scaling_convert(ctx, obj_surface,
+                proc_ctx->surface_output_object, pipe->filter_flags);
+        }
    }
 
     return va_status;
@@ -1645,6 +1805,11 @@ gen75_vebox_init_pipe_params(VADriverContextP ctx,
         }
     }
 
+    /* The luma histogram is gathered by ACE, whose default curve leaves
+     * the picture as it is */
+    if (proc_ctx->statistics)
+        proc_ctx->filters_mask |= VPP_IECP_ACE;
+
     if(proc_ctx->filters_mask == 0)
         proc_ctx->filters_mask |= VPP_IECP_CSC;
 
@@ -1760,6 +1925,10 @@ gen75_vebox_process_picture(VADriverContextP ctx,
         assert(proc_ctx->is_second_field);
         /* directly copy the saved frame in the second call */
     } else {
+        status = gen75_vebox_ensure_statistics(ctx, proc_ctx);
+        if (status != VA_STATUS_SUCCESS)
+            return status;
+
         intel_batchbuffer_start_atomic_veb(proc_ctx->batch, 0x1000);
         intel_batchbuffer_emit_mi_flush(proc_ctx->batch);
         hsw_veb_state_table_setup(ctx, proc_ctx);
@@ -1798,12 +1967,6 @@ void gen75_vebox_context_destroy(VADriverContextP ctx,
        proc_ctx->surface_output_vebox_object = NULL;
      }
 
-    if(proc_ctx->surface_output_scaled != VA_INVALID_ID){
-       i965_DestroySurfaces(ctx, &proc_ctx->surface_output_scaled, 1);
-       proc_ctx->surface_output_scaled = VA_INVALID_ID;
-       proc_ctx->surface_output_scaled_object = NULL;
-     }
-
     for (i = 0; i < ARRAY_ELEMS(proc_ctx->frame_store); i++)
         frame_store_clear(&proc_ctx->frame_store[i], ctx);
 
@@ -1847,11 +2010,10 @@ struct intel_vebox_context * gen75_vebox_context_init(VADriverContextP ctx)
     proc_context->surface_input_vebox_object = NULL;
     proc_context->surface_output_vebox  = VA_INVALID_ID;
     proc_context->surface_output_vebox_object = NULL;
-    proc_context->surface_output_scaled = VA_INVALID_ID;
-    proc_context->surface_output_scaled_object = NULL;
     proc_context->filters_mask          = 0;
     proc_context->format_convert_flags  = 0;
     proc_context->vpp_gpe_ctx      = NULL;
+    proc_context->statistics       = NULL;
 
     return proc_context;
 }
@@ -1911,11 +2073,15 @@ void bdw_veb_dndi_iecp_command(VADriverContextP ctx, struct intel_vebox_context
     unsigned char frame_ctrl_bits = 0;
     struct object_surface *obj_surface = proc_ctx->frame_store[FRAME_IN_CURRENT].obj_surface;
     unsigned int width64 = ALIGN(proc_ctx->width_input, 64);
+    unsigned int statistics_offset;
+    dri_bo *statistics_bo;
 
     assert(obj_surface);
     if (width64 > obj_surface->orig_width)
         width64 = obj_surface->orig_width;
 
+    statistics_bo = gen75_vebox_statistics_bo(proc_ctx, &statistics_offset);
+
     BEGIN_VEB_BATCH(batch, 0x14);
     OUT_VEB_BATCH(batch, VEB_DNDI_IECP_STATE | (0x14 - 2));//DWord 0
     OUT_VEB_BATCH(batch, (width64 - 1));
@@ -1949,8 +2115,8 @@ void bdw_veb_dndi_iecp_command(VADriverContextP ctx, struct intel_vebox_context
               I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);//DWord 14
 
     OUT_RELOC64(batch,
-              proc_ctx->frame_store[FRAME_OUT_STATISTIC].obj_surface->bo,
-              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, frame_ctrl_bits);//DWord 16
+              statistics_bo,
+              I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, statistics_offset | frame_ctrl_bits);//DWord 16
 
     OUT_VEB_BATCH(batch,0);//DWord 18
     OUT_VEB_BATCH(batch,0);//DWord 19
@@ -1990,6 +2156,10 @@ gen8_vebox_process_picture(VADriverContextP ctx,
         assert(proc_ctx->is_second_field);
         /* directly copy the saved frame in the second call */
     } else {
+        status = gen75_vebox_ensure_statistics(ctx, proc_ctx);
+        if (status != VA_STATUS_SUCCESS)
+            return status;
+
         intel_batchbuffer_start_atomic_veb(proc_ctx->batch, 0x1000);
         intel_batchbuffer_emit_mi_flush(proc_ctx->batch);
         hsw_veb_state_table_setup(ctx, proc_ctx);
@@ -2168,6 +2338,7 @@ void skl_veb_iecp_csc_transform_table(VADriverContextP ctx, struct intel_vebox_c
     }else if((proc_ctx->fourcc_input  == VA_FOURCC_NV12 ||
               proc_ctx->fourcc_input  == VA_FOURCC_YV12 ||
               proc_ctx->fourcc_input  == VA_FOURCC_YUY2 ||
+              proc_ctx->fourcc_input  == VA_FOURCC_UYVY ||
               proc_ctx->fourcc_input  == VA_FOURCC_AYUV) &&
              proc_ctx->fourcc_output == VA_FOURCC_RGBA) {
         tran_coef[0] = 1.164;
@@ -2357,6 +2528,7 @@ void skl_veb_surface_state(VADriverContextP ctx, struct intel_vebox_context *pro
 
     assert(obj_surf->fourcc == VA_FOURCC_NV12 ||
            obj_surf->fourcc == VA_FOURCC_YUY2 ||
+           obj_surf->fourcc == VA_FOURCC_UYVY ||
            obj_surf->fourcc == VA_FOURCC_AYUV ||
            obj_surf->fourcc == VA_FOURCC_RGBA ||
            obj_surf->fourcc == VA_FOURCC_P010);
@@ -2371,6 +2543,11 @@ void skl_veb_surface_state(VADriverContextP ctx, struct intel_vebox_context *pro
         surface_pitch = obj_surf->width * 2;
         is_uv_interleaved = 0;
         half_pitch_chroma = 0;
+    } else if (obj_surf->fourcc == VA_FOURCC_UYVY) {
+        surface_format = YCRCB_SWAPY;
+        surface_pitch = obj_surf->width * 2;
+        is_uv_interleaved = 0;
+        half_pitch_chroma = 0;
     } else if (obj_surf->fourcc == VA_FOURCC_AYUV) {
         surface_format = PACKED_444A_8;
         surface_pitch = obj_surf->width * 4;
@@ -2464,6 +2641,10 @@ gen9_vebox_process_picture(VADriverContextP ctx,
         assert(proc_ctx->is_second_field);
         /* directly copy the saved frame in the second call */
     } else {
+        status = gen75_vebox_ensure_statistics(ctx, proc_ctx);
+        if (status != VA_STATUS_SUCCESS)
+            return status;
+
         intel_batchbuffer_start_atomic_veb(proc_ctx->batch, 0x1000);
         intel_batchbuffer_emit_mi_flush(proc_ctx->batch);
         skl_veb_state_table_setup(ctx, proc_ctx);
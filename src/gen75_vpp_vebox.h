@@ -56,6 +56,14 @@
 #define VPP_SHARP_MASK     0x000f0000
 #define MAX_FILTER_SUM     8
 
+/* The statistics surface holds the 16x4 block statistics followed by
+ * the per-frame statistics and the ACE histogram of each VEBOX slice */
+#define VEB_STATISTICS_NUM_SLICES       2
+#define VEB_STATISTICS_FRAME_SIZE       (32 * 4)
+#define VEB_STATISTICS_HISTOGRAM_SIZE   (256 * 4)
+#define VEB_STATISTICS_FMD_OFFSET       0x00    /* field motion detection */
+#define VEB_STATISTICS_GNE_OFFSET       0x2C    /* global noise estimate */
+
 #define PRE_FORMAT_CONVERT      0x01
 #define POST_FORMAT_CONVERT     0x02
 #define POST_SCALING_CONVERT    0x04
@@ -114,8 +122,6 @@ struct intel_vebox_context
     struct object_surface *surface_input_vebox_object;    
     VASurfaceID surface_output_vebox;
     struct object_surface *surface_output_vebox_object;
-    VASurfaceID surface_output_scaled;
-    struct object_surface *surface_output_scaled_object;
 
     unsigned int fourcc_input;
     unsigned int fourcc_output;
@@ -137,6 +143,7 @@ struct intel_vebox_context
     int current_output_type; /* 0:Both, 1:Previous, 2:Current */
 
     VAProcPipelineParameterBuffer * pipeline_param;
+    struct buffer_store *statistics;
     void * filter_dn;
     void * filter_di;
     void * filter_iecp_std;
@@ -172,4 +179,7 @@ VAStatus gen8_vebox_process_picture(VADriverContextP ctx,
 VAStatus gen9_vebox_process_picture(VADriverContextP ctx,
                          struct intel_vebox_context *proc_ctx);
 
+void gen75_vebox_get_statistics(VADriverContextP ctx,
+                         struct i965_proc_statistics_segment *statistics_segment);
+
 #endif
@@ -68,6 +68,7 @@ gen7_mfd_init_avc_surface(VADriverContextP ctx,
         assert(gen7_avc_surface);
         gen7_avc_surface->base.frame_store_id = -1;
         assert((obj_surface->size & 0x3f) == 0);
+        gen7_avc_surface->bo_pool = &i965->codec_bo_pool;
         obj_surface->private_data = gen7_avc_surface;
     }
 
@@ -75,19 +76,19 @@ gen7_mfd_init_avc_surface(VADriverContextP ctx,
                                          !pic_param->seq_fields.bits.direct_8x8_inference_flag);
 
     if (gen7_avc_surface->dmv_top == NULL) {
-        gen7_avc_surface->dmv_top = dri_bo_alloc(i965->intel.bufmgr,
-                                                 "direct mv w/r buffer",
-                                                 width_in_mbs * (height_in_mbs + 1) * 64,
-                                                 0x1000);
+        gen7_avc_surface->dmv_top = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                      "direct mv w/r buffer",
+                                                      width_in_mbs * (height_in_mbs + 1) * 64,
+                                                      0x1000);
         assert(gen7_avc_surface->dmv_top);
     }
 
     if (gen7_avc_surface->dmv_bottom_flag &&
         gen7_avc_surface->dmv_bottom == NULL) {
-        gen7_avc_surface->dmv_bottom = dri_bo_alloc(i965->intel.bufmgr,
-                                                    "direct mv w/r buffer",
-                                                    width_in_mbs * (height_in_mbs + 1) * 64,
-                                                    0x1000);
+        gen7_avc_surface->dmv_bottom = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                         "direct mv w/r buffer",
+                                                         width_in_mbs * (height_in_mbs + 1) * 64,
+                                                         0x1000);
         assert(gen7_avc_surface->dmv_bottom);
     }
 }
@@ -1045,19 +1046,22 @@ gen7_mfd_mpeg2_qm_state(VADriverContextP ctx,
     }
 }
 
-uint32_t mpeg2_get_slice_data_length(dri_bo *slice_data_bo, VASliceParameterBufferMPEG2 *slice_param)
+uint32_t mpeg2_get_slice_data_length(struct decode_state *decode_state,
+                                     struct buffer_store *slice_data_store,
+                                     VASliceParameterBufferMPEG2 *slice_param)
 {
-    uint8_t *buf;
+    const uint8_t *buf;
     uint32_t buf_offset = slice_param->slice_data_offset + (slice_param->macroblock_offset >> 3);
     uint32_t buf_size = slice_param->slice_data_size - (slice_param->macroblock_offset >> 3);
     uint32_t i = 0;
 
-    dri_bo_map(slice_data_bo, 0);
-    buf = (uint8_t *)slice_data_bo->virtual + buf_offset;
-
     if (buf_size < 4)
       return buf_size;
 
+    buf = intel_decoder_map_slice_data(decode_state, slice_data_store,
+                                       buf_offset, buf_size);
+    assert(buf);
+
     while (i <= (buf_size - 4)) {
       if (buf[i + 2] > 1) {
         i += 3;
@@ -1073,7 +1077,7 @@ uint32_t mpeg2_get_slice_data_length(dri_bo *slice_data_bo, VASliceParameterBuff
     if (i <= (buf_size - 4))
       buf_size = i;
 
-    dri_bo_unmap(slice_data_bo);
+    intel_decoder_unmap_slice_data(slice_data_store, buf);
     return buf_size;
 }
 
@@ -1081,7 +1085,8 @@ static void
 gen7_mfd_mpeg2_bsd_object(VADriverContextP ctx,
                           VAPictureParameterBufferMPEG2 *pic_param,
                           VASliceParameterBufferMPEG2 *slice_param,
-                          dri_bo *slice_data_bo,
+                          struct decode_state *decode_state,
+                          struct buffer_store *slice_data_store,
                           VASliceParameterBufferMPEG2 *next_slice_param,
                           struct gen7_mfd_context *gen7_mfd_context)
 {
@@ -1112,7 +1117,7 @@ gen7_mfd_mpeg2_bsd_object(VADriverContextP ctx,
     BEGIN_BCS_BATCH(batch, 5);
     OUT_BCS_BATCH(batch, MFD_MPEG2_BSD_OBJECT | (5 - 2));
     OUT_BCS_BATCH(batch, 
-                  mpeg2_get_slice_data_length(slice_data_bo, slice_param));
+                  mpeg2_get_slice_data_length(decode_state, slice_data_store, slice_param));
     OUT_BCS_BATCH(batch, 
                   slice_param->slice_data_offset + (slice_param->macroblock_offset >> 3));
     OUT_BCS_BATCH(batch,
@@ -1175,7 +1180,9 @@ gen7_mfd_mpeg2_decode_picture(VADriverContextP ctx,
             else
                 next_slice_param = next_slice_group_param;
 
-            gen7_mfd_mpeg2_bsd_object(ctx, pic_param, slice_param, slice_data_bo, next_slice_param, gen7_mfd_context);
+            gen7_mfd_mpeg2_bsd_object(ctx, pic_param, slice_param,
+                                      decode_state, decode_state->slice_datas[j],
+                                      next_slice_param, gen7_mfd_context);
             slice_param++;
         }
     }
@@ -1228,7 +1235,7 @@ gen7_mfd_free_vc1_surface(void **data)
     if (!gen7_vc1_surface)
         return;
 
-    dri_bo_unreference(gen7_vc1_surface->dmv);
+    gen_bo_pool_release(gen7_vc1_surface->bo_pool, gen7_vc1_surface->dmv);
     free(gen7_vc1_surface);
     *data = NULL;
 }
@@ -1249,16 +1256,17 @@ gen7_mfd_init_vc1_surface(VADriverContextP ctx,
         gen7_vc1_surface = calloc(sizeof(struct gen7_vc1_surface), 1);
         assert(gen7_vc1_surface);
         assert((obj_surface->size & 0x3f) == 0);
+        gen7_vc1_surface->bo_pool = &i965->codec_bo_pool;
         obj_surface->private_data = gen7_vc1_surface;
     }
 
     gen7_vc1_surface->picture_type = pic_param->picture_fields.bits.picture_type;
 
     if (gen7_vc1_surface->dmv == NULL) {
-        gen7_vc1_surface->dmv = dri_bo_alloc(i965->intel.bufmgr,
-                                             "direct mv w/r buffer",
-                                             width_in_mbs * height_in_mbs * 64,
-                                             0x1000);
+        gen7_vc1_surface->dmv = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                  "direct mv w/r buffer",
+                                                  width_in_mbs * height_in_mbs * 64,
+                                                  0x1000);
     }
 }
 
@@ -1717,7 +1725,7 @@ gen7_mfd_vc1_directmode_state(VADriverContextP ctx,
 }
 
 static int
-gen7_mfd_vc1_get_macroblock_bit_offset(uint8_t *buf, int in_slice_data_bit_offset, int profile)
+gen7_mfd_vc1_get_macroblock_bit_offset(const uint8_t *buf, int in_slice_data_bit_offset, int profile)
 {
     int out_slice_data_bit_offset;
     int slice_header_size = in_slice_data_bit_offset / 8;
@@ -1743,20 +1751,27 @@ gen7_mfd_vc1_bsd_object(VADriverContextP ctx,
                         VAPictureParameterBufferVC1 *pic_param,
                         VASliceParameterBufferVC1 *slice_param,
                         VASliceParameterBufferVC1 *next_slice_param,
-                        dri_bo *slice_data_bo,
+                        struct decode_state *decode_state,
+                        struct buffer_store *slice_data_store,
                         struct gen7_mfd_context *gen7_mfd_context)
 {
     struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     int next_slice_start_vert_pos;
     int macroblock_offset;
-    uint8_t *slice_data = NULL;
-
-    dri_bo_map(slice_data_bo, 0);
-    slice_data = (uint8_t *)(slice_data_bo->virtual + slice_param->slice_data_offset);
+    const uint8_t *slice_data;
+    unsigned int header_size;
+
+    /* Max possible header size with EPB (x1.5), plus lookahead */
+    header_size = MIN(slice_param->slice_data_size,
+                      (slice_param->macroblock_offset / 8) * 3 / 2 + 4);
+    slice_data = intel_decoder_map_slice_data(decode_state, slice_data_store,
+                                              slice_param->slice_data_offset,
+                                              header_size);
+    assert(slice_data);
     macroblock_offset = gen7_mfd_vc1_get_macroblock_bit_offset(slice_data, 
                                                                slice_param->macroblock_offset,
                                                                pic_param->sequence_fields.bits.profile);
-    dri_bo_unmap(slice_data_bo);
+    intel_decoder_unmap_slice_data(slice_data_store, slice_data);
 
     if (next_slice_param)
         next_slice_start_vert_pos = next_slice_param->slice_vertical_position;
@@ -1821,7 +1836,8 @@ gen7_mfd_vc1_decode_picture(VADriverContextP ctx,
             else
                 next_slice_param = next_slice_group_param;
 
-            gen7_mfd_vc1_bsd_object(ctx, pic_param, slice_param, next_slice_param, slice_data_bo, gen7_mfd_context);
+            gen7_mfd_vc1_bsd_object(ctx, pic_param, slice_param, next_slice_param,
+                                    decode_state, decode_state->slice_datas[j], gen7_mfd_context);
             slice_param++;
         }
     }
@@ -34,6 +34,7 @@
 #include <i915_drm.h>
 #include <intel_bufmgr.h>
 #include "i965_decoder.h"
+#include "intel_batchbuffer.h"
 
 #define GEN7_VC1_I_PICTURE              0
 #define GEN7_VC1_P_PICTURE              1
@@ -60,10 +61,13 @@
 #define GEN7_YUV422H_4Y                 6
 #define GEN7_YUV422V_4Y                 7
 
+struct gen_bo_pool;
+
 struct gen7_vc1_surface
 {
     dri_bo *dmv;
     int picture_type;
+    struct gen_bo_pool *bo_pool;
 };
 
 struct hw_context;
@@ -94,6 +98,9 @@ struct gen7_mfd_context
 
     int                 wa_mpeg2_slice_vertical_position;
 
+    /* BSD ring the current picture is decoded on */
+    bsd_ring_flag       bsd_ring;
+
     void *driver_context;
 };
 
@@ -556,7 +556,7 @@ static void gen8_mfc_init(VADriverContextP ctx,
     }
 
     slice_batchbuffer_size = 64 * width_in_mbs * height_in_mbs + 4096 +
-		(SLICE_HEADER + SLICE_TAIL) * encode_state->num_slice_params_ext;
+		(SLICE_HEADER + SLICE_TAIL + SLICE_END_RECORD) * encode_state->num_slice_params_ext;
 
     /*Encode common setup for MFC*/
     dri_bo_unreference(mfc_context->post_deblocking_output.bo);
@@ -851,7 +851,10 @@ gen8_mfc_stop(VADriverContextP ctx,
     VAStatus vaStatus = VA_STATUS_ERROR_UNKNOWN;
     VAEncPictureParameterBufferH264 *pPicParameter = (VAEncPictureParameterBufferH264 *)encode_state->pic_param_ext->buffer;
     VACodedBufferSegment *coded_buffer_segment;
-    
+
+    /* The BRC needs the whole picture, not the slices done so far */
+    dri_bo_wait_rendering(encode_state->coded_buf_object->buffer_store->bo);
+
     vaStatus = i965_MapBuffer(ctx, pPicParameter->coded_buf, (void **)&coded_buffer_segment);
     assert(vaStatus == VA_STATUS_SUCCESS);
     *encoded_bits_size = coded_buffer_segment->size * 8;
@@ -1243,6 +1246,8 @@ gen8_mfc_avc_pipeline_slice_programing(VADriverContextP ctx,
                                    tail_data, 1, 8,
                                    1, 1, 1, 0, slice_batch);
     }
+
+    intel_avc_slice_end_record(ctx, encode_state, encoder_context, slice_index, slice_batch);
 }
 
 static dri_bo *
@@ -1594,6 +1599,8 @@ gen8_mfc_avc_batchbuffer_slice(VADriverContextP ctx,
                                    slice_batch);
     }
 
+    intel_avc_slice_end_record(ctx, encode_state, encoder_context, slice_index, slice_batch);
+
     return;
 }
 
@@ -80,16 +80,17 @@ gen8_mfd_init_avc_surface(VADriverContextP ctx,
 
         gen7_avc_surface->base.frame_store_id = -1;
         assert((obj_surface->size & 0x3f) == 0);
+        gen7_avc_surface->bo_pool = &i965->codec_bo_pool;
         obj_surface->private_data = gen7_avc_surface;
     }
 
     /* DMV buffers now relate to the whole frame, irrespective of
        field coding modes */
     if (gen7_avc_surface->dmv_top == NULL) {
-        gen7_avc_surface->dmv_top = dri_bo_alloc(i965->intel.bufmgr,
-                                                 "direct mv w/r buffer",
-                                                 width_in_mbs * height_in_mbs * 128,
-                                                 0x1000);
+        gen7_avc_surface->dmv_top = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                      "direct mv w/r buffer",
+                                                      width_in_mbs * height_in_mbs * 128,
+                                                      0x1000);
         assert(gen7_avc_surface->dmv_top);
     }
 }
@@ -283,9 +284,9 @@ static void
 gen8_mfd_ind_obj_base_addr_state(VADriverContextP ctx,
                                  dri_bo *slice_data_bo,
                                  int standard_select,
+                                 struct intel_batchbuffer *batch,
                                  struct gen7_mfd_context *gen7_mfd_context)
 {
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     struct i965_driver_data *i965 = i965_driver_data(ctx);
 
     BEGIN_BCS_BATCH(batch, 26);
@@ -520,10 +521,10 @@ gen8_mfd_avc_directmode_state(VADriverContextP ctx,
                               struct decode_state *decode_state,
                               VAPictureParameterBufferH264 *pic_param,
                               VASliceParameterBufferH264 *slice_param,
+                              struct intel_batchbuffer *batch,
                               struct gen7_mfd_context *gen7_mfd_context)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     struct object_surface *obj_surface;
     GenAvcSurface *gen7_avc_surface;
     VAPictureH264 *va_pic;
@@ -593,9 +594,10 @@ static void
 gen8_mfd_avc_phantom_slice_first(VADriverContextP ctx,
                                  VAPictureParameterBufferH264 *pic_param,
                                  VASliceParameterBufferH264 *next_slice_param,
+                                 struct intel_batchbuffer *batch,
                                  struct gen7_mfd_context *gen7_mfd_context)
 {
-    gen6_mfd_avc_phantom_slice(ctx, pic_param, next_slice_param, gen7_mfd_context->base.batch);
+    gen6_mfd_avc_phantom_slice(ctx, pic_param, next_slice_param, batch);
 }
 
 static void
@@ -603,9 +605,9 @@ gen8_mfd_avc_slice_state(VADriverContextP ctx,
                          VAPictureParameterBufferH264 *pic_param,
                          VASliceParameterBufferH264 *slice_param,
                          VASliceParameterBufferH264 *next_slice_param,
+                         struct intel_batchbuffer *batch,
                          struct gen7_mfd_context *gen7_mfd_context)
 {
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     int width_in_mbs = pic_param->picture_width_in_mbs_minus1 + 1;
     int height_in_mbs = pic_param->picture_height_in_mbs_minus1 + 1;
     int slice_hor_pos, slice_ver_pos, next_slice_hor_pos, next_slice_ver_pos;
@@ -693,10 +695,11 @@ static inline void
 gen8_mfd_avc_ref_idx_state(VADriverContextP ctx,
                            VAPictureParameterBufferH264 *pic_param,
                            VASliceParameterBufferH264 *slice_param,
+                           struct intel_batchbuffer *batch,
                            struct gen7_mfd_context *gen7_mfd_context)
 {
     gen6_send_avc_ref_idx_state(
-        gen7_mfd_context->base.batch,
+        batch,
         slice_param,
         gen7_mfd_context->reference_surface
     );
@@ -706,9 +709,9 @@ static void
 gen8_mfd_avc_weightoffset_state(VADriverContextP ctx,
                                 VAPictureParameterBufferH264 *pic_param,
                                 VASliceParameterBufferH264 *slice_param,
+                                struct intel_batchbuffer *batch,
                                 struct gen7_mfd_context *gen7_mfd_context)
 {
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     int i, j, num_weight_offset_table = 0;
     short weightoffsets[32 * 6];
 
@@ -759,9 +762,9 @@ gen8_mfd_avc_bsd_object(VADriverContextP ctx,
                         VASliceParameterBufferH264 *slice_param,
                         dri_bo *slice_data_bo,
                         VASliceParameterBufferH264 *next_slice_param,
+                        struct intel_batchbuffer *batch,
                         struct gen7_mfd_context *gen7_mfd_context)
 {
-    struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     int slice_data_bit_offset = avc_get_first_mb_bit_offset(slice_data_bo,
                                                             slice_param,
                                                             pic_param->pic_fields.bits.entropy_coding_mode_flag);
@@ -901,22 +904,84 @@ gen8_mfd_avc_decode_init(VADriverContextP ctx,
     gen7_mfd_context->bitplane_read_buffer.valid = 0;
 }
 
+static void
+gen8_mfd_avc_emit_slice_group(VADriverContextP ctx,
+                              struct decode_state *decode_state,
+                              struct intel_batchbuffer *batch,
+                              int slice_group,
+                              int slice_index,
+                              int slice_num,
+                              void *hw_context)
+{
+    struct gen7_mfd_context *gen7_mfd_context = hw_context;
+    VAPictureParameterBufferH264 *pic_param;
+    VASliceParameterBufferH264 *slice_param;
+
+    pic_param = (VAPictureParameterBufferH264 *)decode_state->pic_param->buffer;
+    slice_param = (VASliceParameterBufferH264 *)decode_state->slice_params[slice_group]->buffer;
+    gen8_mfd_ind_obj_base_addr_state(ctx, decode_state->slice_datas[slice_group]->bo,
+                                     MFX_FORMAT_AVC, batch, gen7_mfd_context);
+
+    if (slice_num == 0 && slice_param->first_mb_in_slice)
+        gen8_mfd_avc_phantom_slice_first(ctx, pic_param, slice_param, batch, gen7_mfd_context);
+}
+
+static void
+gen8_mfd_avc_emit_slice(VADriverContextP ctx,
+                        struct decode_state *decode_state,
+                        struct intel_batchbuffer *batch,
+                        int slice_group,
+                        int slice_index,
+                        int slice_num,
+                        void *hw_context)
+{
+    struct gen7_mfd_context *gen7_mfd_context = hw_context;
+    VAPictureParameterBufferH264 *pic_param;
+    VASliceParameterBufferH264 *slice_param, *next_slice_param;
+    dri_bo *slice_data_bo = decode_state->slice_datas[slice_group]->bo;
+
+    assert(decode_state->slice_params && decode_state->slice_params[slice_group]->buffer);
+    pic_param = (VAPictureParameterBufferH264 *)decode_state->pic_param->buffer;
+    slice_param = (VASliceParameterBufferH264 *)decode_state->slice_params[slice_group]->buffer + slice_index;
+
+    assert(slice_param->slice_data_flag == VA_SLICE_DATA_FLAG_ALL);
+    assert((slice_param->slice_type == SLICE_TYPE_I) ||
+           (slice_param->slice_type == SLICE_TYPE_SI) ||
+           (slice_param->slice_type == SLICE_TYPE_P) ||
+           (slice_param->slice_type == SLICE_TYPE_SP) ||
+           (slice_param->slice_type == SLICE_TYPE_B));
+
+    if (slice_index < decode_state->slice_params[slice_group]->num_elements - 1)
+        next_slice_param = slice_param + 1;
+    else if (slice_group < decode_state->num_slice_params - 1)
+        next_slice_param = (VASliceParameterBufferH264 *)decode_state->slice_params[slice_group + 1]->buffer;
+    else
+        next_slice_param = NULL;
+
+    gen8_mfd_avc_directmode_state(ctx, decode_state, pic_param, slice_param, batch, gen7_mfd_context);
+    gen8_mfd_avc_ref_idx_state(ctx, pic_param, slice_param, batch, gen7_mfd_context);
+    gen8_mfd_avc_weightoffset_state(ctx, pic_param, slice_param, batch, gen7_mfd_context);
+    gen8_mfd_avc_slice_state(ctx, pic_param, slice_param, next_slice_param, batch, gen7_mfd_context);
+    gen8_mfd_avc_bsd_object(ctx, pic_param, slice_param, slice_data_bo, next_slice_param, batch, gen7_mfd_context);
+}
+
+static const struct intel_decoder_slice_emitter gen8_mfd_avc_slice_emitter = {
+    .emit_slice_group = gen8_mfd_avc_emit_slice_group,
+    .emit_slice = gen8_mfd_avc_emit_slice,
+    .max_slice_size = 0x800,
+};
+
 static void
 gen8_mfd_avc_decode_picture(VADriverContextP ctx,
                             struct decode_state *decode_state,
                             struct gen7_mfd_context *gen7_mfd_context)
 {
     struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
-    VAPictureParameterBufferH264 *pic_param;
-    VASliceParameterBufferH264 *slice_param, *next_slice_param, *next_slice_group_param;
-    dri_bo *slice_data_bo;
-    int i, j;
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
-    pic_param = (VAPictureParameterBufferH264 *)decode_state->pic_param->buffer;
     gen8_mfd_avc_decode_init(ctx, decode_state, gen7_mfd_context);
 
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, gen7_mfd_context->bsd_ring);
     intel_batchbuffer_emit_mi_flush(batch);
     gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
     gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_AVC, gen7_mfd_context);
@@ -926,41 +991,8 @@ gen8_mfd_avc_decode_picture(VADriverContextP ctx,
     gen8_mfd_avc_picid_state(ctx, decode_state, gen7_mfd_context);
     gen8_mfd_avc_img_state(ctx, decode_state, gen7_mfd_context);
 
-    for (j = 0; j < decode_state->num_slice_params; j++) {
-        assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
-        slice_param = (VASliceParameterBufferH264 *)decode_state->slice_params[j]->buffer;
-        slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_AVC, gen7_mfd_context);
-
-        if (j == decode_state->num_slice_params - 1)
-            next_slice_group_param = NULL;
-        else
-            next_slice_group_param = (VASliceParameterBufferH264 *)decode_state->slice_params[j + 1]->buffer;
-
-        if (j == 0 && slice_param->first_mb_in_slice)
-            gen8_mfd_avc_phantom_slice_first(ctx, pic_param, slice_param, gen7_mfd_context); 
-
-        for (i = 0; i < decode_state->slice_params[j]->num_elements; i++) {
-            assert(slice_param->slice_data_flag == VA_SLICE_DATA_FLAG_ALL);
-            assert((slice_param->slice_type == SLICE_TYPE_I) ||
-                   (slice_param->slice_type == SLICE_TYPE_SI) ||
-                   (slice_param->slice_type == SLICE_TYPE_P) ||
-                   (slice_param->slice_type == SLICE_TYPE_SP) ||
-                   (slice_param->slice_type == SLICE_TYPE_B));
-
-            if (i < decode_state->slice_params[j]->num_elements - 1)
-                next_slice_param = slice_param + 1;
-            else
-                next_slice_param = next_slice_group_param;
-
-            gen8_mfd_avc_directmode_state(ctx, decode_state, pic_param, slice_param, gen7_mfd_context);
-            gen8_mfd_avc_ref_idx_state(ctx, pic_param, slice_param, gen7_mfd_context);
-            gen8_mfd_avc_weightoffset_state(ctx, pic_param, slice_param, gen7_mfd_context);
-            gen8_mfd_avc_slice_state(ctx, pic_param, slice_param, next_slice_param, gen7_mfd_context);
-            gen8_mfd_avc_bsd_object(ctx, pic_param, slice_param, slice_data_bo, next_slice_param, gen7_mfd_context);
-            slice_param++;
-        }
-    }
+    intel_decoder_emit_slices(ctx, decode_state, batch,
+                              &gen8_mfd_avc_slice_emitter, gen7_mfd_context);
 
     intel_batchbuffer_end_atomic(batch);
     intel_batchbuffer_flush(batch);
@@ -1184,7 +1216,7 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
     pic_param = (VAPictureParameterBufferMPEG2 *)decode_state->pic_param->buffer;
 
     gen8_mfd_mpeg2_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, gen7_mfd_context->bsd_ring);
     intel_batchbuffer_emit_mi_flush(batch);
     gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
     gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_MPEG2, gen7_mfd_context);
@@ -1201,7 +1233,8 @@ gen8_mfd_mpeg2_decode_picture(VADriverContextP ctx,
         assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
         slice_param = (VASliceParameterBufferMPEG2 *)decode_state->slice_params[j]->buffer;
         slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_MPEG2, gen7_mfd_context);
+        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_MPEG2,
+                                         gen7_mfd_context->base.batch, gen7_mfd_context);
 
         if (j == decode_state->num_slice_params - 1)
             next_slice_group_param = NULL;
@@ -1269,7 +1302,7 @@ gen8_mfd_free_vc1_surface(void **data)
     if (!gen7_vc1_surface)
         return;
 
-    dri_bo_unreference(gen7_vc1_surface->dmv);
+    gen_bo_pool_release(gen7_vc1_surface->bo_pool, gen7_vc1_surface->dmv);
     free(gen7_vc1_surface);
     *data = NULL;
 }
@@ -1293,16 +1326,17 @@ gen8_mfd_init_vc1_surface(VADriverContextP ctx,
             return;
 
         assert((obj_surface->size & 0x3f) == 0);
+        gen7_vc1_surface->bo_pool = &i965->codec_bo_pool;
         obj_surface->private_data = gen7_vc1_surface;
     }
 
     gen7_vc1_surface->picture_type = pic_param->picture_fields.bits.picture_type;
 
     if (gen7_vc1_surface->dmv == NULL) {
-        gen7_vc1_surface->dmv = dri_bo_alloc(i965->intel.bufmgr,
-                                             "direct mv w/r buffer",
-                                             width_in_mbs * height_in_mbs * 64,
-                                             0x1000);
+        gen7_vc1_surface->dmv = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                  "direct mv w/r buffer",
+                                                  width_in_mbs * height_in_mbs * 64,
+                                                  0x1000);
     }
 }
 
@@ -1769,7 +1803,7 @@ gen8_mfd_vc1_directmode_state(VADriverContextP ctx,
 }
 
 static int
-gen8_mfd_vc1_get_macroblock_bit_offset(uint8_t *buf, int in_slice_data_bit_offset, int profile)
+gen8_mfd_vc1_get_macroblock_bit_offset(const uint8_t *buf, int in_slice_data_bit_offset, int profile)
 {
     int out_slice_data_bit_offset;
     int slice_header_size = in_slice_data_bit_offset / 8;
@@ -1795,20 +1829,27 @@ gen8_mfd_vc1_bsd_object(VADriverContextP ctx,
                         VAPictureParameterBufferVC1 *pic_param,
                         VASliceParameterBufferVC1 *slice_param,
                         VASliceParameterBufferVC1 *next_slice_param,
-                        dri_bo *slice_data_bo,
+                        struct decode_state *decode_state,
+                        struct buffer_store *slice_data_store,
                         struct gen7_mfd_context *gen7_mfd_context)
 {
     struct intel_batchbuffer *batch = gen7_mfd_context->base.batch;
     int next_slice_start_vert_pos;
     int macroblock_offset;
-    uint8_t *slice_data = NULL;
-
-    dri_bo_map(slice_data_bo, 0);
-    slice_data = (uint8_t *)(slice_data_bo->virtual + slice_param->slice_data_offset);
+    const uint8_t *slice_data;
+    unsigned int header_size;
+
+    /* Max possible header size with EPB (x1.5), plus lookahead */
+    header_size = MIN(slice_param->slice_data_size,
+                      (slice_param->macroblock_offset / 8) * 3 / 2 + 4);
+    slice_data = intel_decoder_map_slice_data(decode_state, slice_data_store,
+                                              slice_param->slice_data_offset,
+                                              header_size);
+    assert(slice_data);
     macroblock_offset = gen8_mfd_vc1_get_macroblock_bit_offset(slice_data, 
                                                                slice_param->macroblock_offset,
                                                                pic_param->sequence_fields.bits.profile);
-    dri_bo_unmap(slice_data_bo);
+    intel_decoder_unmap_slice_data(slice_data_store, slice_data);
 
     if (next_slice_param)
         next_slice_start_vert_pos = next_slice_param->slice_vertical_position;
@@ -1844,7 +1885,7 @@ gen8_mfd_vc1_decode_picture(VADriverContextP ctx,
     pic_param = (VAPictureParameterBufferVC1 *)decode_state->pic_param->buffer;
 
     gen8_mfd_vc1_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, gen7_mfd_context->bsd_ring);
     intel_batchbuffer_emit_mi_flush(batch);
     gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
     gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_VC1, gen7_mfd_context);
@@ -1858,7 +1899,8 @@ gen8_mfd_vc1_decode_picture(VADriverContextP ctx,
         assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
         slice_param = (VASliceParameterBufferVC1 *)decode_state->slice_params[j]->buffer;
         slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_VC1, gen7_mfd_context);
+        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_VC1,
+                                         gen7_mfd_context->base.batch, gen7_mfd_context);
 
         if (j == decode_state->num_slice_params - 1)
             next_slice_group_param = NULL;
@@ -1873,7 +1915,8 @@ gen8_mfd_vc1_decode_picture(VADriverContextP ctx,
             else
                 next_slice_param = next_slice_group_param;
 
-            gen8_mfd_vc1_bsd_object(ctx, pic_param, slice_param, next_slice_param, slice_data_bo, gen7_mfd_context);
+            gen8_mfd_vc1_bsd_object(ctx, pic_param, slice_param, next_slice_param,
+                                    decode_state, decode_state->slice_datas[j], gen7_mfd_context);
             slice_param++;
         }
     }
@@ -2635,7 +2678,7 @@ gen8_mfd_jpeg_decode_picture(VADriverContextP ctx,
 
     /* Currently only support Baseline DCT */
     gen8_mfd_jpeg_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, gen7_mfd_context->bsd_ring);
 #ifdef JPEG_WA
     gen8_mfd_jpeg_wa(ctx, gen7_mfd_context);
 #endif
@@ -2650,7 +2693,8 @@ gen8_mfd_jpeg_decode_picture(VADriverContextP ctx,
         assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
         slice_param = (VASliceParameterBufferJPEGBaseline *)decode_state->slice_params[j]->buffer;
         slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_JPEG, gen7_mfd_context);
+        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_JPEG,
+                                         gen7_mfd_context->base.batch, gen7_mfd_context);
 
         if (j == decode_state->num_slice_params - 1)
             next_slice_group_param = NULL;
@@ -2686,7 +2730,8 @@ gen8_mfd_jpeg_decode_picture(VADriverContextP ctx,
         assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
         slice_param = (VASliceParameterBufferJPEGBaseline *)decode_state->slice_params[j]->buffer;
         slice_data_bo = decode_state->slice_datas[j]->bo;
-        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_JPEG, gen7_mfd_context);
+        gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_JPEG,
+                                         gen7_mfd_context->base.batch, gen7_mfd_context);
 
         if (j == decode_state->num_slice_params - 1)
             next_slice_group_param = NULL;
@@ -3058,13 +3103,14 @@ gen8_mfd_vp8_decode_picture(VADriverContextP ctx,
     slice_data_bo = decode_state->slice_datas[0]->bo;
 
     gen8_mfd_vp8_decode_init(ctx, decode_state, gen7_mfd_context);
-    intel_batchbuffer_start_atomic_bcs(batch, 0x1000);
+    intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, gen7_mfd_context->bsd_ring);
     intel_batchbuffer_emit_mi_flush(batch);
     gen8_mfd_pipe_mode_select(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_surface_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_pipe_buf_addr_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
     gen8_mfd_bsp_buf_base_addr_state(ctx, decode_state, MFX_FORMAT_VP8, gen7_mfd_context);
-    gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_VP8, gen7_mfd_context);
+    gen8_mfd_ind_obj_base_addr_state(ctx, slice_data_bo, MFX_FORMAT_VP8,
+                                     gen7_mfd_context->base.batch, gen7_mfd_context);
     gen8_mfd_vp8_pic_state(ctx, decode_state, gen7_mfd_context);
     gen8_mfd_vp8_bsd_object(ctx, pic_param, slice_param, slice_data_bo, gen7_mfd_context);
     intel_batchbuffer_end_atomic(batch);
@@ -3090,6 +3136,7 @@ gen8_mfd_decode_picture(VADriverContextP ctx,
         goto out;
 
     gen7_mfd_context->wa_mpeg2_slice_vertical_position = -1;
+    gen7_mfd_context->bsd_ring = intel_decoder_get_bsd_ring(ctx, decode_state);
 
     switch (profile) {
     case VAProfileMPEG2Simple:
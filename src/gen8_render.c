@@ -79,6 +79,17 @@ static const uint32_t ps_subpic_kernel_static_gen8[][4] = {
 #define SURFACE_STATE_OFFSET(index)     (SURFACE_STATE_PADDED_SIZE * index)
 #define BINDING_TABLE_OFFSET            SURFACE_STATE_OFFSET(MAX_RENDER_SURFACES)
 
+/* Every source of a composition has its own surface states and binding
+ * table, constants and rectangle in the vertex buffer */
+#define SOURCE_STATE_SIZE               ALIGN(BINDING_TABLE_OFFSET + sizeof(unsigned int) * MAX_RENDER_SURFACES, 64)
+#define SOURCE_STATE_OFFSET(source)     (SOURCE_STATE_SIZE * (source))
+#define SOURCE_VERTEX_SIZE              (12 * sizeof(float))
+#define SOURCE_BATCH_SIZE               0x100
+
+/* The subpicture blend state follows the one of the surface */
+#define SUBPIC_BLEND_STATE_OFFSET(render_state) \
+    ((render_state)->blend_state_offset + ALIGN((render_state)->blend_state_size, ALIGNMENT))
+
 enum {
     SF_KERNEL = 0,
     PS_KERNEL,
@@ -216,12 +227,13 @@ gen8_render_src_surface_state(
     struct i965_render_state *render_state = &i965->render_state;
     void *ss;
     dri_bo *ss_bo = render_state->wm.surface_state_binding_table_bo;
+    const unsigned int source_offset = SOURCE_STATE_OFFSET(render_state->source_index);
 
     assert(index < MAX_RENDER_SURFACES);
 
     dri_bo_map(ss_bo, 1);
     assert(ss_bo->virtual);
-    ss = (char *)ss_bo->virtual + SURFACE_STATE_OFFSET(index);
+    ss = (char *)ss_bo->virtual + source_offset + SURFACE_STATE_OFFSET(index);
 
     gen8_render_set_surface_state(ss,
                                   region, offset,
@@ -231,10 +243,11 @@ gen8_render_src_surface_state(
     dri_bo_emit_reloc(ss_bo,
                       I915_GEM_DOMAIN_SAMPLER, 0,
                       offset,
-                      SURFACE_STATE_OFFSET(index) + offsetof(struct gen8_surface_state, ss8),
+                      source_offset + SURFACE_STATE_OFFSET(index) + offsetof(struct gen8_surface_state, ss8),
                       region);
 
-    ((unsigned int *)((char *)ss_bo->virtual + BINDING_TABLE_OFFSET))[index] = SURFACE_STATE_OFFSET(index);
+    ((unsigned int *)((char *)ss_bo->virtual + source_offset + BINDING_TABLE_OFFSET))[index] =
+        source_offset + SURFACE_STATE_OFFSET(index);
     dri_bo_unmap(ss_bo);
     render_state->wm.sampler_count++;
 }
@@ -315,6 +328,7 @@ gen8_render_dest_surface_state(VADriverContextP ctx, int index)
     struct intel_region *dest_region = render_state->draw_region;
     void *ss;
     dri_bo *ss_bo = render_state->wm.surface_state_binding_table_bo;
+    const unsigned int source_offset = SOURCE_STATE_OFFSET(render_state->source_index);
     int format;
     assert(index < MAX_RENDER_SURFACES);
 
@@ -326,7 +340,7 @@ gen8_render_dest_surface_state(VADriverContextP ctx, int index)
 
     dri_bo_map(ss_bo, 1);
     assert(ss_bo->virtual);
-    ss = (char *)ss_bo->virtual + SURFACE_STATE_OFFSET(index);
+    ss = (char *)ss_bo->virtual + source_offset + SURFACE_STATE_OFFSET(index);
 
     gen8_render_set_surface_state(ss,
                                   dest_region->bo, 0,
@@ -336,10 +350,11 @@ gen8_render_dest_surface_state(VADriverContextP ctx, int index)
     dri_bo_emit_reloc(ss_bo,
                       I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
                       0,
-                      SURFACE_STATE_OFFSET(index) + offsetof(struct gen8_surface_state, ss8),
+                      source_offset + SURFACE_STATE_OFFSET(index) + offsetof(struct gen8_surface_state, ss8),
                       dest_region->bo);
 
-    ((unsigned int *)((char *)ss_bo->virtual + BINDING_TABLE_OFFSET))[index] = SURFACE_STATE_OFFSET(index);
+    ((unsigned int *)((char *)ss_bo->virtual + source_offset + BINDING_TABLE_OFFSET))[index] =
+        source_offset + SURFACE_STATE_OFFSET(index);
     dri_bo_unmap(ss_bo);
 }
 
@@ -380,7 +395,9 @@ i965_fill_vertex_buffer(
     vb[10] = vid_coords[X1];
     vb[11] = vid_coords[Y1];
 
-    dri_bo_subdata(i965->render_state.vb.vertex_buffer, 0, sizeof(vb), vb);
+    dri_bo_subdata(i965->render_state.vb.vertex_buffer,
+                   SOURCE_VERTEX_SIZE * i965->render_state.source_index,
+                   sizeof(vb), vb);
 }
 
 static void
@@ -556,7 +573,7 @@ gen8_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->vb.vertex_buffer);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "vertex buffer",
-                      4096,
+                      ALIGN(SOURCE_VERTEX_SIZE * RENDER_NUM_SLOTS(render_state), 4096),
                       4096);
     assert(bo);
     render_state->vb.vertex_buffer = bo;
@@ -565,7 +582,7 @@ gen8_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->wm.surface_state_binding_table_bo);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "surface state & binding table",
-                      (SURFACE_STATE_PADDED_SIZE + sizeof(unsigned int)) * MAX_RENDER_SURFACES,
+                      SOURCE_STATE_OFFSET(RENDER_NUM_SLOTS(render_state)),
                       4096);
     assert(bo);
     render_state->wm.surface_state_binding_table_bo = bo;
@@ -587,11 +604,11 @@ gen8_render_initialize(VADriverContextP ctx)
 
     render_state->scissor_size = 1024;
 
-    size = ALIGN(render_state->curbe_size, ALIGNMENT) +
+    size = ALIGN(render_state->curbe_size, ALIGNMENT) * RENDER_NUM_SLOTS(render_state) +
         ALIGN(render_state->sampler_size, ALIGNMENT) +
         ALIGN(render_state->cc_viewport_size, ALIGNMENT) +
         ALIGN(render_state->cc_state_size, ALIGNMENT) +
-        ALIGN(render_state->blend_state_size, ALIGNMENT) +
+        ALIGN(render_state->blend_state_size, ALIGNMENT) * 2 +
         ALIGN(render_state->sf_clip_size, ALIGNMENT) +
         ALIGN(render_state->scissor_size, ALIGNMENT);
 
@@ -608,7 +625,7 @@ gen8_render_initialize(VADriverContextP ctx)
 
     /* Constant buffer offset */
     render_state->curbe_offset = end_offset;
-    end_offset += ALIGN(render_state->curbe_size, ALIGNMENT);
+    end_offset += ALIGN(render_state->curbe_size, ALIGNMENT) * RENDER_NUM_SLOTS(render_state);
 
     /* Sampler_state  */
     render_state->sampler_offset = end_offset;
@@ -622,9 +639,9 @@ gen8_render_initialize(VADriverContextP ctx)
     render_state->cc_state_offset = end_offset;
     end_offset += ALIGN(render_state->cc_state_size, ALIGNMENT);
 
-    /* Blend_state  */
+    /* Blend_state for the surface and the subpictures */
     render_state->blend_state_offset = end_offset;
-    end_offset += ALIGN(render_state->blend_state_size, ALIGNMENT);
+    end_offset += ALIGN(render_state->blend_state_size, ALIGNMENT) * 2;
 
     /* SF_CLIP_state  */
     render_state->sf_clip_offset = end_offset;
@@ -773,7 +790,8 @@ gen8_render_upload_constants(VADriverContextP ctx,
     assert(render_state->dynamic_state.bo->virtual);
 
     cc_ptr = (unsigned char *) render_state->dynamic_state.bo->virtual +
-			render_state->curbe_offset;
+        render_state->curbe_offset +
+        ALIGN(render_state->curbe_size, ALIGNMENT) * render_state->source_index;
 
     constant_buffer = (unsigned short *) cc_ptr;
 
@@ -812,25 +830,6 @@ gen8_render_upload_constants(VADriverContextP ctx,
     dri_bo_unmap(render_state->dynamic_state.bo);
 }
 
-static void
-gen8_render_setup_states(
-    VADriverContextP   ctx,
-    struct object_surface *obj_surface,
-    const VARectangle *src_rect,
-    const VARectangle *dst_rect,
-    unsigned int       flags
-)
-{
-    gen8_render_dest_surface_state(ctx, 0);
-    gen8_render_src_surfaces_state(ctx, obj_surface, flags);
-    gen8_render_sampler(ctx);
-    gen8_render_cc_viewport(ctx);
-    gen8_render_color_calc_state(ctx);
-    gen8_render_blend_state(ctx);
-    gen8_render_upload_constants(ctx, obj_surface, flags);
-    i965_render_upload_vertex(ctx, obj_surface, src_rect, dst_rect);
-}
-
 static void
 gen8_emit_state_base_address(VADriverContextP ctx)
 {
@@ -871,22 +870,54 @@ gen8_emit_state_base_address(VADriverContextP ctx)
 }
 
 static void
-gen8_emit_cc_state_pointers(VADriverContextP ctx)
+gen8_emit_blend_state_pointers(VADriverContextP ctx, int kernel)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
     struct i965_render_state *render_state = &i965->render_state;
+    unsigned int blend_state_offset = render_state->blend_state_offset;
+
+    if (kernel == PS_SUBPIC_KERNEL)
+        blend_state_offset = SUBPIC_BLEND_STATE_OFFSET(render_state);
 
     BEGIN_BATCH(batch, 2);
-    OUT_BATCH(batch, GEN6_3DSTATE_CC_STATE_POINTERS | (2 - 2));
-    OUT_BATCH(batch, (render_state->cc_state_offset + 1));
+    OUT_BATCH(batch, GEN7_3DSTATE_BLEND_STATE_POINTERS | (2 - 2));
+    OUT_BATCH(batch, (blend_state_offset + 1));
     ADVANCE_BATCH(batch);
+}
+
+static void
+gen8_emit_cc_state_pointers(VADriverContextP ctx, int kernel)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
     BEGIN_BATCH(batch, 2);
-    OUT_BATCH(batch, GEN7_3DSTATE_BLEND_STATE_POINTERS | (2 - 2));
-    OUT_BATCH(batch, (render_state->blend_state_offset + 1));
+    OUT_BATCH(batch, GEN6_3DSTATE_CC_STATE_POINTERS | (2 - 2));
+    OUT_BATCH(batch, (render_state->cc_state_offset + 1));
     ADVANCE_BATCH(batch);
 
+    gen8_emit_blend_state_pointers(ctx, kernel);
+}
+
+static void
+gen8_emit_primitive(VADriverContextP ctx)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
+
+    BEGIN_BATCH(batch, 7);
+    OUT_BATCH(batch, CMD_3DPRIMITIVE | (7 - 2));
+    OUT_BATCH(batch,
+              GEN7_3DPRIM_VERTEXBUFFER_ACCESS_SEQUENTIAL);
+    OUT_BATCH(batch, 3); /* vertex count per instance */
+    OUT_BATCH(batch, 3 * render_state->source_index); /* start vertex offset */
+    OUT_BATCH(batch, 1); /* single instance */
+    OUT_BATCH(batch, 0); /* start instance location */
+    OUT_BATCH(batch, 0);
+    ADVANCE_BATCH(batch);
 }
 
 static void
@@ -905,7 +936,7 @@ gen8_emit_vertices(VADriverContextP ctx)
               ((4 * 4) << VB0_BUFFER_PITCH_SHIFT));
     OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0, 0);
     OUT_BATCH(batch, 0);
-    OUT_BATCH(batch, 12 * 4);
+    OUT_BATCH(batch, SOURCE_VERTEX_SIZE * RENDER_NUM_SLOTS(render_state));
     ADVANCE_BATCH(batch);
 
     /* Topology in 3D primitive is overrided by VF_TOPOLOGY command */
@@ -915,16 +946,7 @@ gen8_emit_vertices(VADriverContextP ctx)
               _3DPRIM_RECTLIST);
     ADVANCE_BATCH(batch);
 
-    BEGIN_BATCH(batch, 7);
-    OUT_BATCH(batch, CMD_3DPRIMITIVE | (7 - 2));
-    OUT_BATCH(batch,
-              GEN7_3DPRIM_VERTEXBUFFER_ACCESS_SEQUENTIAL);
-    OUT_BATCH(batch, 3); /* vertex count per instance */
-    OUT_BATCH(batch, 0); /* start vertex offset */
-    OUT_BATCH(batch, 1); /* single instance */
-    OUT_BATCH(batch, 0); /* start instance location */
-    OUT_BATCH(batch, 0);
-    ADVANCE_BATCH(batch);
+    gen8_emit_primitive(ctx);
 }
 
 static void
@@ -1412,7 +1434,8 @@ gen8_emit_wm_state(VADriverContextP ctx, int kernel)
     OUT_BATCH(batch, URB_CS_ENTRY_SIZE);
     OUT_BATCH(batch, 0);
     /*DW3-4. Constant buffer 0 */
-    OUT_BATCH(batch, render_state->curbe_offset);
+    OUT_BATCH(batch, render_state->curbe_offset +
+              ALIGN(render_state->curbe_size, ALIGNMENT) * render_state->source_index);
     OUT_BATCH(batch, 0);
 
     /*DW5-10. Constant buffer 1-3 */
@@ -1454,7 +1477,7 @@ gen8_emit_wm_state(VADriverContextP ctx, int kernel)
 
     BEGIN_BATCH(batch, 2);
     OUT_BATCH(batch, GEN7_3DSTATE_BINDING_TABLE_POINTERS_PS | (2 - 2));
-    OUT_BATCH(batch, BINDING_TABLE_OFFSET);
+    OUT_BATCH(batch, SOURCE_STATE_OFFSET(render_state->source_index) + BINDING_TABLE_OFFSET);
     ADVANCE_BATCH(batch);
 }
 
@@ -1570,19 +1593,54 @@ gen7_emit_drawing_rectangle(VADriverContextP ctx)
     i965_render_drawing_rectangle(ctx);
 }
 
+/* Only the constants, binding table and rectangle differ between sources,
+ * the subpictures also switch to the blending kernel */
+static void
+gen8_emit_sources(VADriverContextP ctx, int kernel)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
+    const struct i965_render_subpic *subpic;
+    struct object_subpic *obj_subpic;
+    unsigned int i;
+
+    for (render_state->source_index = 1;
+         render_state->source_index < render_state->num_sources;
+         render_state->source_index++) {
+        gen8_emit_wm_state(ctx, kernel);
+        gen8_emit_primitive(ctx);
+    }
+
+    if (render_state->num_subpics > 0)
+        gen8_emit_blend_state_pointers(ctx, PS_SUBPIC_KERNEL);
+
+    for (i = 0; i < render_state->num_subpics; i++) {
+        subpic = &render_state->subpics[i];
+        obj_subpic = subpic->obj_surface->obj_subpic[subpic->index];
+        render_state->source_index = render_state->num_sources + i;
+
+        i965_render_upload_image_palette(ctx, obj_subpic->obj_image, 0xff);
+        gen8_emit_wm_state(ctx, PS_SUBPIC_KERNEL);
+        gen8_emit_primitive(ctx);
+    }
+
+    render_state->source_index = 0;
+}
+
 static void
 gen8_render_emit_states(VADriverContextP ctx, int kernel)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
-    intel_batchbuffer_start_atomic(batch, 0x1000);
+    intel_batchbuffer_start_atomic(batch, 0x1000 + SOURCE_BATCH_SIZE * RENDER_NUM_SLOTS(render_state));
     intel_batchbuffer_emit_mi_flush(batch);
     gen8_emit_invarient_states(ctx);
     gen8_emit_state_base_address(ctx);
     gen8_emit_viewport_state_pointers(ctx);
     gen8_emit_urb(ctx);
-    gen8_emit_cc_state_pointers(ctx);
+    gen8_emit_cc_state_pointers(ctx, kernel);
     gen8_emit_sampler_state_pointers(ctx);
     gen8_emit_wm_hz_op(ctx);
     gen8_emit_bypass_state(ctx);
@@ -1595,28 +1653,10 @@ gen8_render_emit_states(VADriverContextP ctx, int kernel)
     gen7_emit_drawing_rectangle(ctx);
     gen8_emit_vertex_element_state(ctx);
     gen8_emit_vertices(ctx);
+    gen8_emit_sources(ctx, kernel);
     intel_batchbuffer_end_atomic(batch);
 }
 
-static void
-gen8_render_put_surface(
-    VADriverContextP   ctx,
-    struct object_surface *obj_surface,
-    const VARectangle *src_rect,
-    const VARectangle *dst_rect,
-    unsigned int       flags
-)
-{
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct intel_batchbuffer *batch = i965->batch;
-
-    gen8_render_initialize(ctx);
-    gen8_render_setup_states(ctx, obj_surface, src_rect, dst_rect, flags);
-    gen8_clear_dest_region(ctx);
-    gen8_render_emit_states(ctx, PS_KERNEL);
-    intel_batchbuffer_flush(batch);
-}
-
 static void
 gen8_subpicture_render_blend_state(VADriverContextP ctx)
 {
@@ -1630,7 +1670,7 @@ gen8_subpicture_render_blend_state(VADriverContextP ctx)
     assert(render_state->dynamic_state.bo->virtual);
 
     cc_ptr = (unsigned char *) render_state->dynamic_state.bo->virtual +
-			render_state->blend_state_offset;
+			SUBPIC_BLEND_STATE_OFFSET(render_state);
 
     global_blend_state = (struct gen8_global_blend_state*) cc_ptr;
 
@@ -1672,7 +1712,8 @@ gen8_subpic_render_upload_constants(VADriverContextP ctx,
     assert(render_state->dynamic_state.bo->virtual);
 
     cc_ptr = (unsigned char *) render_state->dynamic_state.bo->virtual +
-				render_state->curbe_offset;
+        render_state->curbe_offset +
+        ALIGN(render_state->curbe_size, ALIGNMENT) * render_state->source_index;
 
     constant_buffer = (float *) cc_ptr;
     *constant_buffer = global_alpha;
@@ -1698,6 +1739,69 @@ gen8_subpicture_render_setup_states(
     i965_subpic_render_upload_vertex(ctx, obj_surface, dst_rect);
 }
 
+static void
+gen8_render_put_surfaces(
+    VADriverContextP   ctx,
+    const struct i965_render_source *sources,
+    unsigned int       num_sources,
+    unsigned int       flags
+)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
+    const struct i965_render_source *source;
+    const struct i965_render_subpic *subpic;
+    int sampler_count = 0;
+    unsigned int i;
+
+    render_state->num_sources = num_sources;
+    gen8_render_initialize(ctx);
+
+    /* The samplers are shared, sized for the source with the most planes */
+    for (render_state->source_index = 0;
+         render_state->source_index < num_sources;
+         render_state->source_index++) {
+        source = &sources[render_state->source_index];
+
+        render_state->wm.sampler_count = 0;
+        gen8_render_dest_surface_state(ctx, 0);
+        gen8_render_src_surfaces_state(ctx, source->obj_surface, flags);
+        gen8_render_upload_constants(ctx, source->obj_surface, flags);
+        i965_render_upload_vertex(ctx, source->obj_surface,
+                                  &source->src_rect, &source->dst_rect);
+        sampler_count = MAX(sampler_count, render_state->wm.sampler_count);
+    }
+
+    for (i = 0; i < render_state->num_subpics; i++) {
+        subpic = &render_state->subpics[i];
+        subpic->obj_surface->subpic_render_idx = subpic->index;
+        render_state->source_index = num_sources + i;
+
+        render_state->wm.sampler_count = 0;
+        gen8_render_dest_surface_state(ctx, 0);
+        gen8_subpic_render_src_surfaces_state(ctx, subpic->obj_surface);
+        gen8_subpic_render_upload_constants(ctx, subpic->obj_surface);
+        i965_subpic_render_upload_vertex(ctx, subpic->obj_surface,
+                                         &subpic->dst_rect);
+        sampler_count = MAX(sampler_count, render_state->wm.sampler_count);
+    }
+
+    render_state->source_index = 0;
+    render_state->wm.sampler_count = sampler_count;
+
+    gen8_render_sampler(ctx);
+    gen8_render_cc_viewport(ctx);
+    gen8_render_color_calc_state(ctx);
+    gen8_render_blend_state(ctx);
+    gen8_subpicture_render_blend_state(ctx);
+    gen8_clear_dest_region(ctx);
+    gen8_render_emit_states(ctx, PS_KERNEL);
+    intel_batchbuffer_flush(batch);
+    render_state->num_sources = 1;
+    render_state->num_subpics = 0;
+}
+
 static void
 gen8_render_put_subpicture(
     VADriverContextP   ctx,
@@ -1763,9 +1867,12 @@ gen8_render_init(VADriverContextP ctx)
     unsigned char *kernel_ptr;
     struct i965_kernel *kernel;
 
-    render_state->render_put_surface = gen8_render_put_surface;
+    render_state->render_put_surfaces = gen8_render_put_surfaces;
     render_state->render_put_subpicture = gen8_render_put_subpicture;
     render_state->render_terminate = gen8_render_terminate;
+    render_state->num_sources = 1;
+    render_state->source_index = 0;
+    render_state->num_subpics = 0;
 
     memcpy(render_state->render_kernels, render_kernels_gen8,
            sizeof(render_state->render_kernels));
@@ -42,6 +42,7 @@
 #include "i965_drv_video.h"
 #include "i965_encoder.h"
 #include "i965_encoder_utils.h"
+#include "i965_encoder_analysis.h"
 #include "intel_media.h"
 
 #include "i965_gpe_utils.h"
@@ -761,9 +762,8 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
     /*all the surface/buffer are allocated here*/
 
     /*second level batch buffer for image state write when cqp etc*/
-    i965_free_gpe_resource(&avc_ctx->res_image_state_batch_buffer_2nd_level);
     size = INTEL_AVC_IMAGE_STATE_CMD_SIZE ;
-    allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+    allocate_flag = i965_reallocate_gpe_resource(i965->intel.bufmgr,
                              &avc_ctx->res_image_state_batch_buffer_2nd_level,
                              ALIGN(size,0x1000),
                              "second levle batch (image state write) buffer");
@@ -773,9 +773,8 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
     /* scaling related surface   */
     if(avc_state->mb_status_supported)
     {
-        i965_free_gpe_resource(&avc_ctx->res_mb_status_buffer);
         size = (generic_state->frame_width_in_mbs * generic_state->frame_height_in_mbs * 16 * 4 + 1023)&~0x3ff;
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+        allocate_flag = i965_reallocate_gpe_resource(i965->intel.bufmgr,
                                  &avc_ctx->res_mb_status_buffer,
                                  ALIGN(size,0x1000),
                                  "MB statistics output buffer");
@@ -788,8 +787,7 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
     {
         width = generic_state->frame_width_in_mbs * 4;
         height= generic_state->frame_height_in_mbs * 4;
-        i965_free_gpe_resource(&avc_ctx->res_flatness_check_surface);
-        allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
                                      &avc_ctx->res_flatness_check_surface,
                                      width, height,
                                      ALIGN(width,64),
@@ -797,70 +795,59 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
         if (!allocate_flag)
             goto failed_allocation;
     }
-    /* me related surface */
-    width = generic_state->downscaled_width_4x_in_mb * 8;
-    height= generic_state->downscaled_height_4x_in_mb * 4 * 10;
-    i965_free_gpe_resource(&avc_ctx->s4x_memv_distortion_buffer);
-    allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                 &avc_ctx->s4x_memv_distortion_buffer,
-                                 width, height,
-                                 ALIGN(width,64),
-                                 "4x MEMV distortion buffer");
-    if (!allocate_flag)
-        goto failed_allocation;
-    i965_zero_gpe_resource(&avc_ctx->s4x_memv_distortion_buffer);
-
-    width = (generic_state->downscaled_width_4x_in_mb + 7)/8 * 64;
-    height= (generic_state->downscaled_height_4x_in_mb + 1)/2 * 8;
-    i965_free_gpe_resource(&avc_ctx->s4x_memv_min_distortion_brc_buffer);
-    allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                 &avc_ctx->s4x_memv_min_distortion_brc_buffer,
-                                 width, height,
-                                 width,
-                                 "4x MEMV min distortion brc buffer");
-    if (!allocate_flag)
-        goto failed_allocation;
-    i965_zero_gpe_resource(&avc_ctx->s4x_memv_min_distortion_brc_buffer);
-
-
-    width = ALIGN(generic_state->downscaled_width_4x_in_mb * 32,64);
-    height= generic_state->downscaled_height_4x_in_mb * 4 * 2 * 10;
-    i965_free_gpe_resource(&avc_ctx->s4x_memv_data_buffer);
-    allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                 &avc_ctx->s4x_memv_data_buffer,
-                                 width, height,
-                                 width,
-                                 "4x MEMV data buffer");
-    if (!allocate_flag)
-        goto failed_allocation;
-    i965_zero_gpe_resource(&avc_ctx->s4x_memv_data_buffer);
-
-
-    width = ALIGN(generic_state->downscaled_width_16x_in_mb * 32,64);
-    height= generic_state->downscaled_height_16x_in_mb * 4 * 2 * 10 ;
-    i965_free_gpe_resource(&avc_ctx->s16x_memv_data_buffer);
-    allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                 &avc_ctx->s16x_memv_data_buffer,
-                                 width, height,
-                                 width,
-                                 "16x MEMV data buffer");
-    if (!allocate_flag)
-        goto failed_allocation;
-    i965_zero_gpe_resource(&avc_ctx->s16x_memv_data_buffer);
+    /* me related surface, only for the HME levels in use */
+    if(generic_state->hme_supported)
+    {
+        width = generic_state->downscaled_width_4x_in_mb * 8;
+        height= generic_state->downscaled_height_4x_in_mb * 4 * 10;
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
+                                     &avc_ctx->s4x_memv_distortion_buffer,
+                                     width, height,
+                                     ALIGN(width,64),
+                                     "4x MEMV distortion buffer");
+        if (!allocate_flag)
+            goto failed_allocation;
+        i965_zero_gpe_resource(&avc_ctx->s4x_memv_distortion_buffer);
 
+        width = ALIGN(generic_state->downscaled_width_4x_in_mb * 32,64);
+        height= generic_state->downscaled_height_4x_in_mb * 4 * 2 * 10;
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
+                                     &avc_ctx->s4x_memv_data_buffer,
+                                     width, height,
+                                     width,
+                                     "4x MEMV data buffer");
+        if (!allocate_flag)
+            goto failed_allocation;
+        i965_zero_gpe_resource(&avc_ctx->s4x_memv_data_buffer);
+    }
 
-    width = ALIGN(generic_state->downscaled_width_32x_in_mb * 32,64);
-    height= generic_state->downscaled_height_32x_in_mb * 4 * 2 * 10 ;
-    i965_free_gpe_resource(&avc_ctx->s32x_memv_data_buffer);
-    allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                 &avc_ctx->s32x_memv_data_buffer,
-                                 width, height,
-                                 width,
-                                 "32x MEMV data buffer");
-    if (!allocate_flag)
-        goto failed_allocation;
-    i965_zero_gpe_resource(&avc_ctx->s32x_memv_data_buffer);
+    if(generic_state->b16xme_supported)
+    {
+        width = ALIGN(generic_state->downscaled_width_16x_in_mb * 32,64);
+        height= generic_state->downscaled_height_16x_in_mb * 4 * 2 * 10 ;
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
+                                     &avc_ctx->s16x_memv_data_buffer,
+                                     width, height,
+                                     width,
+                                     "16x MEMV data buffer");
+        if (!allocate_flag)
+            goto failed_allocation;
+        i965_zero_gpe_resource(&avc_ctx->s16x_memv_data_buffer);
+    }
 
+    if(generic_state->b32xme_supported)
+    {
+        width = ALIGN(generic_state->downscaled_width_32x_in_mb * 32,64);
+        height= generic_state->downscaled_height_32x_in_mb * 4 * 2 * 10 ;
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
+                                     &avc_ctx->s32x_memv_data_buffer,
+                                     width, height,
+                                     width,
+                                     "32x MEMV data buffer");
+        if (!allocate_flag)
+            goto failed_allocation;
+        i965_zero_gpe_resource(&avc_ctx->s32x_memv_data_buffer);
+    }
 
     if(!generic_state->brc_allocated)
     {
@@ -929,21 +916,6 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
             i965_zero_gpe_resource(&avc_ctx->res_brc_dist_data_surface);
         }
 
-        if(generic_state->brc_roi_enable)
-        {
-            width = ALIGN(generic_state->downscaled_width_4x_in_mb * 16,64);
-            height= ALIGN(generic_state->downscaled_height_4x_in_mb * 4,8);
-            i965_free_gpe_resource(&avc_ctx->res_mbbrc_roi_surface);
-            allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                         &avc_ctx->res_mbbrc_roi_surface,
-                                         width, height,
-                                         width,
-                                         "mbbrc roi buffer");
-            if (!allocate_flag)
-                goto failed_allocation;
-            i965_zero_gpe_resource(&avc_ctx->res_mbbrc_roi_surface);
-        }
-
         /*mb qp in mb brc*/
         width = ALIGN(generic_state->downscaled_width_4x_in_mb * 4,64);
         height= ALIGN(generic_state->downscaled_height_4x_in_mb * 4,8);
@@ -980,13 +952,27 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
         generic_state->brc_allocated = 1;
     }
 
+    /* ROI may be turned on by any frame, not only the first one */
+    if(generic_state->brc_roi_enable && !avc_ctx->res_mbbrc_roi_surface.bo)
+    {
+        width = ALIGN(generic_state->downscaled_width_4x_in_mb * 16,64);
+        height= ALIGN(generic_state->downscaled_height_4x_in_mb * 4,8);
+        allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
+                                     &avc_ctx->res_mbbrc_roi_surface,
+                                     width, height,
+                                     width,
+                                     "mbbrc roi buffer");
+        if (!allocate_flag || !avc_ctx->res_mbbrc_roi_surface.bo)
+            goto failed_allocation;
+        i965_zero_gpe_resource(&avc_ctx->res_mbbrc_roi_surface);
+    }
+
     /*mb qp external*/
     if(avc_state->mb_qp_data_enable)
     {
         width = ALIGN(generic_state->downscaled_width_4x_in_mb * 4,64);
         height= ALIGN(generic_state->downscaled_height_4x_in_mb * 4,8);
-        i965_free_gpe_resource(&avc_ctx->res_mb_qp_data_surface);
-        allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
                                      &avc_ctx->res_mb_qp_data_surface,
                                      width, height,
                                      width,
@@ -1000,8 +986,7 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
     {
         width = (generic_state->frame_width_in_mbs + 1) * 64;
         height= generic_state->frame_height_in_mbs ;
-        i965_free_gpe_resource(&avc_ctx->res_mbenc_slice_map_surface);
-        allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
+        allocate_flag = i965_gpe_reallocate_2d_resource(i965->intel.bufmgr,
                                      &avc_ctx->res_mbenc_slice_map_surface,
                                      width, height,
                                      width,
@@ -1015,18 +1000,16 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
     /* sfd related surface  */
     if(avc_state->sfd_enable)
     {
-        i965_free_gpe_resource(&avc_ctx->res_sfd_output_buffer);
         size = 128;
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+        allocate_flag = i965_reallocate_gpe_resource(i965->intel.bufmgr,
                                  &avc_ctx->res_sfd_output_buffer,
                                  size,
                                  "sfd output buffer");
         if (!allocate_flag)
             goto failed_allocation;
 
-        i965_free_gpe_resource(&avc_ctx->res_sfd_cost_table_p_frame_buffer);
         size = ALIGN(52,64);
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+        allocate_flag = i965_reallocate_gpe_resource(i965->intel.bufmgr,
                                  &avc_ctx->res_sfd_cost_table_p_frame_buffer,
                                  size,
                                  "sfd P frame cost table buffer");
@@ -1037,9 +1020,8 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
         memcpy(data,gen9_avc_sfd_cost_table_p_frame,sizeof(unsigned char) *52);
         i965_unmap_gpe_resource(&(avc_ctx->res_sfd_cost_table_p_frame_buffer));
 
-        i965_free_gpe_resource(&avc_ctx->res_sfd_cost_table_b_frame_buffer);
         size = ALIGN(52,64);
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+        allocate_flag = i965_reallocate_gpe_resource(i965->intel.bufmgr,
                                  &avc_ctx->res_sfd_cost_table_b_frame_buffer,
                                  size,
                                  "sfd B frame cost table buffer");
@@ -1085,9 +1067,8 @@ gen9_avc_allocate_resources(VADriverContextP ctx,
 
     /* other   */
 
-    i965_free_gpe_resource(&avc_ctx->res_mad_data_buffer);
     size = 4 * 1;
-    allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+    allocate_flag = i965_reallocate_gpe_resource(i965->intel.bufmgr,
                                  &avc_ctx->res_mad_data_buffer,
                                  ALIGN(size,0x1000),
                                  "MAD data buffer");
@@ -1969,6 +1950,8 @@ gen9_avc_init_brc_const_data(VADriverContextP ctx,
     gpe_resource = &(avc_ctx->res_brc_const_data_buffer);
     assert(gpe_resource);
 
+    /* Rewritten in full, so don't wait for the previous frame to retire */
+    i965_renew_gpe_resource(i965->intel.bufmgr, gpe_resource, "brc const data buffer");
     i965_zero_gpe_resource(gpe_resource);
 
     data = i965_map_gpe_resource(gpe_resource);
@@ -2118,6 +2101,7 @@ gen9_avc_init_brc_const_data_old(VADriverContextP ctx,
                                  struct encode_state *encode_state,
                                  struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct encoder_vme_mfc_context * vme_context = (struct encoder_vme_mfc_context *)encoder_context->vme_context;
     struct i965_avc_encoder_context * avc_ctx = (struct i965_avc_encoder_context * )vme_context->private_enc_ctx;
     struct generic_enc_codec_state * generic_state = (struct generic_enc_codec_state * )vme_context->generic_enc_state;
@@ -2135,6 +2119,8 @@ gen9_avc_init_brc_const_data_old(VADriverContextP ctx,
     gpe_resource = &(avc_ctx->res_brc_const_data_buffer);
     assert(gpe_resource);
 
+    /* Rewritten in full, so don't wait for the previous frame to retire */
+    i965_renew_gpe_resource(i965->intel.bufmgr, gpe_resource, "brc const data buffer");
     i965_zero_gpe_resource(gpe_resource);
 
     data = i965_map_gpe_resource(gpe_resource);
@@ -2452,6 +2438,7 @@ gen9_avc_set_curbe_brc_frame_update(VADriverContextP ctx,
     struct gen9_surface_avc *avc_priv_surface;
     struct avc_param common_param;
     VAEncSequenceParameterBufferH264 * seq_param = avc_state->seq_param;
+    double target_size;
 
     obj_surface = encode_state->reconstructed_object;
 
@@ -2482,7 +2469,13 @@ gen9_avc_set_curbe_brc_frame_update(VADriverContextP ctx,
         generic_state->brc_init_current_target_buf_full_in_bits += generic_state->brc_init_reset_input_bits_per_frame * generic_state->num_skip_frames;
 
     }
-    cmd->dw0.target_size = (unsigned int)generic_state->brc_init_current_target_buf_full_in_bits ;
+    /* Move bits towards the pictures more complex than the recent ones */
+    target_size = generic_state->brc_init_current_target_buf_full_in_bits;
+    target_size += intel_enc_analysis_extra_bits(encoder_context->analysis,
+                                                 generic_state->frame_type == SLICE_TYPE_I,
+                                                 generic_state->brc_init_reset_input_bits_per_frame,
+                                                 generic_state->brc_init_reset_buf_size_in_bits);
+    cmd->dw0.target_size = (unsigned int)MAX(target_size, 0);
     cmd->dw1.frame_number = generic_state->seq_frame_number ;
     cmd->dw2.size_of_pic_headers = generic_state->herder_bytes_inserted << 3 ;
     cmd->dw5.cur_frame_type = generic_state->frame_type ;
@@ -2779,6 +2772,7 @@ gen9_avc_kernel_brc_frame_update(VADriverContextP ctx,
         gen9_avc_init_brc_const_data_old(ctx,encode_state,encoder_context);
     }
     /* image state construct*/
+    i965_renew_gpe_resource(i965->intel.bufmgr, &avc_ctx->res_brc_image_state_read_buffer, "brc image state read buffer");
     gen9_avc_set_image_state(ctx,encode_state,encoder_context,&(avc_ctx->res_brc_image_state_read_buffer));
     /* set surface frame mbenc*/
     generic_ctx->pfn_send_brc_frame_update_surface(ctx,encode_state,gpe_context,encoder_context,&curbe_brc_param);
@@ -3068,6 +3062,7 @@ gen9_avc_load_mb_brc_const_data(VADriverContextP ctx,
                         struct encode_state *encode_state,
                         struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct encoder_vme_mfc_context * vme_context = (struct encoder_vme_mfc_context *)encoder_context->vme_context;
     struct i965_avc_encoder_context * avc_ctx = (struct i965_avc_encoder_context * )vme_context->private_enc_ctx;
     struct generic_enc_codec_state * generic_state = (struct generic_enc_codec_state * )vme_context->generic_enc_state;
@@ -3084,6 +3079,7 @@ gen9_avc_load_mb_brc_const_data(VADriverContextP ctx,
 
     gpe_resource = &(avc_ctx->res_mbbrc_const_data_buffer);
     assert(gpe_resource);
+    i965_renew_gpe_resource(i965->intel.bufmgr, gpe_resource, "mbbrc const data buffer");
     data = i965_map_gpe_resource(gpe_resource);
     assert(data);
 
@@ -6013,6 +6009,10 @@ gen9_avc_vme_gpe_kernel_run(VADriverContextP ctx,
     VAEncSliceParameterBufferH264 *slice_param = avc_state->slice_param[0];
     int sfd_in_use = 0;
 
+    /* Complexity of the input for the BRC update, see gen9_avc_set_curbe_brc_frame_update() */
+    if (generic_state->brc_enabled)
+        intel_enc_analysis_surface(encoder_context->analysis, encode_state->input_yuv_object);
+
     /* BRC init/reset needs to be called before HME since it will reset the Brc Distortion surface*/
     if(generic_state->brc_enabled &&(!generic_state->brc_inited || generic_state->brc_need_reset ))
     {
@@ -61,6 +61,30 @@ struct encode_state;
 
 #define CMD_LEN_IN_OWORD        4
 
+/* Slices with fewer CTBs always build their CU records serially */
+#define GEN9_HCPE_CU_THREADS_MIN_CTBS   64
+#define GEN9_HCPE_CU_THREADS_MAX        4
+
+/* Inputs for building the indirect CU records of a slice from VME output */
+struct gen9_hcpe_cu_record_params {
+    unsigned char *vme_output;          /* mapped VME output, one block per MB */
+    unsigned int vme_block_size;
+    unsigned char *cu_records;          /* mapped indirect CU object */
+    unsigned int ref_index_in_mb[2];
+    unsigned int pic_width;             /* in luma samples */
+    unsigned int pic_height;
+    int log2_cu_size;
+    int log2_ctb_size;
+    int qp;
+    int is_intra;
+};
+
+/* What the PAK object of a CTB needs once its CU records are built */
+struct gen9_hcpe_ctb_cu_info {
+    int cu_count;
+    unsigned int split_coding_unit_flag;
+};
+
 struct gen9_hcpe_context {
     struct {
         unsigned int width;
@@ -199,6 +223,10 @@ struct gen9_hcpe_context {
     struct intel_batchbuffer *aux_batchbuffer;
     struct i965_buffer_surface aux_batchbuffer_surface;
 
+    /* Per CTB results of the CU record pass, sized to the picture */
+    struct gen9_hcpe_ctb_cu_info *ctb_cu_info;
+    int num_ctb_cu_info;
+
     void (*pipe_mode_select)(VADriverContextP ctx,
                              int standard_select,
                              struct intel_encoder_context *encoder_context);
@@ -274,6 +302,18 @@ intel_hevc_slice_insert_packed_data(VADriverContextP ctx,
                                     int slice_index,
                                     struct intel_batchbuffer *slice_batch);
 
+/*
+ * Build the indirect CU records of num_ctbs CTBs starting at first_ctb
+ * and fill ctb_info[0..num_ctbs - 1]. Large slices are split into runs
+ * of consecutive CTBs built on up to max_threads threads, max_threads
+ * <= 0 meaning one per online CPU.
+ */
+extern void
+gen9_hcpe_hevc_fill_cu_records(const struct gen9_hcpe_cu_record_params *params,
+                               int first_ctb, int num_ctbs,
+                               struct gen9_hcpe_ctb_cu_info *ctb_info,
+                               int max_threads);
+
 extern
 Bool gen9_hcpe_context_init(VADriverContextP ctx, struct intel_encoder_context *encoder_context);
 
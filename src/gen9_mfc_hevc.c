@@ -31,6 +31,11 @@
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "intel_batchbuffer.h"
 #include "i965_defines.h"
@@ -38,6 +43,7 @@
 #include "i965_drv_video.h"
 #include "i965_encoder.h"
 #include "i965_encoder_utils.h"
+#include "i965_encoder_stats.h"
 #include "gen9_mfc.h"
 #include "gen6_vme.h"
 #include "intel_media.h"
@@ -1236,44 +1242,79 @@ gen9_hcpe_hevc_pak_object(VADriverContextP ctx, int lcu_x, int lcu_y, int isLast
 #define     AVC_INTER_SUBMB_PRE_MODE_MASK       0x00ff0000
 #define     AVC_SUBMB_SHAPE_MASK    0x00FF00
 
+/* Pack the 4 (x, y) MV pairs of each list into the x words and y words
+ * of DW2-DW9 of a CU record */
+static inline void
+gen9_hcpe_hevc_pack_cu_mvs(unsigned int *cu_msg, const unsigned int mv[8])
+{
+#ifdef __SSE2__
+    __m128i lo = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)mv),
+                                   _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i hi = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(mv + 4)),
+                                   _MM_SHUFFLE(3, 1, 2, 0));
+    __m128i l0 = _mm_unpacklo_epi64(lo, hi);    /* mv 0, 2, 4, 6 */
+    __m128i l1 = _mm_unpackhi_epi64(lo, hi);    /* mv 1, 3, 5, 7 */
+
+    /* x0 y0 x2 y2 x4 y4 x6 y6 -> x0 x2 x4 x6 y0 y2 y4 y6 */
+    l0 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(l0, _MM_SHUFFLE(3, 1, 2, 0)),
+                             _MM_SHUFFLE(3, 1, 2, 0));
+    l1 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(l1, _MM_SHUFFLE(3, 1, 2, 0)),
+                             _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(cu_msg + 2),
+                     _mm_shuffle_epi32(l0, _MM_SHUFFLE(3, 1, 2, 0)));
+    _mm_storeu_si128((__m128i *)(cu_msg + 6),
+                     _mm_shuffle_epi32(l1, _MM_SHUFFLE(3, 1, 2, 0)));
+#else
+    /* l0: 4 MV (x,y); l1； 4 MV (x,y) */
+    cu_msg[2] = ((mv[2] & 0xffff) << 16 |   /* mvx_l0[1]  */
+                 (mv[0] & 0xffff)           /* mvx_l0[0] */
+                );
+    cu_msg[3] = ((mv[6] & 0xffff) << 16 |   /* mvx_l0[3]  */
+                 (mv[4] & 0xffff)           /* mvx_l0[2] */
+                );
+    cu_msg[4] = ((mv[2] & 0xffff0000) |         /* mvy_l0[1]  */
+                 (mv[0] & 0xffff0000) >> 16     /* mvy_l0[0] */
+                );
+    cu_msg[5] = ((mv[6] & 0xffff0000) |         /* mvy_l0[3]  */
+                 (mv[4] & 0xffff0000) >> 16     /* mvy_l0[2] */
+                );
+
+    cu_msg[6] = ((mv[3] & 0xffff) << 16 |   /* mvx_l1[1]  */
+                 (mv[1] & 0xffff)           /* mvx_l1[0] */
+                );
+    cu_msg[7] = ((mv[7] & 0xffff) << 16 |   /* mvx_l1[3]  */
+                 (mv[5] & 0xffff)           /* mvx_l1[2] */
+                );
+    cu_msg[8] = ((mv[3] & 0xffff0000) |         /* mvy_l1[1]  */
+                 (mv[1] & 0xffff0000) >> 16     /* mvy_l1[0] */
+                );
+    cu_msg[9] = ((mv[7] & 0xffff0000) |         /* mvy_l1[3]  */
+                 (mv[5] & 0xffff0000) >> 16     /* mvy_l1[2] */
+                );
+#endif
+}
+
 /* here 1 MB = 1CU = 16x16 */
 static void
-gen9_hcpe_hevc_fill_indirect_cu_intra(VADriverContextP ctx,
-                                      struct encode_state *encode_state,
-                                      struct intel_encoder_context *encoder_context,
-                                      int qp, unsigned int *msg,
-                                      int ctb_x, int ctb_y,
-                                      int mb_x, int mb_y,
-                                      int ctb_width_in_mb, int width_in_ctb, int num_cu_record, int slice_type,int cu_index,int index)
+gen9_hcpe_hevc_fill_indirect_cu_intra(unsigned int *cu_record,
+                                      int qp, const unsigned int *msg,
+                                      int intraMbMode, int index)
 {
     /* here cu == mb, so we use mb address as the cu address */
     /* to fill the indirect cu by the vme out */
-    static int intra_mode_8x8_avc2hevc[9] = {26, 10, 1, 34, 18, 24, 13, 28, 8};
-    static int intra_mode_16x16_avc2hevc[4] = {26, 10, 1, 34};
-    struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
-    unsigned char * cu_record_ptr = NULL;
-    unsigned int * cu_msg = NULL;
-    int ctb_address = (ctb_y * width_in_ctb + ctb_x) * num_cu_record;
-    int mb_address_in_ctb = 0;
-    int cu_address = (ctb_address + mb_address_in_ctb + cu_index) * 16 * 4;
-    int zero = 0;
+    static const int intra_mode_8x8_avc2hevc[9] = {26, 10, 1, 34, 18, 24, 13, 28, 8};
+    static const int intra_mode_16x16_avc2hevc[4] = {26, 10, 1, 34};
+    static const int chroma_mode_remap[4] = {5, 4, 3, 2};
+    unsigned int cu_msg[2];
     int is_inter = 0;
-    int intraMbMode = 0;
     int cu_part_mode = 0;
     int intraMode[4];
-    int inerpred_idc = 0;
-    int intra_chroma_mode = 5;
+    int inerpred_idc = 0xff;
+    int intra_chroma_mode = chroma_mode_remap[msg[3] & 0x3];
     int cu_size = 1;
     int tu_size = 0x55;
     int tu_count = 4;
-    int chroma_mode_remap[4]={5,4,3,2};
 
-    if (!is_inter) inerpred_idc = 0xff;
-
-    intraMbMode = (msg[0] & AVC_INTRA_MODE_MASK) >> 4;
-
-    intra_chroma_mode = (msg[3] & 0x3);
-    intra_chroma_mode =  chroma_mode_remap[intra_chroma_mode];
     if (intraMbMode == AVC_INTRA_16X16) {
         cu_part_mode = 0; //2Nx2N
         cu_size = 1;
@@ -1305,253 +1346,124 @@ gen9_hcpe_hevc_fill_indirect_cu_intra(VADriverContextP ctx,
 
     }
 
-    cu_record_ptr = (unsigned char *)mfc_context->hcp_indirect_cu_object.bo->virtual;
-    /* get the mb info from the vme out */
-    cu_msg = (unsigned int *)(cu_record_ptr + cu_address);
-
     cu_msg[0] = (inerpred_idc << 24 |   /* interpred_idc[3:0][1:0] */
-                 zero << 23 |   /* reserved */
                  qp << 16 | /* CU_qp */
-                 zero << 11 |   /* reserved */
                  intra_chroma_mode << 8 |   /* intra_chroma_mode */
-                 zero << 7 |    /* IPCM_enable , reserved for SKL*/
                  cu_part_mode << 4 |    /* cu_part_mode */
-                 zero << 3 |    /* cu_transquant_bypass_flag */
                  is_inter << 2 |    /* cu_pred_mode :intra 1,inter 1*/
                  cu_size          /* cu_size */
                 );
-    cu_msg[1] = (zero << 30 |   /* reserved  */
-                 intraMode[3] << 24 |   /* intra_mode */
-                 zero << 22 |   /* reserved  */
+    cu_msg[1] = (intraMode[3] << 24 |   /* intra_mode */
                  intraMode[2] << 16 |   /* intra_mode */
-                 zero << 14 |   /* reserved  */
                  intraMode[1] << 8 |    /* intra_mode */
-                 zero << 6 |    /* reserved  */
                  intraMode[0]           /* intra_mode */
                 );
-    /* l0: 4 MV (x,y); l1； 4 MV (x,y) */
-    cu_msg[2] = (zero << 16 |   /* mvx_l0[1]  */
-                 zero           /* mvx_l0[0] */
-                );
-    cu_msg[3] = (zero << 16 |   /* mvx_l0[3]  */
-                 zero           /* mvx_l0[2] */
-                );
-    cu_msg[4] = (zero << 16 |   /* mvy_l0[1]  */
-                 zero           /* mvy_l0[0] */
-                );
-    cu_msg[5] = (zero << 16 |   /* mvy_l0[3]  */
-                 zero           /* mvy_l0[2] */
-                );
 
-    cu_msg[6] = (zero << 16 |   /* mvx_l1[1]  */
-                 zero           /* mvx_l1[0] */
-                );
-    cu_msg[7] = (zero << 16 |   /* mvx_l1[3]  */
-                 zero           /* mvx_l1[2] */
-                );
-    cu_msg[8] = (zero << 16 |   /* mvy_l1[1]  */
-                 zero           /* mvy_l1[0] */
-                );
-    cu_msg[9] = (zero << 16 |   /* mvy_l1[3]  */
-                 zero           /* mvy_l1[2] */
-                );
-
-    cu_msg[10] = (zero << 28 |  /* ref_idx_l1[3]  */
-                  zero << 24 |  /* ref_idx_l1[2] */
-                  zero << 20 |  /* ref_idx_l1[1]  */
-                  zero << 16 |  /* ref_idx_l1[0] */
-                  zero << 12 |  /* ref_idx_l0[3]  */
-                  zero << 8 |   /* ref_idx_l0[2] */
-                  zero << 4 |   /* ref_idx_l0[1]  */
-                  zero          /* ref_idx_l0[0] */
-                 );
-
-    cu_msg[11] = tu_size; /* tu_size 00000000 00000000 00000000 10101010  or 0x0*/
-    cu_msg[12] = ((tu_count - 1) << 28 | /* tu count - 1 */
-                  zero << 16 |  /* reserved  */
-                  zero          /* tu_xform_Yskip[15:0] */
-                 );
-    cu_msg[13] = (zero << 16 |  /* tu_xform_Vskip[15:0]  */
-                  zero          /* tu_xform_Uskip[15:0] */
-                 );
-    cu_msg[14] = zero ;
-    cu_msg[15] = zero ;
+    /* No MVs nor reference indices, the whole record is written with
+     * 4 full stores */
+#ifdef __SSE2__
+    _mm_storeu_si128((__m128i *)(cu_record + 0),
+                     _mm_setr_epi32(cu_msg[0], cu_msg[1], 0, 0));
+    _mm_storeu_si128((__m128i *)(cu_record + 4), _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *)(cu_record + 8),
+                     _mm_setr_epi32(0, 0, 0, tu_size));
+    _mm_storeu_si128((__m128i *)(cu_record + 12),
+                     _mm_setr_epi32((tu_count - 1) << 28, 0, 0, 0));
+#else
+    cu_record[0] = cu_msg[0];
+    cu_record[1] = cu_msg[1];
+    memset(cu_record + 2, 0, 9 * sizeof(unsigned int));
+    cu_record[11] = tu_size; /* tu_size 00000000 00000000 00000000 10101010  or 0x0*/
+    cu_record[12] = ((tu_count - 1) << 28); /* tu count - 1 */
+    cu_record[13] = 0;
+    cu_record[14] = 0;
+    cu_record[15] = 0;
+#endif
 }
 
 /* here 1 MB = 1CU = 16x16 */
 static void
-gen9_hcpe_hevc_fill_indirect_cu_inter(VADriverContextP ctx,
-                                      struct encode_state *encode_state,
-                                      struct intel_encoder_context *encoder_context,
-                                      int qp, unsigned int *msg,
-                                      int ctb_x, int ctb_y,
-                                      int mb_x, int mb_y,
-                                      int ctb_width_in_mb, int width_in_ctb, int num_cu_record, int slice_type, int cu_index,int index)
+gen9_hcpe_hevc_fill_indirect_cu_inter(unsigned int *cu_record,
+                                      int qp, const unsigned int *msg,
+                                      int inter_mode,
+                                      const unsigned int ref_index_in_mb[2],
+                                      int index)
 {
     /* here cu == mb, so we use mb address as the cu address */
     /* to fill the indirect cu by the vme out */
-    struct gen9_hcpe_context *mfc_context = encoder_context->mfc_context;
-    struct gen6_vme_context *vme_context = encoder_context->vme_context;
-    unsigned char * cu_record_ptr = NULL;
-    unsigned int * cu_msg = NULL;
-    int ctb_address = (ctb_y * width_in_ctb + ctb_x) * num_cu_record;
-    int mb_address_in_ctb = 0;
-    int cu_address = (ctb_address + mb_address_in_ctb + cu_index) * 16 * 4;
-    int zero = 0;
+    unsigned int *cu_msg = cu_record;
     int cu_part_mode = 0;
-    int submb_pre_mode = 0;
+    int submb_pre_mode = (msg[1] & AVC_INTER_SUBMB_PRE_MODE_MASK) >> 16;
     int is_inter = 1;
     int cu_size = 1;
     int tu_size = 0x55;
     int tu_count = 4;
-    int inter_mode = 0;
+    unsigned int mv[8];
+    const unsigned int *mv_ptr;
+    const unsigned int *mv01, *mv23, *mv45, *mv67;
 
-    unsigned int *mv_ptr;
-    {
-        inter_mode = (msg[0] & AVC_INTER_MODE_MASK);
-        submb_pre_mode = (msg[1] & AVC_INTER_SUBMB_PRE_MODE_MASK) >> 16;
 #define MSG_MV_OFFSET   4
-        mv_ptr = msg + MSG_MV_OFFSET;
-        /* MV of VME output is based on 16 sub-blocks. So it is necessary
-        * to convert them to be compatible with the format of AVC_PAK
-        * command.
-        */
-        /* 0/2/4/6/8... ： l0, 1/3/5/7...: l1 ; now it only support 16x16,16x8,8x16,8x8*/
-
-        if (inter_mode == AVC_INTER_16X16) {
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[6] = mv_ptr[0];
-            mv_ptr[7] = mv_ptr[1];
-            cu_part_mode = 0;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-        } else if (inter_mode == AVC_INTER_8X16) {
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[8];
-            mv_ptr[3] = mv_ptr[9];
-            mv_ptr[6] = mv_ptr[8];
-            mv_ptr[7] = mv_ptr[9];
-            cu_part_mode = 1;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-        } else if (inter_mode == AVC_INTER_16X8) {
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[4] = mv_ptr[16];
-            mv_ptr[5] = mv_ptr[17];
-            mv_ptr[6] = mv_ptr[24];
-            mv_ptr[7] = mv_ptr[25];
-            cu_part_mode = 2;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-        }else if(inter_mode == AVC_INTER_8X8) {
-            mv_ptr[0] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[1] = mv_ptr[index * 8 + 1 ];
-            mv_ptr[2] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[3] = mv_ptr[index * 8 + 1 ];
-            mv_ptr[4] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[5] = mv_ptr[index * 8 + 1 ];
-            mv_ptr[6] = mv_ptr[index * 8 + 0 ];
-            mv_ptr[7] = mv_ptr[index * 8 + 1 ];
-            cu_part_mode = 0;
-            cu_size = 0;
-            tu_size = 0x0;
-            tu_count = 4;
-
-        }else
-        {
-            mv_ptr[4] = mv_ptr[0];
-            mv_ptr[5] = mv_ptr[1];
-            mv_ptr[2] = mv_ptr[0];
-            mv_ptr[3] = mv_ptr[1];
-            mv_ptr[6] = mv_ptr[0];
-            mv_ptr[7] = mv_ptr[1];
-            cu_part_mode = 0;
-            cu_size = 1;
-            tu_size = 0x55;
-            tu_count = 4;
-
-        }
+    mv_ptr = msg + MSG_MV_OFFSET;
+    /* MV of VME output is based on 16 sub-blocks. So it is necessary
+    * to convert them to be compatible with the format of AVC_PAK
+    * command.
+    */
+    /* 0/2/4/6/8... ： l0, 1/3/5/7...: l1 ; now it only support 16x16,16x8,8x16,8x8*/
+
+    if (inter_mode == AVC_INTER_8X16) {
+        mv01 = mv45 = mv_ptr;
+        mv23 = mv67 = mv_ptr + 8;
+        cu_part_mode = 1;
+    } else if (inter_mode == AVC_INTER_16X8) {
+        mv01 = mv23 = mv_ptr;
+        mv45 = mv_ptr + 16;
+        mv67 = mv_ptr + 24;
+        cu_part_mode = 2;
+    } else if (inter_mode == AVC_INTER_8X8) {
+        mv01 = mv23 = mv45 = mv67 = mv_ptr + index * 8;
+        cu_part_mode = 0;
+        cu_size = 0;
+        tu_size = 0x0;
+    } else {
+        /* AVC_INTER_16X16 */
+        mv01 = mv23 = mv45 = mv67 = mv_ptr;
+        cu_part_mode = 0;
     }
 
-    cu_record_ptr = (unsigned char *)mfc_context->hcp_indirect_cu_object.bo->virtual;
-    /* get the mb info from the vme out */
-    cu_msg = (unsigned int *)(cu_record_ptr + cu_address);
+    mv[0] = mv01[0];
+    mv[1] = mv01[1];
+    mv[2] = mv23[0];
+    mv[3] = mv23[1];
+    mv[4] = mv45[0];
+    mv[5] = mv45[1];
+    mv[6] = mv67[0];
+    mv[7] = mv67[1];
 
     cu_msg[0] = (submb_pre_mode << 24 | /* interpred_idc[3:0][1:0] */
-                 zero << 23 |   /* reserved */
                  qp << 16 | /* CU_qp */
-                 zero << 11 |   /* reserved */
                  5 << 8 |   /* intra_chroma_mode */
-                 zero << 7 |    /* IPCM_enable , reserved for SKL*/
                  cu_part_mode << 4 |    /* cu_part_mode */
-                 zero << 3 |    /* cu_transquant_bypass_flag */
                  is_inter << 2 |    /* cu_pred_mode :intra 1,inter 1*/
                  cu_size          /* cu_size */
                 );
-    cu_msg[1] = (zero << 30 |   /* reserved  */
-                 zero << 24 |   /* intra_mode */
-                 zero << 22 |   /* reserved  */
-                 zero << 16 |   /* intra_mode */
-                 zero << 14 |   /* reserved  */
-                 zero << 8 |    /* intra_mode */
-                 zero << 6 |    /* reserved  */
-                 zero           /* intra_mode */
-                );
-    /* l0: 4 MV (x,y); l1； 4 MV (x,y) */
-    cu_msg[2] = ((mv_ptr[2] & 0xffff) << 16 |   /* mvx_l0[1]  */
-                 (mv_ptr[0] & 0xffff)           /* mvx_l0[0] */
-                );
-    cu_msg[3] = ((mv_ptr[6] & 0xffff) << 16 |   /* mvx_l0[3]  */
-                 (mv_ptr[4] & 0xffff)           /* mvx_l0[2] */
-                );
-    cu_msg[4] = ((mv_ptr[2] & 0xffff0000) |         /* mvy_l0[1]  */
-                 (mv_ptr[0] & 0xffff0000) >> 16     /* mvy_l0[0] */
-                );
-    cu_msg[5] = ((mv_ptr[6] & 0xffff0000) |         /* mvy_l0[3]  */
-                 (mv_ptr[4] & 0xffff0000) >> 16     /* mvy_l0[2] */
-                );
-
-    cu_msg[6] = ((mv_ptr[3] & 0xffff) << 16 |   /* mvx_l1[1]  */
-                 (mv_ptr[1] & 0xffff)           /* mvx_l1[0] */
-                );
-    cu_msg[7] = ((mv_ptr[7] & 0xffff) << 16 |   /* mvx_l1[3]  */
-                 (mv_ptr[5] & 0xffff)           /* mvx_l1[2] */
-                );
-    cu_msg[8] = ((mv_ptr[3] & 0xffff0000) |         /* mvy_l1[1]  */
-                 (mv_ptr[1] & 0xffff0000) >> 16     /* mvy_l1[0] */
-                );
-    cu_msg[9] = ((mv_ptr[7] & 0xffff0000) |         /* mvy_l1[3]  */
-                 (mv_ptr[5] & 0xffff0000) >> 16     /* mvy_l1[2] */
-                );
-
-    cu_msg[10] = (((vme_context->ref_index_in_mb[1] >> 24) & 0xf) << 28 |   /* ref_idx_l1[3]  */
-                  ((vme_context->ref_index_in_mb[1] >> 16) & 0xf) << 24 |   /* ref_idx_l1[2] */
-                  ((vme_context->ref_index_in_mb[1] >> 8) & 0xf) << 20 |    /* ref_idx_l1[1]  */
-                  ((vme_context->ref_index_in_mb[1] >> 0) & 0xf) << 16 |    /* ref_idx_l1[0] */
-                  ((vme_context->ref_index_in_mb[0] >> 24) & 0xf) << 12 |   /* ref_idx_l0[3]  */
-                  ((vme_context->ref_index_in_mb[0] >> 16) & 0xf) << 8  |   /* ref_idx_l0[2] */
-                  ((vme_context->ref_index_in_mb[0] >> 8) & 0xf) << 4 |     /* ref_idx_l0[1]  */
-                  ((vme_context->ref_index_in_mb[0] >> 0) & 0xf)            /* ref_idx_l0[0] */
+    cu_msg[1] = 0;  /* intra_mode */
+    gen9_hcpe_hevc_pack_cu_mvs(cu_msg, mv);
+
+    cu_msg[10] = (((ref_index_in_mb[1] >> 24) & 0xf) << 28 |   /* ref_idx_l1[3]  */
+                  ((ref_index_in_mb[1] >> 16) & 0xf) << 24 |   /* ref_idx_l1[2] */
+                  ((ref_index_in_mb[1] >> 8) & 0xf) << 20 |    /* ref_idx_l1[1]  */
+                  ((ref_index_in_mb[1] >> 0) & 0xf) << 16 |    /* ref_idx_l1[0] */
+                  ((ref_index_in_mb[0] >> 24) & 0xf) << 12 |   /* ref_idx_l0[3]  */
+                  ((ref_index_in_mb[0] >> 16) & 0xf) << 8  |   /* ref_idx_l0[2] */
+                  ((ref_index_in_mb[0] >> 8) & 0xf) << 4 |     /* ref_idx_l0[1]  */
+                  ((ref_index_in_mb[0] >> 0) & 0xf)            /* ref_idx_l0[0] */
                  );
 
     cu_msg[11] = tu_size; /* tu_size 00000000 00000000 00000000 10101010  or 0x0*/
-    cu_msg[12] = ((tu_count - 1) << 28 | /* tu count - 1 */
-                  zero << 16 |  /* reserved  */
-                  zero          /* tu_xform_Yskip[15:0] */
-                 );
-    cu_msg[13] = (zero << 16 |  /* tu_xform_Vskip[15:0]  */
-                  zero          /* tu_xform_Uskip[15:0] */
-                 );
-    cu_msg[14] = zero ;
-    cu_msg[15] = zero ;
+    cu_msg[12] = ((tu_count - 1) << 28); /* tu count - 1 */
+    cu_msg[13] = 0;
+    cu_msg[14] = 0;
+    cu_msg[15] = 0;
 }
 
 #define HEVC_SPLIT_CU_FLAG_64_64 ((0x1<<20)|(0xf<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
@@ -1559,6 +1471,200 @@ gen9_hcpe_hevc_fill_indirect_cu_inter(VADriverContextP ctx,
 #define HEVC_SPLIT_CU_FLAG_16_16 ((0x0<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
 #define HEVC_SPLIT_CU_FLAG_8_8   ((0x1<<20)|(0x0<<16)|(0x0<<12)|(0x0<<8)|(0x0<<4)|(0x0))
 
+/* Build the CU records of one CTB from the VME output of its MBs */
+static void
+gen9_hcpe_hevc_fill_ctb_cu_records(const struct gen9_hcpe_cu_record_params *params,
+                                   int i_ctb, struct gen9_hcpe_ctb_cu_info *info)
+{
+    int log2_cu_size = params->log2_cu_size;
+    int ctb_size = 1 << params->log2_ctb_size;
+    int width_in_ctb = (params->pic_width + ctb_size - 1) / ctb_size;
+    int height_in_ctb = (params->pic_height + ctb_size - 1) / ctb_size;
+    int ctb_width_in_mb = (ctb_size + 15) / 16;
+    int width_in_mbs = (params->pic_width + 15) / 16;
+    int row_pad_flag = (params->pic_height % ctb_size) > 0 ? 1 : 0;
+    int col_pad_flag = (params->pic_width % ctb_size) > 0 ? 1 : 0;
+    int ctb_x = i_ctb % width_in_ctb;
+    int ctb_y = i_ctb / width_in_ctb;
+    int ctb_height_in_mb_internal = ctb_width_in_mb;
+    int ctb_width_in_mb_internal = ctb_width_in_mb;
+    int drop_cu_row_in_last_mb = 0;
+    int drop_cu_column_in_last_mb = 0;
+    int num_cu_record = 64;
+    int macroblock_address, mb_addr, mb_x, mb_y;
+    int max_cu_num_in_mb, tmp_mb_mode;
+    int inter_rdo, intra_rdo;
+    int cu_index = 0;
+    unsigned int split_coding_unit_flag;
+    unsigned int *cu_record;
+    const unsigned int *msg;
+
+    if (params->log2_ctb_size == 5) num_cu_record = 16;
+    else if (params->log2_ctb_size == 4) num_cu_record = 4;
+    else if (params->log2_ctb_size == 6) num_cu_record = 64;
+
+    cu_record = (unsigned int *)(params->cu_records + i_ctb * num_cu_record * 16 * 4);
+
+    if (ctb_y == (height_in_ctb - 1) && row_pad_flag) {
+        ctb_height_in_mb_internal = (params->pic_height - (ctb_y * ctb_size) + 15) / 16;
+
+        if ((log2_cu_size == 3) && (params->pic_height % 16))
+            drop_cu_row_in_last_mb = (16 - (params->pic_height % 16)) >> log2_cu_size;
+    }
+
+    if (ctb_x == (width_in_ctb - 1) && col_pad_flag) {
+        ctb_width_in_mb_internal = (params->pic_width - (ctb_x * ctb_size) + 15) / 16;
+
+        if ((log2_cu_size == 3) && (params->pic_width % 16))
+            drop_cu_column_in_last_mb = (16 - (params->pic_width % 16)) >> log2_cu_size;
+    }
+
+    macroblock_address = ctb_y * width_in_mbs * ctb_width_in_mb + ctb_x * ctb_width_in_mb;
+    split_coding_unit_flag = ((ctb_width_in_mb == 2) ? HEVC_SPLIT_CU_FLAG_32_32 : HEVC_SPLIT_CU_FLAG_16_16);
+
+    for (mb_y = 0; mb_y < ctb_height_in_mb_internal; mb_y++) {
+        mb_addr = macroblock_address + mb_y * width_in_mbs;
+        for (mb_x = 0; mb_x < ctb_width_in_mb_internal; mb_x++, mb_addr++) {
+            max_cu_num_in_mb = 4;
+            if (drop_cu_row_in_last_mb && (mb_y == ctb_height_in_mb_internal - 1))
+                max_cu_num_in_mb /= 2;
+
+            if (drop_cu_column_in_last_mb && (mb_x == ctb_width_in_mb_internal - 1))
+                max_cu_num_in_mb /= 2;
+
+            /* get the mb info from the vme out */
+            msg = (const unsigned int *)(params->vme_output + mb_addr * params->vme_block_size);
+
+            inter_rdo = msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK;
+            intra_rdo = msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK;
+
+            if (params->is_intra || intra_rdo < inter_rdo) {
+                /* fill intra cu */
+                tmp_mb_mode = (msg[0] & AVC_INTRA_MODE_MASK) >> 4;
+                if (max_cu_num_in_mb < 4) {
+                    /* MBs cut by the picture edge are coded as 8x8 CUs */
+                    if (tmp_mb_mode == AVC_INTRA_16X16)
+                        tmp_mb_mode = AVC_INTRA_8X8;
+
+                    gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 0);
+                    if (--max_cu_num_in_mb > 0)
+                        gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 2);
+
+                    if (ctb_width_in_mb == 2)
+                        split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
+                    else if (ctb_width_in_mb == 1)
+                        split_coding_unit_flag |= 0x1 << 20;
+                } else if (tmp_mb_mode == AVC_INTRA_16X16) {
+                    gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 0);
+                } else { // for 4x4 to use 8x8 replace
+                    gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 0);
+                    gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 1);
+                    gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 2);
+                    gen9_hcpe_hevc_fill_indirect_cu_intra(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, 3);
+                    if (ctb_width_in_mb == 2)
+                        split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
+                    else if (ctb_width_in_mb == 1)
+                        split_coding_unit_flag |= 0x1 << 20;
+                }
+            } else {
+                msg += AVC_INTER_MSG_OFFSET;
+                /* fill inter cu */
+                tmp_mb_mode = msg[0] & AVC_INTER_MODE_MASK;
+                if (max_cu_num_in_mb < 4) {
+                    tmp_mb_mode = AVC_INTER_8X8;
+                    gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 0);
+                    if (--max_cu_num_in_mb > 0)
+                        gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 1);
+
+                    if (ctb_width_in_mb == 2)
+                        split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
+                    else if (ctb_width_in_mb == 1)
+                        split_coding_unit_flag |= 0x1 << 20;
+                } else if (tmp_mb_mode == AVC_INTER_8X8) {
+                    gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 0);
+                    gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 1);
+                    gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 2);
+                    gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 3);
+                    if (ctb_width_in_mb == 2)
+                        split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
+                    else if (ctb_width_in_mb == 1)
+                        split_coding_unit_flag |= 0x1 << 20;
+                } else {
+                    /* AVC_INTER_16X16, AVC_INTER_8X16 or AVC_INTER_16X8 */
+                    gen9_hcpe_hevc_fill_indirect_cu_inter(cu_record + 16 * cu_index++, params->qp, msg, tmp_mb_mode, params->ref_index_in_mb, 0);
+                }
+            }
+        }
+    }
+
+    info->cu_count = cu_index;
+    info->split_coding_unit_flag = split_coding_unit_flag;
+}
+
+struct cu_record_job {
+    const struct gen9_hcpe_cu_record_params *params;
+    struct gen9_hcpe_ctb_cu_info            *ctb_info;
+    int                                      first_ctb;
+    int                                      num_ctbs;
+    pthread_t                                thread;
+    int                                      thread_started;
+};
+
+static void *
+cu_record_job_run(void *arg)
+{
+    struct cu_record_job * const job = arg;
+    int i;
+
+    for (i = 0; i < job->num_ctbs; i++)
+        gen9_hcpe_hevc_fill_ctb_cu_records(job->params, job->first_ctb + i,
+                                           &job->ctb_info[i]);
+    return NULL;
+}
+
+void
+gen9_hcpe_hevc_fill_cu_records(const struct gen9_hcpe_cu_record_params *params,
+                               int first_ctb, int num_ctbs,
+                               struct gen9_hcpe_ctb_cu_info *ctb_info,
+                               int max_threads)
+{
+    struct cu_record_job jobs[GEN9_HCPE_CU_THREADS_MAX];
+    int num_jobs, ctbs_per_job, k, n;
+
+    num_jobs = max_threads > 0 ? max_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    num_jobs = MIN(num_jobs, GEN9_HCPE_CU_THREADS_MAX);
+
+    if (num_jobs < 2 || num_ctbs < GEN9_HCPE_CU_THREADS_MIN_CTBS)
+        num_jobs = 1;
+
+    memset(jobs, 0, sizeof(jobs));
+    ctbs_per_job = (num_ctbs + num_jobs - 1) / num_jobs;
+
+    for (k = 0, n = 0; k < num_jobs && n < num_ctbs; k++) {
+        jobs[k].params = params;
+        jobs[k].first_ctb = first_ctb + n;
+        jobs[k].ctb_info = ctb_info + n;
+        jobs[k].num_ctbs = MIN(ctbs_per_job, num_ctbs - n);
+        n += jobs[k].num_ctbs;
+    }
+    num_jobs = k;
+
+    /* A CTB only reads the VME output of its own MBs and writes its own
+       CU records, so runs of CTBs need no locking */
+    for (k = 1; k < num_jobs; k++)
+        jobs[k].thread_started = !pthread_create(&jobs[k].thread, NULL,
+                                                 cu_record_job_run, &jobs[k]);
+
+    cu_record_job_run(&jobs[0]);
+
+    for (k = 1; k < num_jobs; k++) {
+        if (jobs[k].thread_started)
+            pthread_join(jobs[k].thread, NULL);
+        else
+            cu_record_job_run(&jobs[k]);
+    }
+}
+
 
 void
 intel_hevc_slice_insert_packed_data(VADriverContextP ctx,
@@ -1687,31 +1793,11 @@ gen9_hcpe_hevc_pipeline_slice_programing(VADriverContextP ctx,
     int width_in_ctb = (pSequenceParameter->pic_width_in_luma_samples + ctb_size - 1) / ctb_size;
     int height_in_ctb = (pSequenceParameter->pic_height_in_luma_samples + ctb_size - 1) / ctb_size;
     int last_slice = (pSliceParameter->slice_segment_address + pSliceParameter->num_ctu_in_slice) == (width_in_ctb * height_in_ctb);
-    int ctb_width_in_mb = (ctb_size + 15) / 16;
-    int i_ctb, ctb_x, ctb_y;
-    unsigned int split_coding_unit_flag = 0;
-    int width_in_mbs = (pSequenceParameter->pic_width_in_luma_samples + 15) / 16;
-    int row_pad_flag = (pSequenceParameter->pic_height_in_luma_samples % ctb_size)> 0 ? 1:0;
-    int col_pad_flag = (pSequenceParameter->pic_width_in_luma_samples % ctb_size)> 0 ? 1:0;
-
-    int is_intra = (slice_type == HEVC_SLICE_I);
-    unsigned int *msg = NULL;
-    unsigned char *msg_ptr = NULL;
-    int macroblock_address = 0;
-    int num_cu_record = 64;
-    int cu_count = 1;
-    int tmp_mb_mode = 0;
-    int mb_x = 0, mb_y = 0;
-    int mb_addr = 0;
-    int cu_index = 0;
-    int inter_rdo, intra_rdo;
+    int num_ctbs = pSliceParameter->num_ctu_in_slice;
+    int i, i_ctb;
+    struct gen9_hcpe_cu_record_params cu_params;
+    struct gen9_hcpe_ctb_cu_info *ctb_info;
     int qp;
-    int drop_cu_row_in_last_mb = 0;
-    int drop_cu_column_in_last_mb = 0;
-
-    if (log2_ctb_size == 5) num_cu_record = 16;
-    else if (log2_ctb_size == 4) num_cu_record = 4;
-    else if (log2_ctb_size == 6) num_cu_record = 64;
 
     qp = qp_slice;
     if (rate_control_mode == VA_RC_CBR) {
@@ -1762,141 +1848,44 @@ gen9_hcpe_hevc_pipeline_slice_programing(VADriverContextP ctx,
 
 
 
-    split_coding_unit_flag = (ctb_width_in_mb == 4) ? HEVC_SPLIT_CU_FLAG_64_64 : ((ctb_width_in_mb == 2) ? HEVC_SPLIT_CU_FLAG_32_32 : HEVC_SPLIT_CU_FLAG_16_16);
+    if (mfc_context->num_ctb_cu_info < num_ctbs) {
+        free(mfc_context->ctb_cu_info);
+        mfc_context->num_ctb_cu_info = width_in_ctb * height_in_ctb;
+        mfc_context->ctb_cu_info = calloc(mfc_context->num_ctb_cu_info,
+                                          sizeof(*mfc_context->ctb_cu_info));
+        assert(mfc_context->ctb_cu_info);
+    }
+    ctb_info = mfc_context->ctb_cu_info;
 
     dri_bo_map(vme_context->vme_output.bo , 1);
-    msg_ptr = (unsigned char *)vme_context->vme_output.bo->virtual;
     dri_bo_map(mfc_context->hcp_indirect_cu_object.bo , 1);
 
-    for (i_ctb = pSliceParameter->slice_segment_address;i_ctb < pSliceParameter->slice_segment_address + pSliceParameter->num_ctu_in_slice; i_ctb++) {
-        int last_ctb = (i_ctb == (pSliceParameter->slice_segment_address + pSliceParameter->num_ctu_in_slice - 1));
-        int ctb_height_in_mb_internal = ctb_width_in_mb;
-        int ctb_width_in_mb_internal = ctb_width_in_mb;
-        int max_cu_num_in_mb = 4;
-
-        ctb_x = i_ctb % width_in_ctb;
-        ctb_y = i_ctb / width_in_ctb;
-
-        drop_cu_row_in_last_mb = 0;
-        drop_cu_column_in_last_mb = 0;
-
-        if(ctb_y == (height_in_ctb - 1) && row_pad_flag)
-        {
-            ctb_height_in_mb_internal = (pSequenceParameter->pic_height_in_luma_samples - (ctb_y * ctb_size) + 15)/16;
-
-            if((log2_cu_size == 3) && (pSequenceParameter->pic_height_in_luma_samples % 16))
-                drop_cu_row_in_last_mb = (16 - (pSequenceParameter->pic_height_in_luma_samples % 16))>>log2_cu_size;
-        }
-
-        if(ctb_x == (width_in_ctb - 1) && col_pad_flag)
-        {
-            ctb_width_in_mb_internal = (pSequenceParameter->pic_width_in_luma_samples - (ctb_x * ctb_size) + 15) / 16;
-
-            if((log2_cu_size == 3) && (pSequenceParameter->pic_width_in_luma_samples % 16))
-                drop_cu_column_in_last_mb = (16 - (pSequenceParameter->pic_width_in_luma_samples % 16))>>log2_cu_size;
-        }
-
-        mb_x = 0;
-        mb_y = 0;
-        macroblock_address = ctb_y * width_in_mbs * ctb_width_in_mb + ctb_x * ctb_width_in_mb;
-        split_coding_unit_flag = ((ctb_width_in_mb == 2) ? HEVC_SPLIT_CU_FLAG_32_32 : HEVC_SPLIT_CU_FLAG_16_16);
-        cu_count = 1;
-        cu_index = 0;
-        mb_addr = 0;
-        msg = NULL;
-        for (mb_y = 0; mb_y < ctb_height_in_mb_internal; mb_y++)
-        {
-            mb_addr = macroblock_address + mb_y * width_in_mbs ;
-            for (mb_x = 0; mb_x < ctb_width_in_mb_internal; mb_x++)
-            {
-                max_cu_num_in_mb = 4;
-                if(drop_cu_row_in_last_mb && (mb_y == ctb_height_in_mb_internal - 1))
-                    max_cu_num_in_mb /= 2;
-
-                if(drop_cu_column_in_last_mb && (mb_x == ctb_width_in_mb_internal - 1))
-                    max_cu_num_in_mb /= 2;
-
-                /* get the mb info from the vme out */
-                msg = (unsigned int *)(msg_ptr + mb_addr * vme_context->vme_output.size_block);
-
-                inter_rdo = msg[AVC_INTER_RDO_OFFSET] & AVC_RDO_MASK;
-                intra_rdo = msg[AVC_INTRA_RDO_OFFSET] & AVC_RDO_MASK;
-                /*fill to indirect cu */
-                /*to do */
-                if (is_intra || intra_rdo < inter_rdo) {
-                    /* fill intra cu */
-                    tmp_mb_mode = (msg[0] & AVC_INTRA_MODE_MASK) >> 4;
-                    if(max_cu_num_in_mb < 4){
-                        if(tmp_mb_mode == AVC_INTRA_16X16)
-                        {
-                            msg[0] = (msg[0] & !AVC_INTRA_MODE_MASK) | (AVC_INTRA_8X8<<4);
-                            tmp_mb_mode = AVC_INTRA_8X8;
-                        }
-
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        if(--max_cu_num_in_mb > 0)
-                            gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,2);
-
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-                    }
-                    else if(tmp_mb_mode == AVC_INTRA_16X16) {
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                    } else { // for 4x4 to use 8x8 replace
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,1);
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,2);
-                        gen9_hcpe_hevc_fill_indirect_cu_intra(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,3);
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-                    }
-                } else {
-                    msg += AVC_INTER_MSG_OFFSET;
-                    /* fill inter cu */
-                    tmp_mb_mode = msg[0] & AVC_INTER_MODE_MASK;
-                    if(max_cu_num_in_mb < 4)
-                    {
-                        if(tmp_mb_mode != AVC_INTER_8X8)
-                        {
-                            msg[0] = (msg[0] & !AVC_INTER_MODE_MASK) | AVC_INTER_8X8;
-                            tmp_mb_mode = AVC_INTER_8X8;
-                        }
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        if(--max_cu_num_in_mb > 0)
-                            gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,1);
-
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-                    }
-                    else if (tmp_mb_mode == AVC_INTER_8X8){
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,1);
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,2);
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,3);
-                        if(ctb_width_in_mb == 2)
-                            split_coding_unit_flag |= 0x1 << (mb_x + mb_y * ctb_width_in_mb + 16);
-                        else if(ctb_width_in_mb == 1)
-                            split_coding_unit_flag |= 0x1 << 20;
-
-                    }else if(tmp_mb_mode == AVC_INTER_16X16 ||
-                        tmp_mb_mode == AVC_INTER_8X16 ||
-                        tmp_mb_mode == AVC_INTER_16X8) {
-                        gen9_hcpe_hevc_fill_indirect_cu_inter(ctx, encode_state, encoder_context, qp, msg, ctb_x, ctb_y, mb_x, mb_y, ctb_width_in_mb, width_in_ctb, num_cu_record, slice_type,cu_index++,0);
-                    }
-                }
-                mb_addr++;
-            }
-        }
-
-        cu_count = cu_index;
+    cu_params.vme_output = (unsigned char *)vme_context->vme_output.bo->virtual;
+    cu_params.vme_block_size = vme_context->vme_output.size_block;
+    cu_params.cu_records = (unsigned char *)mfc_context->hcp_indirect_cu_object.bo->virtual;
+    cu_params.ref_index_in_mb[0] = vme_context->ref_index_in_mb[0];
+    cu_params.ref_index_in_mb[1] = vme_context->ref_index_in_mb[1];
+    cu_params.pic_width = pSequenceParameter->pic_width_in_luma_samples;
+    cu_params.pic_height = pSequenceParameter->pic_height_in_luma_samples;
+    cu_params.log2_cu_size = log2_cu_size;
+    cu_params.log2_ctb_size = log2_ctb_size;
+    cu_params.qp = qp;
+    cu_params.is_intra = (slice_type == HEVC_SLICE_I);
+
+    /* The CU records of the CTBs are independent, only the PAK objects
+     * need to go into the batch in order */
+    gen9_hcpe_hevc_fill_cu_records(&cu_params,
+                                   pSliceParameter->slice_segment_address,
+                                   num_ctbs, ctb_info, 0);
+
+    for (i = 0; i < num_ctbs; i++) {
+        i_ctb = pSliceParameter->slice_segment_address + i;
         // PAK object fill accordingly.
-        gen9_hcpe_hevc_pak_object(ctx, ctb_x, ctb_y, last_ctb, encoder_context, cu_count, split_coding_unit_flag, slice_batch);
+        gen9_hcpe_hevc_pak_object(ctx, i_ctb % width_in_ctb, i_ctb / width_in_ctb,
+                                  i == num_ctbs - 1, encoder_context,
+                                  ctb_info[i].cu_count,
+                                  ctb_info[i].split_coding_unit_flag,
+                                  slice_batch);
     }
 
     dri_bo_unmap(mfc_context->hcp_indirect_cu_object.bo);
@@ -2520,6 +2509,18 @@ int intel_hcpe_interlace_check(VADriverContextP ctx,
     return 1;
 }
 
+static int intel_hcpe_brc_stats_frame_type(int slice_type)
+{
+    switch (slice_type) {
+    case HEVC_SLICE_I:
+        return INTEL_ENC_STATS_FRAME_I;
+    case HEVC_SLICE_P:
+        return INTEL_ENC_STATS_FRAME_P;
+    default:
+        return INTEL_ENC_STATS_FRAME_B;
+    }
+}
+
 void intel_hcpe_brc_prepare(struct encode_state *encode_state,
                             struct intel_encoder_context *encoder_context)
 {
@@ -2542,6 +2543,23 @@ void intel_hcpe_brc_prepare(struct encode_state *encode_state,
         /*Programing HRD control */
         if ((mfc_context->vui_hrd.i_cpb_size_value == 0) || brc_updated)
             intel_hcpe_hrd_context_init(encode_state, encoder_context);
+
+        /* Second pass of a two-pass encode, the QP comes from the plan */
+        if (encoder_context->stats) {
+            VAEncSliceParameterBufferHEVC *pSliceParameter = (VAEncSliceParameterBufferHEVC *)encode_state->slice_params_ext[0]->buffer;
+            int slice_type = pSliceParameter->slice_type;
+            int qp;
+
+            if (brc_updated || !encoder_context->stats->rate_factor)
+                intel_enc_stats_plan(encoder_context->stats, mfc_context->brc.bits_per_frame);
+
+            if (intel_enc_stats_frame_qp(encoder_context->stats,
+                                         intel_hcpe_brc_stats_frame_type(slice_type),
+                                         1,
+                                         51,
+                                         &qp))
+                mfc_context->bit_rate_control_context[slice_type].QpPrimeY = qp;
+        }
     }
 }
 
@@ -2554,7 +2572,10 @@ gen9_hcpe_hevc_encode_picture(VADriverContextP ctx,
 {
     struct gen9_hcpe_context *hcpe_context = encoder_context->mfc_context;
     unsigned int rate_control_mode = encoder_context->rate_control_mode;
+    VAEncSliceParameterBufferHEVC *pSliceParameter = (VAEncSliceParameterBufferHEVC *)encode_state->slice_params_ext[0]->buffer;
+    int slice_type = pSliceParameter->slice_type;
     int current_frame_bits_size;
+    int qp;
     int sts;
 
     for (;;) {
@@ -2565,7 +2586,13 @@ gen9_hcpe_hevc_encode_picture(VADriverContextP ctx,
         gen9_hcpe_run(ctx, encode_state, encoder_context);
         if (rate_control_mode == VA_RC_CBR /*|| rate_control_mode == VA_RC_VBR*/) {
             gen9_hcpe_stop(ctx, encode_state, encoder_context, &current_frame_bits_size);
+            qp = hcpe_context->bit_rate_control_context[slice_type].QpPrimeY;
             sts = intel_hcpe_brc_postpack(encode_state, hcpe_context, current_frame_bits_size);
+            if (sts != BRC_UNDERFLOW && sts != BRC_OVERFLOW)
+                intel_enc_stats_frame_done(encoder_context->stats,
+                                           intel_hcpe_brc_stats_frame_type(slice_type),
+                                           qp,
+                                           current_frame_bits_size);
             if (sts == BRC_NO_HRD_VIOLATION) {
                 intel_hcpe_hrd_context_update(encode_state, hcpe_context);
                 break;
@@ -2649,6 +2676,7 @@ gen9_hcpe_context_destroy(void *context)
 
     hcpe_context->aux_batchbuffer = NULL;
 
+    free(hcpe_context->ctb_cu_info);
     free(hcpe_context);
 }
 
@@ -80,6 +80,7 @@ gen9_hcpd_init_hevc_surface(VADriverContextP ctx,
         gen9_hevc_surface = calloc(sizeof(GenHevcSurface), 1);
         assert(gen9_hevc_surface);
         gen9_hevc_surface->base.frame_store_id = -1;
+        gen9_hevc_surface->bo_pool = &i965->codec_bo_pool;
         obj_surface->private_data = gen9_hevc_surface;
     }
 
@@ -94,10 +95,10 @@ gen9_hcpd_init_hevc_surface(VADriverContextP ctx,
                 ((gen9_hcpd_context->picture_height_in_pixels + 31) >> 5);
 
         size <<= 6; /* in unit of 64bytes */
-        gen9_hevc_surface->motion_vector_temporal_bo = dri_bo_alloc(i965->intel.bufmgr,
-                                                                    "motion vector temporal buffer",
-                                                                    size,
-                                                                    0x1000);
+        gen9_hevc_surface->motion_vector_temporal_bo = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                                         "motion vector temporal buffer",
+                                                                         size,
+                                                                         0x1000);
     }
 }
 
@@ -339,10 +340,10 @@ gen9_hcpd_pipe_buf_addr_state(VADriverContextP ctx,
 static void
 gen9_hcpd_ind_obj_base_addr_state(VADriverContextP ctx,
                                   dri_bo *slice_data_bo,
+                                  struct intel_batchbuffer *batch,
                                   struct gen9_hcpd_context *gen9_hcpd_context)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
 
     BEGIN_BCS_BATCH(batch, 14);
 
@@ -635,9 +636,9 @@ static void
 gen9_hcpd_ref_idx_state(VADriverContextP ctx,
                         VAPictureParameterBufferHEVC *pic_param,
                         VASliceParameterBufferHEVC *slice_param,
+                        struct intel_batchbuffer *batch,
                         struct gen9_hcpd_context *gen9_hcpd_context)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
 
     if (slice_param->LongSliceFlags.fields.slice_type == HEVC_SLICE_I)
         return;
@@ -695,9 +696,9 @@ static void
 gen9_hcpd_weightoffset_state(VADriverContextP ctx,
                              VAPictureParameterBufferHEVC *pic_param,
                              VASliceParameterBufferHEVC *slice_param,
+                             struct intel_batchbuffer *batch,
                              struct gen9_hcpd_context *gen9_hcpd_context)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
 
     if (slice_param->LongSliceFlags.fields.slice_type == HEVC_SLICE_I)
         return;
@@ -799,9 +800,10 @@ gen9_hcpd_slice_state(VADriverContextP ctx,
                       VAPictureParameterBufferHEVC *pic_param,
                       VASliceParameterBufferHEVC *slice_param,
                       VASliceParameterBufferHEVC *next_slice_param,
+                      int slice_num,
+                      struct intel_batchbuffer *batch,
                       struct gen9_hcpd_context *gen9_hcpd_context)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
     int slice_hor_pos, slice_ver_pos, next_slice_hor_pos, next_slice_ver_pos;
     unsigned short collocated_ref_idx, collocated_from_l0_flag;
     int sliceqp_sign_flag = 0, sliceqp = 0;
@@ -820,16 +822,9 @@ gen9_hcpd_slice_state(VADriverContextP ctx,
     collocated_ref_idx = gen9_hcpd_get_collocated_ref_idx(ctx, pic_param, slice_param, gen9_hcpd_context);
     collocated_from_l0_flag = slice_param->LongSliceFlags.fields.collocated_from_l0_flag;
 
-    if ((!gen9_hcpd_context->first_inter_slice_valid) &&
-        (slice_param->LongSliceFlags.fields.slice_type != HEVC_SLICE_I) &&
-        slice_param->LongSliceFlags.fields.slice_temporal_mvp_enabled_flag) {
-        gen9_hcpd_context->first_inter_slice_collocated_ref_idx = collocated_ref_idx;
-        gen9_hcpd_context->first_inter_slice_collocated_from_l0_flag = collocated_from_l0_flag;
-        gen9_hcpd_context->first_inter_slice_valid = 1;
-    }
-
     /* HW requirement */
     if (gen9_hcpd_context->first_inter_slice_valid &&
+        slice_num > gen9_hcpd_context->first_inter_slice_num &&
         ((slice_param->LongSliceFlags.fields.slice_type == HEVC_SLICE_I) ||
          (!slice_param->LongSliceFlags.fields.slice_temporal_mvp_enabled_flag))) {
         collocated_ref_idx = gen9_hcpd_context->first_inter_slice_collocated_ref_idx;
@@ -896,9 +891,9 @@ gen9_hcpd_slice_state(VADriverContextP ctx,
 static void
 gen9_hcpd_bsd_object(VADriverContextP ctx,
                      VASliceParameterBufferHEVC *slice_param,
+                     struct intel_batchbuffer *batch,
                      struct gen9_hcpd_context *gen9_hcpd_context)
 {
-    struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
 
     BEGIN_BCS_BATCH(batch, 3);
 
@@ -910,6 +905,87 @@ gen9_hcpd_bsd_object(VADriverContextP ctx,
     ADVANCE_BCS_BATCH(batch);
 }
 
+/* Slice states depend on the first inter slice using TMVP, find it
+   upfront so that slices can be emitted in any order */
+static void
+gen9_hcpd_hevc_find_first_inter_slice(VADriverContextP ctx,
+                                      struct decode_state *decode_state,
+                                      VAPictureParameterBufferHEVC *pic_param,
+                                      struct gen9_hcpd_context *gen9_hcpd_context)
+{
+    VASliceParameterBufferHEVC *slice_param;
+    int i, j, slice_num = 0;
+
+    gen9_hcpd_context->first_inter_slice_valid = 0;
+
+    for (j = 0; j < decode_state->num_slice_params; j++) {
+        slice_param = (VASliceParameterBufferHEVC *)decode_state->slice_params[j]->buffer;
+
+        for (i = 0; i < decode_state->slice_params[j]->num_elements; i++, slice_num++, slice_param++) {
+            if (slice_param->LongSliceFlags.fields.slice_type == HEVC_SLICE_I ||
+                !slice_param->LongSliceFlags.fields.slice_temporal_mvp_enabled_flag)
+                continue;
+
+            gen9_hcpd_context->first_inter_slice_collocated_ref_idx =
+                gen9_hcpd_get_collocated_ref_idx(ctx, pic_param, slice_param, gen9_hcpd_context);
+            gen9_hcpd_context->first_inter_slice_collocated_from_l0_flag =
+                slice_param->LongSliceFlags.fields.collocated_from_l0_flag;
+            gen9_hcpd_context->first_inter_slice_num = slice_num;
+            gen9_hcpd_context->first_inter_slice_valid = 1;
+            return;
+        }
+    }
+}
+
+static void
+gen9_hcpd_hevc_emit_slice_group(VADriverContextP ctx,
+                                struct decode_state *decode_state,
+                                struct intel_batchbuffer *batch,
+                                int slice_group,
+                                int slice_index,
+                                int slice_num,
+                                void *hw_context)
+{
+    gen9_hcpd_ind_obj_base_addr_state(ctx, decode_state->slice_datas[slice_group]->bo,
+                                      batch, hw_context);
+}
+
+static void
+gen9_hcpd_hevc_emit_slice(VADriverContextP ctx,
+                          struct decode_state *decode_state,
+                          struct intel_batchbuffer *batch,
+                          int slice_group,
+                          int slice_index,
+                          int slice_num,
+                          void *hw_context)
+{
+    struct gen9_hcpd_context *gen9_hcpd_context = hw_context;
+    VAPictureParameterBufferHEVC *pic_param;
+    VASliceParameterBufferHEVC *slice_param, *next_slice_param;
+
+    assert(decode_state->slice_params && decode_state->slice_params[slice_group]->buffer);
+    pic_param = (VAPictureParameterBufferHEVC *)decode_state->pic_param->buffer;
+    slice_param = (VASliceParameterBufferHEVC *)decode_state->slice_params[slice_group]->buffer + slice_index;
+
+    if (slice_index < decode_state->slice_params[slice_group]->num_elements - 1)
+        next_slice_param = slice_param + 1;
+    else if (slice_group < decode_state->num_slice_params - 1)
+        next_slice_param = (VASliceParameterBufferHEVC *)decode_state->slice_params[slice_group + 1]->buffer;
+    else
+        next_slice_param = NULL;
+
+    gen9_hcpd_slice_state(ctx, pic_param, slice_param, next_slice_param, slice_num, batch, gen9_hcpd_context);
+    gen9_hcpd_ref_idx_state(ctx, pic_param, slice_param, batch, gen9_hcpd_context);
+    gen9_hcpd_weightoffset_state(ctx, pic_param, slice_param, batch, gen9_hcpd_context);
+    gen9_hcpd_bsd_object(ctx, slice_param, batch, gen9_hcpd_context);
+}
+
+static const struct intel_decoder_slice_emitter gen9_hcpd_hevc_slice_emitter = {
+    .emit_slice_group = gen9_hcpd_hevc_emit_slice_group,
+    .emit_slice = gen9_hcpd_hevc_emit_slice,
+    .max_slice_size = 0x400,
+};
+
 static VAStatus
 gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
                               struct decode_state *decode_state,
@@ -919,9 +995,6 @@ gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = gen9_hcpd_context->base.batch;
     VAPictureParameterBufferHEVC *pic_param;
-    VASliceParameterBufferHEVC *slice_param, *next_slice_param, *next_slice_group_param;
-    dri_bo *slice_data_bo;
-    int i, j;
 
     vaStatus = gen9_hcpd_hevc_decode_init(ctx, decode_state, gen9_hcpd_context);
 
@@ -930,6 +1003,7 @@ gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
 
     assert(decode_state->pic_param && decode_state->pic_param->buffer);
     pic_param = (VAPictureParameterBufferHEVC *)decode_state->pic_param->buffer;
+    gen9_hcpd_hevc_find_first_inter_slice(ctx, decode_state, pic_param, gen9_hcpd_context);
 
     if (i965->intel.has_bsd2)
         intel_batchbuffer_start_atomic_bcs_override(batch, 0x1000, BSD_RING0);
@@ -947,31 +1021,8 @@ gen9_hcpd_hevc_decode_picture(VADriverContextP ctx,
         gen9_hcpd_tile_state(ctx, decode_state, gen9_hcpd_context);
 
     /* Need to double it works or not if the two slice groups have differenct slice data buffers */
-    for (j = 0; j < decode_state->num_slice_params; j++) {
-        assert(decode_state->slice_params && decode_state->slice_params[j]->buffer);
-        slice_param = (VASliceParameterBufferHEVC *)decode_state->slice_params[j]->buffer;
-        slice_data_bo = decode_state->slice_datas[j]->bo;
-
-        gen9_hcpd_ind_obj_base_addr_state(ctx, slice_data_bo, gen9_hcpd_context);
-
-        if (j == decode_state->num_slice_params - 1)
-            next_slice_group_param = NULL;
-        else
-            next_slice_group_param = (VASliceParameterBufferHEVC *)decode_state->slice_params[j + 1]->buffer;
-
-        for (i = 0; i < decode_state->slice_params[j]->num_elements; i++) {
-            if (i < decode_state->slice_params[j]->num_elements - 1)
-                next_slice_param = slice_param + 1;
-            else
-                next_slice_param = next_slice_group_param;
-
-            gen9_hcpd_slice_state(ctx, pic_param, slice_param, next_slice_param, gen9_hcpd_context);
-            gen9_hcpd_ref_idx_state(ctx, pic_param, slice_param, gen9_hcpd_context);
-            gen9_hcpd_weightoffset_state(ctx, pic_param, slice_param, gen9_hcpd_context);
-            gen9_hcpd_bsd_object(ctx, slice_param, gen9_hcpd_context);
-            slice_param++;
-        }
-    }
+    intel_decoder_emit_slices(ctx, decode_state, batch,
+                              &gen9_hcpd_hevc_slice_emitter, gen9_hcpd_context);
 
     intel_batchbuffer_end_atomic(batch);
     intel_batchbuffer_flush(batch);
@@ -1784,7 +1835,7 @@ gen9_hcpd_vp9_decode_picture(VADriverContextP ctx,
     //Only one VASliceParameterBufferVP9 should be sent per frame
     slice_data_bo = decode_state->slice_datas[0]->bo;
 
-    gen9_hcpd_ind_obj_base_addr_state(ctx, slice_data_bo, gen9_hcpd_context);
+    gen9_hcpd_ind_obj_base_addr_state(ctx, slice_data_bo, batch, gen9_hcpd_context);
 
     gen9_hcpd_vp9_pipe_buf_addr_state(ctx, decode_state, gen9_hcpd_context);
     //If segmentation is disabled, only SegParam[0] is valid,
@@ -96,6 +96,7 @@ struct gen9_hcpd_context
     unsigned short first_inter_slice_collocated_ref_idx;
     unsigned short first_inter_slice_collocated_from_l0_flag;
     int first_inter_slice_valid;
+    int first_inter_slice_num;
 
     vp9_last_frame_status last_frame;
     FRAME_CONTEXT vp9_frame_ctx[FRAME_CONTEXTS];
@@ -840,6 +840,125 @@ map_44_lut_value(unsigned int v, unsigned char max)
     return ret;
 }
 
+/*
+ * Each temporal layer gets the bit rate and the frame rate it adds to the
+ * layers below, and a share of the HRD buffer in proportion of its bit rate
+ */
+void
+gen9_vdenc_update_brc_layers(VADriverContextP ctx,
+                             struct intel_encoder_context *encoder_context)
+{
+    struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
+    unsigned int num_layers = MAX(encoder_context->layer.num_layers, 1);
+    unsigned int top_bits_per_second = encoder_context->brc.bits_per_second[num_layers - 1];
+    struct intel_fraction top_framerate = encoder_context->brc.framerate[num_layers - 1];
+    unsigned int i;
+
+    if (vdenc_context->num_layers != num_layers) {
+        memset(vdenc_context->layer, 0, sizeof(vdenc_context->layer));
+        vdenc_context->num_layers = num_layers;
+    }
+
+    for (i = 0; i < num_layers; i++) {
+        struct gen9_vdenc_brc_layer *layer = &vdenc_context->layer[i];
+        unsigned int bits_per_second = encoder_context->brc.bits_per_second[i];
+        struct intel_fraction framerate = encoder_context->brc.framerate[i];
+        double share = 1.0;
+
+        if (i > 0) {
+            struct intel_fraction lower = encoder_context->brc.framerate[i - 1];
+            uint64_t num = (uint64_t)framerate.num * lower.den;
+            uint64_t lower_num = (uint64_t)lower.num * framerate.den;
+
+            /* Increasing rates are enforced by intel_encoder_check_temporal_layer_structure() */
+            assert(bits_per_second > encoder_context->brc.bits_per_second[i - 1]);
+            bits_per_second -= encoder_context->brc.bits_per_second[i - 1];
+
+            if (num > lower_num)
+                framerate = (struct intel_fraction) { num - lower_num, framerate.den * lower.den };
+            else
+                framerate = (struct intel_fraction) { 0, 1 };
+        }
+
+        if (num_layers > 1 && top_bits_per_second)
+            share = (double)bits_per_second / top_bits_per_second;
+
+        layer->framerate = framerate;
+        layer->vbv_buffer_size_in_bit = (uint64_t)(encoder_context->brc.hrd_buffer_size * share);
+        layer->init_vbv_buffer_fullness_in_bit = (uint64_t)(encoder_context->brc.hrd_initial_buffer_fullness * share);
+        layer->gop_size = encoder_context->brc.gop_size;
+
+        if (num_layers > 1 && framerate.den && top_framerate.num) {
+            layer->gop_size = (uint32_t)((double)encoder_context->brc.gop_size * framerate.num * top_framerate.den /
+                                         ((double)framerate.den * top_framerate.num) + 0.5);
+            layer->gop_size = MAX(layer->gop_size, 1);
+        }
+
+        layer->max_bit_rate = ALIGN(bits_per_second, 1000) / 1000;
+
+        if (vdenc_context->internal_rate_mode == I965_BRC_CBR) {
+            layer->min_bit_rate = layer->max_bit_rate;
+            layer->target_bit_rate = layer->max_bit_rate;
+        } else {
+            assert(vdenc_context->internal_rate_mode == I965_BRC_VBR);
+            layer->min_bit_rate = layer->max_bit_rate * (2 * encoder_context->brc.target_percentage[i] - 100) / 100;
+            layer->target_bit_rate = layer->max_bit_rate * encoder_context->brc.target_percentage[i] / 100;
+        }
+
+        layer->brc_need_reset = layer->brc_initted;
+    }
+}
+
+/* Load the BRC instance of the layer the current frame belongs to */
+static void
+gen9_vdenc_select_brc_layer(VADriverContextP ctx,
+                            struct intel_encoder_context *encoder_context)
+{
+    struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
+    struct gen9_vdenc_brc_layer *layer;
+
+    vdenc_context->curr_layer = 0;
+
+    if (vdenc_context->num_layers > 1 &&
+        encoder_context->layer.curr_frame_layer_id < vdenc_context->num_layers)
+        vdenc_context->curr_layer = encoder_context->layer.curr_frame_layer_id;
+
+    layer = &vdenc_context->layer[vdenc_context->curr_layer];
+
+    vdenc_context->target_bit_rate = layer->target_bit_rate;
+    vdenc_context->max_bit_rate = layer->max_bit_rate;
+    vdenc_context->min_bit_rate = layer->min_bit_rate;
+    vdenc_context->init_vbv_buffer_fullness_in_bit = layer->init_vbv_buffer_fullness_in_bit;
+    vdenc_context->vbv_buffer_size_in_bit = layer->vbv_buffer_size_in_bit;
+    vdenc_context->framerate = layer->framerate;
+
+    if (vdenc_context->num_layers > 1)
+        vdenc_context->gop_size = layer->gop_size;
+
+    vdenc_context->brc_target_size = layer->brc_target_size;
+    vdenc_context->brc_init_current_target_buf_full_in_bits = layer->brc_init_current_target_buf_full_in_bits;
+    vdenc_context->brc_init_reset_input_bits_per_frame = layer->brc_init_reset_input_bits_per_frame;
+    vdenc_context->brc_init_previous_target_buf_full_in_bits = layer->brc_init_previous_target_buf_full_in_bits;
+    vdenc_context->brc_initted = layer->brc_initted;
+    vdenc_context->brc_need_reset = layer->brc_need_reset;
+}
+
+/* Keep the state of the BRC instance until the next frame of the layer */
+static void
+gen9_vdenc_save_brc_layer(VADriverContextP ctx,
+                          struct intel_encoder_context *encoder_context)
+{
+    struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
+    struct gen9_vdenc_brc_layer *layer = &vdenc_context->layer[vdenc_context->curr_layer];
+
+    layer->brc_target_size = vdenc_context->brc_target_size;
+    layer->brc_init_current_target_buf_full_in_bits = vdenc_context->brc_init_current_target_buf_full_in_bits;
+    layer->brc_init_reset_input_bits_per_frame = vdenc_context->brc_init_reset_input_bits_per_frame;
+    layer->brc_init_previous_target_buf_full_in_bits = vdenc_context->brc_init_previous_target_buf_full_in_bits;
+    layer->brc_initted = vdenc_context->brc_initted;
+    layer->brc_need_reset = vdenc_context->brc_need_reset;
+}
+
 static void
 gen9_vdenc_update_misc_parameters(VADriverContextP ctx,
                                   struct encode_state *encode_state,
@@ -853,26 +972,12 @@ gen9_vdenc_update_misc_parameters(VADriverContextP ctx,
 
     if (vdenc_context->internal_rate_mode != I965_BRC_CQP &&
         encoder_context->brc.need_reset) {
-        /* So far, vdenc doesn't support temporal layer */
-        vdenc_context->framerate = encoder_context->brc.framerate[0];
-
-        vdenc_context->vbv_buffer_size_in_bit = encoder_context->brc.hrd_buffer_size;
-        vdenc_context->init_vbv_buffer_fullness_in_bit = encoder_context->brc.hrd_initial_buffer_fullness;
-
-        vdenc_context->max_bit_rate = ALIGN(encoder_context->brc.bits_per_second[0], 1000) / 1000;
         vdenc_context->mb_brc_enabled = encoder_context->brc.mb_rate_control[0];
-        vdenc_context->brc_need_reset = (vdenc_context->brc_initted && encoder_context->brc.need_reset);
-
-        if (vdenc_context->internal_rate_mode == I965_BRC_CBR) {
-            vdenc_context->min_bit_rate = vdenc_context->max_bit_rate;
-            vdenc_context->target_bit_rate = vdenc_context->max_bit_rate;
-        } else {
-            assert(vdenc_context->internal_rate_mode == I965_BRC_VBR);
-            vdenc_context->min_bit_rate = vdenc_context->max_bit_rate * (2 * encoder_context->brc.target_percentage[0] - 100) / 100;
-            vdenc_context->target_bit_rate = vdenc_context->max_bit_rate * encoder_context->brc.target_percentage[0] / 100;
-        }
+        gen9_vdenc_update_brc_layers(ctx, encoder_context);
     }
 
+    gen9_vdenc_select_brc_layer(ctx, encoder_context);
+
     vdenc_context->mb_brc_enabled = 1;
     vdenc_context->num_roi = MIN(encoder_context->brc.num_roi, 3);
     vdenc_context->max_delta_qp = encoder_context->brc.roi_max_delta_qp;
@@ -883,7 +988,7 @@ gen9_vdenc_update_misc_parameters(VADriverContextP ctx,
         vdenc_context->roi[i].left = encoder_context->brc.roi[i].left >> 4;
         vdenc_context->roi[i].right = encoder_context->brc.roi[i].right >> 4;
         vdenc_context->roi[i].top = encoder_context->brc.roi[i].top >> 4;
-        vdenc_context->roi[i].bottom = encoder_context->brc.roi[i].top >> 4;
+        vdenc_context->roi[i].bottom = encoder_context->brc.roi[i].bottom >> 4;
         vdenc_context->roi[i].value = encoder_context->brc.roi[i].value;
     }
 }
@@ -1766,7 +1871,7 @@ gen9_vdenc_huc_brc_init_reset(VADriverContextP ctx,
     gen9_vdenc_huc_dmem_state(ctx, encoder_context, &dmem_state_params);
 
     memset(&virtual_addr_params, 0, sizeof(virtual_addr_params));
-    virtual_addr_params.regions[0].huc_surface_res = &vdenc_context->brc_history_buffer_res;
+    virtual_addr_params.regions[0].huc_surface_res = &vdenc_context->brc_history_buffer_res[vdenc_context->curr_layer];
     virtual_addr_params.regions[0].is_target = 1;
     gen9_vdenc_huc_virtual_addr_state(ctx, encoder_context, &virtual_addr_params);
 
@@ -2135,11 +2240,16 @@ gen9_vdenc_init_img_states(VADriverContextP ctx,
                            struct encode_state *encode_state,
                            struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
     struct gen9_mfx_avc_img_state *mfx_img_cmd;
     struct gen9_vdenc_img_state *vdenc_img_cmd;
     char *pbuffer;
 
+    /* Rewritten in full, so don't wait for the previous frame to retire */
+    i965_renew_gpe_resource(i965->intel.bufmgr,
+                            &vdenc_context->vdenc_avc_image_state_res,
+                            "VDENC/AVC image state buffer");
     pbuffer = i965_map_gpe_resource(&vdenc_context->vdenc_avc_image_state_res);
 
     if (!pbuffer)
@@ -2164,9 +2274,13 @@ gen9_vdenc_huc_brc_update_constant_data(VADriverContextP ctx,
                                         struct encode_state *encode_state,
                                         struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen9_vdenc_context *vdenc_context = encoder_context->mfc_context;
     struct huc_brc_update_constant_data *brc_buffer;
 
+    i965_renew_gpe_resource(i965->intel.bufmgr,
+                            &vdenc_context->brc_constant_data_res,
+                            "BRC constant buffer");
     brc_buffer = (struct huc_brc_update_constant_data *)
         i965_map_gpe_resource(&vdenc_context->brc_constant_data_res);
 
@@ -2237,10 +2351,10 @@ gen9_vdenc_huc_brc_update(VADriverContextP ctx,
 
     gen9_vdenc_huc_brc_update_constant_data(ctx, encode_state, encoder_context);
     memset(&virtual_addr_params, 0, sizeof(virtual_addr_params));
-    virtual_addr_params.regions[0].huc_surface_res = &vdenc_context->brc_history_buffer_res;
+    virtual_addr_params.regions[0].huc_surface_res = &vdenc_context->brc_history_buffer_res[vdenc_context->curr_layer];
     virtual_addr_params.regions[0].is_target = 1;
-    virtual_addr_params.regions[1].huc_surface_res = &vdenc_context->vdenc_statistics_res;
-    virtual_addr_params.regions[2].huc_surface_res = &vdenc_context->pak_statistics_res;
+    virtual_addr_params.regions[1].huc_surface_res = &vdenc_context->vdenc_statistics_res[vdenc_context->curr_layer];
+    virtual_addr_params.regions[2].huc_surface_res = &vdenc_context->pak_statistics_res[vdenc_context->curr_layer];
     virtual_addr_params.regions[3].huc_surface_res = &vdenc_context->vdenc_avc_image_state_res;
     virtual_addr_params.regions[4].huc_surface_res = &vdenc_context->hme_detection_summary_buffer_res;
     virtual_addr_params.regions[4].is_target = 1;
@@ -2371,7 +2485,7 @@ gen9_vdenc_mfx_pipe_buf_addr_state(VADriverContextP ctx, struct intel_encoder_co
     OUT_BUFFER_3DW(batch, vdenc_context->uncompressed_input_surface_res.bo, 0, 0, 0);
 
     /* the DW10-12 is for PAK information (write) */
-    OUT_BUFFER_3DW(batch, vdenc_context->pak_statistics_res.bo, 1, 0, 0);
+    OUT_BUFFER_3DW(batch, vdenc_context->pak_statistics_res[vdenc_context->curr_layer].bo, 1, 0, 0);
 
     /* the DW13-15 is for the intra_row_store_scratch */
     OUT_BUFFER_3DW(batch, vdenc_context->mfx_intra_row_store_scratch_res.bo, 1, 0, 0);
@@ -2388,7 +2502,7 @@ gen9_vdenc_mfx_pipe_buf_addr_state(VADriverContextP ctx, struct intel_encoder_co
     OUT_BCS_BATCH(batch, i965->intel.mocs_state);
 
     /* The DW 52-54 is for PAK information (read) */
-    OUT_BUFFER_3DW(batch, vdenc_context->pak_statistics_res.bo, 0, 0, 0);
+    OUT_BUFFER_3DW(batch, vdenc_context->pak_statistics_res[vdenc_context->curr_layer].bo, 0, 0, 0);
 
     /* the DW 55-57 is the ILDB buffer */
     OUT_BUFFER_3DW(batch, NULL, 0, 0, 0);
@@ -2704,7 +2818,7 @@ gen9_vdenc_vdenc_pipe_buf_addr_state(VADriverContextP ctx,
     OUT_BUFFER_3DW(batch, NULL, 0, 0, 0);
 
     /* DW34-DW36 for VDEnc statistics streamout */
-    OUT_BUFFER_3DW(batch, vdenc_context->vdenc_statistics_res.bo, 1, 0, 0);
+    OUT_BUFFER_3DW(batch, vdenc_context->vdenc_statistics_res[vdenc_context->curr_layer].bo, 1, 0, 0);
 
     ADVANCE_BCS_BATCH(batch);
 }
@@ -3721,6 +3835,8 @@ gen9_vdenc_avc_encode_picture(VADriverContextP ctx,
         vdenc_context->brc_need_reset = 0;
     }
 
+    gen9_vdenc_save_brc_layer(ctx, encoder_context);
+
     return VA_STATUS_SUCCESS;
 }
 
@@ -3753,7 +3869,13 @@ gen9_vdenc_free_resources(struct gen9_vdenc_context *vdenc_context)
     int i;
 
     i965_free_gpe_resource(&vdenc_context->brc_init_reset_dmem_res);
-    i965_free_gpe_resource(&vdenc_context->brc_history_buffer_res);
+
+    for (i = 0; i < MAX_TEMPORAL_LAYERS; i++) {
+        i965_free_gpe_resource(&vdenc_context->brc_history_buffer_res[i]);
+        i965_free_gpe_resource(&vdenc_context->vdenc_statistics_res[i]);
+        i965_free_gpe_resource(&vdenc_context->pak_statistics_res[i]);
+    }
+
     i965_free_gpe_resource(&vdenc_context->brc_stream_in_res);
     i965_free_gpe_resource(&vdenc_context->brc_stream_out_res);
     i965_free_gpe_resource(&vdenc_context->huc_dummy_res);
@@ -3761,8 +3883,6 @@ gen9_vdenc_free_resources(struct gen9_vdenc_context *vdenc_context)
     for (i = 0; i < NUM_OF_BRC_PAK_PASSES; i++)
         i965_free_gpe_resource(&vdenc_context->brc_update_dmem_res[i]);
 
-    i965_free_gpe_resource(&vdenc_context->vdenc_statistics_res);
-    i965_free_gpe_resource(&vdenc_context->pak_statistics_res);
     i965_free_gpe_resource(&vdenc_context->vdenc_avc_image_state_res);
     i965_free_gpe_resource(&vdenc_context->hme_detection_summary_buffer_res);
     i965_free_gpe_resource(&vdenc_context->brc_constant_data_res);
@@ -3815,9 +3935,19 @@ gen9_vdenc_allocate_resources(VADriverContextP ctx,
                                 ALIGN(sizeof(struct huc_brc_init_dmem), 64),
                                 "HuC Init&Reset DMEM buffer");
 
-    ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->brc_history_buffer_res,
-                                ALIGN(HUC_BRC_HISTORY_BUFFER_SIZE, 0x1000),
-                                "HuC History buffer");
+    for (i = 0; i < MAX_TEMPORAL_LAYERS; i++) {
+        ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->brc_history_buffer_res[i],
+                                    ALIGN(HUC_BRC_HISTORY_BUFFER_SIZE, 0x1000),
+                                    "HuC History buffer");
+
+        ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->vdenc_statistics_res[i],
+                                    ALIGN(VDENC_STATISTICS_SIZE, 0x1000),
+                                    "VDENC statistics buffer");
+
+        ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->pak_statistics_res[i],
+                                    ALIGN(PAK_STATISTICS_SIZE, 0x1000),
+                                    "PAK statistics buffer");
+    }
 
     ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->brc_stream_in_res,
                                 ALIGN(HUC_BRC_STREAM_INOUT_BUFFER_SIZE, 0x1000),
@@ -3838,14 +3968,6 @@ gen9_vdenc_allocate_resources(VADriverContextP ctx,
         i965_zero_gpe_resource(&vdenc_context->brc_update_dmem_res[i]);
     }
 
-    ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->vdenc_statistics_res,
-                                ALIGN(VDENC_STATISTICS_SIZE, 0x1000),
-                                "VDENC statistics buffer");
-
-    ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->pak_statistics_res,
-                                ALIGN(PAK_STATISTICS_SIZE, 0x1000),
-                                "PAK statistics buffer");
-
     ALLOC_VDENC_BUFFER_RESOURCE(vdenc_context->vdenc_avc_image_state_res,
                                 ALIGN(VDENC_AVC_IMAGE_STATE_SIZE, 0x1000),
                                 "VDENC/AVC image state buffer");
@@ -726,6 +726,30 @@ struct gen9_vdenc_status
     uint32_t    bytes_per_frame;
 };
 
+/*
+ * The HuC BRC runs one instance per temporal layer, each with the bit rate,
+ * frame rate and share of the HRD buffer of its layer. The state of the
+ * instance is kept here while the frames of the other layers are encoded.
+ */
+struct gen9_vdenc_brc_layer
+{
+    uint32_t    target_bit_rate;        /* in kbps */
+    uint32_t    max_bit_rate;           /* in kbps */
+    uint32_t    min_bit_rate;           /* in kbps */
+    uint64_t    init_vbv_buffer_fullness_in_bit;
+    uint64_t    vbv_buffer_size_in_bit;
+    struct intel_fraction framerate;
+    uint32_t    gop_size;
+
+    uint32_t    brc_target_size;
+    double      brc_init_current_target_buf_full_in_bits;
+    double      brc_init_reset_input_bits_per_frame;
+    uint32_t    brc_init_previous_target_buf_full_in_bits;
+
+    uint32_t    brc_initted:1;
+    uint32_t    brc_need_reset:1;
+};
+
 struct gen9_vdenc_context
 {
     uint32_t    frame_width_in_mbs;
@@ -760,6 +784,10 @@ struct gen9_vdenc_context
     uint32_t    min_delta_qp;
     struct intel_roi roi[3];
 
+    uint32_t    num_layers;
+    uint32_t    curr_layer;
+    struct gen9_vdenc_brc_layer layer[MAX_TEMPORAL_LAYERS];
+
     uint32_t    brc_initted:1;
     uint32_t    brc_need_reset:1;
     uint32_t    is_low_delay:1;
@@ -782,14 +810,14 @@ struct gen9_vdenc_context
     uint32_t    pad0:29;
 
     struct i965_gpe_resource brc_init_reset_dmem_res;
-    struct i965_gpe_resource brc_history_buffer_res;
+    struct i965_gpe_resource brc_history_buffer_res[MAX_TEMPORAL_LAYERS];
     struct i965_gpe_resource brc_stream_in_res;
     struct i965_gpe_resource brc_stream_out_res;
     struct i965_gpe_resource huc_dummy_res;
 
     struct i965_gpe_resource brc_update_dmem_res[NUM_OF_BRC_PAK_PASSES];
-    struct i965_gpe_resource vdenc_statistics_res;
-    struct i965_gpe_resource pak_statistics_res;
+    struct i965_gpe_resource vdenc_statistics_res[MAX_TEMPORAL_LAYERS];
+    struct i965_gpe_resource pak_statistics_res[MAX_TEMPORAL_LAYERS];
     struct i965_gpe_resource vdenc_avc_image_state_res;
     struct i965_gpe_resource hme_detection_summary_buffer_res;
     struct i965_gpe_resource brc_constant_data_res;
@@ -905,4 +933,7 @@ struct vd_pipeline_flush_parameter
 extern Bool
 gen9_vdenc_context_init(VADriverContextP ctx, struct intel_encoder_context *encoder_context);
 
+extern void
+gen9_vdenc_update_brc_layers(VADriverContextP ctx, struct intel_encoder_context *encoder_context);
+
 #endif	/* GEN9_VDENC_H */
@@ -297,16 +297,9 @@ gen9_vme_output_vme_batchbuffer_setup(VADriverContextP ctx,
                                       int width_in_mbs,
                                       int height_in_mbs)
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
 
-    vme_context->vme_batchbuffer.num_blocks = width_in_mbs * height_in_mbs + 1;
-    vme_context->vme_batchbuffer.size_block = 64; /* 4 OWORDs */
-    vme_context->vme_batchbuffer.pitch = 16;
-    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                                   "VME batchbuffer",
-                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
-                                                   0x1000);
+    intel_vme_batchbuffer_setup(ctx, vme_context, width_in_mbs, height_in_mbs);
     vme_context->vme_buffer_suface_setup(ctx,
                                          &vme_context->gpe_context,
                                          &vme_context->vme_batchbuffer,
@@ -459,6 +452,24 @@ static VAStatus gen9_vme_constant_setup(VADriverContextP ctx,
 #define		MB_SCOREBOARD_B		(1 << 1)
 #define		MB_SCOREBOARD_C		(1 << 2)
 
+static void
+gen9_vme_batch_key_init(struct intel_vme_batch_key *key,
+                        struct intel_encoder_context *encoder_context,
+                        int walker,
+                        int mb_width, int mb_height,
+                        int kernel,
+                        int transform_8x8_mode_flag)
+{
+    memset(key, 0, sizeof(*key));
+    key->codec = encoder_context->codec;
+    key->walker = walker;
+    key->mb_width = mb_width;
+    key->mb_height = mb_height;
+    key->mbs_per_unit = 1;
+    key->kernel = kernel;
+    key->flags = transform_8x8_mode_flag;
+}
+
 /* check whether the mb of (x_index, y_index) is out of bound */
 static inline int loop_in_bounds(int x_index, int y_index, int first_mb, int num_mb, int mb_width, int mb_height)
 {
@@ -486,9 +497,15 @@ gen9wa_vme_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_row;
     int s;
     unsigned int *command_ptr;
+    struct intel_vme_batch_key key;
 
 #define		USE_SCOREBOARD		(1 << 21)
 
+    gen9_vme_batch_key_init(&key, encoder_context, 1, mb_width, mb_height,
+                            kernel, transform_8x8_mode_flag);
+    if (intel_vme_batchbuffer_reusable(ctx, vme_context, encode_state, &key))
+        return;
+
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -615,6 +632,7 @@ gen9_vme_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_x = 0, mb_y = 0;
     int i, s;
     unsigned int *command_ptr;
+    struct intel_vme_batch_key key;
     struct gen6_mfc_context *mfc_context = encoder_context->mfc_context;
     VAEncPictureParameterBufferH264 *pic_param = (VAEncPictureParameterBufferH264 *)encode_state->pic_param_ext->buffer;
     VAEncSliceParameterBufferH264 *slice_param = (VAEncSliceParameterBufferH264 *)encode_state->slice_params_ext[0]->buffer;
@@ -627,6 +645,15 @@ gen9_vme_fill_vme_batchbuffer(VADriverContextP ctx,
     else
         qp = mfc_context->brc.qp_prime_y[encoder_context->layer.curr_frame_layer_id][slice_type];
 
+    gen9_vme_batch_key_init(&key, encoder_context, 0, mb_width, mb_height,
+                            kernel, transform_8x8_mode_flag);
+    key.qp = qp;
+    key.quality_level = encoder_context->quality_level;
+    /* Per MB QPs are not part of the key */
+    if (intel_vme_batchbuffer_reusable(ctx, vme_context, encode_state,
+                                       vme_context->roi_enabled ? NULL : &key))
+        return;
+
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -703,8 +730,7 @@ static void gen9_vme_media_init(VADriverContextP ctx, struct intel_encoder_conte
     dri_bo_unreference(vme_context->vme_output.bo);
     vme_context->vme_output.bo = NULL;
 
-    dri_bo_unreference(vme_context->vme_batchbuffer.bo);
-    vme_context->vme_batchbuffer.bo = NULL;
+    /* The VME batch is kept, see intel_vme_batchbuffer_reusable() */
 
     /* VME state */
     dri_bo_unreference(vme_context->vme_state.bo);
@@ -917,9 +943,15 @@ gen9wa_vme_mpeg2_walker_fill_vme_batchbuffer(VADriverContextP ctx,
 {
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     unsigned int *command_ptr;
+    struct intel_vme_batch_key key;
 
 #define		MPEG2_SCOREBOARD		(1 << 21)
 
+    gen9_vme_batch_key_init(&key, encoder_context, 1, mb_width, mb_height,
+                            kernel, 0);
+    if (intel_vme_batchbuffer_reusable(ctx, vme_context, encode_state, &key))
+        return;
+
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1048,7 +1080,13 @@ gen9_vme_mpeg2_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_x = 0, mb_y = 0;
     int i, s, j;
     unsigned int *command_ptr;
+    struct intel_vme_batch_key key;
+
 
+    gen9_vme_batch_key_init(&key, encoder_context, 0, mb_width, mb_height,
+                            kernel, transform_8x8_mode_flag);
+    if (intel_vme_batchbuffer_reusable(ctx, vme_context, encode_state, &key))
+        return;
 
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
@@ -1400,19 +1438,12 @@ gen9_vme_hevc_output_vme_batchbuffer_setup(VADriverContextP ctx,
                                       struct intel_encoder_context *encoder_context)
 
 {
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen6_vme_context *vme_context = encoder_context->vme_context;
     VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
     int width_in_mbs = (pSequenceParameter->pic_width_in_luma_samples + 15)/16;
     int height_in_mbs = (pSequenceParameter->pic_height_in_luma_samples + 15)/16;
 
-    vme_context->vme_batchbuffer.num_blocks = width_in_mbs * height_in_mbs + 1;
-    vme_context->vme_batchbuffer.size_block = 64; /* 4 OWORDs */
-    vme_context->vme_batchbuffer.pitch = 16;
-    vme_context->vme_batchbuffer.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                                   "VME batchbuffer",
-                                                   vme_context->vme_batchbuffer.num_blocks * vme_context->vme_batchbuffer.size_block,
-                                                   0x1000);
+    intel_vme_batchbuffer_setup(ctx, vme_context, width_in_mbs, height_in_mbs);
 }
 static VAStatus
 gen9_vme_hevc_surface_setup(VADriverContextP ctx,
@@ -1470,6 +1501,7 @@ gen9wa_vme_hevc_walker_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_row;
     int s;
     unsigned int *command_ptr;
+    struct intel_vme_batch_key key;
     VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
     int log2_cu_size = pSequenceParameter->log2_min_luma_coding_block_size_minus3 + 3;
     int log2_ctb_size = pSequenceParameter->log2_diff_max_min_luma_coding_block_size + log2_cu_size;
@@ -1479,6 +1511,12 @@ gen9wa_vme_hevc_walker_fill_vme_batchbuffer(VADriverContextP ctx,
 
 #define		USE_SCOREBOARD		(1 << 21)
 
+    gen9_vme_batch_key_init(&key, encoder_context, 1, mb_width, mb_height,
+                            kernel, transform_8x8_mode_flag);
+    key.mbs_per_unit = num_mb_in_ctb;
+    if (intel_vme_batchbuffer_reusable(ctx, vme_context, encode_state, &key))
+        return;
+
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1606,6 +1644,7 @@ gen9_vme_hevc_fill_vme_batchbuffer(VADriverContextP ctx,
     int mb_x = 0, mb_y = 0;
     int i, s;
     unsigned int *command_ptr;
+    struct intel_vme_batch_key key;
     VAEncSequenceParameterBufferHEVC *pSequenceParameter = (VAEncSequenceParameterBufferHEVC *)encode_state->seq_param_ext->buffer;
     int log2_cu_size = pSequenceParameter->log2_min_luma_coding_block_size_minus3 + 3;
     int log2_ctb_size = pSequenceParameter->log2_diff_max_min_luma_coding_block_size + log2_cu_size;
@@ -1614,6 +1653,12 @@ gen9_vme_hevc_fill_vme_batchbuffer(VADriverContextP ctx,
     int num_mb_in_ctb = (ctb_size + 15)/16;
     num_mb_in_ctb = num_mb_in_ctb * num_mb_in_ctb;
 
+    gen9_vme_batch_key_init(&key, encoder_context, 0, mb_width, mb_height,
+                            kernel, transform_8x8_mode_flag);
+    key.mbs_per_unit = num_mb_in_ctb;
+    if (intel_vme_batchbuffer_reusable(ctx, vme_context, encode_state, &key))
+        return;
+
     dri_bo_map(vme_context->vme_batchbuffer.bo, 1);
     command_ptr = vme_context->vme_batchbuffer.bo->virtual;
 
@@ -1955,8 +2000,7 @@ gen9_vme_context_destroy(void *context)
     dri_bo_unreference(vme_context->vme_state.bo);
     vme_context->vme_state.bo = NULL;
 
-    dri_bo_unreference(vme_context->vme_batchbuffer.bo);
-    vme_context->vme_batchbuffer.bo = NULL;
+    intel_vme_batchbuffer_destroy(vme_context);
 
     free(vme_context->vme_state_message);
     vme_context->vme_state_message = NULL;
@@ -40,6 +40,7 @@
 #include "i965_defines.h"
 #include "i965_drv_video.h"
 #include "i965_encoder.h"
+#include "i965_encoder_analysis.h"
 #include "gen9_vp9_encapi.h"
 #include "gen9_vp9_encoder.h"
 #include "gen9_vp9_encoder_kernels.h"
@@ -420,18 +421,36 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
         return VA_STATUS_ERROR_INVALID_PARAMETER;
 
     /* the buffer related with BRC is not changed. So it is allocated
-     * based on the input parameter
+     * based on the input parameter. The BRC kernel buffers are only
+     * needed when BRC is in use.
      */
     if (allocate) {
+        i965_free_gpe_resource(&vme_context->res_pic_state_brc_write_hfw_read_buffer);
+        i965_free_gpe_resource(&vme_context->res_brc_bitstream_size_buffer);
+
+        res_size = VP9_PIC_STATE_BUFFER_SIZE * 4;
+        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+                                 &vme_context->res_pic_state_brc_write_hfw_read_buffer,
+                                 res_size,
+                                 "Pic State Brc_write Hfw_Read");
+        if (!allocate_flag)
+            goto failed_allocation;
+
+        res_size = VP9_BRC_BITSTREAM_SIZE_BUFFER_SIZE;
+        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
+                                 &vme_context->res_brc_bitstream_size_buffer,
+                                 res_size,
+                                 "Brc bitstream buffer");
+        if (!allocate_flag)
+            goto failed_allocation;
+    }
+
+    if (allocate && vp9_state->brc_enabled) {
         i965_free_gpe_resource(&vme_context->res_brc_history_buffer);
         i965_free_gpe_resource(&vme_context->res_brc_const_data_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_mbenc_curbe_write_buffer);
         i965_free_gpe_resource(&vme_context->res_pic_state_brc_read_buffer);
-        i965_free_gpe_resource(&vme_context->res_pic_state_brc_write_hfw_read_buffer);
-        i965_free_gpe_resource(&vme_context->res_pic_state_hfw_write_buffer);
         i965_free_gpe_resource(&vme_context->res_seg_state_brc_read_buffer);
         i965_free_gpe_resource(&vme_context->res_seg_state_brc_write_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_bitstream_size_buffer);
         i965_free_gpe_resource(&vme_context->res_brc_hfw_data_buffer);
         i965_free_gpe_resource(&vme_context->res_brc_mmdk_pak_buffer);
 
@@ -448,15 +467,6 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
         if (!allocate_flag)
             goto failed_allocation;
 
-        res_size = ALIGN(sizeof(vp9_mbenc_curbe_data), 64) + 128 +
-           ALIGN(sizeof(struct gen8_interface_descriptor_data), 64) * NUM_VP9_MBENC;
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
-                                 &vme_context->res_brc_mbenc_curbe_write_buffer,
-                                 res_size,
-                                 "Brc Curbe write");
-        if (!allocate_flag)
-            goto failed_allocation;
-
         res_size = VP9_PIC_STATE_BUFFER_SIZE * 4;
         allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
                                  &vme_context->res_pic_state_brc_read_buffer,
@@ -465,22 +475,6 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
         if (!allocate_flag)
             goto failed_allocation;
 
-        res_size = VP9_PIC_STATE_BUFFER_SIZE * 4;
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
-                                 &vme_context->res_pic_state_brc_write_hfw_read_buffer,
-                                 res_size,
-                                 "Pic State Brc_write Hfw_Read");
-        if (!allocate_flag)
-            goto failed_allocation;
-
-        res_size = VP9_PIC_STATE_BUFFER_SIZE * 4;
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
-                                 &vme_context->res_pic_state_hfw_write_buffer,
-                                 res_size,
-                                 "Pic State Hfw Write");
-        if (!allocate_flag)
-            goto failed_allocation;
-
         res_size = VP9_SEGMENT_STATE_BUFFER_SIZE;
         allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
                                  &vme_context->res_seg_state_brc_read_buffer,
@@ -497,14 +491,6 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
         if (!allocate_flag)
             goto failed_allocation;
 
-        res_size = VP9_BRC_BITSTREAM_SIZE_BUFFER_SIZE;
-        allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
-                                 &vme_context->res_brc_bitstream_size_buffer,
-                                 res_size,
-                                 "Brc bitstream buffer");
-        if (!allocate_flag)
-            goto failed_allocation;
-
         res_size = VP9_HFW_BRC_DATA_BUFFER_SIZE;
         allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
                                  &vme_context->res_brc_hfw_data_buffer,
@@ -625,17 +611,6 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
 
     i965_zero_gpe_resource(&vme_context->res_segmentid_buffer);
 
-    i965_free_gpe_resource(&vme_context->res_prob_delta_buffer);
-    res_size = 29 * 64;
-    allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
-                                 &vme_context->res_prob_delta_buffer,
-                                 res_size,
-                                 "VP9 prob delta");
-    if (!allocate_flag)
-        goto failed_allocation;
-
-    i965_zero_gpe_resource(&vme_context->res_segmentid_buffer);
-
     i965_free_gpe_resource(&vme_context->res_prob_delta_buffer);
     res_size = 29 * 64;
     allocate_flag = i965_allocate_gpe_resource(i965->intel.bufmgr,
@@ -692,6 +667,7 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
     if (!allocate_flag)
         goto failed_allocation;
 
+    /* also the BRC distortion input, so it is needed without HME too */
     width = vp9_state->downscaled_width_4x_in_mb * 8;
     height = vp9_state->downscaled_height_4x_in_mb * 16;
     i965_free_gpe_resource(&vme_context->s4x_memv_distortion_buffer);
@@ -703,16 +679,20 @@ gen9_vp9_allocate_resources(VADriverContextP ctx,
     if (!allocate_flag)
         goto failed_allocation;
 
-    width = ALIGN(vp9_state->downscaled_width_16x_in_mb * 32, 64);
-    height = vp9_state->downscaled_height_16x_in_mb * 16;
+    /* 16x HME only when it may be enabled */
     i965_free_gpe_resource(&vme_context->s16x_memv_data_buffer);
-    allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
-                                 &vme_context->s16x_memv_data_buffer,
-                                 width, height,
-                                 width,
-                                 "VP9 16x MEMV data");
-    if (!allocate_flag)
-        goto failed_allocation;
+
+    if (vp9_state->b16xme_supported) {
+        width = ALIGN(vp9_state->downscaled_width_16x_in_mb * 32, 64);
+        height = vp9_state->downscaled_height_16x_in_mb * 16;
+        allocate_flag = i965_gpe_allocate_2d_resource(i965->intel.bufmgr,
+                                     &vme_context->s16x_memv_data_buffer,
+                                     width, height,
+                                     width,
+                                     "VP9 16x MEMV data");
+        if (!allocate_flag)
+            goto failed_allocation;
+    }
 
     width = vp9_state->frame_width_in_mb * 16;
     height = vp9_state->frame_height_in_mb * 8;
@@ -788,19 +768,17 @@ gen9_vp9_free_resources(struct gen9_encoder_context_vp9 *vme_context)
     int i;
     struct gen9_vp9_state *vp9_state = (struct gen9_vp9_state *) vme_context->enc_priv_state;
 
-    if (vp9_state->brc_enabled) {
-        i965_free_gpe_resource(&vme_context->res_brc_history_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_const_data_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_mbenc_curbe_write_buffer);
-        i965_free_gpe_resource(&vme_context->res_pic_state_brc_read_buffer);
-        i965_free_gpe_resource(&vme_context->res_pic_state_brc_write_hfw_read_buffer);
-        i965_free_gpe_resource(&vme_context->res_pic_state_hfw_write_buffer);
-        i965_free_gpe_resource(&vme_context->res_seg_state_brc_read_buffer);
-        i965_free_gpe_resource(&vme_context->res_seg_state_brc_write_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_bitstream_size_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_hfw_data_buffer);
-        i965_free_gpe_resource(&vme_context->res_brc_mmdk_pak_buffer);
-    }
+    i965_free_gpe_resource(&vme_context->res_brc_history_buffer);
+    i965_free_gpe_resource(&vme_context->res_brc_const_data_buffer);
+    i965_free_gpe_resource(&vme_context->res_brc_mbenc_curbe_write_buffer);
+    i965_free_gpe_resource(&vme_context->res_pic_state_brc_read_buffer);
+    i965_free_gpe_resource(&vme_context->res_pic_state_brc_write_hfw_read_buffer);
+    i965_free_gpe_resource(&vme_context->res_pic_state_hfw_write_buffer);
+    i965_free_gpe_resource(&vme_context->res_seg_state_brc_read_buffer);
+    i965_free_gpe_resource(&vme_context->res_seg_state_brc_write_buffer);
+    i965_free_gpe_resource(&vme_context->res_brc_bitstream_size_buffer);
+    i965_free_gpe_resource(&vme_context->res_brc_hfw_data_buffer);
+    i965_free_gpe_resource(&vme_context->res_brc_mmdk_pak_buffer);
 
     i965_free_gpe_resource(&vme_context->res_hvd_line_buffer);
     i965_free_gpe_resource(&vme_context->res_hvd_tile_line_buffer);
@@ -1009,6 +987,7 @@ void gen9_vp9_set_curbe_brc(VADriverContextP ctx,
     VAEncMiscParameterTypeVP9PerSegmantParam *segment_param;
     vp9_brc_curbe_data      *cmd;
     double                  dbps_ratio, dInputBitsPerFrame;
+    double                  target_size;
     struct gen9_vp9_state *vp9_state;
 
     vp9_state = (struct gen9_vp9_state *) encoder_context->enc_priv_state;
@@ -1171,7 +1150,13 @@ void gen9_vp9_set_curbe_brc(VADriverContextP ctx,
             else
                 cmd->dw35.overflow = 0;
 
-            cmd->dw24.target_size                 = (uint32_t)(*param->pbrc_init_current_target_buf_full_in_bits);
+            /* Move bits towards the pictures more complex than the recent ones */
+            target_size = *param->pbrc_init_current_target_buf_full_in_bits +
+                intel_enc_analysis_extra_bits(encoder_context->analysis,
+                                              param->picture_coding_type == KEY_FRAME,
+                                              *param->pbrc_init_reset_input_bits_per_frame,
+                                              *param->pbrc_init_reset_buf_size_in_bits);
+            cmd->dw24.target_size                 = (uint32_t)MAX(target_size, 0);
 
             cmd->dw36.segmentation               = pic_param->pic_flags.bits.segmentation_enabled;
 
@@ -1745,6 +1730,7 @@ gen9_vp9_brc_update_kernel(VADriverContextP ctx,
                                struct encode_state *encode_state,
                                struct intel_encoder_context *encoder_context)
 {
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct gen9_encoder_context_vp9 *vme_context = encoder_context->vme_context;
     struct vp9_brc_context *brc_context = &vme_context->brc_context;
     struct i965_gpe_context *brc_gpe_context, *mbenc_gpe_context;
@@ -1838,6 +1824,11 @@ gen9_vp9_brc_update_kernel(VADriverContextP ctx,
     if (vp9_state->brc_constant_buffer_supported)
     {
         char *brc_const_buffer;
+
+        /* Rewritten in full, so don't wait for the previous frame to retire */
+        i965_renew_gpe_resource(i965->intel.bufmgr,
+                                &vme_context->res_brc_const_data_buffer,
+                                "Brc Constant buffer");
         brc_const_buffer = i965_map_gpe_resource(&vme_context->res_brc_const_data_buffer);
 
         if (!brc_const_buffer)
@@ -1862,6 +1853,9 @@ gen9_vp9_brc_update_kernel(VADriverContextP ctx,
     {
         pic_param->filter_level = 0;
         // clear the filter level value in picParams ebfore programming pic state, as this value will be determined and updated by BRC.
+        i965_renew_gpe_resource(i965->intel.bufmgr,
+                                &vme_context->res_pic_state_brc_read_buffer,
+                                "Pic State Brc_read buffer");
         intel_vp9enc_construct_picstate_batchbuf(ctx, encode_state,
                  encoder_context, &vme_context->res_pic_state_brc_read_buffer);
     }
@@ -4143,6 +4137,10 @@ gen9_vme_gpe_kernel_run_vp9(VADriverContextP ctx,
         gen9_vp9_brc_init_reset_kernel(ctx, encode_state, encoder_context);
     }
 
+    /* Complexity of the input for the BRC update, see gen9_vp9_set_curbe_brc() */
+    if (vp9_state->brc_enabled)
+        intel_enc_analysis_surface(encoder_context->analysis, encode_state->input_yuv_object);
+
     if (vp9_state->picture_coding_type == KEY_FRAME) {
         for (i = 0; i < 2; i++)
             i965_zero_gpe_resource(&vme_context->res_mode_decision[i]);
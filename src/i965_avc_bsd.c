@@ -54,6 +54,7 @@ i965_avc_bsd_init_avc_bsd_surface(VADriverContextP ctx,
         assert(avc_bsd_surface);
         avc_bsd_surface->base.frame_store_id = -1;
         assert((obj_surface->size & 0x3f) == 0);
+        avc_bsd_surface->bo_pool = &i965->codec_bo_pool;
         obj_surface->private_data = avc_bsd_surface;
     }
 
@@ -61,18 +62,18 @@ i965_avc_bsd_init_avc_bsd_surface(VADriverContextP ctx,
                                         !pic_param->seq_fields.bits.direct_8x8_inference_flag);
 
     if (avc_bsd_surface->dmv_top == NULL) {
-        avc_bsd_surface->dmv_top = dri_bo_alloc(i965->intel.bufmgr,
-                                                "direct mv w/r buffer",
-                                                DMV_SIZE,
-                                                0x1000);
+        avc_bsd_surface->dmv_top = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                     "direct mv w/r buffer",
+                                                     DMV_SIZE,
+                                                     0x1000);
     }
 
     if (avc_bsd_surface->dmv_bottom_flag &&
         avc_bsd_surface->dmv_bottom == NULL) {
-        avc_bsd_surface->dmv_bottom = dri_bo_alloc(i965->intel.bufmgr,
-                                                   "direct mv w/r buffer",
-                                                   DMV_SIZE,
-                                                   0x1000);
+        avc_bsd_surface->dmv_bottom = gen_bo_pool_alloc(&i965->codec_bo_pool,
+                                                        "direct mv w/r buffer",
+                                                        DMV_SIZE,
+                                                        0x1000);
     }
 }
 
@@ -524,7 +525,8 @@ g4x_avc_bsd_object(VADriverContextP ctx,
 
 
         slice_data_bit_offset = avc_get_first_mb_bit_offset_with_epb(
-            decode_state->slice_datas[slice_index]->bo,
+            decode_state,
+            decode_state->slice_datas[slice_index],
             slice_param,
             pic_param->pic_fields.bits.entropy_coding_mode_flag
         );
@@ -650,7 +652,8 @@ ironlake_avc_bsd_object(VADriverContextP ctx,
             counter_value = 0;
 
         slice_data_bit_offset = avc_get_first_mb_bit_offset_with_epb(
-            decode_state->slice_datas[slice_index]->bo,
+            decode_state,
+            decode_state->slice_datas[slice_index],
             slice_param,
             pic_param->pic_fields.bits.entropy_coding_mode_flag
         );
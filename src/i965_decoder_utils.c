@@ -23,6 +23,11 @@
 
 #include "sysdeps.h"
 #include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "intel_batchbuffer.h"
 #include "intel_media.h"
@@ -320,20 +325,97 @@ avc_get_first_mb_bit_offset(
     return slice_data_bit_offset;
 }
 
+/* Count emulation prevention bytes (00 00 03) within the first
+   header_size bytes of RBSP data, scanning at most buf_size bytes */
+unsigned int
+intel_count_emulation_prevention_bytes(
+    const uint8_t *buf,
+    unsigned int   buf_size,
+    unsigned int   header_size
+)
+{
+    unsigned int i = 2, j = 2, n = 0;
+
+#ifdef __SSE2__
+    const __m128i v_epb = _mm_set1_epi8(0x03);
+#endif
+
+    while (i < buf_size && j < header_size) {
+#ifdef __SSE2__
+        /* An EPB can only sit on a 0x03 byte: skip to the next one */
+        if (i + 16 <= buf_size && j + 16 <= header_size) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            const unsigned int mask =
+                _mm_movemask_epi8(_mm_cmpeq_epi8(v, v_epb));
+
+            if (!mask) {
+                i += 16, j += 16;
+                continue;
+            }
+
+            const unsigned int k = __builtin_ctz(mask);
+            i += k, j += k;
+        }
+#endif
+        if (buf[i] == 0x03 && buf[i - 1] == 0x00 && buf[i - 2] == 0x00)
+            i += 3, j += 2, n++;
+        else
+            i++, j++;
+    }
+    return n;
+}
+
+/* Get read access to slice data, from the host shadow when it covers it */
+const uint8_t *
+intel_decoder_map_slice_data(
+    struct decode_state *decode_state,
+    struct buffer_store *slice_data,
+    unsigned int         offset,
+    unsigned int         size
+)
+{
+    if (slice_data->shadow && offset + size <= slice_data->shadow_size)
+        return slice_data->shadow + offset;
+
+    if (dri_bo_map(slice_data->bo, 0) != 0)
+        return NULL;
+
+    decode_state->slice_data_readback_bytes += size;
+    return (const uint8_t *)slice_data->bo->virtual + offset;
+}
+
+void
+intel_decoder_unmap_slice_data(
+    struct buffer_store *slice_data,
+    const uint8_t       *data
+)
+{
+    if (!data)
+        return;
+
+    /* An empty slice at the end of the shadow points just past it */
+    if (slice_data->shadow &&
+        data >= slice_data->shadow &&
+        data <= slice_data->shadow + slice_data->shadow_size)
+        return;
+
+    dri_bo_unmap(slice_data->bo);
+}
+
 /* Get first macroblock bit offset for BSD, with EPB count (AVC) */
 /* XXX: slice_data_bit_offset does not account for EPB */
 unsigned int
 avc_get_first_mb_bit_offset_with_epb(
-    dri_bo                     *slice_data_bo,
+    struct decode_state        *decode_state,
+    struct buffer_store        *slice_data,
     VASliceParameterBufferH264 *slice_param,
     unsigned int                mode_flag
 )
 {
     unsigned int in_slice_data_bit_offset = slice_param->slice_data_bit_offset;
     unsigned int out_slice_data_bit_offset;
-    unsigned int i, j, n = 0, buf_size, data_size, header_size;
-    uint8_t *buf;
-    int ret;
+    unsigned int n = 0, buf_size, data_size, header_size;
+    const uint8_t *buf;
 
     header_size = slice_param->slice_data_bit_offset / 8;
     data_size   = slice_param->slice_data_size - slice_param->slice_data_offset;
@@ -342,25 +424,15 @@ avc_get_first_mb_bit_offset_with_epb(
     if (buf_size > data_size)
         buf_size = data_size;
 
-    buf = malloc(buf_size);
-
-    if (!buf)
-        goto out;
-
-    ret = dri_bo_get_subdata(
-        slice_data_bo, slice_param->slice_data_offset,
-        buf_size, buf
-    );
-    assert(ret == 0);
+    buf = intel_decoder_map_slice_data(decode_state, slice_data,
+                                       slice_param->slice_data_offset,
+                                       buf_size);
 
-    for (i = 2, j = 2, n = 0; i < buf_size && j < header_size; i++, j++) {
-        if (buf[i] == 0x03 && buf[i - 1] == 0x00 && buf[i - 2] == 0x00)
-            i += 2, j++, n++;
+    if (buf) {
+        n = intel_count_emulation_prevention_bytes(buf, buf_size, header_size);
+        intel_decoder_unmap_slice_data(slice_data, buf);
     }
 
-    free(buf);
-
-out:
     out_slice_data_bit_offset = in_slice_data_bit_offset + n * 8;
 
     if (mode_flag == ENTROPY_CABAC)
@@ -568,6 +640,246 @@ gen6_mfd_avc_phantom_slice(VADriverContextP ctx,
     gen6_mfd_avc_phantom_slice_bsd_object(ctx, pic_param, batch);
 }
 
+struct slice_batch_job {
+    VADriverContextP                          ctx;
+    struct decode_state                      *decode_state;
+    const struct intel_decoder_slice_emitter *emitter;
+    void                                     *hw_context;
+    struct intel_batchbuffer                 *batch;
+    int                                       slice_group;
+    int                                       slice_index;
+    int                                       slice_num;
+    int                                       num_slices;
+    pthread_t                                 thread;
+    int                                       thread_started;
+};
+
+/* Emit a run of consecutive slices into job->batch */
+static void
+slice_batch_job_emit(struct slice_batch_job *job)
+{
+    struct decode_state * const decode_state = job->decode_state;
+    int j = job->slice_group, i = job->slice_index, n;
+
+    job->emitter->emit_slice_group(job->ctx, decode_state, job->batch,
+                                   j, i, job->slice_num, job->hw_context);
+
+    for (n = 0; n < job->num_slices; n++, i++) {
+        if (i == decode_state->slice_params[j]->num_elements) {
+            do {
+                j++;
+            } while (!decode_state->slice_params[j]->num_elements);
+            i = 0;
+            job->emitter->emit_slice_group(job->ctx, decode_state, job->batch,
+                                           j, i, job->slice_num + n,
+                                           job->hw_context);
+        }
+
+        job->emitter->emit_slice(job->ctx, decode_state, job->batch,
+                                 j, i, job->slice_num + n, job->hw_context);
+    }
+}
+
+static void *
+slice_batch_job_run(void *arg)
+{
+    slice_batch_job_emit(arg);
+    return NULL;
+}
+
+/* Jump from batch to the start of next_bo */
+static void
+slice_batch_chain(struct intel_batchbuffer *batch, dri_bo *next_bo)
+{
+    BEGIN_BCS_BATCH(batch, 3);
+    OUT_BCS_BATCH(batch, MI_BATCH_BUFFER_START | (1 << 8) | (1 << 0));
+    OUT_BCS_RELOC64(batch,
+                    next_bo,
+                    I915_GEM_DOMAIN_COMMAND, 0,
+                    0);
+    ADVANCE_BCS_BATCH(batch);
+}
+
+/*
+ * Emit the slice level commands of a picture. Pictures with many slices
+ * are split into runs of consecutive slices that are built in parallel
+ * into separate batch buffers, chained one after the other from the
+ * main batch. The last run terminates the execution, so this must be
+ * the last thing emitted for the picture.
+ */
+void
+intel_decoder_emit_slices(
+    VADriverContextP                          ctx,
+    struct decode_state                      *decode_state,
+    struct intel_batchbuffer                 *batch,
+    const struct intel_decoder_slice_emitter *emitter,
+    void                                     *hw_context
+)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct slice_batch_job jobs[I965_DECODER_SLICE_THREADS_MAX], *job;
+    _I965Mutex reloc_mutex;
+    int num_slices = 0, num_jobs, slices_per_job;
+    int j, i, k, n;
+
+    for (j = 0; j < decode_state->num_slice_params; j++)
+        num_slices += decode_state->slice_params[j]->num_elements;
+
+    if (!num_slices)
+        return;
+
+    num_jobs = emitter->max_threads > 0 ?
+        emitter->max_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    num_jobs = MIN(num_jobs, I965_DECODER_SLICE_THREADS_MAX);
+
+    if (num_jobs < 2 ||
+        num_slices < I965_DECODER_SLICE_THREADS_MIN_SLICES ||
+        !(IS_GEN8(i965->intel.device_info) ||
+          IS_GEN9(i965->intel.device_info))) {
+        memset(jobs, 0, sizeof(jobs));
+        job = &jobs[0];
+        job->ctx = ctx;
+        job->decode_state = decode_state;
+        job->emitter = emitter;
+        job->hw_context = hw_context;
+        job->batch = batch;
+        job->num_slices = num_slices;
+
+        while (!decode_state->slice_params[job->slice_group]->num_elements)
+            job->slice_group++;
+
+        slice_batch_job_emit(job);
+        return;
+    }
+
+    /* Split into runs and allocate all batches before starting workers,
+       so that each one can chain to the next */
+    memset(jobs, 0, sizeof(jobs));
+    slices_per_job = (num_slices + num_jobs - 1) / num_jobs;
+
+    for (k = 0, j = 0, i = 0, n = 0; k < num_jobs && n < num_slices; k++) {
+        job = &jobs[k];
+        job->ctx = ctx;
+        job->decode_state = decode_state;
+        job->emitter = emitter;
+        job->hw_context = hw_context;
+
+        while (i == decode_state->slice_params[j]->num_elements) {
+            j++;
+            i = 0;
+        }
+
+        job->slice_group = j;
+        job->slice_index = i;
+        job->slice_num = n;
+        job->num_slices = MIN(slices_per_job, num_slices - n);
+        job->batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_BSD,
+                                           (job->num_slices + decode_state->num_slice_params) *
+                                           emitter->max_slice_size + 0x1000);
+        job->batch->reloc_mutex = &reloc_mutex;
+
+        /* Advance to the first slice of the next run */
+        n += job->num_slices;
+        i += job->num_slices;
+
+        while (j < decode_state->num_slice_params &&
+               i >= decode_state->slice_params[j]->num_elements) {
+            i -= decode_state->slice_params[j]->num_elements;
+            j++;
+        }
+    }
+    num_jobs = k;
+
+    /*
+     * Workers only emit their own slices. Relocations to buffers shared
+     * between runs (references, slice data) also update the target bo in
+     * libdrm, hence the lock around them.
+     */
+    _i965InitMutex(&reloc_mutex);
+
+    for (k = 1; k < num_jobs; k++)
+        jobs[k].thread_started = !pthread_create(&jobs[k].thread, NULL,
+                                                 slice_batch_job_run, &jobs[k]);
+
+    slice_batch_job_run(&jobs[0]);
+
+    for (k = 1; k < num_jobs; k++) {
+        if (jobs[k].thread_started)
+            pthread_join(jobs[k].thread, NULL);
+        else
+            slice_batch_job_run(&jobs[k]);
+    }
+
+    _i965DestroyMutex(&reloc_mutex);
+
+    /*
+     * Chain the runs from the last one back to the first, so that every
+     * batch is complete before it becomes a relocation target: libdrm
+     * does not allow adding relocations to a bo already used as one, and
+     * the aperture size of a chaining batch includes its target's.
+     */
+    job = &jobs[num_jobs - 1];
+    job->batch->reloc_mutex = NULL;
+    intel_batchbuffer_align(job->batch, 8);
+
+    BEGIN_BCS_BATCH(job->batch, 2);
+    OUT_BCS_BATCH(job->batch, 0);
+    OUT_BCS_BATCH(job->batch, MI_BATCH_BUFFER_END);
+    ADVANCE_BCS_BATCH(job->batch);
+
+    for (k = num_jobs - 2; k >= 0; k--) {
+        jobs[k].batch->reloc_mutex = NULL;
+        slice_batch_chain(jobs[k].batch, jobs[k + 1].batch->buffer);
+    }
+
+    slice_batch_chain(batch, jobs[0].batch->buffer);
+
+    for (k = 0; k < num_jobs; k++)
+        intel_batchbuffer_free(jobs[k].batch);
+}
+
+/*
+ * Selects the BSD ring to decode the current picture on. Ordering between
+ * rings is still enforced by the kernel through the relocations on the
+ * surfaces; the scheduler only keeps dependent pictures on the ring the
+ * references are being decoded on, so that independent pictures and
+ * streams can use the other one.
+ */
+bsd_ring_flag
+intel_decoder_get_bsd_ring(
+    VADriverContextP     ctx,
+    struct decode_state *decode_state
+)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct intel_bsd_dependency deps[1 + ARRAY_ELEMS(decode_state->reference_objects)];
+    struct object_surface * const render_object = decode_state->render_object;
+    int i, ring, num_deps = 0;
+
+    if (i965->bsd_scheduler.num_rings < 2 || !render_object)
+        return BSD_DEFAULT;
+
+    deps[num_deps].fence = &render_object->bsd_fence;
+    deps[num_deps++].resource = render_object->bo;
+
+    for (i = 0; i < ARRAY_ELEMS(decode_state->reference_objects); i++) {
+        struct object_surface * const obj_surface =
+            decode_state->reference_objects[i];
+
+        if (!obj_surface || obj_surface == render_object)
+            continue;
+
+        deps[num_deps].fence = &obj_surface->bsd_fence;
+        deps[num_deps++].resource = obj_surface->bo;
+    }
+
+    ring = intel_bsd_scheduler_submit(&i965->bsd_scheduler,
+                                      &render_object->bsd_fence,
+                                      deps, num_deps);
+
+    return ring == 0 ? BSD_RING0 : BSD_RING1;
+}
+
 /* Comparison function for sorting out the array of free frame store entries */
 static int
 compare_avc_ref_store_func(const void *p1, const void *p2)
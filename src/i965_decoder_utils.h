@@ -28,6 +28,7 @@
 #include "intel_batchbuffer.h"
 
 struct decode_state;
+struct buffer_store;
 
 int
 mpeg2_wa_slice_vertical_position(
@@ -67,9 +68,31 @@ avc_get_first_mb_bit_offset(
     unsigned int                mode_flag
 );
 
+unsigned int
+intel_count_emulation_prevention_bytes(
+    const uint8_t *buf,
+    unsigned int   buf_size,
+    unsigned int   header_size
+);
+
+const uint8_t *
+intel_decoder_map_slice_data(
+    struct decode_state *decode_state,
+    struct buffer_store *slice_data,
+    unsigned int         offset,
+    unsigned int         size
+);
+
+void
+intel_decoder_unmap_slice_data(
+    struct buffer_store *slice_data,
+    const uint8_t       *data
+);
+
 unsigned int
 avc_get_first_mb_bit_offset_with_epb(
-    dri_bo                     *slice_data_bo,
+    struct decode_state        *decode_state,
+    struct buffer_store        *slice_data,
     VASliceParameterBufferH264 *slice_param,
     unsigned int                mode_flag
 );
@@ -96,6 +119,46 @@ gen6_mfd_avc_phantom_slice(VADriverContextP ctx,
                            struct intel_batchbuffer *batch
 );
 
+/* Slices below this count per picture are always emitted serially */
+#define I965_DECODER_SLICE_THREADS_MIN_SLICES   32
+#define I965_DECODER_SLICE_THREADS_MAX          4
+
+typedef void (*intel_decoder_emit_slice_func)(
+    VADriverContextP          ctx,
+    struct decode_state      *decode_state,
+    struct intel_batchbuffer *batch,
+    int                       slice_group,
+    int                       slice_index,
+    int                       slice_num,
+    void                     *hw_context
+);
+
+struct intel_decoder_slice_emitter {
+    /* Called before the first slice of a run within a slice group */
+    intel_decoder_emit_slice_func emit_slice_group;
+    /* Called for each slice, must only write to the batch it is given */
+    intel_decoder_emit_slice_func emit_slice;
+    /* Worst case size in bytes of the commands for one slice or group */
+    unsigned int max_slice_size;
+    /* Upper bound on worker threads, 0 selects the default */
+    int max_threads;
+};
+
+void
+intel_decoder_emit_slices(
+    VADriverContextP                          ctx,
+    struct decode_state                      *decode_state,
+    struct intel_batchbuffer                 *batch,
+    const struct intel_decoder_slice_emitter *emitter,
+    void                                     *hw_context
+);
+
+bsd_ring_flag
+intel_decoder_get_bsd_ring(
+    VADriverContextP     ctx,
+    struct decode_state *decode_state
+);
+
 VAStatus
 intel_decoder_sanity_check_input(VADriverContextP ctx,
                                  VAProfile profile,
@@ -1082,6 +1082,15 @@ i965_GetConfigAttributes(VADriverContextP ctx,
                         val_config->bits.max_num_temporal_layers_minus1 = MAX_TEMPORAL_LAYERS - 1;
                         val_config->bits.temporal_layer_bitrate_control_flag = 1;
                     }
+            } else if ((profile == VAProfileH264ConstrainedBaseline ||
+                        profile == VAProfileH264Main ||
+                        profile == VAProfileH264High) &&
+                       entrypoint == VAEntrypointEncSliceLP) {
+                /* One HuC BRC instance per layer */
+                VAConfigAttribValEncRateControlExt *val_config = (VAConfigAttribValEncRateControlExt *)&(attrib_list[i].value);
+
+                val_config->bits.max_num_temporal_layers_minus1 = MAX_TEMPORAL_LAYERS - 1;
+                val_config->bits.temporal_layer_bitrate_control_flag = 1;
             } else {
                 attrib_list[i].value = VA_ATTRIB_NOT_SUPPORTED;
             }
@@ -1350,6 +1359,138 @@ i965_destroy_surface_storage(struct object_surface *obj_surface)
         obj_surface->free_private_data(&obj_surface->private_data);
         obj_surface->private_data = NULL;
     }
+
+    if (obj_surface->free_output_data != NULL) {
+        obj_surface->free_output_data(&obj_surface->output_data);
+        obj_surface->output_data = NULL;
+    }
+}
+
+void
+i965_surface_cache_init(struct i965_surface_cache *cache, unsigned long max_size)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->max_size = max_size;
+    _i965InitMutex(&cache->mutex);
+}
+
+void
+i965_surface_cache_terminate(struct i965_surface_cache *cache)
+{
+    int i;
+
+    for (i = 0; i < cache->num_entries; i++)
+        dri_bo_unreference(cache->entries[i].bo);
+
+    cache->num_entries = 0;
+    cache->total_size = 0;
+    _i965DestroyMutex(&cache->mutex);
+}
+
+/* Unlinks entries[index] from the cache, the caller takes its reference */
+static dri_bo *
+i965_surface_cache_remove(struct i965_surface_cache *cache, int index)
+{
+    dri_bo *bo = cache->entries[index].bo;
+
+    cache->total_size -= bo->size;
+    cache->num_entries--;
+    memmove(&cache->entries[index], &cache->entries[index + 1],
+            (cache->num_entries - index) * sizeof(cache->entries[0]));
+
+    return bo;
+}
+
+/* Returns a buffer of a destroyed surface laid out like obj_surface */
+static dri_bo *
+i965_surface_cache_get(struct i965_surface_cache *cache,
+                       struct object_surface *obj_surface,
+                       uint32_t tiling)
+{
+    struct i965_surface_cache_entry *entry;
+    dri_bo *bo = NULL;
+    int i;
+
+    _i965LockMutex(&cache->mutex);
+
+    /* Most recently freed first */
+    for (i = cache->num_entries - 1; i >= 0; i--) {
+        entry = &cache->entries[i];
+
+        if (entry->fourcc != obj_surface->fourcc ||
+            entry->subsampling != obj_surface->subsampling ||
+            entry->tiling != tiling ||
+            entry->width != obj_surface->width ||
+            entry->height != obj_surface->height ||
+            entry->size != obj_surface->size)
+            continue;
+
+        bo = i965_surface_cache_remove(cache, i);
+
+        /* The kernel may have reclaimed the pages while it sat idle */
+        if (!drm_intel_bo_madvise(bo, I915_MADV_WILLNEED)) {
+            dri_bo_unreference(bo);
+            bo = NULL;
+            continue;
+        }
+
+        cache->num_hits++;
+        break;
+    }
+
+    _i965UnlockMutex(&cache->mutex);
+
+    return bo;
+}
+
+/* Takes the buffer of a destroyed surface if nobody else can see it */
+static void
+i965_surface_cache_put(struct i965_surface_cache *cache,
+                       struct object_surface *obj_surface)
+{
+    struct i965_surface_cache_entry *entry;
+    dri_bo *evicted[I965_SURFACE_CACHE_MAX_ENTRIES];
+    dri_bo *bo = obj_surface->bo;
+    uint32_t tiling, swizzle;
+    int i, num_evicted = 0;
+
+    /* Flinked, exported or imported buffers and the ones still backing
+     * a derived image may be accessed behind our back */
+    if (!bo || bo->size > cache->max_size ||
+        !drm_intel_bo_is_reusable(bo) ||
+        obj_surface->derived_image_id != VA_INVALID_ID)
+        return;
+
+    if (dri_bo_get_tiling(bo, &tiling, &swizzle) != 0)
+        return;
+
+    _i965LockMutex(&cache->mutex);
+
+    /* Oldest buffers go first */
+    while (cache->num_entries == I965_SURFACE_CACHE_MAX_ENTRIES ||
+           (cache->num_entries > 0 &&
+            cache->total_size + bo->size > cache->max_size))
+        evicted[num_evicted++] = i965_surface_cache_remove(cache, 0);
+
+    entry = &cache->entries[cache->num_entries++];
+    entry->bo = bo;
+    entry->fourcc = obj_surface->fourcc;
+    entry->subsampling = obj_surface->subsampling;
+    entry->tiling = tiling;
+    entry->width = obj_surface->width;
+    entry->height = obj_surface->height;
+    entry->size = obj_surface->size;
+    cache->total_size += bo->size;
+
+    /* Let the kernel reclaim the pages under memory pressure */
+    drm_intel_bo_madvise(bo, I915_MADV_DONTNEED);
+
+    _i965UnlockMutex(&cache->mutex);
+
+    for (i = 0; i < num_evicted; i++)
+        dri_bo_unreference(evicted[i]);
+
+    obj_surface->bo = NULL;
 }
 
 static void 
@@ -1357,10 +1498,124 @@ i965_destroy_surface(struct object_heap *heap, struct object_base *obj)
 {
     struct object_surface *obj_surface = (struct object_surface *)obj;
 
+    if (obj_surface->bo_cache)
+        i965_surface_cache_put(obj_surface->bo_cache, obj_surface);
+
     i965_destroy_surface_storage(obj_surface);
     object_heap_free(heap, obj);
 }
 
+/*
+ * Zeroes the bytes [x0, x1) of the rows [y0, y1) of a Y-tiled plane
+ * through a CPU mapping. The rows of a 16-byte tile column are
+ * contiguous in memory, so whole columns are cleared at once.
+ */
+static void
+i965_clear_y_tiled_rect(unsigned char *base, int pitch,
+                        int x0, int x1, int y0, int y1)
+{
+    int x, y, i, n, rows;
+
+    for (y = y0; y < y1; y += rows) {
+        rows = MIN(ALIGN(y + 1, 32), y1) - y;
+
+        for (x = x0; x < x1; x += n) {
+            n = MIN(16 - x % 16, x1 - x);
+
+            if (n == 16) {
+                memset(base + Y_TILED_OFFSET(pitch, x, y), 0, rows * 16);
+            } else {
+                for (i = 0; i < rows; i++)
+                    memset(base + Y_TILED_OFFSET(pitch, x, y + i), 0, n);
+            }
+        }
+    }
+}
+
+static void
+i965_clear_linear_rect(unsigned char *base, int pitch,
+                       int x0, int x1, int y0, int y1)
+{
+    int y;
+
+    if (x0 == 0 && x1 == pitch) {
+        memset(base + y0 * pitch, 0, (y1 - y0) * pitch);
+        return;
+    }
+
+    for (y = y0; y < y1; y++)
+        memset(base + y * pitch + x0, 0, x1 - x0);
+}
+
+/*
+ * Zeroes the padding on the right and at the bottom of the planes of a
+ * NV12 or P010 surface, which the encoders read when the size is not
+ * aligned to their block size. Y-tiled surfaces are written through a
+ * CPU mapping when there is no bit 6 swizzling, which avoids the slow
+ * uncached writes through the GTT fence.
+ */
+VAStatus
+i965_clear_surface_border(struct object_surface *obj_surface)
+{
+    int width[2], height[2], vstride[2], offset[2];
+    uint32_t tiling = I915_TILING_NONE, swizzle = I915_BIT_6_SWIZZLE_NONE;
+    int pitch, bpp, i;
+    unsigned char *p;
+    bool use_gtt;
+
+    if (obj_surface->border_cleared)
+        return VA_STATUS_SUCCESS;
+
+    if (obj_surface->fourcc != VA_FOURCC_NV12 &&
+        obj_surface->fourcc != VA_FOURCC_P010)
+        return VA_STATUS_SUCCESS;
+
+    if (!obj_surface->bo)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    bpp = (obj_surface->fourcc == VA_FOURCC_P010) ? 2 : 1;
+    pitch = obj_surface->width;
+    width[0] = width[1] = obj_surface->orig_width * bpp;
+    height[0] = obj_surface->orig_height;
+    height[1] = obj_surface->orig_height / 2;
+    vstride[0] = obj_surface->height;
+    vstride[1] = obj_surface->height / 2;
+    offset[0] = 0;
+    offset[1] = obj_surface->y_cb_offset * pitch;
+
+    dri_bo_get_tiling(obj_surface->bo, &tiling, &swizzle);
+    use_gtt = (tiling != I915_TILING_NONE &&
+               (tiling != I915_TILING_Y || swizzle != I915_BIT_6_SWIZZLE_NONE));
+
+    if (use_gtt)
+        drm_intel_gem_bo_map_gtt(obj_surface->bo);
+    else
+        dri_bo_map(obj_surface->bo, 1);
+
+    p = (unsigned char *)obj_surface->bo->virtual;
+    if (!p)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    for (i = 0; i < 2; i++) {
+        if (tiling == I915_TILING_Y && !use_gtt) {
+            i965_clear_y_tiled_rect(p + offset[i], pitch, width[i], pitch, 0, height[i]);
+            i965_clear_y_tiled_rect(p + offset[i], pitch, 0, pitch, height[i], vstride[i]);
+        } else {
+            i965_clear_linear_rect(p + offset[i], pitch, width[i], pitch, 0, height[i]);
+            i965_clear_linear_rect(p + offset[i], pitch, 0, pitch, height[i], vstride[i]);
+        }
+    }
+
+    if (use_gtt)
+        drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+    else
+        dri_bo_unmap(obj_surface->bo);
+
+    obj_surface->border_cleared = true;
+
+    return VA_STATUS_SUCCESS;
+}
+
 static VAStatus
 i965_surface_native_memory(VADriverContextP ctx,
                            struct object_surface *obj_surface,
@@ -1690,10 +1945,14 @@ i965_CreateSurfaces2(
         obj_surface->derived_image_id = VA_INVALID_ID;
         obj_surface->private_data = NULL;
         obj_surface->free_private_data = NULL;
+        obj_surface->output_data = NULL;
+        obj_surface->free_output_data = NULL;
         obj_surface->subsampling = SUBSAMPLE_YUV420;
 
         obj_surface->wrapper_surface = VA_INVALID_ID;
         obj_surface->exported_primefd = -1;
+        obj_surface->bo_cache = NULL;
+        intel_bsd_fence_init(&obj_surface->bsd_fence);
 
         switch (memory_type) {
         case I965_SURFACE_MEM_NATIVE:
@@ -2128,14 +2387,38 @@ i965_release_buffer_store(struct buffer_store **ptr)
     if (buffer_store->ref_count == 0) {
         dri_bo_unreference(buffer_store->bo);
         free(buffer_store->buffer);
+        free(buffer_store->shadow);
         buffer_store->bo = NULL;
         buffer_store->buffer = NULL;
+        buffer_store->shadow = NULL;
         free(buffer_store);
     }
 
     *ptr = NULL;
 }
 
+/* Capture the first bytes of a slice data buffer in host memory */
+static void
+i965_update_buffer_store_shadow(struct buffer_store *buffer_store,
+                                const void *data,
+                                unsigned int size)
+{
+    unsigned int shadow_size = MIN(size, I965_SLICE_DATA_SHADOW_SIZE);
+
+    if (!data || !shadow_size)
+        return;
+
+    if (!buffer_store->shadow) {
+        buffer_store->shadow = malloc(I965_SLICE_DATA_SHADOW_SIZE);
+
+        if (!buffer_store->shadow)
+            return;
+    }
+
+    memcpy(buffer_store->shadow, data, shadow_size);
+    buffer_store->shadow_size = shadow_size;
+}
+
 static void 
 i965_destroy_context(struct object_heap *heap, struct object_base *obj)
 {
@@ -2149,6 +2432,7 @@ i965_destroy_context(struct object_heap *heap, struct object_base *obj)
 
     if (obj_context->codec_type == CODEC_PROC) {
         i965_release_buffer_store(&obj_context->codec_state.proc.pipeline_param);
+        i965_release_buffer_store(&obj_context->codec_state.proc.statistics);
 
     } else if (obj_context->codec_type == CODEC_ENC) {
         i965_release_buffer_store(&obj_context->codec_state.encode.q_matrix);
@@ -2443,6 +2727,7 @@ i965_destroy_buffer(struct object_heap *heap, struct object_base *obj)
 
     assert(obj_buffer->buffer_store);
     i965_release_buffer_store(&obj_buffer->buffer_store);
+    free(obj_buffer->slice_segments);
     object_heap_free(heap, obj);
 }
 
@@ -2493,6 +2778,10 @@ i965_create_buffer_internal(VADriverContextP ctx,
         break;
 
     default:
+        /* driver specific buffer types */
+        if (type == VAProcStatisticsBufferTypeI965)
+            break;
+
         return VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
     }
 
@@ -2516,6 +2805,7 @@ i965_create_buffer_internal(VADriverContextP ctx,
     obj_buffer->buffer_store = NULL;
     obj_buffer->wrapper_buffer = VA_INVALID_ID;
     obj_buffer->context_id = context;
+    obj_buffer->slice_segments = NULL;
 
     buffer_store = calloc(1, sizeof(struct buffer_store));
     assert(buffer_store);
@@ -2546,6 +2836,19 @@ i965_create_buffer_internal(VADriverContextP ctx,
         /* If the buffer is wrapped, the buffer_store is bogus. Unnecessary to copy it */
         if (data && !wrapper_flag)
             dri_bo_subdata(buffer_store->bo, 0, size * num_elements, data);
+    } else if (type == VAProcStatisticsBufferTypeI965) {
+        /* Only the header for now, VEBOX grows the bo to hold the
+         * statistics surface of the picture it processes */
+        buffer_store->bo = dri_bo_alloc(i965->intel.bufmgr,
+                                        "Statistics buffer",
+                                        I965_PROC_STATISTICS_HEADER_SIZE, 64);
+        assert(buffer_store->bo);
+
+        if (buffer_store->bo) {
+            dri_bo_map(buffer_store->bo, 1);
+            memset(buffer_store->bo->virtual, 0, I965_PROC_STATISTICS_HEADER_SIZE);
+            dri_bo_unmap(buffer_store->bo);
+        }
     } else if (type == VASliceDataBufferType || 
                type == VAImageBufferType || 
                type == VAEncCodedBufferType ||
@@ -2582,9 +2885,14 @@ i965_create_buffer_internal(VADriverContextP ctx,
             coded_buffer_segment->mapped = 0;
             coded_buffer_segment->codec = 0;
             coded_buffer_segment->status_support = 0;
+            coded_buffer_segment->num_slices = 0;
             dri_bo_unmap(buffer_store->bo);
           } else if (data) {
               dri_bo_subdata(buffer_store->bo, 0, size * num_elements, data);
+
+              if (type == VASliceDataBufferType)
+                  i965_update_buffer_store_shadow(buffer_store, data,
+                                                  size * num_elements);
           }
        }
 
@@ -2668,6 +2976,59 @@ i965_BufferSetNumElements(VADriverContextP ctx,
     return vaStatus;
 }
 
+/*
+ * Chain one segment per slice recorded in slice_end[], the first one being
+ * the segment in the header. Returns the number of slices finished, or -1
+ * if the records are not consistent, in which case nothing is changed.
+ */
+int
+i965_coded_buffer_split_slices(struct i965_coded_buffer_segment *coded_buffer_segment,
+                               VACodedBufferSegment *slice_segments,
+                               unsigned int max_size)
+{
+    VACodedBufferSegment *segment = &coded_buffer_segment->base;
+    unsigned int num_slices = coded_buffer_segment->num_slices;
+    unsigned int start = 0;
+    unsigned int i, num_finished;
+
+    if (num_slices == 0 || num_slices > I965_CODEDBUFFER_MAX_SLICES)
+        return -1;
+
+    for (i = 0; i < num_slices; i++) {
+        unsigned int end = coded_buffer_segment->slice_end[i];
+
+        if (end == I965_CODEDBUFFER_SLICE_PENDING)
+            break;
+
+        if (end < start || end > max_size)
+            return -1;
+
+        start = end;
+    }
+
+    num_finished = i;
+
+    segment->size = num_finished ? coded_buffer_segment->slice_end[0] : 0;
+    segment->status &= ~VA_CODED_BUF_STATUS_INCOMPLETE_I965;
+
+    for (i = 1; i < num_finished; i++) {
+        VACodedBufferSegment *next = &slice_segments[i - 1];
+
+        memset(next, 0, sizeof(*next));
+        next->buf = (unsigned char *)coded_buffer_segment->base.buf + coded_buffer_segment->slice_end[i - 1];
+        next->size = coded_buffer_segment->slice_end[i] - coded_buffer_segment->slice_end[i - 1];
+        segment->next = next;
+        segment = next;
+    }
+
+    segment->next = NULL;
+
+    if (num_finished < num_slices)
+        segment->status |= VA_CODED_BUF_STATUS_INCOMPLETE_I965;
+
+    return num_finished;
+}
+
 VAStatus 
 i965_MapBuffer(VADriverContextP ctx,
                VABufferID buf_id,       /* in */
@@ -2705,7 +3066,12 @@ i965_MapBuffer(VADriverContextP ctx,
 
         dri_bo_get_tiling(obj_buffer->buffer_store->bo, &tiling, &swizzle);
 
-        if (tiling != I915_TILING_NONE)
+        /* The slices already encoded are read while the PAK writes the rest */
+        if (obj_buffer->slice_segments &&
+            tiling == I915_TILING_NONE &&
+            drm_intel_bo_busy(obj_buffer->buffer_store->bo))
+            drm_intel_gem_bo_map_unsynchronized(obj_buffer->buffer_store->bo);
+        else if (tiling != I915_TILING_NONE)
             drm_intel_gem_bo_map_gtt(obj_buffer->buffer_store->bo);
         else
             dri_bo_map(obj_buffer->buffer_store->bo, 1);
@@ -2720,7 +3086,25 @@ i965_MapBuffer(VADriverContextP ctx,
             unsigned int  header_offset = I965_CODEDBUFFER_HEADER_SIZE;
             struct i965_coded_buffer_segment *coded_buffer_segment = (struct i965_coded_buffer_segment *)(obj_buffer->buffer_store->bo->virtual);
 
-            if (!coded_buffer_segment->mapped) {
+            if (!coded_buffer_segment->mapped &&
+                obj_buffer->slice_segments &&
+                coded_buffer_segment->num_slices &&
+                drm_intel_bo_busy(obj_buffer->buffer_store->bo)) {
+                /* Return the slices finished so far, from the start of the
+                 * picture. The header is left unmapped so that the next call
+                 * returns the chain again with the slices finished since */
+                coded_buffer_segment->base.buf = (unsigned char *)(obj_buffer->buffer_store->bo->virtual) + I965_CODEDBUFFER_HEADER_SIZE;
+
+                if (i965_coded_buffer_split_slices(coded_buffer_segment,
+                                                   obj_buffer->slice_segments,
+                                                   obj_buffer->size_element - header_offset - 0x1000) < 0) {
+                    coded_buffer_segment->base.size = 0;
+                    coded_buffer_segment->base.status |= VA_CODED_BUF_STATUS_INCOMPLETE_I965;
+                    coded_buffer_segment->base.next = NULL;
+                }
+
+                vaStatus = VA_STATUS_SUCCESS;
+            } else if (!coded_buffer_segment->mapped) {
                 unsigned char delimiter0, delimiter1, delimiter2, delimiter3, delimiter4;
 
                 coded_buffer_segment->base.buf = buffer = (unsigned char *)(obj_buffer->buffer_store->bo->virtual) + I965_CODEDBUFFER_HEADER_SIZE;
@@ -2790,11 +3174,32 @@ i965_MapBuffer(VADriverContextP ctx,
                     vaStatus = VA_STATUS_SUCCESS;
                 }
 
+                if (obj_buffer->slice_segments) {
+                    coded_buffer_segment->base.status &= ~VA_CODED_BUF_STATUS_INCOMPLETE_I965;
+                    coded_buffer_segment->base.next = NULL;
+
+                    if (coded_buffer_segment->num_slices &&
+                        coded_buffer_segment->slice_end[coded_buffer_segment->num_slices - 1] != I965_CODEDBUFFER_SLICE_PENDING)
+                        i965_coded_buffer_split_slices(coded_buffer_segment,
+                                                       obj_buffer->slice_segments,
+                                                       coded_buffer_segment->base.size);
+                }
+
                 coded_buffer_segment->mapped = 1;
             } else {
                 assert(coded_buffer_segment->base.buf);
                 vaStatus = VA_STATUS_SUCCESS;
             }
+        } else if (obj_buffer->type == VAProcStatisticsBufferTypeI965) {
+            struct i965_proc_statistics_segment *statistics_segment = (struct i965_proc_statistics_segment *)(obj_buffer->buffer_store->bo->virtual);
+
+            /* The statistics are reduced from the VEBOX output once the
+             * picture is done, i.e. here */
+            if (statistics_segment->pending &&
+                obj_context &&
+                obj_context->hw_context &&
+                obj_context->hw_context->get_status)
+                vaStatus = obj_context->hw_context->get_status(ctx, obj_context->hw_context, statistics_segment);
         }
     } else if (NULL != obj_buffer->buffer_store->buffer) {
         *pbuf = obj_buffer->buffer_store->buffer;
@@ -2837,8 +3242,14 @@ i965_UnmapBuffer(VADriverContextP ctx, VABufferID buf_id)
 
         if (tiling != I915_TILING_NONE)
             drm_intel_gem_bo_unmap_gtt(obj_buffer->buffer_store->bo);
-        else
+        else {
+            if (obj_buffer->type == VASliceDataBufferType)
+                i965_update_buffer_store_shadow(obj_buffer->buffer_store,
+                                                obj_buffer->buffer_store->bo->virtual,
+                                                obj_buffer->size_element * obj_buffer->num_elements);
+
             dri_bo_unmap(obj_buffer->buffer_store->bo);
+        }
 
         vaStatus = VA_STATUS_SUCCESS;
     } else if (NULL != obj_buffer->buffer_store->buffer) {
@@ -2893,6 +3304,7 @@ i965_BeginPicture(VADriverContextP ctx,
 
     if (obj_context->codec_type == CODEC_PROC) {
         obj_context->codec_state.proc.current_render_target = render_target;
+        i965_release_buffer_store(&obj_context->codec_state.proc.statistics);
     } else if (obj_context->codec_type == CODEC_ENC) {
         /* ext */
         i965_release_buffer_store(&obj_context->codec_state.encode.pic_param_ext);
@@ -2944,6 +3356,7 @@ i965_BeginPicture(VADriverContextP ctx,
 
         obj_context->codec_state.decode.num_slice_params = 0;
         obj_context->codec_state.decode.num_slice_datas = 0;
+        obj_context->codec_state.decode.slice_data_readback_bytes = 0;
 
         if ((obj_context->wrapper_context != VA_INVALID_ID) &&
             i965->wrapper_pdrvctx) {
@@ -3522,6 +3935,7 @@ i965_encoder_render_picture(VADriverContextP ctx,
 
 #define DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(name, member) DEF_RENDER_SINGLE_BUFFER_FUNC(proc, name, member)
 DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(pipeline_parameter, pipeline_param)    
+DEF_RENDER_PROC_SINGLE_BUFFER_FUNC(statistics, statistics)
 
 static VAStatus 
 i965_proc_render_picture(VADriverContextP ctx,
@@ -3548,7 +3962,10 @@ i965_proc_render_picture(VADriverContextP ctx,
             break;
 
         default:
-            vaStatus = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
+            if (obj_buffer->type == VAProcStatisticsBufferTypeI965)
+                vaStatus = I965_RENDER_PROC_BUFFER(statistics);
+            else
+                vaStatus = VA_STATUS_ERROR_UNSUPPORTED_BUFFERTYPE;
             break;
         }
     }
@@ -4334,8 +4751,25 @@ i965_check_alloc_surface_bo(VADriverContextP ctx,
     }
 
     obj_surface->size = ALIGN(region_width * region_height, 0x1000);
+    obj_surface->fourcc = fourcc;
+    obj_surface->subsampling = subsampling;
+    obj_surface->bo_cache = &i965->surface_cache;
 
-    if ((tiled && !obj_surface->user_disable_tiling)) {
+    /* Reuse the buffer of a destroyed surface with the same layout */
+    obj_surface->bo = i965_surface_cache_get(&i965->surface_cache, obj_surface,
+                                             (tiled && !obj_surface->user_disable_tiling) ?
+                                             I915_TILING_Y : I915_TILING_NONE);
+
+    /*
+     * A recycled buffer holds the pixels of its previous surface, pad it
+     * now rather than on the first encode. If the GPU still uses it, it
+     * is padded when it is first encoded so that the creation does not
+     * stall.
+     */
+    if (obj_surface->bo && !drm_intel_bo_busy(obj_surface->bo))
+        i965_clear_surface_border(obj_surface);
+
+    if (!obj_surface->bo && (tiled && !obj_surface->user_disable_tiling)) {
         uint32_t tiling_mode = I915_TILING_Y; /* always uses Y-tiled format */
         unsigned long pitch;
 
@@ -4349,15 +4783,13 @@ i965_check_alloc_surface_bo(VADriverContextP ctx,
                                                    0);
         assert(tiling_mode == I915_TILING_Y);
         assert(pitch == obj_surface->width);
-    } else {
+    } else if (!obj_surface->bo) {
         obj_surface->bo = dri_bo_alloc(i965->intel.bufmgr,
                                        "vaapi surface",
                                        obj_surface->size,
                                        0x1000);
     }
 
-    obj_surface->fourcc = fourcc;
-    obj_surface->subsampling = subsampling;
     assert(obj_surface->bo);
     return VA_STATUS_SUCCESS;
 }
@@ -6476,10 +6908,21 @@ VAStatus i965_QueryVideoProcPipelineCaps(
 
 extern struct hw_codec_info *i965_get_codec_info(int devid);
 
+static int
+i965_bsd_bo_is_busy(void *resource, void *data)
+{
+    dri_bo * const bo = resource;
+
+    return bo && drm_intel_bo_busy(bo);
+}
+
 static bool
 i965_driver_data_init(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
+    struct intel_bsd_backend bsd_backend;
+    unsigned long surface_cache_size;
+    char *env_str;
 
     i965->codec_info = i965_get_codec_info(i965->intel.device_id);
 
@@ -6517,6 +6960,19 @@ i965_driver_data_init(VADriverContextP ctx)
     _i965InitMutex(&i965->render_mutex);
     _i965InitMutex(&i965->pp_mutex);
 
+    bsd_backend.is_busy = i965_bsd_bo_is_busy;
+    bsd_backend.data = NULL;
+    intel_bsd_scheduler_init(&i965->bsd_scheduler,
+                             i965->intel.has_bsd2 ? 2 : 1,
+                             &bsd_backend);
+    gen_bo_pool_init(&i965->codec_bo_pool, i965->intel.bufmgr);
+    i965_kernel_cache_init(&i965->kernel_cache, i965->intel.bufmgr);
+
+    surface_cache_size = I965_SURFACE_CACHE_DEFAULT_SIZE;
+    if ((env_str = getenv("VA_INTEL_SURFACE_CACHE_SIZE")))
+        surface_cache_size = strtoul(env_str, NULL, 0) * 1024 * 1024;
+    i965_surface_cache_init(&i965->surface_cache, surface_cache_size);
+
     return true;
 
 err_subpic_heap:    
@@ -6539,6 +6995,7 @@ i965_driver_data_terminate(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx); 
 
+    intel_bsd_scheduler_terminate(&i965->bsd_scheduler);
     _i965DestroyMutex(&i965->pp_mutex);
     _i965DestroyMutex(&i965->render_mutex);
 
@@ -6551,9 +7008,14 @@ i965_driver_data_terminate(VADriverContextP ctx)
     i965_destroy_heap(&i965->subpic_heap, i965_destroy_subpic);
     i965_destroy_heap(&i965->image_heap, i965_destroy_image);
     i965_destroy_heap(&i965->buffer_heap, i965_destroy_buffer);
-    i965_destroy_heap(&i965->surface_heap, i965_destroy_surface);
+    /* Contexts may still own internal surfaces */
     i965_destroy_heap(&i965->context_heap, i965_destroy_context);
+    i965_destroy_heap(&i965->surface_heap, i965_destroy_surface);
     i965_destroy_heap(&i965->config_heap, i965_destroy_config);
+
+    gen_bo_pool_terminate(&i965->codec_bo_pool);
+    i965_kernel_cache_terminate(&i965->kernel_cache);
+    i965_surface_cache_terminate(&i965->surface_cache);
 }
 
 struct {
@@ -42,6 +42,8 @@
 
 #include "i965_mutext.h"
 #include "object_heap.h"
+#include "intel_bsd_scheduler.h"
+#include "intel_media.h"
 #include "intel_driver.h"
 #include "i965_fourcc.h"
 
@@ -173,12 +175,20 @@ struct i965_kernel
     unsigned int kernel_offset;
 };
 
+/* Max number of bytes of each slice data buffer kept in host memory */
+#define I965_SLICE_DATA_SHADOW_SIZE     8192
+
 struct buffer_store
 {
     unsigned char *buffer;
     dri_bo *bo;
     int ref_count;
     int num_elements;
+
+    /* Host copy of the start of bo, so that decoders parsing slice
+     * headers do not need to read back from the GPU buffer */
+    unsigned char *shadow;
+    unsigned int shadow_size;
 };
     
 struct object_config 
@@ -216,6 +226,9 @@ struct decode_state
 
     struct object_surface *render_object;
     struct object_surface *reference_objects[16]; /* Up to 2 reference surfaces are valid for MPEG-2,*/
+
+    /* Number of slice data bytes read back from bo for the current frame */
+    unsigned int slice_data_readback_bytes;
 };
 
 #define SLICE_PACKED_DATA_INDEX_TYPE    0x80000000
@@ -288,6 +301,7 @@ struct proc_state
 {
     struct codec_state_base base;
     struct buffer_store *pipeline_param;
+    struct buffer_store *statistics;
 
     VASurfaceID current_render_target;
 };
@@ -360,6 +374,9 @@ struct object_surface
     VAImageID derived_image_id;
     void (*free_private_data)(void **data);
     void *private_data;
+    /* buffer exported to the display server, owned by the output backend */
+    void (*free_output_data)(void **data);
+    void *output_data;
     unsigned int subsampling;
     int x_cb_offset;
     int y_cb_offset;
@@ -379,6 +396,12 @@ struct object_surface
     VAGenericID wrapper_surface;
 
     int exported_primefd;
+
+    /* BSD ring of the last decode into this surface */
+    struct intel_bsd_fence bsd_fence;
+
+    /* Set when bo was allocated by the driver and may be recycled */
+    struct i965_surface_cache *bo_cache;
 };
 
 struct object_buffer 
@@ -396,6 +419,8 @@ struct object_buffer
 
     VAGenericID wrapper_buffer;
     VAContextID context_id;
+
+    VACodedBufferSegment *slice_segments;       /* per-slice segments chained after the coded buffer header */
 };
 
 struct object_image 
@@ -503,6 +528,36 @@ struct hw_codec_info
 #include "i965_render.h"
 #include "i965_gpe_utils.h"
 
+/* Limits on the buffers of destroyed surfaces kept for reuse */
+#define I965_SURFACE_CACHE_MAX_ENTRIES          64
+#define I965_SURFACE_CACHE_DEFAULT_SIZE         (128 * 1024 * 1024)
+
+struct i965_surface_cache_entry
+{
+    dri_bo *bo;
+    unsigned int fourcc;
+    unsigned int subsampling;
+    uint32_t tiling;
+    int width;
+    int height;
+    int size;
+};
+
+/*
+ * Buffers of destroyed surfaces, handed to new surfaces with the same
+ * layout. The size limit comes from VA_INTEL_SURFACE_CACHE_SIZE (in MB),
+ * 0 disables the cache.
+ */
+struct i965_surface_cache
+{
+    _I965Mutex mutex;
+    struct i965_surface_cache_entry entries[I965_SURFACE_CACHE_MAX_ENTRIES];
+    int num_entries;
+    unsigned long total_size;
+    unsigned long max_size;
+    unsigned int num_hits;              /* allocations served by the cache */
+};
+
 struct i965_driver_data 
 {
     struct intel_driver_data intel;
@@ -518,6 +573,10 @@ struct i965_driver_data
     _I965Mutex pp_mutex;
     struct intel_batchbuffer *batch;
     struct intel_batchbuffer *pp_batch;
+    struct intel_bsd_scheduler bsd_scheduler;
+    GenBoPool codec_bo_pool;    /* per-surface codec buffers, e.g. DMV */
+    struct i965_kernel_cache kernel_cache;      /* GPE kernels shared by contexts */
+    struct i965_surface_cache surface_cache;
     struct i965_render_state render_state;
     void *pp_context;
     char va_vendor[256];
@@ -605,6 +664,9 @@ va_enc_packed_type_to_idx(int packed_type);
 #define HEVC_DELIMITER3 0x00
 #define HEVC_DELIMITER4 0x00
 
+#define I965_CODEDBUFFER_MAX_SLICES     256
+#define I965_CODEDBUFFER_SLICE_PENDING  0xffffffff
+
 struct i965_coded_buffer_segment
 {
     union {
@@ -615,13 +677,70 @@ struct i965_coded_buffer_segment
     unsigned int mapped;
     unsigned int codec;
     unsigned int status_support;
-    unsigned int pad1;
+    unsigned int num_slices;                    /* slices recorded in slice_end[], 0 if not enabled */
 
     unsigned int codec_private_data[512];       /* Store codec private data, must be 16-bytes aligned */
+
+    unsigned int slice_end[I965_CODEDBUFFER_MAX_SLICES]; /* end offset of each slice, written by the PAK */
 };
 
 #define I965_CODEDBUFFER_HEADER_SIZE   ALIGN(sizeof(struct i965_coded_buffer_segment), 0x1000)
 
+/*
+ * Per-slice readout. When the encoder records the end of each slice in
+ * slice_end[], vaMapBuffer() returns one segment per slice. A coded
+ * buffer mapped while the picture is still being encoded returns the
+ * slices finished so far, from the first slice of the picture, with
+ * VA_CODED_BUF_STATUS_INCOMPLETE_I965 set on the last segment. Each new map
+ * returns the whole chain again; the application skips the segments it
+ * already sent.
+ */
+#define VA_CODED_BUF_STATUS_INCOMPLETE_I965     0x40000000
+
+int
+i965_coded_buffer_split_slices(struct i965_coded_buffer_segment *coded_buffer_segment,
+                               VACodedBufferSegment *slice_segments,
+                               unsigned int max_size);
+
+/*
+ * VEBOX statistics. A buffer of this driver specific type rendered along
+ * with a VAProcPipelineParameterBuffer receives the statistics gathered
+ * by VEBOX while processing that picture. vaMapBuffer() returns a
+ * VAProcStatisticsI965; flags tells which fields the pipeline produced.
+ */
+#define VAProcStatisticsBufferTypeI965          ((VABufferType)0x10001)
+
+#define VA_PROC_STATISTICS_HISTOGRAM            0x00000001
+#define VA_PROC_STATISTICS_NOISE                0x00000002
+#define VA_PROC_STATISTICS_FIELD_MOTION         0x00000004
+
+typedef struct _VAProcStatisticsI965
+{
+    unsigned int flags;
+    unsigned int histogram[256];                /* luma histogram */
+    unsigned int noise_sum[3];                  /* global noise estimate, Y/U/V */
+    unsigned int noise_count[3];
+    unsigned int field_motion[11];              /* field motion detection counters */
+} VAProcStatisticsI965;
+
+struct i965_proc_statistics_segment
+{
+    union {
+        VAProcStatisticsI965 base;
+        unsigned char pad0[2048];               /* change the size if sizeof(VAProcStatisticsI965) > 2048 */
+    };
+
+    unsigned int pending;                       /* VEBOX wrote statistics not parsed yet */
+    unsigned int flags;
+    unsigned int frame_offset;                  /* per-frame statistics, from the statistics surface */
+    unsigned int histogram_offset;
+    unsigned int slice_pitch;                   /* per-frame statistics size of a VEBOX slice */
+    unsigned int histogram_pitch;
+    unsigned int num_slices;
+};
+
+#define I965_PROC_STATISTICS_HEADER_SIZE        ALIGN(sizeof(struct i965_proc_statistics_segment), 0x1000)
+
 extern VAStatus i965_MapBuffer(VADriverContextP ctx,
 		VABufferID buf_id,       /* in */
 		void **pbuf);            /* out */
@@ -646,4 +765,13 @@ extern VAStatus i965_CreateSurfaces(VADriverContextP ctx,
 void
 i965_destroy_surface_storage(struct object_surface *obj_surface);
 
+VAStatus
+i965_clear_surface_border(struct object_surface *obj_surface);
+
+void
+i965_surface_cache_init(struct i965_surface_cache *cache, unsigned long max_size);
+
+void
+i965_surface_cache_terminate(struct i965_surface_cache *cache);
+
 #endif /* _I965_DRV_VIDEO_H_ */
@@ -37,6 +37,8 @@
 #include "i965_defines.h"
 #include "i965_drv_video.h"
 #include "i965_encoder.h"
+#include "i965_encoder_analysis.h"
+#include "i965_encoder_stats.h"
 #include "gen6_vme.h"
 #include "gen6_mfc.h"
 
@@ -54,56 +56,62 @@ reduce_fraction(struct intel_fraction f)
     return (struct intel_fraction) { f.num / b, f.den / b };
 }
 
-static VAStatus
-clear_border(struct object_surface *obj_surface)
+/*
+ * The input is converted into a staging surface owned by the encoder
+ * context, which is only reallocated when the size or the format of the
+ * input changes
+ */
+static struct object_surface *
+intel_encoder_get_staging_surface(VADriverContextP ctx,
+                                  struct intel_encoder_context *encoder_context,
+                                  int width,
+                                  int height,
+                                  int format,
+                                  unsigned int fourcc,
+                                  int subsample)
 {
-    int width[3], height[3], hstride[3], vstride[3]; /* in byte */
-    int planes;
-    unsigned char* p;
-    int i,j;
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct object_surface *obj_surface = NULL;
+    VAStatus status;
 
-    if (obj_surface->border_cleared)
-        return VA_STATUS_SUCCESS;
+    if (encoder_context->staging_yuv_surface != VA_INVALID_SURFACE)
+        obj_surface = SURFACE(encoder_context->staging_yuv_surface);
 
-    if (obj_surface->fourcc == VA_FOURCC_NV12) {
-        planes = 2;
-        width[0] = width[1] = obj_surface->orig_width;
-        height[0] = obj_surface->orig_height;
-        height[1] = obj_surface->orig_height / 2;
-        hstride[0] = hstride[1] = obj_surface->width;
-        vstride[0]= obj_surface->height;
-        vstride[1] = obj_surface->height / 2;
+    if (obj_surface &&
+        obj_surface->orig_width == width &&
+        obj_surface->orig_height == height &&
+        obj_surface->fourcc == fourcc)
+        return obj_surface;
 
-    } else {
-        /* todo add P010 */
-        return VA_STATUS_SUCCESS;
+    if (obj_surface)
+        i965_DestroySurfaces(ctx, &encoder_context->staging_yuv_surface, 1);
+
+    encoder_context->staging_yuv_surface = VA_INVALID_SURFACE;
+
+    status = i965_CreateSurfaces(ctx,
+                                 width,
+                                 height,
+                                 format,
+                                 1,
+                                 &encoder_context->staging_yuv_surface);
+
+    if (status != VA_STATUS_SUCCESS) {
+        encoder_context->staging_yuv_surface = VA_INVALID_SURFACE;
+        return NULL;
     }
-    drm_intel_gem_bo_map_gtt(obj_surface->bo);
-
-    p = (unsigned char*)obj_surface->bo->virtual;
-    if (!p)
-        return VA_STATUS_ERROR_INVALID_SURFACE;
-
-    for (i = 0; i < planes; i++) {
-        int w = width[i];
-        int h = height[i];
-        int hs = hstride[i];
-        int vs = vstride[i];
-        /* right */
-        for (j = 0; j < h; j++) {
-            memset(p + w, 0, hs - w);
-            p += hs;
-        }
-        /* bottom */
-        for (/* nothing */; j < vs; j++) {
-            memset(p, 0, hs);
-            p += hs;
-        }
 
+    obj_surface = SURFACE(encoder_context->staging_yuv_surface);
+    assert(obj_surface);
+
+    status = i965_check_alloc_surface_bo(ctx, obj_surface, 1, fourcc, subsample);
+
+    if (status != VA_STATUS_SUCCESS) {
+        i965_DestroySurfaces(ctx, &encoder_context->staging_yuv_surface, 1);
+        encoder_context->staging_yuv_surface = VA_INVALID_SURFACE;
+        return NULL;
     }
-    drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
-    obj_surface->border_cleared = true;
-    return VA_STATUS_SUCCESS;
+
+    return obj_surface;
 }
 
 static VAStatus
@@ -120,13 +128,7 @@ intel_encoder_check_yuv_surface(VADriverContextP ctx,
     int format = VA_RT_FORMAT_YUV420;
     unsigned int fourcc = VA_FOURCC_NV12;
 
-    /* releae the temporary surface */
-    if (encoder_context->is_tmp_id) {
-        i965_DestroySurfaces(ctx, &encoder_context->input_yuv_surface, 1);
-        encode_state->input_yuv_object = NULL;
-    }
-
-    encoder_context->is_tmp_id = 0;
+    encode_state->input_yuv_object = NULL;
     obj_surface = SURFACE(encode_state->current_render_target);
     assert(obj_surface && obj_surface->bo);
 
@@ -147,7 +149,7 @@ intel_encoder_check_yuv_surface(VADriverContextP ctx,
         if (tiling == I915_TILING_Y) {
             encoder_context->input_yuv_surface = encode_state->current_render_target;
             encode_state->input_yuv_object = obj_surface;
-            return clear_border(obj_surface);
+            return i965_clear_surface_border(obj_surface);
         }
     }
 
@@ -165,19 +167,18 @@ intel_encoder_check_yuv_surface(VADriverContextP ctx,
     src_surface.type = I965_SURFACE_TYPE_SURFACE;
     src_surface.flags = I965_SURFACE_FLAG_FRAME;
     
-    status = i965_CreateSurfaces(ctx,
-                                 obj_surface->orig_width,
-                                 obj_surface->orig_height,
-                                 format,
-                                 1,
-                                 &encoder_context->input_yuv_surface);
-    ASSERT_RET(status == VA_STATUS_SUCCESS, status);
-
-    obj_surface = SURFACE(encoder_context->input_yuv_surface);
+    obj_surface = intel_encoder_get_staging_surface(ctx,
+                                                    encoder_context,
+                                                    rect.width,
+                                                    rect.height,
+                                                    format,
+                                                    fourcc,
+                                                    SUBSAMPLE_YUV420);
+    ASSERT_RET(obj_surface, VA_STATUS_ERROR_ALLOCATION_FAILED);
+
+    encoder_context->input_yuv_surface = encoder_context->staging_yuv_surface;
     encode_state->input_yuv_object = obj_surface;
-    assert(obj_surface);
-    i965_check_alloc_surface_bo(ctx, obj_surface, 1, fourcc, SUBSAMPLE_YUV420);
-    
+
     dst_surface.base = (struct object_base *)obj_surface;
     dst_surface.type = I965_SURFACE_TYPE_SURFACE;
     dst_surface.flags = I965_SURFACE_FLAG_FRAME;
@@ -189,9 +190,10 @@ intel_encoder_check_yuv_surface(VADriverContextP ctx,
                                    &rect);
     assert(status == VA_STATUS_SUCCESS);
 
-    encoder_context->is_tmp_id = 1;
+    /* The conversion may have written past the visible area */
+    obj_surface->border_cleared = false;
 
-    return clear_border(obj_surface);
+    return i965_clear_surface_border(obj_surface);
 }
 
 
@@ -208,13 +210,7 @@ intel_encoder_check_jpeg_yuv_surface(VADriverContextP ctx,
     VARectangle rect;
     int format=0, fourcc=0, subsample=0;
 
-    /* releae the temporary surface */
-    if (encoder_context->is_tmp_id) {
-        i965_DestroySurfaces(ctx, &encoder_context->input_yuv_surface, 1);
-        encode_state->input_yuv_object = NULL;
-    }
-
-    encoder_context->is_tmp_id = 0;
+    encode_state->input_yuv_object = NULL;
     obj_surface = SURFACE(encode_state->current_render_target);
     assert(obj_surface && obj_surface->bo);
 
@@ -283,21 +279,20 @@ intel_encoder_check_jpeg_yuv_surface(VADriverContextP ctx,
             break;
     }
 
-    status = i965_CreateSurfaces(ctx,
-                                 obj_surface->orig_width,
-                                 obj_surface->orig_height,
-                                 format,
-                                 1,
-                                 &encoder_context->input_yuv_surface);
-    assert(status == VA_STATUS_SUCCESS);
+    obj_surface = intel_encoder_get_staging_surface(ctx,
+                                                    encoder_context,
+                                                    rect.width,
+                                                    rect.height,
+                                                    format,
+                                                    fourcc,
+                                                    subsample);
+    assert(obj_surface);
 
-    if (status != VA_STATUS_SUCCESS)
-        return status;
+    if (!obj_surface)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
-    obj_surface = SURFACE(encoder_context->input_yuv_surface);
+    encoder_context->input_yuv_surface = encoder_context->staging_yuv_surface;
     encode_state->input_yuv_object = obj_surface;
-    assert(obj_surface);
-    i965_check_alloc_surface_bo(ctx, obj_surface, 1, fourcc, subsample);
 
     dst_surface.base = (struct object_base *)obj_surface;
     dst_surface.type = I965_SURFACE_TYPE_SURFACE;
@@ -314,8 +309,6 @@ intel_encoder_check_jpeg_yuv_surface(VADriverContextP ctx,
         assert(status == VA_STATUS_SUCCESS);
     }
 
-    encoder_context->is_tmp_id = 1;
-
     return VA_STATUS_SUCCESS;
 }
 
@@ -729,7 +722,7 @@ intel_encoder_check_brc_parameter(VADriverContextP ctx,
     return VA_STATUS_SUCCESS;
 }
 
-static VAStatus
+VAStatus
 intel_encoder_check_temporal_layer_structure(VADriverContextP ctx,
                                              struct encode_state *encode_state,
                                              struct intel_encoder_context *encoder_context)
@@ -777,6 +770,18 @@ intel_encoder_check_temporal_layer_structure(VADriverContextP ctx,
         }
     }
 
+    /* VDENC rate controls each layer on the bits it adds to the ones below */
+    if (encoder_context->low_power_mode) {
+        for (i = 1; i < tls_paramter->number_of_layers; i++) {
+            VAEncMiscParameterBuffer *lower_param = (VAEncMiscParameterBuffer *)encode_state->misc_param[VAEncMiscParameterTypeRateControl][i - 1]->buffer;
+            VAEncMiscParameterBuffer *layer_param = (VAEncMiscParameterBuffer *)encode_state->misc_param[VAEncMiscParameterTypeRateControl][i]->buffer;
+
+            if (((VAEncMiscParameterRateControl *)layer_param->data)->bits_per_second <=
+                ((VAEncMiscParameterRateControl *)lower_param->data)->bits_per_second)
+                return VA_STATUS_ERROR_INVALID_PARAMETER;
+        }
+    }
+
     encoder_context->layer.size_frame_layer_ids = tls_paramter->periodicity;
     encoder_context->layer.num_layers = tls_paramter->number_of_layers;
 
@@ -1351,6 +1356,12 @@ intel_encoder_context_destroy(void *hw_context)
         encoder_context->enc_priv_state = NULL;
     }
 
+    if (encoder_context->staging_yuv_surface != VA_INVALID_SURFACE)
+        i965_DestroySurfaces(encoder_context->ctx, &encoder_context->staging_yuv_surface, 1);
+
+    intel_enc_analysis_destroy(encoder_context->analysis);
+    intel_enc_stats_destroy(encoder_context->stats);
+
     intel_batchbuffer_free(encoder_context->base.batch);
     free(encoder_context);
 }
@@ -1379,6 +1390,7 @@ intel_enc_hw_context_init(VADriverContextP ctx,
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_driver_data *intel = intel_driver_data(ctx);
     struct intel_encoder_context *encoder_context = calloc(1, sizeof(struct intel_encoder_context));
+    char *env_str;
     int i;
 
     assert(encoder_context);
@@ -1386,8 +1398,9 @@ intel_enc_hw_context_init(VADriverContextP ctx,
     encoder_context->base.run = intel_encoder_end_picture;
     encoder_context->base.get_status = intel_encoder_get_status;
     encoder_context->base.batch = intel_batchbuffer_new(intel, I915_EXEC_RENDER, 0);
+    encoder_context->ctx = ctx;
     encoder_context->input_yuv_surface = VA_INVALID_SURFACE;
-    encoder_context->is_tmp_id = 0;
+    encoder_context->staging_yuv_surface = VA_INVALID_SURFACE;
     encoder_context->low_power_mode = 0;
     encoder_context->rate_control_mode = VA_RC_NONE;
     encoder_context->quality_level = ENCODER_DEFAULT_QUALITY;
@@ -1474,6 +1487,37 @@ intel_enc_hw_context_init(VADriverContextP ctx,
         }
     }
 
+    /*
+     * The gen9 AVC and VP9 BRC can weigh the target of each picture with
+     * its complexity against the last VA_INTEL_ENC_ANALYSIS_DEPTH pictures
+     */
+    if (!encoder_context->low_power_mode &&
+        (encoder_context->codec == CODEC_H264 || encoder_context->codec == CODEC_VP9) &&
+        (env_str = getenv("VA_INTEL_ENC_ANALYSIS_DEPTH")))
+        encoder_context->analysis = intel_enc_analysis_create(strtol(env_str, NULL, 0));
+
+    /*
+     * Two-pass encoding with the software BRC of AVC and HEVC: the first
+     * pass writes the stats of each picture to VA_INTEL_ENC_STATS_OUT, the
+     * second pass plans its QPs from the stats in VA_INTEL_ENC_STATS_IN
+     */
+    if (!encoder_context->low_power_mode &&
+        (encoder_context->codec == CODEC_H264 || encoder_context->codec == CODEC_HEVC) &&
+        (encoder_context->rate_control_mode & (VA_RC_CBR | VA_RC_VBR)) &&
+        (getenv("VA_INTEL_ENC_STATS_OUT") || getenv("VA_INTEL_ENC_STATS_IN")))
+        encoder_context->stats = intel_enc_stats_create(encoder_context->codec,
+                                                        getenv("VA_INTEL_ENC_STATS_OUT"),
+                                                        getenv("VA_INTEL_ENC_STATS_IN"));
+
+    /*
+     * Low latency output: the PAK records the end of each slice so that
+     * the slices already encoded can be mapped before the picture is done
+     */
+    if (!encoder_context->low_power_mode &&
+        encoder_context->codec == CODEC_H264 &&
+        getenv("VA_INTEL_ENC_SLICE_SEGMENTS"))
+        encoder_context->slice_segments = 1;
+
     if (vme_context_init) {
         vme_context_init(ctx, encoder_context);
         assert(!encoder_context->vme_context ||
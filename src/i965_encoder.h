@@ -64,8 +64,10 @@ struct intel_fraction
 struct intel_encoder_context
 {
     struct hw_context base;
+    VADriverContextP ctx;
     int codec;
     VASurfaceID input_yuv_surface;
+    VASurfaceID staging_yuv_surface;    /* input converted to a tiled layout */
     unsigned int rate_control_mode;
     unsigned int quality_level;
     unsigned int quality_range;
@@ -107,12 +109,14 @@ struct intel_encoder_context
     void *vme_context;
     void *mfc_context;
     void *enc_priv_state;
+    struct intel_enc_analysis *analysis;        /* input pre-analysis for BRC */
+    struct intel_enc_stats *stats;              /* two-pass statistics */
 
-    unsigned int is_tmp_id:1;
     unsigned int low_power_mode:1;
     unsigned int soft_batch_force:1;
     unsigned int context_roi:1;
     unsigned int is_new_sequence:1; /* Currently only valid for H.264, TODO for other codecs */
+    unsigned int slice_segments:1;  /* return the coded buffer slice by slice */
 
     void (*vme_context_destroy)(void *vme_context);
     VAStatus (*vme_pipeline)(VADriverContextP ctx,
@@ -140,6 +144,11 @@ gen8_enc_hw_context_init(VADriverContextP ctx, struct object_config *obj_config)
 
 extern struct hw_context *
 gen9_enc_hw_context_init(VADriverContextP ctx, struct object_config *obj_config);
+
+VAStatus
+intel_encoder_check_temporal_layer_structure(VADriverContextP ctx,
+                                             struct encode_state *encode_state,
+                                             struct intel_encoder_context *encoder_context);
 #endif	/* _I965_ENCODER_H_ */
 
 
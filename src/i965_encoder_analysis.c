@@ -0,0 +1,382 @@
+/*
+ * Copyright © 2011 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "intel_driver.h"
+#include "i965_drv_video.h"
+#include "i965_encoder_analysis.h"
+
+#define ANALYSIS_BLOCK          INTEL_ENC_ANALYSIS_BLOCK
+#define ANALYSIS_SEARCH         INTEL_ENC_ANALYSIS_SEARCH
+
+struct intel_enc_analysis *
+intel_enc_analysis_create(int depth)
+{
+    struct intel_enc_analysis *analysis;
+
+    if (depth <= 0)
+        return NULL;
+
+    analysis = calloc(1, sizeof(*analysis));
+    if (!analysis)
+        return NULL;
+
+    analysis->depth = MIN(depth, INTEL_ENC_ANALYSIS_MAX_DEPTH);
+    analysis->history = calloc(analysis->depth, sizeof(*analysis->history));
+    if (!analysis->history) {
+        free(analysis);
+        return NULL;
+    }
+
+    return analysis;
+}
+
+void
+intel_enc_analysis_destroy(struct intel_enc_analysis *analysis)
+{
+    if (!analysis)
+        return;
+
+    free(analysis->planes[0]);
+    free(analysis->planes[1]);
+    free(analysis->history);
+    free(analysis);
+}
+
+/* Address of the luma byte (x, y) of a linear or Y-tiled plane */
+static inline const unsigned char *
+analysis_src_pixel(const unsigned char *src, int pitch, bool y_tiled, int x, int y)
+{
+    if (!y_tiled)
+        return src + y * pitch + x;
+
+    return src + Y_TILED_OFFSET(pitch, x, y);
+}
+
+/*
+ * Box filters the luma plane at src down to a width x height plane at
+ * dst, 4x4 pixels to one. The 4 bytes of a row of a box never straddle a
+ * 16-byte Y tile column, so they are contiguous in both layouts.
+ */
+void
+intel_enc_analysis_downscale(const unsigned char *src, int pitch, bool y_tiled,
+                             unsigned char *dst, int width, int height)
+{
+    const unsigned char *row;
+    int x, y, i, sum;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            sum = 0;
+
+            for (i = 0; i < 4; i++) {
+                row = analysis_src_pixel(src, pitch, y_tiled, x * 4, y * 4 + i);
+                sum += row[0] + row[1] + row[2] + row[3];
+            }
+
+            dst[y * width + x] = (sum + 8) >> 4;
+        }
+    }
+}
+
+unsigned char *
+intel_enc_analysis_plane(struct intel_enc_analysis *analysis,
+                         int width, int height)
+{
+    int i;
+
+    if (width != analysis->width || height != analysis->height) {
+        for (i = 0; i < 2; i++) {
+            free(analysis->planes[i]);
+            analysis->planes[i] = malloc(width * height);
+        }
+
+        if (!analysis->planes[0] || !analysis->planes[1])
+            width = height = 0;
+
+        /* The costs of another size are no reference */
+        analysis->width = width;
+        analysis->height = height;
+        analysis->num_frames = 0;
+        analysis->history_count = 0;
+    }
+
+    if (!width || !height)
+        return NULL;
+
+    return analysis->planes[analysis->cur];
+}
+
+static inline unsigned int
+analysis_block_sad(const unsigned char *a, const unsigned char *b, int pitch)
+{
+    unsigned int sad = 0;
+    int i;
+
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+
+    for (i = 0; i < ANALYSIS_BLOCK; i++) {
+        __m128i va = _mm_loadl_epi64((const __m128i *)(a + i * pitch));
+        __m128i vb = _mm_loadl_epi64((const __m128i *)(b + i * pitch));
+
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sad = _mm_cvtsi128_si32(acc);
+#else
+    int j;
+
+    for (i = 0; i < ANALYSIS_BLOCK; i++) {
+        for (j = 0; j < ANALYSIS_BLOCK; j++)
+            sad += abs(a[i * pitch + j] - b[i * pitch + j]);
+    }
+#endif
+
+    return sad;
+}
+
+/* Sum of the differences to the block mean, the cost of a DC prediction */
+static unsigned int
+analysis_block_intra_cost(const unsigned char *p, int pitch)
+{
+    unsigned int sum = 0, cost = 0, mean;
+    int i, j;
+
+    for (i = 0; i < ANALYSIS_BLOCK; i++) {
+        for (j = 0; j < ANALYSIS_BLOCK; j++)
+            sum += p[i * pitch + j];
+    }
+
+    mean = (sum + ANALYSIS_BLOCK * ANALYSIS_BLOCK / 2) / (ANALYSIS_BLOCK * ANALYSIS_BLOCK);
+
+    for (i = 0; i < ANALYSIS_BLOCK; i++) {
+        for (j = 0; j < ANALYSIS_BLOCK; j++)
+            cost += abs(p[i * pitch + j] - (int)mean);
+    }
+
+    return cost;
+}
+
+/* Full search of the best match of a block in the previous picture */
+static unsigned int
+analysis_block_inter_cost(const unsigned char *cur, const unsigned char *ref,
+                          int width, int height, int x, int y)
+{
+    unsigned int cost = ~0u, sad;
+    int x0 = MAX(x - ANALYSIS_SEARCH, 0);
+    int y0 = MAX(y - ANALYSIS_SEARCH, 0);
+    int x1 = MIN(x + ANALYSIS_SEARCH, width - ANALYSIS_BLOCK);
+    int y1 = MIN(y + ANALYSIS_SEARCH, height - ANALYSIS_BLOCK);
+    int i, j;
+
+    for (j = y0; j <= y1; j++) {
+        for (i = x0; i <= x1; i++) {
+            sad = analysis_block_sad(cur, ref + j * width + i, width);
+            if (sad < cost)
+                cost = sad;
+        }
+    }
+
+    return cost;
+}
+
+/*
+ * Analyses the picture in the plane returned by intel_enc_analysis_plane()
+ * against the previous one. A picture whose motion searched cost comes
+ * close to its intra cost, and well above the recent inter costs, starts
+ * a new scene.
+ */
+const struct intel_enc_frame_analysis *
+intel_enc_analysis_add_frame(struct intel_enc_analysis *analysis)
+{
+    struct intel_enc_frame_analysis *last = &analysis->last;
+    const unsigned char *cur = analysis->planes[analysis->cur];
+    const unsigned char *ref = analysis->planes[!analysis->cur];
+    int width = analysis->width, height = analysis->height;
+    unsigned long long intra_sum = 0, inter_sum = 0, num_pixels;
+    unsigned int intra, inter;
+    int x, y, i, n;
+
+    if (!cur)
+        return NULL;
+
+    for (y = 0; y + ANALYSIS_BLOCK <= height; y += ANALYSIS_BLOCK) {
+        for (x = 0; x + ANALYSIS_BLOCK <= width; x += ANALYSIS_BLOCK) {
+            intra = analysis_block_intra_cost(cur + y * width + x, width);
+            inter = intra;
+
+            if (analysis->num_frames)
+                inter = MIN(inter, analysis_block_inter_cost(cur + y * width + x,
+                                                             ref, width, height, x, y));
+
+            intra_sum += intra;
+            inter_sum += inter;
+        }
+    }
+
+    num_pixels = (unsigned long long)(width / ANALYSIS_BLOCK) * (height / ANALYSIS_BLOCK) *
+        ANALYSIS_BLOCK * ANALYSIS_BLOCK;
+    if (!num_pixels)
+        num_pixels = 1;
+
+    last->intra_cost = intra_sum * 16 / num_pixels;
+    last->inter_cost = inter_sum * 16 / num_pixels;
+
+    analysis->mean_intra_cost = 0;
+    analysis->mean_inter_cost = 0;
+    if (analysis->history_count) {
+        unsigned long long intra_total = 0, inter_total = 0;
+
+        for (i = 0; i < analysis->history_count; i++) {
+            intra_total += analysis->history[i].intra_cost;
+            inter_total += analysis->history[i].inter_cost;
+        }
+
+        analysis->mean_intra_cost = intra_total / analysis->history_count;
+        analysis->mean_inter_cost = inter_total / analysis->history_count;
+    }
+
+    last->scene_change = (analysis->num_frames &&
+                          last->inter_cost >= 16 &&
+                          last->inter_cost * 10 >= last->intra_cost * 6 &&
+                          last->inter_cost >= analysis->mean_inter_cost * 2);
+
+    n = analysis->history_head;
+    analysis->history[n] = *last;
+    analysis->history_head = (n + 1) % analysis->depth;
+    if (analysis->history_count < analysis->depth)
+        analysis->history_count++;
+
+    analysis->cur = !analysis->cur;
+    analysis->num_frames++;
+    analysis->last_valid = true;
+
+    return last;
+}
+
+/*
+ * Analyses the luma of an 8-bit NV12 input surface. A Y-tiled surface
+ * without bit 6 swizzling is read through a CPU mapping, other tiled
+ * surfaces through the GTT.
+ */
+bool
+intel_enc_analysis_surface(struct intel_enc_analysis *analysis,
+                           struct object_surface *obj_surface)
+{
+    uint32_t tiling = I915_TILING_NONE, swizzle = I915_BIT_6_SWIZZLE_NONE;
+    unsigned char *plane;
+    bool use_gtt;
+
+    if (!analysis)
+        return false;
+
+    analysis->last_valid = false;
+
+    if (!obj_surface || !obj_surface->bo ||
+        obj_surface->fourcc != VA_FOURCC_NV12)
+        return false;
+
+    plane = intel_enc_analysis_plane(analysis,
+                                     obj_surface->orig_width / 4,
+                                     obj_surface->orig_height / 4);
+    if (!plane)
+        return false;
+
+    dri_bo_get_tiling(obj_surface->bo, &tiling, &swizzle);
+    use_gtt = (tiling != I915_TILING_NONE &&
+               (tiling != I915_TILING_Y || swizzle != I915_BIT_6_SWIZZLE_NONE));
+
+    if (use_gtt)
+        drm_intel_gem_bo_map_gtt(obj_surface->bo);
+    else
+        dri_bo_map(obj_surface->bo, 0);
+
+    if (!obj_surface->bo->virtual)
+        return false;
+
+    intel_enc_analysis_downscale(obj_surface->bo->virtual,
+                                 obj_surface->width,
+                                 tiling == I915_TILING_Y && !use_gtt,
+                                 plane, analysis->width, analysis->height);
+
+    if (use_gtt)
+        drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+    else
+        dri_bo_unmap(obj_surface->bo);
+
+    return intel_enc_analysis_add_frame(analysis) != NULL;
+}
+
+/*
+ * Bits to add to the BRC target of the last analysed picture. Pictures
+ * more complex than the recent ones of the same kind get more, simpler
+ * ones less; a scene change is weighed against the recent inter costs
+ * with its intra cost. The rate over time is left to the BRC, the
+ * adjustment only moves bits between neighbouring pictures.
+ */
+double
+intel_enc_analysis_extra_bits(const struct intel_enc_analysis *analysis,
+                              int is_intra,
+                              double bits_per_frame,
+                              double buffer_size)
+{
+    const struct intel_enc_frame_analysis *last;
+    double cost, mean, ratio, max_ratio = 2.0, extra;
+
+    if (!analysis || !analysis->last_valid || analysis->history_count < 2)
+        return 0;
+
+    last = &analysis->last;
+
+    if (is_intra) {
+        cost = last->intra_cost;
+        mean = analysis->mean_intra_cost;
+    } else if (last->scene_change) {
+        cost = last->intra_cost;
+        mean = analysis->mean_inter_cost;
+        max_ratio = 4.0;
+    } else {
+        cost = last->inter_cost;
+        mean = analysis->mean_inter_cost;
+    }
+
+    if (mean <= 0)
+        return 0;
+
+    ratio = sqrt(cost / mean);
+    ratio = MIN(MAX(ratio, 0.5), max_ratio);
+
+    extra = (ratio - 1.0) * bits_per_frame;
+    extra = MIN(MAX(extra, -buffer_size / 8), buffer_size / 8);
+
+    return extra;
+}
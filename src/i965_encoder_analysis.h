@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2011 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef I965_ENCODER_ANALYSIS_H
+#define I965_ENCODER_ANALYSIS_H
+
+#include <stdbool.h>
+
+#define INTEL_ENC_ANALYSIS_MAX_DEPTH    60
+#define INTEL_ENC_ANALYSIS_BLOCK        8       /* in downscaled pixels */
+#define INTEL_ENC_ANALYSIS_SEARCH       4       /* in downscaled pixels */
+
+struct object_surface;
+
+/* Costs of a picture, per downscaled pixel in 1/16 units */
+struct intel_enc_frame_analysis
+{
+    unsigned int intra_cost;
+    unsigned int inter_cost;
+    int scene_change;
+};
+
+/*
+ * Pre-analysis of the encoder input on a 4x downscaled luma plane. Each
+ * picture gets an intra cost and a motion searched inter cost against
+ * the previous picture. The costs of the last depth pictures give the
+ * BRC a reference for how complex the current picture is.
+ */
+struct intel_enc_analysis
+{
+    int depth;
+    int width, height;                  /* of the downscaled planes */
+    unsigned char *planes[2];           /* current and previous picture */
+    int cur;
+    int num_frames;
+    struct intel_enc_frame_analysis *history;   /* ring of depth entries */
+    int history_head;
+    int history_count;
+
+    /* The last picture and the mean costs of the pictures before it */
+    struct intel_enc_frame_analysis last;
+    bool last_valid;
+    unsigned int mean_intra_cost;
+    unsigned int mean_inter_cost;
+};
+
+struct intel_enc_analysis *
+intel_enc_analysis_create(int depth);
+
+void
+intel_enc_analysis_destroy(struct intel_enc_analysis *analysis);
+
+void
+intel_enc_analysis_downscale(const unsigned char *src, int pitch, bool y_tiled,
+                             unsigned char *dst, int width, int height);
+
+unsigned char *
+intel_enc_analysis_plane(struct intel_enc_analysis *analysis,
+                         int width, int height);
+
+const struct intel_enc_frame_analysis *
+intel_enc_analysis_add_frame(struct intel_enc_analysis *analysis);
+
+bool
+intel_enc_analysis_surface(struct intel_enc_analysis *analysis,
+                           struct object_surface *obj_surface);
+
+double
+intel_enc_analysis_extra_bits(const struct intel_enc_analysis *analysis,
+                              int is_intra,
+                              double bits_per_frame,
+                              double buffer_size);
+
+#endif /* I965_ENCODER_ANALYSIS_H */
@@ -0,0 +1,277 @@
+/*
+ * Copyright © 2011 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "intel_driver.h"
+#include "i965_encoder_stats.h"
+
+/* Pictures over which the second pass pays back a drift from the plan */
+#define STATS_DRIFT_FRAMES      30
+
+static inline double
+stats_qp_to_qstep(double qp)
+{
+    return pow(2.0, (qp - 4.0) / 6.0);
+}
+
+static inline double
+stats_qstep_to_qp(double qstep)
+{
+    return 4.0 + 6.0 * log2(qstep);
+}
+
+static inline void
+stats_put_le(unsigned char *p, uint32_t value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        p[i] = value >> (8 * i);
+}
+
+static inline uint32_t
+stats_get_le(const unsigned char *p, int bytes)
+{
+    uint32_t value = 0;
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        value |= (uint32_t)p[i] << (8 * i);
+
+    return value;
+}
+
+/* Bits times the quantizer step of a first pass picture */
+static inline double
+stats_complexity(const struct intel_enc_stats_record *record)
+{
+    return MAX(record->frame_bits, 1) * stats_qp_to_qstep(record->qp);
+}
+
+struct intel_enc_stats *
+intel_enc_stats_create(int codec, const char *out_path, const char *in_path)
+{
+    struct intel_enc_stats *stats;
+    unsigned char header[INTEL_ENC_STATS_HEADER_SIZE];
+    FILE *in;
+
+    stats = calloc(1, sizeof(*stats));
+    if (!stats)
+        return NULL;
+
+    stats->codec = codec;
+
+    if (in_path) {
+        in = fopen(in_path, "rb");
+        if (!in || !intel_enc_stats_read(stats, in))
+            fprintf(stderr, "Failed to read the encoder stats from %s\n", in_path);
+        if (in)
+            fclose(in);
+    }
+
+    if (out_path) {
+        memcpy(header, INTEL_ENC_STATS_MAGIC, 4);
+        stats_put_le(header + 4, INTEL_ENC_STATS_VERSION, 2);
+        stats_put_le(header + 6, codec, 2);
+
+        stats->out = fopen(out_path, "wb");
+        if (stats->out && fwrite(header, sizeof(header), 1, stats->out) != 1) {
+            fclose(stats->out);
+            stats->out = NULL;
+        }
+        if (!stats->out)
+            fprintf(stderr, "Failed to write the encoder stats to %s\n", out_path);
+    }
+
+    if (!stats->out && !stats->frames) {
+        free(stats);
+        return NULL;
+    }
+
+    return stats;
+}
+
+void
+intel_enc_stats_destroy(struct intel_enc_stats *stats)
+{
+    if (!stats)
+        return;
+
+    if (stats->out)
+        fclose(stats->out);
+
+    free(stats->frames);
+    free(stats);
+}
+
+/*
+ * Loads the records of a first pass of the same codec. A truncated last
+ * record, from a first pass that did not finish, is dropped.
+ */
+bool
+intel_enc_stats_read(struct intel_enc_stats *stats, FILE *in)
+{
+    unsigned char buf[INTEL_ENC_STATS_RECORD_SIZE];
+    struct intel_enc_stats_record *frames = NULL, *record;
+    int num_frames = 0, max_frames = 0;
+
+    if (fread(buf, INTEL_ENC_STATS_HEADER_SIZE, 1, in) != 1 ||
+        memcmp(buf, INTEL_ENC_STATS_MAGIC, 4) ||
+        stats_get_le(buf + 4, 2) != INTEL_ENC_STATS_VERSION ||
+        stats_get_le(buf + 6, 2) != (uint32_t)stats->codec)
+        return false;
+
+    while (fread(buf, INTEL_ENC_STATS_RECORD_SIZE, 1, in) == 1) {
+        if (num_frames == max_frames) {
+            max_frames = max_frames ? max_frames * 2 : 256;
+            record = realloc(frames, max_frames * sizeof(*frames));
+            if (!record) {
+                free(frames);
+                return false;
+            }
+            frames = record;
+        }
+
+        record = &frames[num_frames++];
+        record->frame_bits = stats_get_le(buf, 4);
+        record->qp = buf[4];
+        record->frame_type = buf[5];
+    }
+
+    if (!num_frames) {
+        free(frames);
+        return false;
+    }
+
+    free(stats->frames);
+    stats->frames = frames;
+    stats->num_frames = num_frames;
+    stats->rate_factor = 0;
+
+    return true;
+}
+
+/*
+ * Spreads bits_per_frame times the number of pictures over the pictures,
+ * each getting its complexity raised to QCOMP times the rate factor
+ */
+void
+intel_enc_stats_plan(struct intel_enc_stats *stats, double bits_per_frame)
+{
+    double sum = 0;
+    int i;
+
+    if (!stats || !stats->frames || bits_per_frame <= 0)
+        return;
+
+    for (i = 0; i < stats->num_frames; i++)
+        sum += pow(stats_complexity(&stats->frames[i]), INTEL_ENC_STATS_QCOMP);
+
+    stats->bits_per_frame = bits_per_frame;
+    stats->rate_factor = bits_per_frame * stats->num_frames / sum;
+}
+
+double
+intel_enc_stats_target_bits(const struct intel_enc_stats *stats, int index)
+{
+    if (!stats->rate_factor || index < 0 || index >= stats->num_frames)
+        return 0;
+
+    return stats->rate_factor *
+        pow(stats_complexity(&stats->frames[index]), INTEL_ENC_STATS_QCOMP);
+}
+
+/*
+ * QP of the next picture in the second pass. The first pass model, bits
+ * times the quantizer step being constant, gives the quantizer step that
+ * hits the planned size. It is then scaled by how far the pictures so far
+ * went over or under their plan. Returns false once the stream no longer
+ * follows the first pass, leaving the QP to the single pass BRC.
+ */
+bool
+intel_enc_stats_frame_qp(struct intel_enc_stats *stats,
+                         int frame_type,
+                         int min_qp,
+                         int max_qp,
+                         int *qp)
+{
+    const struct intel_enc_stats_record *record;
+    double target, qstep, overflow;
+
+    if (!stats || !stats->rate_factor ||
+        stats->next_frame >= stats->num_frames)
+        return false;
+
+    record = &stats->frames[stats->next_frame];
+    if (record->frame_type != frame_type)
+        return false;
+
+    target = intel_enc_stats_target_bits(stats, stats->next_frame);
+    qstep = stats_complexity(record) / target;
+
+    overflow = 1.0 + (stats->actual_bits - stats->planned_bits) /
+        (stats->bits_per_frame * STATS_DRIFT_FRAMES);
+    overflow = MIN(MAX(overflow, 0.5), 2.0);
+
+    *qp = (int)floor(stats_qstep_to_qp(qstep * overflow) + 0.5);
+    *qp = MIN(MAX(*qp, min_qp), max_qp);
+
+    return true;
+}
+
+void
+intel_enc_stats_frame_done(struct intel_enc_stats *stats,
+                           int frame_type,
+                           int qp,
+                           int frame_bits)
+{
+    unsigned char buf[INTEL_ENC_STATS_RECORD_SIZE];
+
+    if (!stats)
+        return;
+
+    if (stats->out) {
+        stats_put_le(buf, MAX(frame_bits, 0), 4);
+        buf[4] = qp;
+        buf[5] = frame_type;
+        stats_put_le(buf + 6, 0, 2);
+
+        if (fwrite(buf, sizeof(buf), 1, stats->out) != 1) {
+            fprintf(stderr, "Failed to write the encoder stats\n");
+            fclose(stats->out);
+            stats->out = NULL;
+        }
+    }
+
+    if (stats->rate_factor && stats->next_frame < stats->num_frames) {
+        stats->planned_bits += intel_enc_stats_target_bits(stats, stats->next_frame);
+        stats->actual_bits += frame_bits;
+    }
+
+    stats->next_frame++;
+}
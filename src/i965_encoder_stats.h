@@ -0,0 +1,110 @@
+/*
+ * Copyright © 2011 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef I965_ENCODER_STATS_H
+#define I965_ENCODER_STATS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define INTEL_ENC_STATS_MAGIC           "I9ES"
+#define INTEL_ENC_STATS_VERSION         1
+#define INTEL_ENC_STATS_HEADER_SIZE     8
+#define INTEL_ENC_STATS_RECORD_SIZE     8
+
+#define INTEL_ENC_STATS_FRAME_I         0
+#define INTEL_ENC_STATS_FRAME_P         1
+#define INTEL_ENC_STATS_FRAME_B         2
+
+/*
+ * One record per encoded picture. On disk it is stored little endian
+ * after a header of the magic, the version and the codec:
+ *   u32 frame_bits, u8 qp, u8 frame_type, u16 reserved
+ */
+struct intel_enc_stats_record
+{
+    uint32_t frame_bits;
+    uint8_t qp;
+    uint8_t frame_type;
+};
+
+/*
+ * Statistics of a two-pass encode. The first pass appends the size and
+ * the QP of each picture to a stats file. The second pass reads the file
+ * back and spreads the bits of the whole sequence over the pictures in
+ * proportion to their complexity, the bits times the quantizer step of
+ * the first pass, raised to INTEL_ENC_STATS_QCOMP.
+ */
+struct intel_enc_stats
+{
+    int codec;
+
+    /* First pass */
+    FILE *out;
+
+    /* Second pass */
+    struct intel_enc_stats_record *frames;
+    int num_frames;
+    double rate_factor;                 /* bits per unit of complexity */
+    double bits_per_frame;
+
+    /* Pictures encoded so far */
+    int next_frame;
+    double planned_bits;
+    double actual_bits;
+};
+
+#define INTEL_ENC_STATS_QCOMP           0.6
+
+struct intel_enc_stats *
+intel_enc_stats_create(int codec, const char *out_path, const char *in_path);
+
+void
+intel_enc_stats_destroy(struct intel_enc_stats *stats);
+
+bool
+intel_enc_stats_read(struct intel_enc_stats *stats, FILE *in);
+
+void
+intel_enc_stats_plan(struct intel_enc_stats *stats, double bits_per_frame);
+
+double
+intel_enc_stats_target_bits(const struct intel_enc_stats *stats, int index);
+
+bool
+intel_enc_stats_frame_qp(struct intel_enc_stats *stats,
+                         int frame_type,
+                         int min_qp,
+                         int max_qp,
+                         int *qp);
+
+void
+intel_enc_stats_frame_done(struct intel_enc_stats *stats,
+                           int frame_type,
+                           int qp,
+                           int frame_bits);
+
+#endif /* I965_ENCODER_STATS_H */
@@ -1858,6 +1858,8 @@ i965_encoder_vp8_vme_allocate_resources(VADriverContextP ctx,
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     unsigned int frame_size_in_mbs = vp8_context->frame_width_in_mbs *
         vp8_context->frame_height_in_mbs;
+    unsigned char brc_enabled = (vp8_context->internal_rate_mode == I965_BRC_CBR ||
+                                 vp8_context->internal_rate_mode == I965_BRC_VBR);
 
     vp8_context->mv_offset = ALIGN((frame_size_in_mbs * 16 * 4), 4096);
     vp8_context->mb_coded_buffer_size = vp8_context->mv_offset + (frame_size_in_mbs * 16 * sizeof(unsigned int));
@@ -1906,50 +1908,46 @@ i965_encoder_vp8_vme_allocate_resources(VADriverContextP ctx,
     ALLOC_VP8_RESOURCE_BUFFER(mode_cost_update_buffer, 16 * sizeof(unsigned int), "Mode cost update buffer");
 
     /*
-     * BRC buffers
+     * BRC buffers, the PAK statistics are always written by the PAK
      */
-    ALLOC_VP8_RESOURCE_BUFFER(brc_history_buffer, VP8_BRC_HISTORY_BUFFER_SIZE, "BRC history buffer");
-    i965_zero_gpe_resource(&vp8_context->brc_history_buffer);
-
-    vp8_context->brc_segment_map_buffer.type = I965_GPE_RESOURCE_2D;
-    vp8_context->brc_segment_map_buffer.width = vp8_context->frame_width_in_mbs;
-    vp8_context->brc_segment_map_buffer.height = vp8_context->frame_height_in_mbs;
-    vp8_context->brc_segment_map_buffer.pitch = vp8_context->brc_segment_map_buffer.width;
-    vp8_context->brc_segment_map_buffer.size = vp8_context->brc_segment_map_buffer.pitch *
-        vp8_context->brc_segment_map_buffer.height;
-    vp8_context->brc_segment_map_buffer.tiling = I915_TILING_NONE;
-    i965_allocate_gpe_resource(i965->intel.bufmgr,
-                               &vp8_context->brc_segment_map_buffer,
-                               vp8_context->brc_segment_map_buffer.size,
-                               "BRC segment map buffer");
-
-    vp8_context->brc_distortion_buffer.type = I965_GPE_RESOURCE_2D;
-    vp8_context->brc_distortion_buffer.width = ALIGN((vp8_context->down_scaled_width_in_mb4x * 8), 64);
-    vp8_context->brc_distortion_buffer.height = 2 * ALIGN((vp8_context->down_scaled_height_in_mb4x * 4), 8);
-    vp8_context->brc_distortion_buffer.pitch = vp8_context->brc_distortion_buffer.width;
-    vp8_context->brc_distortion_buffer.size = vp8_context->brc_distortion_buffer.pitch *
-        vp8_context->brc_distortion_buffer.height;
-    vp8_context->brc_distortion_buffer.tiling = I915_TILING_NONE;
-    i965_allocate_gpe_resource(i965->intel.bufmgr,
-                               &vp8_context->brc_distortion_buffer,
-                               vp8_context->brc_distortion_buffer.size,
-                               "BRC distortion buffer");
-    i965_zero_gpe_resource(&vp8_context->brc_distortion_buffer);
-
     ALLOC_VP8_RESOURCE_BUFFER(brc_pak_statistics_buffer, sizeof(struct vp8_brc_pak_statistics), "BRC pak statistics buffer");
     i965_zero_gpe_resource(&vp8_context->brc_pak_statistics_buffer);
 
-    ALLOC_VP8_RESOURCE_BUFFER(brc_vp8_cfg_command_read_buffer, VP8_BRC_IMG_STATE_SIZE_PER_PASS * VP8_BRC_MAXIMUM_NUM_PASSES, "BRC VP8 configuration command read buffer");
-    i965_zero_gpe_resource(&vp8_context->brc_vp8_cfg_command_read_buffer);
-
-    ALLOC_VP8_RESOURCE_BUFFER(brc_vp8_cfg_command_write_buffer, VP8_BRC_IMG_STATE_SIZE_PER_PASS * VP8_BRC_MAXIMUM_NUM_PASSES, "BRC VP8 configuration command write buffer");
-    i965_zero_gpe_resource(&vp8_context->brc_vp8_cfg_command_write_buffer);
+    if (brc_enabled) {
+        ALLOC_VP8_RESOURCE_BUFFER(brc_history_buffer, VP8_BRC_HISTORY_BUFFER_SIZE, "BRC history buffer");
+        i965_zero_gpe_resource(&vp8_context->brc_history_buffer);
+
+        vp8_context->brc_segment_map_buffer.type = I965_GPE_RESOURCE_2D;
+        vp8_context->brc_segment_map_buffer.width = vp8_context->frame_width_in_mbs;
+        vp8_context->brc_segment_map_buffer.height = vp8_context->frame_height_in_mbs;
+        vp8_context->brc_segment_map_buffer.pitch = vp8_context->brc_segment_map_buffer.width;
+        vp8_context->brc_segment_map_buffer.size = vp8_context->brc_segment_map_buffer.pitch *
+            vp8_context->brc_segment_map_buffer.height;
+        vp8_context->brc_segment_map_buffer.tiling = I915_TILING_NONE;
+        i965_allocate_gpe_resource(i965->intel.bufmgr,
+                                   &vp8_context->brc_segment_map_buffer,
+                                   vp8_context->brc_segment_map_buffer.size,
+                                   "BRC segment map buffer");
+
+        vp8_context->brc_distortion_buffer.type = I965_GPE_RESOURCE_2D;
+        vp8_context->brc_distortion_buffer.width = ALIGN((vp8_context->down_scaled_width_in_mb4x * 8), 64);
+        vp8_context->brc_distortion_buffer.height = 2 * ALIGN((vp8_context->down_scaled_height_in_mb4x * 4), 8);
+        vp8_context->brc_distortion_buffer.pitch = vp8_context->brc_distortion_buffer.width;
+        vp8_context->brc_distortion_buffer.size = vp8_context->brc_distortion_buffer.pitch *
+            vp8_context->brc_distortion_buffer.height;
+        vp8_context->brc_distortion_buffer.tiling = I915_TILING_NONE;
+        i965_allocate_gpe_resource(i965->intel.bufmgr,
+                                   &vp8_context->brc_distortion_buffer,
+                                   vp8_context->brc_distortion_buffer.size,
+                                   "BRC distortion buffer");
+        i965_zero_gpe_resource(&vp8_context->brc_distortion_buffer);
 
-    ALLOC_VP8_RESOURCE_BUFFER(brc_vp8_constant_data_buffer, VP8_BRC_CONSTANT_DATA_SIZE, "BRC VP8 constant data buffer");
-    i965_zero_gpe_resource(&vp8_context->brc_vp8_constant_data_buffer);
+        ALLOC_VP8_RESOURCE_BUFFER(brc_vp8_cfg_command_write_buffer, VP8_BRC_IMG_STATE_SIZE_PER_PASS * VP8_BRC_MAXIMUM_NUM_PASSES, "BRC VP8 configuration command write buffer");
+        i965_zero_gpe_resource(&vp8_context->brc_vp8_cfg_command_write_buffer);
 
-    ALLOC_VP8_RESOURCE_BUFFER(brc_pak_statistics_dump_buffer, vp8_context->num_brc_pak_passes * sizeof(unsigned int) * 12, "BRC pak statistics buffer");
-    i965_zero_gpe_resource(&vp8_context->brc_pak_statistics_dump_buffer);
+        ALLOC_VP8_RESOURCE_BUFFER(brc_vp8_constant_data_buffer, VP8_BRC_CONSTANT_DATA_SIZE, "BRC VP8 constant data buffer");
+        i965_zero_gpe_resource(&vp8_context->brc_vp8_constant_data_buffer);
+    }
 
     vp8_context->me_4x_mv_data_buffer.type = I965_GPE_RESOURCE_2D;
     vp8_context->me_4x_mv_data_buffer.width = vp8_context->down_scaled_width_in_mb4x * 32;
@@ -1975,17 +1973,19 @@ i965_encoder_vp8_vme_allocate_resources(VADriverContextP ctx,
                                vp8_context->me_4x_distortion_buffer.size,
                                "ME 4x Distortion buffer");
 
-    vp8_context->me_16x_mv_data_buffer.type = I965_GPE_RESOURCE_2D;
-    vp8_context->me_16x_mv_data_buffer.width = ALIGN((vp8_context->down_scaled_width_in_mb16x * 32), 64);
-    vp8_context->me_16x_mv_data_buffer.height = vp8_context->down_scaled_height_in_mb16x * 4 * VP8_ME_MV_DATA_SIZE_MULTIPLIER;
-    vp8_context->me_16x_mv_data_buffer.pitch = vp8_context->me_16x_mv_data_buffer.width;
-    vp8_context->me_16x_mv_data_buffer.size = vp8_context->me_16x_mv_data_buffer.pitch *
-        vp8_context->me_16x_mv_data_buffer.height;
-    vp8_context->me_16x_mv_data_buffer.tiling = I915_TILING_NONE;
-    i965_allocate_gpe_resource(i965->intel.bufmgr,
-                               &vp8_context->me_16x_mv_data_buffer,
-                               vp8_context->me_16x_mv_data_buffer.size,
-                               "ME 16x MV Data buffer");
+    if (vp8_context->hme_16x_supported) {
+        vp8_context->me_16x_mv_data_buffer.type = I965_GPE_RESOURCE_2D;
+        vp8_context->me_16x_mv_data_buffer.width = ALIGN((vp8_context->down_scaled_width_in_mb16x * 32), 64);
+        vp8_context->me_16x_mv_data_buffer.height = vp8_context->down_scaled_height_in_mb16x * 4 * VP8_ME_MV_DATA_SIZE_MULTIPLIER;
+        vp8_context->me_16x_mv_data_buffer.pitch = vp8_context->me_16x_mv_data_buffer.width;
+        vp8_context->me_16x_mv_data_buffer.size = vp8_context->me_16x_mv_data_buffer.pitch *
+            vp8_context->me_16x_mv_data_buffer.height;
+        vp8_context->me_16x_mv_data_buffer.tiling = I915_TILING_NONE;
+        i965_allocate_gpe_resource(i965->intel.bufmgr,
+                                   &vp8_context->me_16x_mv_data_buffer,
+                                   vp8_context->me_16x_mv_data_buffer.size,
+                                   "ME 16x MV Data buffer");
+    }
 
     ALLOC_VP8_RESOURCE_BUFFER(histogram_buffer, VP8_HISTOGRAM_SIZE, "Histogram buffer");
     ALLOC_VP8_RESOURCE_BUFFER(pak_intra_row_store_scratch_buffer, vp8_context->frame_width_in_mbs * 64, "Intra row store scratch buffer");
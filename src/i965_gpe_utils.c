@@ -35,6 +35,10 @@
 #include "i965_drv_video.h"
 #include "i965_gpe_utils.h"
 
+static void
+gen8_gpe_context_track_state(struct i965_gpe_context *gpe_context,
+                             struct intel_batchbuffer *batch);
+
 static void
 i965_gpe_select(VADriverContextP ctx,
                 struct i965_gpe_context *gpe_context,
@@ -127,6 +131,176 @@ gen6_gpe_idrt(VADriverContextP ctx,
     ADVANCE_BATCH(batch);
 }
 
+void
+i965_kernel_cache_init(struct i965_kernel_cache *cache, dri_bufmgr *bufmgr)
+{
+    _i965InitMutex(&cache->mutex);
+    cache->bufmgr = bufmgr;
+    cache->entries = NULL;
+    cache->num_uploads = 0;
+}
+
+void
+i965_kernel_cache_terminate(struct i965_kernel_cache *cache)
+{
+    struct i965_kernel_cache_entry *entry, *next;
+
+    for (entry = cache->entries; entry; entry = next) {
+        next = entry->next;
+        dri_bo_unreference(entry->bo);
+        free(entry);
+    }
+
+    cache->entries = NULL;
+    _i965DestroyMutex(&cache->mutex);
+}
+
+static int
+i965_kernel_cache_match(const struct i965_kernel_cache_entry *entry,
+                        const struct i965_kernel *kernels,
+                        unsigned int num_kernels)
+{
+    unsigned int i;
+
+    if (entry->num_kernels != num_kernels)
+        return 0;
+
+    for (i = 0; i < num_kernels; i++) {
+        if (entry->kernels[i].bin != kernels[i].bin ||
+            entry->kernels[i].size != kernels[i].size)
+            return 0;
+    }
+
+    return 1;
+}
+
+static dri_bo *
+i965_kernel_cache_upload(struct i965_kernel_cache *cache,
+                         const char *name,
+                         const struct i965_kernel *kernels,
+                         unsigned int num_kernels)
+{
+    unsigned int i, kernel_size = 0, kernel_offset = 0;
+    dri_bo *bo;
+
+    for (i = 0; i < num_kernels; i++)
+        kernel_size += ALIGN(kernels[i].size, 64);
+
+    bo = dri_bo_alloc(cache->bufmgr, name, kernel_size, 0x1000);
+
+    if (!bo)
+        return NULL;
+
+    dri_bo_map(bo, 1);
+
+    for (i = 0; i < num_kernels; i++) {
+        if (kernels[i].size)
+            memcpy((unsigned char *)bo->virtual + kernel_offset,
+                   kernels[i].bin,
+                   kernels[i].size);
+
+        kernel_offset += ALIGN(kernels[i].size, 64);
+    }
+
+    dri_bo_unmap(bo);
+    cache->num_uploads++;
+
+    return bo;
+}
+
+/*
+ * Returns the buffer holding the given kernels back to back at 64 byte
+ * aligned offsets, uploading it on first use, and sets kernel_offset of
+ * each kernel. The buffer is shared and must not be written; drop it with
+ * i965_kernel_cache_put().
+ */
+dri_bo *
+i965_kernel_cache_get(struct i965_kernel_cache *cache,
+                      const char *name,
+                      struct i965_kernel *kernels,
+                      unsigned int num_kernels)
+{
+    struct i965_kernel_cache_entry *entry;
+    unsigned int i, kernel_offset = 0;
+    dri_bo *bo = NULL;
+
+    assert(num_kernels <= MAX_GPE_KERNELS);
+
+    _i965LockMutex(&cache->mutex);
+
+    for (entry = cache->entries; entry; entry = entry->next) {
+        if (i965_kernel_cache_match(entry, kernels, num_kernels))
+            break;
+    }
+
+    if (!entry) {
+        entry = calloc(1, sizeof(*entry));
+
+        if (entry) {
+            entry->bo = i965_kernel_cache_upload(cache, name, kernels, num_kernels);
+
+            if (entry->bo) {
+                entry->num_kernels = num_kernels;
+
+                for (i = 0; i < num_kernels; i++) {
+                    entry->kernels[i].bin = kernels[i].bin;
+                    entry->kernels[i].size = kernels[i].size;
+                }
+
+                entry->next = cache->entries;
+                cache->entries = entry;
+            } else {
+                free(entry);
+                entry = NULL;
+            }
+        }
+    }
+
+    if (entry) {
+        entry->ref_count++;
+        bo = entry->bo;
+    }
+
+    _i965UnlockMutex(&cache->mutex);
+
+    for (i = 0; i < num_kernels; i++) {
+        kernels[i].kernel_offset = kernel_offset;
+        kernel_offset += ALIGN(kernels[i].size, 64);
+    }
+
+    return bo;
+}
+
+void
+i965_kernel_cache_put(struct i965_kernel_cache *cache, dri_bo *bo)
+{
+    struct i965_kernel_cache_entry **link, *entry;
+
+    if (!bo)
+        return;
+
+    _i965LockMutex(&cache->mutex);
+
+    for (link = &cache->entries; *link; link = &(*link)->next) {
+        entry = *link;
+
+        if (entry->bo != bo)
+            continue;
+
+        assert(entry->ref_count > 0);
+
+        if (--entry->ref_count == 0) {
+            *link = entry->next;
+            dri_bo_unreference(entry->bo);
+            free(entry);
+        }
+
+        break;
+    }
+
+    _i965UnlockMutex(&cache->mutex);
+}
+
 void
 i965_gpe_load_kernels(VADriverContextP ctx,
                       struct i965_gpe_context *gpe_context,
@@ -139,16 +313,16 @@ i965_gpe_load_kernels(VADriverContextP ctx,
     assert(num_kernels <= MAX_GPE_KERNELS);
     memcpy(gpe_context->kernels, kernel_list, sizeof(*kernel_list) * num_kernels);
     gpe_context->num_kernels = num_kernels;
+    gpe_context->kernel_cache = &i965->kernel_cache;
 
     for (i = 0; i < num_kernels; i++) {
         struct i965_kernel *kernel = &gpe_context->kernels[i];
 
-        kernel->bo = dri_bo_alloc(i965->intel.bufmgr, 
-                                  kernel->name, 
-                                  kernel->size,
-                                  0x1000);
+        kernel->bo = i965_kernel_cache_get(gpe_context->kernel_cache,
+                                           kernel->name,
+                                           kernel,
+                                           1);
         assert(kernel->bo);
-        dri_bo_subdata(kernel->bo, 0, kernel->size, kernel->bin);
     }
 }
 
@@ -169,7 +343,11 @@ i965_gpe_context_destroy(struct i965_gpe_context *gpe_context)
     for (i = 0; i < gpe_context->num_kernels; i++) {
         struct i965_kernel *kernel = &gpe_context->kernels[i];
 
-        dri_bo_unreference(kernel->bo);
+        if (gpe_context->kernel_cache)
+            i965_kernel_cache_put(gpe_context->kernel_cache, kernel->bo);
+        else
+            dri_bo_unreference(kernel->bo);
+
         kernel->bo = NULL;
     }
 }
@@ -979,6 +1157,8 @@ gen8_gpe_state_base_address(VADriverContextP ctx,
                             struct i965_gpe_context *gpe_context,
                             struct intel_batchbuffer *batch)
 {
+    gen8_gpe_context_track_state(gpe_context, batch);
+
     BEGIN_BATCH(batch, 16);
 
     OUT_BATCH(batch, CMD_STATE_BASE_ADDRESS | 14);
@@ -1116,32 +1296,151 @@ gen8_gpe_pipeline_setup(VADriverContextP ctx,
     gen8_gpe_idrt(ctx, gpe_context, batch);
 }
 
-void
-gen8_gpe_context_init(VADriverContextP ctx,
-                      struct i965_gpe_context *gpe_context)
+static void
+gen8_gpe_context_free_state_slot(struct i965_gpe_context *gpe_context, int i)
+{
+    dri_bo * const bos[2] = {
+        gpe_context->state_ring.slots[i].surface_state_bo,
+        gpe_context->state_ring.slots[i].dynamic_state_bo,
+    };
+    int j;
+
+    intel_batchbuffer_unwatch(&gpe_context->state_ring.slots[i].queued);
+
+    for (j = 0; j < ARRAY_ELEMS(bos); j++) {
+        if (!bos[j])
+            continue;
+
+        dri_bo_unmap(bos[j]);
+        dri_bo_unreference(bos[j]);
+    }
+
+    memset(&gpe_context->state_ring.slots[i], 0,
+           sizeof(gpe_context->state_ring.slots[i]));
+}
+
+static void
+gen8_gpe_context_free_state_ring(struct i965_gpe_context *gpe_context)
+{
+    int i;
+
+    for (i = 0; i < gpe_context->state_ring.num_slots; i++)
+        gen8_gpe_context_free_state_slot(gpe_context, i);
+
+    gpe_context->state_ring.num_slots = 0;
+    gpe_context->state_ring.next_slot = 0;
+}
+
+static int
+gen8_gpe_context_state_slot_is_idle(struct i965_gpe_context *gpe_context, int i)
+{
+    const struct i965_gpe_state_slot * const slot = &gpe_context->state_ring.slots[i];
+
+    /* Still queued in a batch that was not submitted yet */
+    if (slot->queued.batch)
+        return 0;
+
+    return (!drm_intel_bo_busy(slot->surface_state_bo) &&
+            !drm_intel_bo_busy(slot->dynamic_state_bo));
+}
+
+static dri_bo *
+gen8_gpe_context_alloc_state_bo(VADriverContextP ctx, unsigned int size)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     dri_bo *bo;
-    int bo_size;
-    unsigned int start_offset, end_offset;
 
-    dri_bo_unreference(gpe_context->surface_state_binding_table.bo);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "surface state & binding table",
-                      gpe_context->surface_state_binding_table.length,
+                      size,
                       4096);
     assert(bo);
-    gpe_context->surface_state_binding_table.bo = bo;
+    dri_bo_map(bo, 1);
+
+    return bo;
+}
+
+/* Returns the index of an idle slot, allocating or replacing one if needed */
+static int
+gen8_gpe_context_get_state_slot(VADriverContextP ctx,
+                                struct i965_gpe_context *gpe_context,
+                                unsigned int surface_state_size,
+                                unsigned int dynamic_state_size)
+{
+    struct i965_gpe_state_ring * const ring = &gpe_context->state_ring;
+    int i, n;
+
+    if (ring->surface_state_size != surface_state_size ||
+        ring->dynamic_state_size != dynamic_state_size) {
+        gen8_gpe_context_free_state_ring(gpe_context);
+        ring->surface_state_size = surface_state_size;
+        ring->dynamic_state_size = dynamic_state_size;
+    }
+
+    for (n = 0; n < ring->num_slots; n++) {
+        i = (ring->next_slot + n) % ring->num_slots;
+
+        if (gen8_gpe_context_state_slot_is_idle(gpe_context, i))
+            goto found;
+    }
+
+    if (ring->num_slots < MAX_GPE_STATE_SLOTS)
+        i = ring->num_slots++;
+    else {
+        /* All in flight, drop the oldest set and let the GPU finish with it */
+        i = ring->next_slot;
+        gen8_gpe_context_free_state_slot(gpe_context, i);
+    }
+
+    ring->slots[i].surface_state_bo = gen8_gpe_context_alloc_state_bo(ctx, surface_state_size);
+    ring->slots[i].dynamic_state_bo = gen8_gpe_context_alloc_state_bo(ctx, dynamic_state_size);
+    ring->num_allocations += 2;
+
+found:
+    ring->next_slot = (i + 1) % ring->num_slots;
+
+    return i;
+}
+
+/* Records that the current state buffers are referenced from batch */
+static void
+gen8_gpe_context_track_state(struct i965_gpe_context *gpe_context,
+                             struct intel_batchbuffer *batch)
+{
+    int i;
+
+    for (i = 0; i < gpe_context->state_ring.num_slots; i++) {
+        if (gpe_context->state_ring.slots[i].surface_state_bo ==
+            gpe_context->surface_state_binding_table.bo) {
+            intel_batchbuffer_watch(batch, &gpe_context->state_ring.slots[i].queued);
+            break;
+        }
+    }
+}
+
+void
+gen8_gpe_context_init(VADriverContextP ctx,
+                      struct i965_gpe_context *gpe_context)
+{
+    dri_bo *bo;
+    int bo_size, slot;
+    unsigned int start_offset, end_offset;
 
     bo_size = gpe_context->idrt.max_entries * ALIGN(gpe_context->idrt.entry_size, 64) +
         ALIGN(gpe_context->curbe.length, 64) +
         gpe_context->sampler.max_entries * ALIGN(gpe_context->sampler.entry_size, 64);
+    slot = gen8_gpe_context_get_state_slot(ctx, gpe_context,
+                                           gpe_context->surface_state_binding_table.length,
+                                           bo_size);
+
+    dri_bo_unreference(gpe_context->surface_state_binding_table.bo);
+    bo = gpe_context->state_ring.slots[slot].surface_state_bo;
+    dri_bo_reference(bo);
+    gpe_context->surface_state_binding_table.bo = bo;
+
     dri_bo_unreference(gpe_context->dynamic_state.bo);
-    bo = dri_bo_alloc(i965->intel.bufmgr,
-                      "surface state & binding table",
-                      bo_size,
-                      4096);
-    assert(bo);
+    bo = gpe_context->state_ring.slots[slot].dynamic_state_bo;
+    dri_bo_reference(bo);
     gpe_context->dynamic_state.bo = bo;
     gpe_context->dynamic_state.bo_size = bo_size;
 
@@ -1180,10 +1479,17 @@ gen8_gpe_context_init(VADriverContextP ctx,
 void
 gen8_gpe_context_destroy(struct i965_gpe_context *gpe_context)
 {
+    gen8_gpe_context_free_state_ring(gpe_context);
+
     dri_bo_unreference(gpe_context->surface_state_binding_table.bo);
     gpe_context->surface_state_binding_table.bo = NULL;
 
-    dri_bo_unreference(gpe_context->instruction_state.bo);
+    if (gpe_context->kernel_cache)
+        i965_kernel_cache_put(gpe_context->kernel_cache,
+                              gpe_context->instruction_state.bo);
+    else
+        dri_bo_unreference(gpe_context->instruction_state.bo);
+
     gpe_context->instruction_state.bo = NULL;
 
     dri_bo_unreference(gpe_context->dynamic_state.bo);
@@ -1211,53 +1517,34 @@ gen8_gpe_load_kernels(VADriverContextP ctx,
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     int i, kernel_size = 0;
-    unsigned int kernel_offset, end_offset;
-    unsigned char *kernel_ptr;
+    unsigned int end_offset = 0;
     struct i965_kernel *kernel;
 
     assert(num_kernels <= MAX_GPE_KERNELS);
     memcpy(gpe_context->kernels, kernel_list, sizeof(*kernel_list) * num_kernels);
     gpe_context->num_kernels = num_kernels;
+    gpe_context->kernel_cache = &i965->kernel_cache;
 
-    for (i = 0; i < num_kernels; i++) {
-        kernel = &gpe_context->kernels[i];
-
-        kernel_size += ALIGN(kernel->size, 64);
-    }
-
-    gpe_context->instruction_state.bo = dri_bo_alloc(i965->intel.bufmgr,
-                                  "kernel shader",
-                                  kernel_size,
-                                  0x1000);
+    gpe_context->instruction_state.bo = i965_kernel_cache_get(gpe_context->kernel_cache,
+                                                              "kernel shader",
+                                                              gpe_context->kernels,
+                                                              num_kernels);
     if (gpe_context->instruction_state.bo == NULL) {
         WARN_ONCE("failure to allocate the buffer space for kernel shader\n");
         return;
     }
 
-    assert(gpe_context->instruction_state.bo);
-
-    gpe_context->instruction_state.bo_size = kernel_size;
-    gpe_context->instruction_state.end_offset = 0;
-    end_offset = 0;
-
-    dri_bo_map(gpe_context->instruction_state.bo, 1);
-    kernel_ptr = (unsigned char *)(gpe_context->instruction_state.bo->virtual);
     for (i = 0; i < num_kernels; i++) {
-        kernel_offset = ALIGN(end_offset, 64);
         kernel = &gpe_context->kernels[i];
-        kernel->kernel_offset = kernel_offset;
-
-        if (kernel->size) {
-            memcpy(kernel_ptr + kernel_offset, kernel->bin, kernel->size);
+        kernel_size += ALIGN(kernel->size, 64);
 
-            end_offset = kernel_offset + kernel->size;
-        }
+        if (kernel->size)
+            end_offset = kernel->kernel_offset + kernel->size;
     }
 
+    gpe_context->instruction_state.bo_size = kernel_size;
     gpe_context->instruction_state.end_offset = end_offset;
 
-    dri_bo_unmap(gpe_context->instruction_state.bo);
-
     return;
 }
 
@@ -1267,6 +1554,9 @@ gen9_gpe_state_base_address(VADriverContextP ctx,
                             struct intel_batchbuffer *batch)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
+
+    gen8_gpe_context_track_state(gpe_context, batch);
+
     BEGIN_BATCH(batch, 19);
 
     OUT_BATCH(batch, CMD_STATE_BASE_ADDRESS | (19 - 2));
@@ -1386,6 +1676,43 @@ i965_allocate_gpe_resource(dri_bufmgr *bufmgr,
     return (res->bo != NULL);
 }
 
+/*
+ * Like i965_allocate_gpe_resource() but keeps the current buffer when it
+ * already has the requested size and the GPU is done with it, so per-frame
+ * callers neither allocate nor stall on the previous frame.
+ */
+Bool
+i965_reallocate_gpe_resource(dri_bufmgr *bufmgr,
+                             struct i965_gpe_resource *res,
+                             int size,
+                             const char *name)
+{
+    if (res->bo && res->size == size && !drm_intel_bo_busy(res->bo))
+        return true;
+
+    i965_free_gpe_resource(res);
+
+    return i965_allocate_gpe_resource(bufmgr, res, size, name);
+}
+
+/*
+ * For a buffer the CPU rewrites in full on every frame: rather than
+ * waiting for the GPU to finish the previous frame with it, move on to
+ * an idle bo of the same size. The previous bos go back to the libdrm
+ * cache once retired, so a context ends up cycling through as many
+ * copies as it has frames in flight.
+ */
+Bool
+i965_renew_gpe_resource(dri_bufmgr *bufmgr,
+                        struct i965_gpe_resource *res,
+                        const char *name)
+{
+    if (!res->bo)
+        return false;
+
+    return i965_reallocate_gpe_resource(bufmgr, res, res->size, name);
+}
+
 void
 i965_object_surface_to_2d_gpe_resource_with_align(struct i965_gpe_resource *res,
                                        struct object_surface *obj_surface,
@@ -2081,6 +2408,29 @@ i965_gpe_allocate_2d_resource(dri_bufmgr *bufmgr,
     return true;
 }
 
+/* The 2D counterpart of i965_reallocate_gpe_resource() */
+bool
+i965_gpe_reallocate_2d_resource(dri_bufmgr *bufmgr,
+                                struct i965_gpe_resource *res,
+                                int width,
+                                int height,
+                                int pitch,
+                                const char *name)
+{
+    if (res->bo &&
+        res->type == I965_GPE_RESOURCE_2D &&
+        res->width == width &&
+        res->height == height &&
+        res->pitch == pitch &&
+        !drm_intel_bo_busy(res->bo))
+        return true;
+
+    i965_free_gpe_resource(res);
+    i965_gpe_allocate_2d_resource(bufmgr, res, width, height, pitch, name);
+
+    return (res->bo != NULL);
+}
+
 void
 gen8_gpe_media_state_flush(VADriverContextP ctx,
                            struct i965_gpe_context *gpe_context,
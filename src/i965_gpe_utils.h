@@ -32,9 +32,14 @@
 
 #include "i965_defines.h"
 #include "i965_structs.h"
+#include "i965_mutext.h"
+#include "intel_batchbuffer.h"
 
 #define MAX_GPE_KERNELS    32
 
+/* Surface/dynamic state buffer sets recycled by gen8_gpe_context_init() */
+#define MAX_GPE_STATE_SLOTS     16
+
 struct i965_buffer_surface
 {
     dri_bo *bo;
@@ -86,6 +91,55 @@ struct gpe_pipe_control_parameter
     unsigned int dw1;
 };
 
+struct i965_gpe_state_slot
+{
+    dri_bo *surface_state_bo;
+    dri_bo *dynamic_state_bo;
+    struct intel_batchbuffer_watch queued;  /* set while in an unsubmitted batch */
+};
+
+/*
+ * Persistently mapped surface state & binding table / dynamic state
+ * buffers, handed out in turn by gen8_gpe_context_init(). A slot is
+ * reused once the batch that last referenced it was submitted and the
+ * GPU is done with it.
+ */
+struct i965_gpe_state_ring
+{
+    struct i965_gpe_state_slot slots[MAX_GPE_STATE_SLOTS];
+    int num_slots;
+    int next_slot;
+    unsigned int surface_state_size;
+    unsigned int dynamic_state_size;
+    unsigned int num_allocations;       /* buffer objects allocated so far */
+};
+
+/*
+ * One uploaded kernel set. The key is the identity of the kernel
+ * binaries (the static tables compiled into the driver) and their sizes,
+ * so every context loading the same list shares one read-only buffer.
+ */
+struct i965_kernel_cache_entry
+{
+    struct i965_kernel_cache_entry *next;
+    dri_bo *bo;
+    int ref_count;
+    unsigned int num_kernels;
+    struct {
+        const uint32_t (*bin)[4];
+        int size;
+    } kernels[MAX_GPE_KERNELS];
+};
+
+/* Driver-wide cache of kernel instruction buffers */
+struct i965_kernel_cache
+{
+    _I965Mutex mutex;
+    dri_bufmgr *bufmgr;
+    struct i965_kernel_cache_entry *entries;
+    unsigned int num_uploads;           /* kernel sets uploaded so far */
+};
+
 struct i965_gpe_context
 {
     struct {
@@ -184,6 +238,11 @@ struct i965_gpe_context
         int bo_size;
         unsigned int end_offset;
     } dynamic_state;
+
+    struct i965_gpe_state_ring state_ring;
+
+    /* Owner of the kernel buffer(s), NULL if privately allocated */
+    struct i965_kernel_cache *kernel_cache;
 };
 
 struct gpe_mi_flush_dw_parameter
@@ -252,6 +311,15 @@ struct gpe_mi_batch_buffer_start_parameter
     unsigned int use_global_gtt;
 };
 
+void i965_kernel_cache_init(struct i965_kernel_cache *cache,
+                            dri_bufmgr *bufmgr);
+void i965_kernel_cache_terminate(struct i965_kernel_cache *cache);
+dri_bo *i965_kernel_cache_get(struct i965_kernel_cache *cache,
+                              const char *name,
+                              struct i965_kernel *kernels,
+                              unsigned int num_kernels);
+void i965_kernel_cache_put(struct i965_kernel_cache *cache, dri_bo *bo);
+
 void i965_gpe_context_destroy(struct i965_gpe_context *gpe_context);
 void i965_gpe_context_init(VADriverContextP ctx,
                            struct i965_gpe_context *gpe_context);
@@ -355,6 +423,15 @@ Bool i965_allocate_gpe_resource(dri_bufmgr *bufmgr,
                                 int size,
                                 const char *name);
 
+Bool i965_reallocate_gpe_resource(dri_bufmgr *bufmgr,
+                                  struct i965_gpe_resource *res,
+                                  int size,
+                                  const char *name);
+
+Bool i965_renew_gpe_resource(dri_bufmgr *bufmgr,
+                             struct i965_gpe_resource *res,
+                             const char *name);
+
 void i965_object_surface_to_2d_gpe_resource(struct i965_gpe_resource *res,
                                             struct object_surface *obj_surface);
 
@@ -487,6 +564,14 @@ i965_gpe_allocate_2d_resource(dri_bufmgr *bufmgr,
                            int pitch,
                            const char *name);
 
+extern bool
+i965_gpe_reallocate_2d_resource(dri_bufmgr *bufmgr,
+                                struct i965_gpe_resource *res,
+                                int width,
+                                int height,
+                                int pitch,
+                                const char *name);
+
 struct gpe_walker_xy
 {
     union {
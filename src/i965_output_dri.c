@@ -45,9 +45,30 @@ struct dri_vtable {
     dri_swap_buffer_func                swap_buffer;
 };
 
+/* Render targets imported from the DRI2 buffers of recent drawables */
+#define DRI_RENDER_TARGET_CACHE_SIZE    8
+
+/* Back buffers kept per drawable, enough for double/triple buffering */
+#define DRI_RENDER_TARGETS_PER_DRAWABLE 3
+
+struct dri_render_target {
+    XID                 drawable;
+    uint32_t            name;
+    unsigned int        width;
+    unsigned int        height;
+    unsigned int        pitch;
+    unsigned int        cpp;
+    unsigned int        tiling;
+    unsigned int        swizzle;
+    unsigned int        last_used;
+    dri_bo             *bo;
+};
+
 struct va_dri_output {
     struct dso_handle  *handle;
     struct dri_vtable   vtable;
+    struct dri_render_target render_targets[DRI_RENDER_TARGET_CACHE_SIZE];
+    unsigned int        num_presents;
 };
 
 bool
@@ -91,10 +112,16 @@ i965_output_dri_terminate(VADriverContextP ctx)
 {
     struct i965_driver_data * const i965 = i965_driver_data(ctx); 
     struct va_dri_output * const dri_output = i965->dri_output;
+    int i;
 
     if (!dri_output)
         return;
 
+    for (i = 0; i < DRI_RENDER_TARGET_CACHE_SIZE; i++) {
+        dri_bo_unreference(dri_output->render_targets[i].bo);
+        dri_output->render_targets[i].bo = NULL;
+    }
+
     if (dri_output->handle) {
         dso_close(dri_output->handle);
         dri_output->handle = NULL;
@@ -104,6 +131,139 @@ i965_output_dri_terminate(VADriverContextP ctx)
     i965->dri_output = NULL;
 }
 
+/*
+ * Look up the render target for the current DRI2 buffer of a drawable,
+ * matching on both the drawable and the buffer name, so neither a
+ * drawable flipping between its back buffers nor several windows
+ * presented in turn need an import per frame. A buffer is imported again
+ * when the drawable is resized. A new buffer replaces the least recently used one of its
+ * drawable once that drawable has DRI_RENDER_TARGETS_PER_DRAWABLE
+ * entries, else the least recently used entry of the cache.
+ */
+static struct dri_render_target *
+dri_get_render_target(
+    VADriverContextP    ctx,
+    XID                 drawable,
+    struct dri_drawable *dri_drawable,
+    union dri_buffer   *buffer
+)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct va_dri_output * const dri_output = i965->dri_output;
+    struct dri_render_target *target = NULL, *lru = NULL, *drawable_lru = NULL;
+    struct dri_render_target *slot;
+    int i, ret, num_drawable_targets = 0;
+
+    for (i = 0; i < DRI_RENDER_TARGET_CACHE_SIZE; i++) {
+        slot = &dri_output->render_targets[i];
+
+        if (!slot->bo) {
+            if (!lru || lru->bo)
+                lru = slot;
+            continue;
+        }
+
+        if (slot->drawable == drawable) {
+            if (slot->name == buffer->dri2.name) {
+                target = slot;
+                break;
+            }
+
+            num_drawable_targets++;
+
+            if (!drawable_lru || slot->last_used < drawable_lru->last_used)
+                drawable_lru = slot;
+        }
+
+        if (!lru || (lru->bo && slot->last_used < lru->last_used))
+            lru = slot;
+    }
+
+    if (!target) {
+        if (num_drawable_targets >= DRI_RENDER_TARGETS_PER_DRAWABLE)
+            target = drawable_lru;
+        else
+            target = lru;
+    }
+
+    if (target->bo &&
+        (target->drawable != drawable ||
+         target->name != buffer->dri2.name ||
+         target->pitch != buffer->dri2.pitch ||
+         target->cpp != buffer->dri2.cpp ||
+         target->width != dri_drawable->width ||
+         target->height != dri_drawable->height)) {
+        dri_bo_unreference(target->bo);
+        target->bo = NULL;
+    }
+
+    if (!target->bo) {
+        target->bo = intel_bo_gem_create_from_name(i965->intel.bufmgr,
+                                                   "rendering buffer",
+                                                   buffer->dri2.name);
+        if (!target->bo)
+            return NULL;
+
+        ret = dri_bo_get_tiling(target->bo, &target->tiling, &target->swizzle);
+        assert(ret == 0);
+
+        target->drawable = drawable;
+        target->name = buffer->dri2.name;
+        target->pitch = buffer->dri2.pitch;
+        target->cpp = buffer->dri2.cpp;
+        target->width = dri_drawable->width;
+        target->height = dri_drawable->height;
+    }
+
+    target->last_used = ++dri_output->num_presents;
+    return target;
+}
+
+/* Points the render destination at the current back buffer of @draw */
+static VAStatus
+dri_setup_draw_region(VADriverContextP ctx, void *draw,
+                      struct dri_drawable *dri_drawable)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct dri_vtable * const dri_vtable = &i965->dri_output->vtable;
+    struct i965_render_state * const render_state = &i965->render_state;
+    union dri_buffer *buffer;
+    struct dri_render_target *target;
+    struct intel_region *dest_region;
+
+    buffer = dri_vtable->get_rendering_buffer(ctx, dri_drawable);
+    assert(buffer);
+
+    dest_region = render_state->draw_region;
+    if (dest_region == NULL) {
+        dest_region = (struct intel_region *)calloc(1, sizeof(*dest_region));
+        assert(dest_region);
+        render_state->draw_region = dest_region;
+    }
+
+    target = dri_get_render_target(ctx, (XID)draw, dri_drawable, buffer);
+    if (!target)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    if (dest_region->bo != target->bo) {
+        dri_bo_reference(target->bo);
+        dri_bo_unreference(dest_region->bo);
+        dest_region->bo = target->bo;
+    }
+
+    dest_region->cpp = target->cpp;
+    dest_region->pitch = target->pitch;
+    dest_region->tiling = target->tiling;
+    dest_region->swizzle = target->swizzle;
+
+    dest_region->x = dri_drawable->x;
+    dest_region->y = dri_drawable->y;
+    dest_region->width = dri_drawable->width;
+    dest_region->height = dri_drawable->height;
+
+    return VA_STATUS_SUCCESS;
+}
+
 VAStatus
 i965_put_surface_dri(
     VADriverContextP    ctx,
@@ -118,13 +278,9 @@ i965_put_surface_dri(
 {
     struct i965_driver_data * const i965 = i965_driver_data(ctx); 
     struct dri_vtable * const dri_vtable = &i965->dri_output->vtable;
-    struct i965_render_state * const render_state = &i965->render_state;
     struct dri_drawable *dri_drawable;
-    union dri_buffer *buffer;
-    struct intel_region *dest_region;
     struct object_surface *obj_surface; 
-    uint32_t name;
-    int i, ret;
+    VAStatus va_status;
 
     /* Currently don't support DRI1 */
     if (!VA_CHECK_DRM_AUTH_TYPE(ctx, VA_DRM_AUTH_DRI2))
@@ -144,53 +300,17 @@ i965_put_surface_dri(
     dri_drawable = dri_vtable->get_drawable(ctx, (Drawable)draw);
     assert(dri_drawable);
 
-    buffer = dri_vtable->get_rendering_buffer(ctx, dri_drawable);
-    assert(buffer);
-    
-    dest_region = render_state->draw_region;
-    if (dest_region == NULL) {
-        dest_region = (struct intel_region *)calloc(1, sizeof(*dest_region));
-        assert(dest_region);
-        render_state->draw_region = dest_region;
-    }
-
-    if (dest_region->bo) {
-        dri_bo_flink(dest_region->bo, &name);
-        if (buffer->dri2.name != name) {
-            dri_bo_unreference(dest_region->bo);
-	    dest_region->bo = NULL;
-	}
+    va_status = dri_setup_draw_region(ctx, draw, dri_drawable);
+    if (va_status != VA_STATUS_SUCCESS) {
+        _i965UnlockMutex(&i965->render_mutex);
+        return va_status;
     }
 
-    if (dest_region->bo == NULL) {
-        dest_region->cpp = buffer->dri2.cpp;
-        dest_region->pitch = buffer->dri2.pitch;
-
-        dest_region->bo = intel_bo_gem_create_from_name(i965->intel.bufmgr, "rendering buffer", buffer->dri2.name);
-        assert(dest_region->bo);
-
-        ret = dri_bo_get_tiling(dest_region->bo, &(dest_region->tiling), &(dest_region->swizzle));
-        assert(ret == 0);
-    }
-
-    dest_region->x = dri_drawable->x;
-    dest_region->y = dri_drawable->y;
-    dest_region->width = dri_drawable->width;
-    dest_region->height = dri_drawable->height;
-
     if (!(flags & VA_SRC_COLOR_MASK))
         flags |= VA_SRC_BT601;
 
     intel_render_put_surface(ctx, obj_surface, src_rect, dst_rect, flags);
 
-    for (i = 0; i < I965_MAX_SUBPIC_SUM; i++) {
-        if (obj_surface->obj_subpic[i] != NULL) {
-            assert(obj_surface->subpic[i] != VA_INVALID_ID);
-            obj_surface->subpic_render_idx = i;
-            intel_render_put_subpicture(ctx, obj_surface, src_rect, dst_rect);
-        }
-    }
-
     if (!(g_intel_debug_option_flags & VA_INTEL_DEBUG_OPTION_BENCH))
         dri_vtable->swap_buffer(ctx, dri_drawable);
 
@@ -63,6 +63,20 @@ struct wl_vtable {
     wl_proxy_add_listener_func  proxy_add_listener;
 };
 
+/* Display side state of a VA surface, exported once and kept until the
+ * surface storage goes away */
+struct wl_surface_output {
+    wl_proxy_destroy_func       proxy_destroy;
+    dri_bo                     *bo;
+    unsigned int                fourcc;
+    uint32_t                    name;
+    int                         fd;
+    uint32_t                    drm_format;
+    int32_t                     offsets[3];
+    int32_t                     pitches[3];
+    struct wl_buffer           *buffer;
+};
+
 struct va_wl_output {
     struct dso_handle  *libegl_handle;
     struct dso_handle  *libwl_client_handle;
@@ -212,41 +226,49 @@ create_prime_or_planar_buffer(
     return (struct wl_buffer *)id;
 }
 
-/* Hook to return Wayland buffer associated with the VA surface */
-static VAStatus
-va_GetSurfaceBufferWl(
-    struct VADriverContext *ctx,
-    VASurfaceID             surface,
-    unsigned int            flags,
-    struct wl_buffer      **out_buffer
-)
+static void
+free_surface_output(void **data)
 {
-    struct VADriverVTableWayland * const vtable = ctx->vtable_wayland;
-    struct i965_driver_data * const i965 = i965_driver_data(ctx);
-    struct object_surface *obj_surface;
-    struct wl_buffer *buffer;
-    uint32_t name, drm_format;
-    int offsets[3], pitches[3];
-    int fd = -1;
+    struct wl_surface_output *output = *data;
 
-    obj_surface = SURFACE(surface);
-    if (!obj_surface)
-        return VA_STATUS_ERROR_INVALID_SURFACE;
+    if (!output)
+        return;
 
-    if (flags != VA_FRAME_PICTURE)
-        return VA_STATUS_ERROR_FLAG_NOT_SUPPORTED;
+    if (output->buffer)
+        output->proxy_destroy((struct wl_proxy *)output->buffer);
 
-    if (!out_buffer)
-        return VA_STATUS_ERROR_INVALID_PARAMETER;
+    if (output->fd != -1)
+        close(output->fd);
 
-    if (!ensure_wl_output(ctx))
-        return VA_STATUS_ERROR_INVALID_DISPLAY;
+    free(output);
+    *data = NULL;
+}
 
-    if (!vtable->has_prime_sharing || (drm_intel_bo_gem_export_to_prime(obj_surface->bo, &fd) != 0)) {
-        fd = -1;
+/* Export the surface to the compositor, preferring a prime fd over a
+ * flink name, and remember the plane layout. Nothing is re-exported
+ * until the surface gets new storage */
+static VAStatus
+ensure_surface_output(
+    VADriverContextP            ctx,
+    struct object_surface      *obj_surface,
+    struct wl_surface_output  **out_output
+)
+{
+    struct VADriverVTableWayland * const vtable = ctx->vtable_wayland;
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct wl_surface_output *output = obj_surface->output_data;
+    uint32_t drm_format;
+    int32_t offsets[3], pitches[3];
+
+    if (output) {
+        if (output->bo == obj_surface->bo &&
+            output->fourcc == obj_surface->fourcc) {
+            *out_output = output;
+            return VA_STATUS_SUCCESS;
+        }
 
-        if (drm_intel_bo_flink(obj_surface->bo, &name) != 0)
-            return VA_STATUS_ERROR_INVALID_SURFACE;
+        obj_surface->free_output_data(&obj_surface->output_data);
+        obj_surface->free_output_data = NULL;
     }
 
     switch (obj_surface->fourcc) {
@@ -295,23 +317,89 @@ va_GetSurfaceBufferWl(
         return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
     }
 
+    output = calloc(1, sizeof(*output));
+    if (!output)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    output->fd = -1;
+    if (!vtable->has_prime_sharing ||
+        (drm_intel_bo_gem_export_to_prime(obj_surface->bo, &output->fd) != 0)) {
+        output->fd = -1;
+
+        if (drm_intel_bo_flink(obj_surface->bo, &output->name) != 0) {
+            free(output);
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+        }
+    }
+
+    output->proxy_destroy = i965->wl_output->vtable.proxy_destroy;
+    output->bo = obj_surface->bo;
+    output->fourcc = obj_surface->fourcc;
+    output->drm_format = drm_format;
+    memcpy(output->offsets, offsets, sizeof(offsets));
+    memcpy(output->pitches, pitches, sizeof(pitches));
+
+    obj_surface->output_data = output;
+    obj_surface->free_output_data = free_surface_output;
+    *out_output = output;
+    return VA_STATUS_SUCCESS;
+}
+
+/* Hook to return Wayland buffer associated with the VA surface */
+static VAStatus
+va_GetSurfaceBufferWl(
+    struct VADriverContext *ctx,
+    VASurfaceID             surface,
+    unsigned int            flags,
+    struct wl_buffer      **out_buffer
+)
+{
+    struct i965_driver_data * const i965 = i965_driver_data(ctx);
+    struct object_surface *obj_surface;
+    struct wl_surface_output *output;
+    struct wl_buffer *buffer;
+    VAStatus va_status;
+
+    obj_surface = SURFACE(surface);
+    if (!obj_surface || !obj_surface->bo)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    if ((flags & ~VA_SURFACE_BUFFER_WL_CACHED_I965) != VA_FRAME_PICTURE)
+        return VA_STATUS_ERROR_FLAG_NOT_SUPPORTED;
+
+    if (!out_buffer)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    if (!ensure_wl_output(ctx))
+        return VA_STATUS_ERROR_INVALID_DISPLAY;
+
+    va_status = ensure_surface_output(ctx, obj_surface, &output);
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    if ((flags & VA_SURFACE_BUFFER_WL_CACHED_I965) && output->buffer) {
+        *out_buffer = output->buffer;
+        return VA_STATUS_SUCCESS;
+    }
+
+    /* The compositor gets its own duplicate of the prime fd */
     buffer = create_prime_or_planar_buffer(
         i965->wl_output,
-        name,
-        fd,
+        output->name,
+        output->fd,
         obj_surface->orig_width,
         obj_surface->orig_height,
-        drm_format,
-        offsets,
-        pitches
+        output->drm_format,
+        output->offsets,
+        output->pitches
     );
 
-    if (fd != -1)
-        close(fd);
-
     if (!buffer)
         return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
+    if (flags & VA_SURFACE_BUFFER_WL_CACHED_I965)
+        output->buffer = buffer;
+
     *out_buffer = buffer;
     return VA_STATUS_SUCCESS;
 }
@@ -343,6 +431,17 @@ ensure_driver_vtable(VADriverContextP ctx)
 
 bool
 i965_output_wayland_init(VADriverContextP ctx)
+{
+    return i965_output_wayland_init_from(ctx, LIBEGL_NAME,
+                                         LIBWAYLAND_CLIENT_NAME);
+}
+
+bool
+i965_output_wayland_init_from(
+    VADriverContextP    ctx,
+    const char         *libegl_name,
+    const char         *libwl_client_name
+)
 {
     struct i965_driver_data * const i965 = i965_driver_data(ctx);
     struct dso_handle *dso_handle;
@@ -379,7 +478,7 @@ i965_output_wayland_init(VADriverContextP ctx)
     if (!i965->wl_output)
         goto error;
 
-    i965->wl_output->libegl_handle = dso_open(LIBEGL_NAME);
+    i965->wl_output->libegl_handle = dso_open(libegl_name);
     if (!i965->wl_output->libegl_handle) {
         i965->wl_output->libegl_handle = dso_open(LIBEGL_NAME_FALLBACK);
         if (!i965->wl_output->libegl_handle)
@@ -392,7 +491,7 @@ i965_output_wayland_init(VADriverContextP ctx)
                          libegl_symbols))
         goto error;
 
-    i965->wl_output->libwl_client_handle = dso_open(LIBWAYLAND_CLIENT_NAME);
+    i965->wl_output->libwl_client_handle = dso_open(libwl_client_name);
     if (!i965->wl_output->libwl_client_handle)
         goto error;
 
@@ -416,6 +515,8 @@ i965_output_wayland_terminate(VADriverContextP ctx)
 {
     struct i965_driver_data * const i965 = i965_driver_data(ctx);
     struct va_wl_output *wl_output;
+    struct object_surface *obj_surface;
+    object_heap_iterator iter;
 
     if (ctx->display_type != VA_DISPLAY_WAYLAND)
         return;
@@ -424,6 +525,17 @@ i965_output_wayland_terminate(VADriverContextP ctx)
     if (!wl_output)
         return;
 
+    /* Cached buffers need the Wayland library, release them while it is
+     * still loaded */
+    obj_surface = (struct object_surface *)object_heap_first(&i965->surface_heap, &iter);
+    while (obj_surface) {
+        if (obj_surface->free_output_data == free_surface_output) {
+            free_surface_output(&obj_surface->output_data);
+            obj_surface->free_output_data = NULL;
+        }
+        obj_surface = (struct object_surface *)object_heap_next(&i965->surface_heap, &iter);
+    }
+
     if (wl_output->wl_drm) {
         wl_output->vtable.proxy_destroy((struct wl_proxy *)wl_output->wl_drm);
         wl_output->wl_drm = NULL;
@@ -28,9 +28,24 @@
 #include <stdbool.h>
 #include <va/va_backend.h>
 
+/* Driver specific vaGetSurfaceBufferWl() flag: return the wl_buffer kept
+ * on the surface rather than a new one. The same buffer is returned until
+ * the surface is destroyed or reallocated, so the caller must not destroy
+ * it. */
+#define VA_SURFACE_BUFFER_WL_CACHED_I965        0x10000
+
 bool
 i965_output_wayland_init(VADriverContextP ctx);
 
+/* Same as i965_output_wayland_init() but resolves the EGL and Wayland
+ * client symbols from the named libraries, NULL meaning the global scope */
+bool
+i965_output_wayland_init_from(
+    VADriverContextP    ctx,
+    const char         *libegl_name,
+    const char         *libwl_client_name
+);
+
 void
 i965_output_wayland_terminate(VADriverContextP ctx);
 
@@ -4874,6 +4874,30 @@ i965_vpp_clear_surface(VADriverContextP ctx,
     intel_batchbuffer_end_atomic(batch);
 }
 
+/*
+ * The PP kernels are loaded on first use, so that processes which never
+ * scale, convert or display surfaces do not pay for them at vaInitialize.
+ * Caller must hold pp_mutex
+ */
+static struct i965_post_processing_context *
+i965_post_processing_get_context(VADriverContextP ctx)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_post_processing_context *pp_context = i965->pp_context;
+
+    if (pp_context == NULL) {
+        pp_context = calloc(1, sizeof(*pp_context));
+
+        if (pp_context == NULL)
+            return NULL;
+
+        i965->codec_info->post_processing_context_init(ctx, pp_context, i965->pp_batch);
+        i965->pp_context = pp_context;
+    }
+
+    return pp_context;
+}
+
 VAStatus
 i965_scaling_processing(
     VADriverContextP   ctx,
@@ -4904,7 +4928,12 @@ i965_scaling_processing(
          dst_surface.type = I965_SURFACE_TYPE_SURFACE;
          dst_surface.flags = I965_SURFACE_FLAG_FRAME;
 
-         pp_context = i965->pp_context;
+         pp_context = i965_post_processing_get_context(ctx);
+         if (pp_context == NULL) {
+             _i965UnlockMutex(&i965->pp_mutex);
+             return VA_STATUS_ERROR_ALLOCATION_FAILED;
+         }
+
          filter_flags = pp_context->filter_flags;
          pp_context->filter_flags = va_flags;
 
@@ -4949,7 +4978,12 @@ i965_post_processing(
 
         _i965LockMutex(&i965->pp_mutex);
 
-        pp_context = i965->pp_context;
+        pp_context = i965_post_processing_get_context(ctx);
+        if (pp_context == NULL) {
+            _i965UnlockMutex(&i965->pp_mutex);
+            return out_surface_id;
+        }
+
         pp_context->filter_flags = va_flags;
         if (avs_is_needed(va_flags)) {
             VARectangle tmp_dst_rect;
@@ -5475,6 +5509,77 @@ EXIT:
     return vaStatus;
 }
 
+/* Caller must hold pp_mutex */
+static VAStatus
+i965_image_processing_locked(VADriverContextP ctx,
+                             const struct i965_surface *src_surface,
+                             const VARectangle *src_rect,
+                             struct i965_surface *dst_surface,
+                             const VARectangle *dst_rect)
+{
+    int fourcc = pp_get_surface_fourcc(ctx, src_surface);
+    VAStatus status;
+
+    if (i965_post_processing_get_context(ctx) == NULL)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    switch (fourcc) {
+    case VA_FOURCC_YV12:
+    case VA_FOURCC_I420:
+    case VA_FOURCC_IMC1:
+    case VA_FOURCC_IMC3:
+    case VA_FOURCC_422H:
+    case VA_FOURCC_422V:
+    case VA_FOURCC_411P:
+    case VA_FOURCC_444P:
+    case VA_FOURCC_YV16:
+        status = i965_image_pl3_processing(ctx,
+                                           src_surface,
+                                           src_rect,
+                                           dst_surface,
+                                           dst_rect);
+        break;
+
+    case  VA_FOURCC_NV12:
+        status = i965_image_pl2_processing(ctx,
+                                           src_surface,
+                                           src_rect,
+                                           dst_surface,
+                                           dst_rect);
+        break;
+    case VA_FOURCC_YUY2:
+    case VA_FOURCC_UYVY:
+        status = i965_image_pl1_processing(ctx,
+                                           src_surface,
+                                           src_rect,
+                                           dst_surface,
+                                           dst_rect);
+        break;
+    case VA_FOURCC_BGRA:
+    case VA_FOURCC_BGRX:
+    case VA_FOURCC_RGBA:
+    case VA_FOURCC_RGBX:
+        status = i965_image_pl1_rgbx_processing(ctx,
+                                           src_surface,
+                                           src_rect,
+                                           dst_surface,
+                                           dst_rect);
+        break;
+    case VA_FOURCC_P010:
+        status = i965_image_p010_processing(ctx,
+                                           src_surface,
+                                           src_rect,
+                                           dst_surface,
+                                           dst_rect);
+        break;
+    default:
+        status = VA_STATUS_ERROR_UNIMPLEMENTED;
+        break;
+    }
+
+    return status;
+}
+
 VAStatus
 i965_image_processing(VADriverContextP ctx,
                       const struct i965_surface *src_surface,
@@ -5486,69 +5591,62 @@ i965_image_processing(VADriverContextP ctx,
     VAStatus status = VA_STATUS_ERROR_UNIMPLEMENTED;
 
     if (HAS_VPP(i965)) {
-        int fourcc = pp_get_surface_fourcc(ctx, src_surface);
-
         _i965LockMutex(&i965->pp_mutex);
+        status = i965_image_processing_locked(ctx,
+                                              src_surface,
+                                              src_rect,
+                                              dst_surface,
+                                              dst_rect);
+        _i965UnlockMutex(&i965->pp_mutex);
+    }
 
-        switch (fourcc) {
-        case VA_FOURCC_YV12:
-        case VA_FOURCC_I420:
-        case VA_FOURCC_IMC1:
-        case VA_FOURCC_IMC3:
-        case VA_FOURCC_422H:
-        case VA_FOURCC_422V:
-        case VA_FOURCC_411P:
-        case VA_FOURCC_444P:
-        case VA_FOURCC_YV16:
-            status = i965_image_pl3_processing(ctx,
-                                               src_surface,
-                                               src_rect,
-                                               dst_surface,
-                                               dst_rect);
-            break;
+    return status;
+}
 
-        case  VA_FOURCC_NV12:
-            status = i965_image_pl2_processing(ctx,
-                                               src_surface,
-                                               src_rect,
-                                               dst_surface,
-                                               dst_rect);
-            break;
-        case VA_FOURCC_YUY2:
-        case VA_FOURCC_UYVY:
-            status = i965_image_pl1_processing(ctx,
-                                               src_surface,
-                                               src_rect,
-                                               dst_surface,
-                                               dst_rect);
-            break;
-        case VA_FOURCC_BGRA:
-        case VA_FOURCC_BGRX:
-        case VA_FOURCC_RGBA:
-        case VA_FOURCC_RGBX:
-            status = i965_image_pl1_rgbx_processing(ctx,
-                                               src_surface,
-                                               src_rect,
-                                               dst_surface,
-                                               dst_rect);
-            break;
-        case VA_FOURCC_P010:
-            status = i965_image_p010_processing(ctx,
-                                               src_surface,
-                                               src_rect,
-                                               dst_surface,
-                                               dst_rect);
-            break;
-        default:
-            status = VA_STATUS_ERROR_UNIMPLEMENTED;
-            break;
+/*
+ * Same as i965_image_processing() but with the scaling filter selected
+ * by va_flags, so that a resize and a color conversion can be done in
+ * a single pass
+ */
+VAStatus
+i965_image_scaling_processing(VADriverContextP ctx,
+                              const struct i965_surface *src_surface,
+                              const VARectangle *src_rect,
+                              struct i965_surface *dst_surface,
+                              const VARectangle *dst_rect,
+                              unsigned int va_flags)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    VAStatus status = VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    if (HAS_VPP(i965)) {
+        struct i965_post_processing_context *pp_context;
+        unsigned int filter_flags;
+
+        _i965LockMutex(&i965->pp_mutex);
+
+        pp_context = i965_post_processing_get_context(ctx);
+        if (pp_context == NULL) {
+            _i965UnlockMutex(&i965->pp_mutex);
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
         }
-        
+
+        filter_flags = pp_context->filter_flags;
+        pp_context->filter_flags = va_flags;
+
+        status = i965_image_processing_locked(ctx,
+                                              src_surface,
+                                              src_rect,
+                                              dst_surface,
+                                              dst_rect);
+
+        pp_context->filter_flags = filter_flags;
+
         _i965UnlockMutex(&i965->pp_mutex);
     }
 
     return status;
-}       
+}
 
 static void
 i965_post_processing_context_finalize(VADriverContextP ctx,
@@ -5693,20 +5791,13 @@ i965_post_processing_context_init(VADriverContextP ctx,
     avs_init_state(&pp_context->pp_avs_context.state, avs_config);
 }
 
+/* See i965_post_processing_get_context() */
 bool
 i965_post_processing_init(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct i965_post_processing_context *pp_context = i965->pp_context;
 
-    if (HAS_VPP(i965)) {
-        if (pp_context == NULL) {
-            pp_context = calloc(1, sizeof(*pp_context));
-            assert(pp_context);
-            i965->codec_info->post_processing_context_init(ctx, pp_context, i965->pp_batch);
-            i965->pp_context = pp_context;
-        }
-    }
+    i965->pp_context = NULL;
 
     return true;
 }
@@ -6148,9 +6239,6 @@ i965_proc_picture(VADriverContextP ctx,
     if (IS_GEN7(i965->intel.device_info) ||
         IS_GEN8(i965->intel.device_info) ||
         IS_GEN9(i965->intel.device_info)) {
-        unsigned int saved_filter_flag;
-        struct i965_post_processing_context *i965pp_context = i965->pp_context;
-
         if (obj_surface->fourcc == 0) {
             i965_check_alloc_surface_bo(ctx, obj_surface, 1,
                                         VA_FOURCC_NV12,
@@ -6163,14 +6251,11 @@ i965_proc_picture(VADriverContextP ctx,
 
         intel_batchbuffer_flush(hw_context->batch);
 
-        saved_filter_flag = i965pp_context->filter_flags;
-        i965pp_context->filter_flags = (pipeline_param->filter_flags & VA_FILTER_SCALING_MASK);
-
         dst_surface.base = (struct object_base *)obj_surface;
         dst_surface.type = I965_SURFACE_TYPE_SURFACE;
-        i965_image_processing(ctx, &src_surface, &src_rect, &dst_surface, &dst_rect);
-
-        i965pp_context->filter_flags = saved_filter_flag;
+        i965_image_scaling_processing(ctx, &src_surface, &src_rect,
+                                      &dst_surface, &dst_rect,
+                                      pipeline_param->filter_flags & VA_FILTER_SCALING_MASK);
 
         if (num_tmp_surfaces)
             i965_DestroySurfaces(ctx,
@@ -642,6 +642,14 @@ i965_image_processing(VADriverContextP ctx,
                       struct i965_surface *dst_surface,
                       const VARectangle *dst_rect);
 
+VAStatus
+i965_image_scaling_processing(VADriverContextP ctx,
+                              const struct i965_surface *src_surface,
+                              const VARectangle *src_rect,
+                              struct i965_surface *dst_surface,
+                              const VARectangle *dst_rect,
+                              unsigned int va_flags);
+
 void
 i965_post_processing_terminate(VADriverContextP ctx);
 bool
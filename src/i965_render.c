@@ -155,6 +155,19 @@ static const uint32_t ps_kernel_static_gen7_haswell[][4] = {
 #define SURFACE_STATE_OFFSET(index)     (SURFACE_STATE_PADDED_SIZE * index)
 #define BINDING_TABLE_OFFSET            SURFACE_STATE_OFFSET(MAX_RENDER_SURFACES)
 
+/* Every source of a composition has its own surface states and binding
+ * table, constants and rectangle in the vertex buffer */
+#define SOURCE_STATE_SIZE               ALIGN(BINDING_TABLE_OFFSET + sizeof(unsigned int) * MAX_RENDER_SURFACES, 64)
+#define SOURCE_STATE_OFFSET(source)     (SOURCE_STATE_SIZE * (source))
+#define SOURCE_CURBE_SIZE               256
+#define SOURCE_CURBE_OFFSET(source)     (SOURCE_CURBE_SIZE * (source))
+#define SOURCE_VERTEX_SIZE              (12 * sizeof(float))
+#define SOURCE_BATCH_SIZE               0x100
+
+/* The subpicture blend state follows the one of the surface */
+#define BLEND_STATE_PADDED_SIZE         ALIGN(sizeof(struct gen6_blend_state), 64)
+#define SUBPIC_BLEND_STATE_OFFSET       BLEND_STATE_PADDED_SIZE
+
 static uint32_t float_to_uint (float f) 
 {
     union {
@@ -805,12 +818,13 @@ i965_render_src_surface_state(
     struct i965_render_state *render_state = &i965->render_state;
     void *ss;
     dri_bo *ss_bo = render_state->wm.surface_state_binding_table_bo;
+    const unsigned int source_offset = SOURCE_STATE_OFFSET(render_state->source_index);
 
     assert(index < MAX_RENDER_SURFACES);
 
     dri_bo_map(ss_bo, 1);
     assert(ss_bo->virtual);
-    ss = (char *)ss_bo->virtual + SURFACE_STATE_OFFSET(index);
+    ss = (char *)ss_bo->virtual + source_offset + SURFACE_STATE_OFFSET(index);
 
     if (IS_GEN7(i965->intel.device_info)) {
         gen7_render_set_surface_state(ss,
@@ -822,7 +836,7 @@ i965_render_src_surface_state(
         dri_bo_emit_reloc(ss_bo,
                           I915_GEM_DOMAIN_SAMPLER, 0,
                           offset,
-                          SURFACE_STATE_OFFSET(index) + offsetof(struct gen7_surface_state, ss1),
+                          source_offset + SURFACE_STATE_OFFSET(index) + offsetof(struct gen7_surface_state, ss1),
                           region);
     } else {
         i965_render_set_surface_state(ss,
@@ -832,11 +846,12 @@ i965_render_src_surface_state(
         dri_bo_emit_reloc(ss_bo,
                           I915_GEM_DOMAIN_SAMPLER, 0,
                           offset,
-                          SURFACE_STATE_OFFSET(index) + offsetof(struct i965_surface_state, ss1),
+                          source_offset + SURFACE_STATE_OFFSET(index) + offsetof(struct i965_surface_state, ss1),
                           region);
     }
 
-    ((unsigned int *)((char *)ss_bo->virtual + BINDING_TABLE_OFFSET))[index] = SURFACE_STATE_OFFSET(index);
+    ((unsigned int *)((char *)ss_bo->virtual + source_offset + BINDING_TABLE_OFFSET))[index] =
+        source_offset + SURFACE_STATE_OFFSET(index);
     dri_bo_unmap(ss_bo);
     render_state->wm.sampler_count++;
 }
@@ -917,6 +932,7 @@ i965_render_dest_surface_state(VADriverContextP ctx, int index)
     struct intel_region *dest_region = render_state->draw_region;
     void *ss;
     dri_bo *ss_bo = render_state->wm.surface_state_binding_table_bo;
+    const unsigned int source_offset = SOURCE_STATE_OFFSET(render_state->source_index);
     int format;
     assert(index < MAX_RENDER_SURFACES);
 
@@ -928,7 +944,7 @@ i965_render_dest_surface_state(VADriverContextP ctx, int index)
 
     dri_bo_map(ss_bo, 1);
     assert(ss_bo->virtual);
-    ss = (char *)ss_bo->virtual + SURFACE_STATE_OFFSET(index);
+    ss = (char *)ss_bo->virtual + source_offset + SURFACE_STATE_OFFSET(index);
 
     if (IS_GEN7(i965->intel.device_info)) {
         gen7_render_set_surface_state(ss,
@@ -940,7 +956,7 @@ i965_render_dest_surface_state(VADriverContextP ctx, int index)
         dri_bo_emit_reloc(ss_bo,
                           I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
                           0,
-                          SURFACE_STATE_OFFSET(index) + offsetof(struct gen7_surface_state, ss1),
+                          source_offset + SURFACE_STATE_OFFSET(index) + offsetof(struct gen7_surface_state, ss1),
                           dest_region->bo);
     } else {
         i965_render_set_surface_state(ss,
@@ -950,11 +966,12 @@ i965_render_dest_surface_state(VADriverContextP ctx, int index)
         dri_bo_emit_reloc(ss_bo,
                           I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER,
                           0,
-                          SURFACE_STATE_OFFSET(index) + offsetof(struct i965_surface_state, ss1),
+                          source_offset + SURFACE_STATE_OFFSET(index) + offsetof(struct i965_surface_state, ss1),
                           dest_region->bo);
     }
 
-    ((unsigned int *)((char *)ss_bo->virtual + BINDING_TABLE_OFFSET))[index] = SURFACE_STATE_OFFSET(index);
+    ((unsigned int *)((char *)ss_bo->virtual + source_offset + BINDING_TABLE_OFFSET))[index] =
+        source_offset + SURFACE_STATE_OFFSET(index);
     dri_bo_unmap(ss_bo);
 }
 
@@ -995,7 +1012,9 @@ i965_fill_vertex_buffer(
     vb[10] = vid_coords[X1];
     vb[11] = vid_coords[Y1];
 
-    dri_bo_subdata(i965->render_state.vb.vertex_buffer, 0, sizeof(vb), vb);
+    dri_bo_subdata(i965->render_state.vb.vertex_buffer,
+                   SOURCE_VERTEX_SIZE * i965->render_state.source_index,
+                   sizeof(vb), vb);
 }
 
 static void 
@@ -1083,7 +1102,8 @@ i965_render_upload_constants(VADriverContextP ctx,
 
     dri_bo_map(render_state->curbe.bo, 1);
     assert(render_state->curbe.bo->virtual);
-    constant_buffer = render_state->curbe.bo->virtual;
+    constant_buffer = (unsigned short *)((char *)render_state->curbe.bo->virtual +
+                                         SOURCE_CURBE_OFFSET(render_state->source_index));
 
     if (obj_surface->subsampling == SUBSAMPLE_YUV400) {
         assert(obj_surface->fourcc == VA_FOURCC_Y800);
@@ -1136,7 +1156,8 @@ i965_subpic_render_upload_constants(VADriverContextP ctx,
     dri_bo_map(render_state->curbe.bo, 1);
 
     assert(render_state->curbe.bo->virtual);
-    constant_buffer = render_state->curbe.bo->virtual;
+    constant_buffer = (float *)((char *)render_state->curbe.bo->virtual +
+                                SOURCE_CURBE_OFFSET(render_state->source_index));
     *constant_buffer = global_alpha;
 
     dri_bo_unmap(render_state->curbe.bo);
@@ -1163,6 +1184,55 @@ i965_surface_render_state_setup(
     i965_render_upload_constants(ctx, obj_surface, flags);
 }
 
+/* Set up the surface states, constants and rectangle of every source, the
+ * samplers are shared and sized for the source with the most planes */
+static void
+i965_render_setup_sources(
+    VADriverContextP   ctx,
+    const struct i965_render_source *sources,
+    unsigned int       num_sources,
+    unsigned int       flags
+)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
+    const struct i965_render_source *source;
+    const struct i965_render_subpic *subpic;
+    int sampler_count = 0;
+    unsigned int i;
+
+    for (render_state->source_index = 0;
+         render_state->source_index < num_sources;
+         render_state->source_index++) {
+        source = &sources[render_state->source_index];
+
+        render_state->wm.sampler_count = 0;
+        i965_render_dest_surface_state(ctx, 0);
+        i965_render_src_surfaces_state(ctx, source->obj_surface, flags);
+        i965_render_upload_constants(ctx, source->obj_surface, flags);
+        i965_render_upload_vertex(ctx, source->obj_surface,
+                                  &source->src_rect, &source->dst_rect);
+        sampler_count = MAX(sampler_count, render_state->wm.sampler_count);
+    }
+
+    for (i = 0; i < render_state->num_subpics; i++) {
+        subpic = &render_state->subpics[i];
+        subpic->obj_surface->subpic_render_idx = subpic->index;
+        render_state->source_index = num_sources + i;
+
+        render_state->wm.sampler_count = 0;
+        i965_render_dest_surface_state(ctx, 0);
+        i965_subpic_render_src_surfaces_state(ctx, subpic->obj_surface);
+        i965_subpic_render_upload_constants(ctx, subpic->obj_surface);
+        i965_subpic_render_upload_vertex(ctx, subpic->obj_surface,
+                                         &subpic->dst_rect);
+        sampler_count = MAX(sampler_count, render_state->wm.sampler_count);
+    }
+
+    render_state->source_index = 0;
+    render_state->wm.sampler_count = sampler_count;
+}
+
 static void
 i965_subpic_render_state_setup(
     VADriverContextP   ctx,
@@ -1724,7 +1794,7 @@ gen6_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->vb.vertex_buffer);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "vertex buffer",
-                      4096,
+                      ALIGN(SOURCE_VERTEX_SIZE * RENDER_NUM_SLOTS(render_state), 4096),
                       4096);
     assert(bo);
     render_state->vb.vertex_buffer = bo;
@@ -1733,7 +1803,7 @@ gen6_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->wm.surface_state_binding_table_bo);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "surface state & binding table",
-                      (SURFACE_STATE_PADDED_SIZE + sizeof(unsigned int)) * MAX_RENDER_SURFACES,
+                      SOURCE_STATE_OFFSET(RENDER_NUM_SLOTS(render_state)),
                       4096);
     assert(bo);
     render_state->wm.surface_state_binding_table_bo = bo;
@@ -1769,7 +1839,7 @@ gen6_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->cc.blend);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "blend state",
-                      sizeof(struct gen6_blend_state),
+                      SUBPIC_BLEND_STATE_OFFSET + sizeof(struct gen6_blend_state),
                       4096);
     assert(bo);
     render_state->cc.blend = bo;
@@ -1832,26 +1902,6 @@ gen6_render_depth_stencil_state(VADriverContextP ctx)
     dri_bo_unmap(render_state->cc.depth_stencil);
 }
 
-static void
-gen6_render_setup_states(
-    VADriverContextP   ctx,
-    struct object_surface *obj_surface,
-    const VARectangle *src_rect,
-    const VARectangle *dst_rect,
-    unsigned int       flags
-)
-{
-    i965_render_dest_surface_state(ctx, 0);
-    i965_render_src_surfaces_state(ctx, obj_surface, flags);
-    i965_render_sampler(ctx);
-    i965_render_cc_viewport(ctx);
-    gen6_render_color_calc_state(ctx);
-    gen6_render_blend_state(ctx);
-    gen6_render_depth_stencil_state(ctx);
-    i965_render_upload_constants(ctx, obj_surface, flags);
-    i965_render_upload_vertex(ctx, obj_surface, src_rect, dst_rect);
-}
-
 static void
 gen6_emit_invarient_states(VADriverContextP ctx)
 {
@@ -1921,14 +1971,18 @@ gen6_emit_urb(VADriverContextP ctx)
 }
 
 static void
-gen6_emit_cc_state_pointers(VADriverContextP ctx)
+gen6_emit_cc_state_pointers(VADriverContextP ctx, int kernel)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
     struct i965_render_state *render_state = &i965->render_state;
+    unsigned int blend_offset = 0;
+
+    if (kernel == PS_SUBPIC_KERNEL)
+        blend_offset = SUBPIC_BLEND_STATE_OFFSET;
 
     OUT_BATCH(batch, GEN6_3DSTATE_CC_STATE_POINTERS | (4 - 2));
-    OUT_RELOC(batch, render_state->cc.blend, I915_GEM_DOMAIN_INSTRUCTION, 0, 1);
+    OUT_RELOC(batch, render_state->cc.blend, I915_GEM_DOMAIN_INSTRUCTION, 0, blend_offset + 1);
     OUT_RELOC(batch, render_state->cc.depth_stencil, I915_GEM_DOMAIN_INSTRUCTION, 0, 1);
     OUT_RELOC(batch, render_state->cc.state, I915_GEM_DOMAIN_INSTRUCTION, 0, 1);
 }
@@ -1953,6 +2007,7 @@ gen6_emit_binding_table(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
     /* Binding table pointers */
     OUT_BATCH(batch, CMD_BINDING_TABLE_POINTERS |
@@ -1961,7 +2016,7 @@ gen6_emit_binding_table(VADriverContextP ctx)
     OUT_BATCH(batch, 0);		/* vs */
     OUT_BATCH(batch, 0);		/* gs */
     /* Only the PS uses the binding table */
-    OUT_BATCH(batch, BINDING_TABLE_OFFSET);
+    OUT_BATCH(batch, SOURCE_STATE_OFFSET(render_state->source_index) + BINDING_TABLE_OFFSET);
 }
 
 static void
@@ -2087,7 +2142,7 @@ gen6_emit_wm_state(VADriverContextP ctx, int kernel)
     OUT_RELOC(batch, 
               render_state->curbe.bo,
               I915_GEM_DOMAIN_INSTRUCTION, 0,
-              (URB_CS_ENTRY_SIZE-1));
+              SOURCE_CURBE_OFFSET(render_state->source_index) + (URB_CS_ENTRY_SIZE-1));
     OUT_BATCH(batch, 0);
     OUT_BATCH(batch, 0);
     OUT_BATCH(batch, 0);
@@ -2138,22 +2193,13 @@ gen6_emit_vertex_element_state(VADriverContextP ctx)
 }
 
 static void
-gen6_emit_vertices(VADriverContextP ctx)
+gen6_emit_primitive(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
     struct i965_render_state *render_state = &i965->render_state;
 
-    BEGIN_BATCH(batch, 11);
-    OUT_BATCH(batch, CMD_VERTEX_BUFFERS | 3);
-    OUT_BATCH(batch, 
-              (0 << GEN6_VB0_BUFFER_INDEX_SHIFT) |
-              GEN6_VB0_VERTEXDATA |
-              ((4 * 4) << VB0_BUFFER_PITCH_SHIFT));
-    OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0, 0);
-    OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0, 12 * 4);
-    OUT_BATCH(batch, 0);
-
+    BEGIN_BATCH(batch, 6);
     OUT_BATCH(batch, 
               CMD_3DPRIMITIVE |
               _3DPRIMITIVE_VERTEX_SEQUENTIAL |
@@ -2161,26 +2207,86 @@ gen6_emit_vertices(VADriverContextP ctx)
               (0 << 9) |
               4);
     OUT_BATCH(batch, 3); /* vertex count per instance */
-    OUT_BATCH(batch, 0); /* start vertex offset */
+    OUT_BATCH(batch, 3 * render_state->source_index); /* start vertex offset */
     OUT_BATCH(batch, 1); /* single instance */
     OUT_BATCH(batch, 0); /* start instance location */
     OUT_BATCH(batch, 0); /* index buffer offset, ignored */
     ADVANCE_BATCH(batch);
 }
 
+static void
+gen6_emit_vertices(VADriverContextP ctx)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
+
+    BEGIN_BATCH(batch, 5);
+    OUT_BATCH(batch, CMD_VERTEX_BUFFERS | 3);
+    OUT_BATCH(batch, 
+              (0 << GEN6_VB0_BUFFER_INDEX_SHIFT) |
+              GEN6_VB0_VERTEXDATA |
+              ((4 * 4) << VB0_BUFFER_PITCH_SHIFT));
+    OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0, 0);
+    OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0,
+              SOURCE_VERTEX_SIZE * RENDER_NUM_SLOTS(render_state));
+    OUT_BATCH(batch, 0);
+    ADVANCE_BATCH(batch);
+
+    gen6_emit_primitive(ctx);
+}
+
+/* Only the constants, binding table and rectangle differ between sources,
+ * the subpictures also switch to the blending kernel */
+static void
+gen6_emit_sources(VADriverContextP ctx, int kernel)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
+    const struct i965_render_subpic *subpic;
+    struct object_subpic *obj_subpic;
+    unsigned int i;
+
+    for (render_state->source_index = 1;
+         render_state->source_index < render_state->num_sources;
+         render_state->source_index++) {
+        gen6_emit_wm_state(ctx, kernel);
+        gen6_emit_binding_table(ctx);
+        gen6_emit_primitive(ctx);
+    }
+
+    /* The blend state can only be changed along with the other CC states */
+    if (render_state->num_subpics > 0)
+        gen6_emit_cc_state_pointers(ctx, PS_SUBPIC_KERNEL);
+
+    for (i = 0; i < render_state->num_subpics; i++) {
+        subpic = &render_state->subpics[i];
+        obj_subpic = subpic->obj_surface->obj_subpic[subpic->index];
+        render_state->source_index = render_state->num_sources + i;
+
+        i965_render_upload_image_palette(ctx, obj_subpic->obj_image, 0xff);
+        gen6_emit_wm_state(ctx, PS_SUBPIC_KERNEL);
+        gen6_emit_binding_table(ctx);
+        gen6_emit_primitive(ctx);
+    }
+
+    render_state->source_index = 0;
+}
+
 static void
 gen6_render_emit_states(VADriverContextP ctx, int kernel)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
-    intel_batchbuffer_start_atomic(batch, 0x1000);
+    intel_batchbuffer_start_atomic(batch, 0x1000 + SOURCE_BATCH_SIZE * RENDER_NUM_SLOTS(render_state));
     intel_batchbuffer_emit_mi_flush(batch);
     gen6_emit_invarient_states(ctx);
     gen6_emit_state_base_address(ctx);
     gen6_emit_viewport_state_pointers(ctx);
     gen6_emit_urb(ctx);
-    gen6_emit_cc_state_pointers(ctx);
+    gen6_emit_cc_state_pointers(ctx, kernel);
     gen6_emit_sampler_state_pointers(ctx);
     gen6_emit_vs_state(ctx);
     gen6_emit_gs_state(ctx);
@@ -2192,28 +2298,10 @@ gen6_render_emit_states(VADriverContextP ctx, int kernel)
     gen6_emit_drawing_rectangle(ctx);
     gen6_emit_vertex_element_state(ctx);
     gen6_emit_vertices(ctx);
+    gen6_emit_sources(ctx, kernel);
     intel_batchbuffer_end_atomic(batch);
 }
 
-static void
-gen6_render_put_surface(
-    VADriverContextP   ctx,
-    struct object_surface *obj_surface,
-    const VARectangle *src_rect,
-    const VARectangle *dst_rect,
-    unsigned int       flags
-)
-{
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct intel_batchbuffer *batch = i965->batch;
-
-    gen6_render_initialize(ctx);
-    gen6_render_setup_states(ctx, obj_surface, src_rect, dst_rect, flags);
-    i965_clear_dest_region(ctx);
-    gen6_render_emit_states(ctx, PS_KERNEL);
-    intel_batchbuffer_flush(batch);
-}
-
 static void
 gen6_subpicture_render_blend_state(VADriverContextP ctx)
 {
@@ -2224,7 +2312,8 @@ gen6_subpicture_render_blend_state(VADriverContextP ctx)
     dri_bo_unmap(render_state->cc.state);    
     dri_bo_map(render_state->cc.blend, 1);
     assert(render_state->cc.blend->virtual);
-    blend_state = render_state->cc.blend->virtual;
+    blend_state = (struct gen6_blend_state *)((char *)render_state->cc.blend->virtual +
+                                              SUBPIC_BLEND_STATE_OFFSET);
     memset(blend_state, 0, sizeof(*blend_state));
     blend_state->blend0.dest_blend_factor = I965_BLENDFACTOR_INV_SRC_ALPHA;
     blend_state->blend0.source_blend_factor = I965_BLENDFACTOR_SRC_ALPHA;
@@ -2255,6 +2344,34 @@ gen6_subpicture_render_setup_states(
     i965_subpic_render_upload_vertex(ctx, obj_surface, dst_rect);
 }
 
+static void
+gen6_render_put_surfaces(
+    VADriverContextP   ctx,
+    const struct i965_render_source *sources,
+    unsigned int       num_sources,
+    unsigned int       flags
+)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
+
+    render_state->num_sources = num_sources;
+    gen6_render_initialize(ctx);
+    i965_render_setup_sources(ctx, sources, num_sources, flags);
+    i965_render_sampler(ctx);
+    i965_render_cc_viewport(ctx);
+    gen6_render_color_calc_state(ctx);
+    gen6_render_blend_state(ctx);
+    gen6_subpicture_render_blend_state(ctx);
+    gen6_render_depth_stencil_state(ctx);
+    i965_clear_dest_region(ctx);
+    gen6_render_emit_states(ctx, PS_KERNEL);
+    intel_batchbuffer_flush(batch);
+    render_state->num_sources = 1;
+    render_state->num_subpics = 0;
+}
+
 static void
 gen6_render_put_subpicture(
     VADriverContextP   ctx,
@@ -2290,7 +2407,7 @@ gen7_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->vb.vertex_buffer);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "vertex buffer",
-                      4096,
+                      ALIGN(SOURCE_VERTEX_SIZE * RENDER_NUM_SLOTS(render_state), 4096),
                       4096);
     assert(bo);
     render_state->vb.vertex_buffer = bo;
@@ -2299,7 +2416,7 @@ gen7_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->wm.surface_state_binding_table_bo);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "surface state & binding table",
-                      (SURFACE_STATE_PADDED_SIZE + sizeof(unsigned int)) * MAX_RENDER_SURFACES,
+                      SOURCE_STATE_OFFSET(RENDER_NUM_SLOTS(render_state)),
                       4096);
     assert(bo);
     render_state->wm.surface_state_binding_table_bo = bo;
@@ -2335,7 +2452,7 @@ gen7_render_initialize(VADriverContextP ctx)
     dri_bo_unreference(render_state->cc.blend);
     bo = dri_bo_alloc(i965->intel.bufmgr,
                       "blend state",
-                      sizeof(struct gen6_blend_state),
+                      SUBPIC_BLEND_STATE_OFFSET + sizeof(struct gen6_blend_state),
                       4096);
     assert(bo);
     render_state->cc.blend = bo;
@@ -2432,27 +2549,6 @@ gen7_render_sampler(VADriverContextP ctx)
 }
 
 
-static void
-gen7_render_setup_states(
-    VADriverContextP   ctx,
-    struct object_surface *obj_surface,
-    const VARectangle *src_rect,
-    const VARectangle *dst_rect,
-    unsigned int       flags
-)
-{
-    i965_render_dest_surface_state(ctx, 0);
-    i965_render_src_surfaces_state(ctx, obj_surface, flags);
-    gen7_render_sampler(ctx);
-    i965_render_cc_viewport(ctx);
-    gen7_render_color_calc_state(ctx);
-    gen7_render_blend_state(ctx);
-    gen7_render_depth_stencil_state(ctx);
-    i965_render_upload_constants(ctx, obj_surface, flags);
-    i965_render_upload_vertex(ctx, obj_surface, src_rect, dst_rect);
-}
-
-
 static void
 gen7_emit_invarient_states(VADriverContextP ctx)
 {
@@ -2575,28 +2671,42 @@ gen7_emit_urb(VADriverContextP ctx)
 }
 
 static void
-gen7_emit_cc_state_pointers(VADriverContextP ctx)
+gen7_emit_blend_state_pointers(VADriverContextP ctx, int kernel)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
     struct i965_render_state *render_state = &i965->render_state;
+    unsigned int blend_offset = 0;
+
+    if (kernel == PS_SUBPIC_KERNEL)
+        blend_offset = SUBPIC_BLEND_STATE_OFFSET;
 
     BEGIN_BATCH(batch, 2);
-    OUT_BATCH(batch, GEN6_3DSTATE_CC_STATE_POINTERS | (2 - 2));
+    OUT_BATCH(batch, GEN7_3DSTATE_BLEND_STATE_POINTERS | (2 - 2));
     OUT_RELOC(batch,
-              render_state->cc.state,
+              render_state->cc.blend,
               I915_GEM_DOMAIN_INSTRUCTION, 0,
-              1);
+              blend_offset + 1);
     ADVANCE_BATCH(batch);
+}
+
+static void
+gen7_emit_cc_state_pointers(VADriverContextP ctx, int kernel)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
     BEGIN_BATCH(batch, 2);
-    OUT_BATCH(batch, GEN7_3DSTATE_BLEND_STATE_POINTERS | (2 - 2));
+    OUT_BATCH(batch, GEN6_3DSTATE_CC_STATE_POINTERS | (2 - 2));
     OUT_RELOC(batch,
-              render_state->cc.blend,
+              render_state->cc.state,
               I915_GEM_DOMAIN_INSTRUCTION, 0,
               1);
     ADVANCE_BATCH(batch);
 
+    gen7_emit_blend_state_pointers(ctx, kernel);
+
     BEGIN_BATCH(batch, 2);
     OUT_BATCH(batch, GEN7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS | (2 - 2));
     OUT_RELOC(batch,
@@ -2627,10 +2737,11 @@ gen7_emit_binding_table(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
     BEGIN_BATCH(batch, 2);
     OUT_BATCH(batch, GEN7_3DSTATE_BINDING_TABLE_POINTERS_PS | (2 - 2));
-    OUT_BATCH(batch, BINDING_TABLE_OFFSET);
+    OUT_BATCH(batch, SOURCE_STATE_OFFSET(render_state->source_index) + BINDING_TABLE_OFFSET);
     ADVANCE_BATCH(batch);
 }
 
@@ -2865,7 +2976,7 @@ gen7_emit_wm_state(VADriverContextP ctx, int kernel)
     OUT_RELOC(batch, 
               render_state->curbe.bo,
               I915_GEM_DOMAIN_INSTRUCTION, 0,
-              0);
+              SOURCE_CURBE_OFFSET(render_state->source_index));
     OUT_BATCH(batch, 0);
     OUT_BATCH(batch, 0);
     OUT_BATCH(batch, 0);
@@ -2921,6 +3032,26 @@ gen7_emit_vertex_element_state(VADriverContextP ctx)
               (I965_VFCOMPONENT_STORE_1_FLT << VE1_VFCOMPONENT_3_SHIFT));
 }
 
+static void
+gen7_emit_primitive(VADriverContextP ctx)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
+
+    BEGIN_BATCH(batch, 7);
+    OUT_BATCH(batch, CMD_3DPRIMITIVE | (7 - 2));
+    OUT_BATCH(batch,
+              _3DPRIM_RECTLIST |
+              GEN7_3DPRIM_VERTEXBUFFER_ACCESS_SEQUENTIAL);
+    OUT_BATCH(batch, 3); /* vertex count per instance */
+    OUT_BATCH(batch, 3 * render_state->source_index); /* start vertex offset */
+    OUT_BATCH(batch, 1); /* single instance */
+    OUT_BATCH(batch, 0); /* start instance location */
+    OUT_BATCH(batch, 0);
+    ADVANCE_BATCH(batch);
+}
+
 static void
 gen7_emit_vertices(VADriverContextP ctx)
 {
@@ -2936,21 +3067,48 @@ gen7_emit_vertices(VADriverContextP ctx)
               GEN7_VB0_ADDRESS_MODIFYENABLE |
               ((4 * 4) << VB0_BUFFER_PITCH_SHIFT));
     OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0, 0);
-    OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0, 12 * 4);
+    OUT_RELOC(batch, render_state->vb.vertex_buffer, I915_GEM_DOMAIN_VERTEX, 0,
+              SOURCE_VERTEX_SIZE * RENDER_NUM_SLOTS(render_state));
     OUT_BATCH(batch, 0);
     ADVANCE_BATCH(batch);
 
-    BEGIN_BATCH(batch, 7);
-    OUT_BATCH(batch, CMD_3DPRIMITIVE | (7 - 2));
-    OUT_BATCH(batch,
-              _3DPRIM_RECTLIST |
-              GEN7_3DPRIM_VERTEXBUFFER_ACCESS_SEQUENTIAL);
-    OUT_BATCH(batch, 3); /* vertex count per instance */
-    OUT_BATCH(batch, 0); /* start vertex offset */
-    OUT_BATCH(batch, 1); /* single instance */
-    OUT_BATCH(batch, 0); /* start instance location */
-    OUT_BATCH(batch, 0);
-    ADVANCE_BATCH(batch);
+    gen7_emit_primitive(ctx);
+}
+
+/* Only the constants, binding table and rectangle differ between sources,
+ * the subpictures also switch to the blending kernel */
+static void
+gen7_emit_sources(VADriverContextP ctx, int kernel)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
+    const struct i965_render_subpic *subpic;
+    struct object_subpic *obj_subpic;
+    unsigned int i;
+
+    for (render_state->source_index = 1;
+         render_state->source_index < render_state->num_sources;
+         render_state->source_index++) {
+        gen7_emit_wm_state(ctx, kernel);
+        gen7_emit_binding_table(ctx);
+        gen7_emit_primitive(ctx);
+    }
+
+    if (render_state->num_subpics > 0)
+        gen7_emit_blend_state_pointers(ctx, PS_SUBPIC_KERNEL);
+
+    for (i = 0; i < render_state->num_subpics; i++) {
+        subpic = &render_state->subpics[i];
+        obj_subpic = subpic->obj_surface->obj_subpic[subpic->index];
+        render_state->source_index = render_state->num_sources + i;
+
+        i965_render_upload_image_palette(ctx, obj_subpic->obj_image, 0xff);
+        gen7_emit_wm_state(ctx, PS_SUBPIC_KERNEL);
+        gen7_emit_binding_table(ctx);
+        gen7_emit_primitive(ctx);
+    }
+
+    render_state->source_index = 0;
 }
 
 static void
@@ -2958,14 +3116,15 @@ gen7_render_emit_states(VADriverContextP ctx, int kernel)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
 
-    intel_batchbuffer_start_atomic(batch, 0x1000);
+    intel_batchbuffer_start_atomic(batch, 0x1000 + SOURCE_BATCH_SIZE * RENDER_NUM_SLOTS(render_state));
     intel_batchbuffer_emit_mi_flush(batch);
     gen7_emit_invarient_states(ctx);
     gen7_emit_state_base_address(ctx);
     gen7_emit_viewport_state_pointers(ctx);
     gen7_emit_urb(ctx);
-    gen7_emit_cc_state_pointers(ctx);
+    gen7_emit_cc_state_pointers(ctx, kernel);
     gen7_emit_sampler_state_pointers(ctx);
     gen7_emit_bypass_state(ctx);
     gen7_emit_vs_state(ctx);
@@ -2977,30 +3136,11 @@ gen7_render_emit_states(VADriverContextP ctx, int kernel)
     gen7_emit_drawing_rectangle(ctx);
     gen7_emit_vertex_element_state(ctx);
     gen7_emit_vertices(ctx);
+    gen7_emit_sources(ctx, kernel);
     intel_batchbuffer_end_atomic(batch);
 }
 
 
-static void
-gen7_render_put_surface(
-    VADriverContextP   ctx,
-    struct object_surface *obj_surface,    
-    const VARectangle *src_rect,
-    const VARectangle *dst_rect,
-    unsigned int       flags
-)
-{
-    struct i965_driver_data *i965 = i965_driver_data(ctx);
-    struct intel_batchbuffer *batch = i965->batch;
-
-    gen7_render_initialize(ctx);
-    gen7_render_setup_states(ctx, obj_surface, src_rect, dst_rect, flags);
-    i965_clear_dest_region(ctx);
-    gen7_render_emit_states(ctx, PS_KERNEL);
-    intel_batchbuffer_flush(batch);
-}
-
-
 static void
 gen7_subpicture_render_blend_state(VADriverContextP ctx)
 {
@@ -3011,7 +3151,8 @@ gen7_subpicture_render_blend_state(VADriverContextP ctx)
     dri_bo_unmap(render_state->cc.state);    
     dri_bo_map(render_state->cc.blend, 1);
     assert(render_state->cc.blend->virtual);
-    blend_state = render_state->cc.blend->virtual;
+    blend_state = (struct gen6_blend_state *)((char *)render_state->cc.blend->virtual +
+                                              SUBPIC_BLEND_STATE_OFFSET);
     memset(blend_state, 0, sizeof(*blend_state));
     blend_state->blend0.dest_blend_factor = I965_BLENDFACTOR_INV_SRC_ALPHA;
     blend_state->blend0.source_blend_factor = I965_BLENDFACTOR_SRC_ALPHA;
@@ -3042,6 +3183,34 @@ gen7_subpicture_render_setup_states(
     i965_subpic_render_upload_vertex(ctx, obj_surface, dst_rect);
 }
 
+static void
+gen7_render_put_surfaces(
+    VADriverContextP   ctx,
+    const struct i965_render_source *sources,
+    unsigned int       num_sources,
+    unsigned int       flags
+)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct intel_batchbuffer *batch = i965->batch;
+    struct i965_render_state *render_state = &i965->render_state;
+
+    render_state->num_sources = num_sources;
+    gen7_render_initialize(ctx);
+    i965_render_setup_sources(ctx, sources, num_sources, flags);
+    gen7_render_sampler(ctx);
+    i965_render_cc_viewport(ctx);
+    gen7_render_color_calc_state(ctx);
+    gen7_render_blend_state(ctx);
+    gen7_subpicture_render_blend_state(ctx);
+    gen7_render_depth_stencil_state(ctx);
+    i965_clear_dest_region(ctx);
+    gen7_render_emit_states(ctx, PS_KERNEL);
+    intel_batchbuffer_flush(batch);
+    render_state->num_sources = 1;
+    render_state->num_subpics = 0;
+}
+
 static void
 gen7_render_put_subpicture(
     VADriverContextP   ctx,
@@ -3063,6 +3232,19 @@ gen7_render_put_subpicture(
     intel_batchbuffer_flush(batch);
 }
 
+/* Caller must hold render_mutex */
+static bool
+intel_render_check_initialized(VADriverContextP ctx)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
+
+    if (!render_state->initialized &&
+        i965->codec_info->render_init(ctx))
+        render_state->initialized = 1;
+
+    return render_state->initialized;
+}
 
 void
 intel_render_put_surface(
@@ -3075,15 +3257,34 @@ intel_render_put_surface(
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct i965_render_state *render_state = &i965->render_state;
+    struct object_surface *render_surface = obj_surface;
+    const VARectangle *render_src_rect = src_rect;
     int has_done_scaling = 0;
     VARectangle calibrated_rect;
-    VASurfaceID out_surface_id = i965_post_processing(ctx,
-                                                      obj_surface,
-                                                      src_rect,
-                                                      dst_rect,
-                                                      flags,
-                                                      &has_done_scaling,
-                                                      &calibrated_rect);
+    VASurfaceID out_surface_id;
+    int i;
+
+    if (!intel_render_check_initialized(ctx))
+        return;
+
+    /* The subpictures are blended by the same batch when supported */
+    if (render_state->render_put_surfaces) {
+        struct i965_render_source source;
+
+        source.obj_surface = obj_surface;
+        source.src_rect = *src_rect;
+        source.dst_rect = *dst_rect;
+        intel_render_put_surfaces(ctx, &source, 1, flags);
+        return;
+    }
+
+    out_surface_id = i965_post_processing(ctx,
+                                          obj_surface,
+                                          src_rect,
+                                          dst_rect,
+                                          flags,
+                                          &has_done_scaling,
+                                          &calibrated_rect);
 
     assert((!has_done_scaling) || (out_surface_id != VA_INVALID_ID));
 
@@ -3091,16 +3292,101 @@ intel_render_put_surface(
         struct object_surface *new_obj_surface = SURFACE(out_surface_id);
         
         if (new_obj_surface && new_obj_surface->bo)
-            obj_surface = new_obj_surface;
+            render_surface = new_obj_surface;
 
         if (has_done_scaling)
-            src_rect = &calibrated_rect;
+            render_src_rect = &calibrated_rect;
     }
 
-    render_state->render_put_surface(ctx, obj_surface, src_rect, dst_rect, flags);
+    render_state->render_put_surface(ctx, render_surface, render_src_rect, dst_rect, flags);
 
     if (out_surface_id != VA_INVALID_ID)
         i965_DestroySurfaces(ctx, &out_surface_id, 1);
+
+    for (i = 0; i < I965_MAX_SUBPIC_SUM; i++) {
+        if (obj_surface->obj_subpic[i] != NULL) {
+            assert(obj_surface->subpic[i] != VA_INVALID_ID);
+            obj_surface->subpic_render_idx = i;
+            render_state->render_put_subpicture(ctx, obj_surface, src_rect, dst_rect);
+        }
+    }
+}
+
+/* Composite several surfaces into the draw region with a single batch */
+VAStatus
+intel_render_put_surfaces(
+    VADriverContextP   ctx,
+    const struct i965_render_source *sources,
+    unsigned int       num_sources,
+    unsigned int       flags
+)
+{
+    struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
+    struct i965_render_source render_sources[MAX_RENDER_SOURCES];
+    struct i965_render_subpic *subpic;
+    VASurfaceID out_surface_ids[MAX_RENDER_SOURCES];
+    VARectangle calibrated_rect;
+    int has_done_scaling;
+    unsigned int i, j;
+
+    if (!intel_render_check_initialized(ctx))
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
+    if (!render_state->render_put_surfaces)
+        return VA_STATUS_ERROR_UNIMPLEMENTED;
+
+    if (num_sources == 0 || num_sources > MAX_RENDER_SOURCES)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    render_state->num_subpics = 0;
+
+    for (i = 0; i < num_sources; i++) {
+        struct i965_render_source * const source = &render_sources[i];
+
+        /* Subpictures stay attached to the surface before post processing */
+        for (j = 0; j < I965_MAX_SUBPIC_SUM; j++) {
+            if (sources[i].obj_surface->obj_subpic[j] == NULL)
+                continue;
+
+            assert(sources[i].obj_surface->subpic[j] != VA_INVALID_ID);
+            subpic = &render_state->subpics[render_state->num_subpics++];
+            subpic->obj_surface = sources[i].obj_surface;
+            subpic->index = j;
+            subpic->dst_rect = sources[i].dst_rect;
+        }
+
+        *source = sources[i];
+        has_done_scaling = 0;
+        out_surface_ids[i] = i965_post_processing(ctx,
+                                                  source->obj_surface,
+                                                  &source->src_rect,
+                                                  &source->dst_rect,
+                                                  flags,
+                                                  &has_done_scaling,
+                                                  &calibrated_rect);
+
+        assert((!has_done_scaling) || (out_surface_ids[i] != VA_INVALID_ID));
+
+        if (out_surface_ids[i] != VA_INVALID_ID) {
+            struct object_surface *new_obj_surface = SURFACE(out_surface_ids[i]);
+
+            if (new_obj_surface && new_obj_surface->bo)
+                source->obj_surface = new_obj_surface;
+
+            if (has_done_scaling)
+                source->src_rect = calibrated_rect;
+        }
+    }
+
+    render_state->render_put_surfaces(ctx, render_sources, num_sources, flags);
+
+    for (i = 0; i < num_sources; i++) {
+        if (out_surface_ids[i] != VA_INVALID_ID)
+            i965_DestroySurfaces(ctx, &out_surface_ids[i], 1);
+    }
+
+    return VA_STATUS_SUCCESS;
 }
 
 void
@@ -3114,6 +3400,9 @@ intel_render_put_subpicture(
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct i965_render_state *render_state = &i965->render_state;
 
+    if (!intel_render_check_initialized(ctx))
+        return;
+
     render_state->render_put_subpicture(ctx, obj_surface, src_rect, dst_rect);
 }
 
@@ -3178,11 +3467,11 @@ genx_render_init(VADriverContextP ctx)
         memcpy(render_state->render_kernels,
                (IS_HASWELL(i965->intel.device_info) ? render_kernels_gen7_haswell : render_kernels_gen7),
                sizeof(render_state->render_kernels));
-        render_state->render_put_surface = gen7_render_put_surface;
+        render_state->render_put_surfaces = gen7_render_put_surfaces;
         render_state->render_put_subpicture = gen7_render_put_subpicture;
     } else if (IS_GEN6(i965->intel.device_info)) {
         memcpy(render_state->render_kernels, render_kernels_gen6, sizeof(render_state->render_kernels));
-        render_state->render_put_surface = gen6_render_put_surface;
+        render_state->render_put_surfaces = gen6_render_put_surfaces;
         render_state->render_put_subpicture = gen6_render_put_subpicture;
     } else if (IS_IRONLAKE(i965->intel.device_info)) {
         memcpy(render_state->render_kernels, render_kernels_gen5, sizeof(render_state->render_kernels));
@@ -3195,6 +3484,9 @@ genx_render_init(VADriverContextP ctx)
     }
 
     render_state->render_terminate = genx_render_terminate;
+    render_state->num_sources = 1;
+    render_state->source_index = 0;
+    render_state->num_subpics = 0;
 
     for (i = 0; i < NUM_RENDER_KERNEL; i++) {
         struct i965_kernel *kernel = &render_state->render_kernels[i];
@@ -3212,18 +3504,25 @@ genx_render_init(VADriverContextP ctx)
     /* constant buffer */
     render_state->curbe.bo = dri_bo_alloc(i965->intel.bufmgr,
                       "constant buffer",
-                      4096, 64);
+                      SOURCE_CURBE_OFFSET(MAX_RENDER_SLOTS), 64);
     assert(render_state->curbe.bo);
 
     return true;
 }
 
+/*
+ * Processes that never display anything should not pay for loading the
+ * render kernels, so they are set up by the first put surface call
+ */
 bool
 i965_render_init(VADriverContextP ctx)
 {
     struct i965_driver_data *i965 = i965_driver_data(ctx);
+    struct i965_render_state *render_state = &i965->render_state;
 
-    return i965->codec_info->render_init(ctx);
+    render_state->initialized = 0;
+
+    return true;
 }
 
 void
@@ -3232,5 +3531,12 @@ i965_render_terminate(VADriverContextP ctx)
     struct i965_driver_data *i965 = i965_driver_data(ctx);
     struct i965_render_state *render_state = &i965->render_state;
 
-    render_state->render_terminate(ctx);
+    if (render_state->initialized) {
+        render_state->render_terminate(ctx);
+        render_state->initialized = 0;
+    } else if (render_state->draw_region) {
+        dri_bo_unreference(render_state->draw_region->bo);
+        free(render_state->draw_region);
+        render_state->draw_region = NULL;
+    }
 }
@@ -33,11 +33,35 @@
 
 #define NUM_RENDER_KERNEL       3
 
+#define MAX_RENDER_SOURCES      64
+#define MAX_RENDER_SUBPICS      (MAX_RENDER_SOURCES * I965_MAX_SUBPIC_SUM)
+#define MAX_RENDER_SLOTS        (MAX_RENDER_SOURCES + MAX_RENDER_SUBPICS)
+
 #define VA_SRC_COLOR_MASK       0x000000f0
 
 
 struct i965_kernel;
 
+/* A surface composited by intel_render_put_surfaces() */
+struct i965_render_source
+{
+    struct object_surface *obj_surface;
+    VARectangle src_rect;
+    VARectangle dst_rect;
+};
+
+/* A subpicture blended over its source by the same batch */
+struct i965_render_subpic
+{
+    struct object_surface *obj_surface;
+    unsigned int index;
+    VARectangle dst_rect;
+};
+
+/* Sources come first, followed by the subpictures blended on top of them */
+#define RENDER_NUM_SLOTS(render_state) \
+    ((render_state)->num_sources + (render_state)->num_subpics)
+
 struct i965_render_state
 {
     struct {
@@ -74,6 +98,9 @@ struct i965_render_state
 
     int pp_flag; /* 0: disable, 1: enable */
 
+    /* Kernels and states are set up by the first put surface call */
+    int initialized;
+
     struct i965_kernel render_kernels[3];
     
     struct {
@@ -113,10 +140,23 @@ struct i965_render_state
     unsigned int scissor_offset;
     int scissor_size;
 
+    /* Sources drawn by the current batch and the one whose binding table,
+     * constants and vertices are being set up */
+    unsigned int num_sources;
+    unsigned int source_index;
+
+    unsigned int num_subpics;
+    struct i965_render_subpic subpics[MAX_RENDER_SUBPICS];
+
+    /* Only used when render_put_surfaces is not implemented */
     void (*render_put_surface)(VADriverContextP ctx, struct object_surface *,
                                const VARectangle *src_rec,
                                const VARectangle *dst_rect,
                                unsigned int flags);
+    void (*render_put_surfaces)(VADriverContextP ctx,
+                                const struct i965_render_source *sources,
+                                unsigned int num_sources,
+                                unsigned int flags);
     void (*render_put_subpicture)(VADriverContextP ctx, struct object_surface *,
                                const VARectangle *src_rec,
                                const VARectangle *dst_rect);
@@ -126,6 +166,8 @@ struct i965_render_state
 bool i965_render_init(VADriverContextP ctx);
 void i965_render_terminate(VADriverContextP ctx);
 
+/* The intel_render_*() functions must be called with render_mutex held */
+
 void
 intel_render_put_surface(
     VADriverContextP   ctx,
@@ -135,6 +177,14 @@ intel_render_put_surface(
     unsigned int       flags
 );
 
+VAStatus
+intel_render_put_surfaces(
+    VADriverContextP   ctx,
+    const struct i965_render_source *sources,
+    unsigned int       num_sources,
+    unsigned int       flags
+);
+
 void
 intel_render_put_subpicture(
     VADriverContextP   ctx,
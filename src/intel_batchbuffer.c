@@ -114,8 +114,23 @@ intel_batchbuffer_new(struct intel_driver_data *intel, int flag, int buffer_size
     return batch;
 }
 
+static void
+intel_batchbuffer_release_watches(struct intel_batchbuffer *batch)
+{
+    struct intel_batchbuffer_watch *watch;
+
+    while (batch->watches) {
+        watch = batch->watches;
+        batch->watches = watch->next;
+        watch->batch = NULL;
+        watch->next = NULL;
+    }
+}
+
 void intel_batchbuffer_free(struct intel_batchbuffer *batch)
 {
+    intel_batchbuffer_release_watches(batch);
+
     if (batch->map) {
         dri_bo_unmap(batch->buffer);
         batch->map = NULL;
@@ -145,6 +160,7 @@ intel_batchbuffer_flush(struct intel_batchbuffer *batch)
     dri_bo_unmap(batch->buffer);
     used = batch->ptr - batch->map;
     batch->run(batch->buffer, used, 0, 0, 0, batch->flag);
+    intel_batchbuffer_release_watches(batch);
     intel_batchbuffer_reset(batch, batch->size);
 }
 
@@ -156,14 +172,29 @@ intel_batchbuffer_emit_dword(struct intel_batchbuffer *batch, unsigned int x)
     batch->ptr += 4;
 }
 
+/* libdrm updates the target bo too, which may be shared between threads */
+static void
+intel_batchbuffer_add_reloc(struct intel_batchbuffer *batch, dri_bo *bo,
+                            uint32_t read_domains, uint32_t write_domains,
+                            uint32_t delta)
+{
+    if (batch->reloc_mutex)
+        _i965LockMutex(batch->reloc_mutex);
+
+    dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
+                      delta, batch->ptr - batch->map, bo);
+
+    if (batch->reloc_mutex)
+        _i965UnlockMutex(batch->reloc_mutex);
+}
+
 void 
 intel_batchbuffer_emit_reloc(struct intel_batchbuffer *batch, dri_bo *bo, 
                                 uint32_t read_domains, uint32_t write_domains, 
                                 uint32_t delta)
 {
     assert(batch->ptr - batch->map < batch->size);
-    dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
-                      delta, batch->ptr - batch->map, bo);
+    intel_batchbuffer_add_reloc(batch, bo, read_domains, write_domains, delta);
     intel_batchbuffer_emit_dword(batch, bo->offset + delta);
 }
 
@@ -173,8 +204,7 @@ intel_batchbuffer_emit_reloc64(struct intel_batchbuffer *batch, dri_bo *bo,
                                 uint32_t delta)
 {
     assert(batch->ptr - batch->map < batch->size);
-    dri_bo_emit_reloc(batch->buffer, read_domains, write_domains,
-                      delta, batch->ptr - batch->map, bo);
+    intel_batchbuffer_add_reloc(batch, bo, read_domains, write_domains, delta);
 
    /* Using the old buffer offset, write in what the right data would be, in
     * case the buffer doesn't move and we can short-circuit the relocation
@@ -444,3 +474,36 @@ intel_batchbuffer_align(struct intel_batchbuffer *batch, unsigned int alignedmen
     }
 }
 
+
+/* Attaches watch to batch, detaching it from the batch it was on before */
+void
+intel_batchbuffer_watch(struct intel_batchbuffer *batch,
+                        struct intel_batchbuffer_watch *watch)
+{
+    if (watch->batch == batch)
+        return;
+
+    intel_batchbuffer_unwatch(watch);
+    watch->batch = batch;
+    watch->next = batch->watches;
+    batch->watches = watch;
+}
+
+void
+intel_batchbuffer_unwatch(struct intel_batchbuffer_watch *watch)
+{
+    struct intel_batchbuffer_watch **p;
+
+    if (!watch->batch)
+        return;
+
+    for (p = &watch->batch->watches; *p; p = &(*p)->next) {
+        if (*p == watch) {
+            *p = watch->next;
+            break;
+        }
+    }
+
+    watch->batch = NULL;
+    watch->next = NULL;
+}
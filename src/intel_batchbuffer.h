@@ -7,6 +7,20 @@
 #include <intel_bufmgr.h>
 
 #include "intel_driver.h"
+#include "i965_mutext.h"
+
+struct intel_batchbuffer;
+
+/*
+ * Lets an object know whether it is still referenced from commands that
+ * were queued but not submitted yet: batch is cleared once the batch is
+ * flushed or freed.
+ */
+struct intel_batchbuffer_watch
+{
+    struct intel_batchbuffer *batch;
+    struct intel_batchbuffer_watch *next;
+};
 
 struct intel_batchbuffer 
 {
@@ -17,6 +31,11 @@ struct intel_batchbuffer
     unsigned char *ptr;
     int atomic;
     int flag;
+    struct intel_batchbuffer_watch *watches;
+
+    /* Held around relocations while several threads build batches that
+     * reference the same buffers, NULL otherwise */
+    _I965Mutex *reloc_mutex;
 
     int emit_total;
     unsigned char *emit_start;
@@ -53,6 +72,8 @@ void intel_batchbuffer_check_batchbuffer_flag(struct intel_batchbuffer *batch, i
 int intel_batchbuffer_check_free_space(struct intel_batchbuffer *batch, int size);
 int intel_batchbuffer_used_size(struct intel_batchbuffer *batch);
 void intel_batchbuffer_align(struct intel_batchbuffer *batch, unsigned int alignedment);
+void intel_batchbuffer_watch(struct intel_batchbuffer *batch, struct intel_batchbuffer_watch *watch);
+void intel_batchbuffer_unwatch(struct intel_batchbuffer_watch *watch);
 
 typedef enum {
     BSD_DEFAULT,
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "intel_bsd_scheduler.h"
+
+/* Sequence numbers may wrap around */
+#define SEQNO_AFTER(a, b)       ((int)((a) - (b)) > 0)
+
+void
+intel_bsd_fence_init(struct intel_bsd_fence *fence)
+{
+    fence->ring = -1;
+    fence->seqno = 0;
+}
+
+void
+intel_bsd_scheduler_init(struct intel_bsd_scheduler *scheduler,
+                         int num_rings,
+                         const struct intel_bsd_backend *backend)
+{
+    assert(num_rings >= 1 && num_rings <= INTEL_BSD_MAX_RINGS);
+
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->num_rings = num_rings;
+    scheduler->backend = *backend;
+    _i965InitMutex(&scheduler->mutex);
+}
+
+void
+intel_bsd_scheduler_terminate(struct intel_bsd_scheduler *scheduler)
+{
+    _i965DestroyMutex(&scheduler->mutex);
+}
+
+int
+intel_bsd_scheduler_submit(struct intel_bsd_scheduler *scheduler,
+                           struct intel_bsd_fence *target,
+                           const struct intel_bsd_dependency *deps,
+                           int num_deps)
+{
+    unsigned int newest = 0;
+    int ring = -1;
+    int i;
+
+    _i965LockMutex(&scheduler->mutex);
+
+    for (i = 0; i < num_deps; i++) {
+        const struct intel_bsd_fence * const fence = deps[i].fence;
+
+        if (!fence || fence->ring < 0 || fence->ring >= scheduler->num_rings)
+            continue;
+
+        if (ring >= 0 && !SEQNO_AFTER(fence->seqno, newest))
+            continue;
+
+        if (!scheduler->backend.is_busy(deps[i].resource, scheduler->backend.data))
+            continue;
+
+        ring = fence->ring;
+        newest = fence->seqno;
+    }
+
+    if (ring < 0) {
+        ring = 0;
+
+        for (i = 1; i < scheduler->num_rings; i++) {
+            if (SEQNO_AFTER(scheduler->ring_seqno[ring], scheduler->ring_seqno[i]))
+                ring = i;
+        }
+    }
+
+    scheduler->seqno++;
+    scheduler->ring_seqno[ring] = scheduler->seqno;
+    target->ring = ring;
+    target->seqno = scheduler->seqno;
+
+    _i965UnlockMutex(&scheduler->mutex);
+
+    return ring;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_BSD_SCHEDULER_H
+#define INTEL_BSD_SCHEDULER_H
+
+#include "i965_mutext.h"
+
+#define INTEL_BSD_MAX_RINGS     2
+
+/*
+ * Records the BSD ring that last wrote a resource (typically a decoded
+ * surface) and the scheduler sequence number of that submission.
+ */
+struct intel_bsd_fence {
+    int ring;                   /* -1 if never written through the scheduler */
+    unsigned int seqno;
+};
+
+/*
+ * The execution backend only has to report whether a resource is still
+ * in use by the GPU, e.g. drm_intel_bo_busy() for the driver and a fake
+ * table for the unit tests.
+ */
+struct intel_bsd_backend {
+    int (*is_busy)(void *resource, void *data);
+    void *data;
+};
+
+struct intel_bsd_dependency {
+    struct intel_bsd_fence *fence;
+    void *resource;
+};
+
+struct intel_bsd_scheduler {
+    int num_rings;
+    unsigned int seqno;
+    unsigned int ring_seqno[INTEL_BSD_MAX_RINGS];
+    struct intel_bsd_backend backend;
+    _I965Mutex mutex;
+};
+
+void
+intel_bsd_fence_init(struct intel_bsd_fence *fence);
+
+void
+intel_bsd_scheduler_init(struct intel_bsd_scheduler *scheduler,
+                         int num_rings,
+                         const struct intel_bsd_backend *backend);
+
+void
+intel_bsd_scheduler_terminate(struct intel_bsd_scheduler *scheduler);
+
+/*
+ * Picks the ring for a new submission that writes target and reads or
+ * writes deps. A submission that depends on work still in flight follows
+ * it onto the same ring (the newest one if the work is spread over both),
+ * independent submissions go to the least recently used ring. Returns the
+ * ring index and updates target.
+ */
+int
+intel_bsd_scheduler_submit(struct intel_bsd_scheduler *scheduler,
+                           struct intel_bsd_fence *target,
+                           const struct intel_bsd_dependency *deps,
+                           int num_deps);
+
+#endif /* INTEL_BSD_SCHEDULER_H */
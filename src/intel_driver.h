@@ -100,6 +100,12 @@ struct intel_batchbuffer;
 
 #define ALIGN_FLOOR(i, n) ((i) & ~((n) - 1))
 
+/* Offset of the byte (x, y) of a Y-tiled surface. A Y tile is 128 bytes x
+ * 32 rows, stored as 8 columns of 16 bytes x 32 rows */
+#define Y_TILED_OFFSET(pitch, x, y)                                     \
+    (((y) / 32) * (pitch) * 32 + ((x) / 128) * 4096 +                   \
+     ((x) % 128) / 16 * 512 + ((y) % 32) * 16 + (x) % 16)
+
 #define Bool int
 #define True 1
 #define False 0
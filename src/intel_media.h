@@ -31,6 +31,33 @@
 #include <va/va.h>
 #include <intel_bufmgr.h>
 
+#include "i965_mutext.h"
+
+/* Limits on the buffers kept around for reuse by a GenBoPool */
+#define GEN_BO_POOL_MAX_BUFFERS 32
+#define GEN_BO_POOL_MAX_SIZE    (128 * 1024 * 1024)
+
+typedef struct gen_bo_pool GenBoPool;
+struct gen_bo_pool
+{
+    _I965Mutex mutex;
+    dri_bufmgr *bufmgr;
+    dri_bo *buffers[GEN_BO_POOL_MAX_BUFFERS];
+    int num_buffers;
+    unsigned long total_size;
+};
+
+extern void gen_bo_pool_init(GenBoPool *pool, dri_bufmgr *bufmgr);
+
+extern void gen_bo_pool_terminate(GenBoPool *pool);
+
+/* Returns a buffer of at least size bytes, recycled from the pool if possible */
+extern dri_bo *gen_bo_pool_alloc(GenBoPool *pool, const char *name,
+                                 unsigned long size, unsigned int alignment);
+
+/* Hands the reference on bo back to the pool, or drops it if pool is NULL */
+extern void gen_bo_pool_release(GenBoPool *pool, dri_bo *bo);
+
 typedef struct gen_codec_surface GenCodecSurface;
 
 struct gen_codec_surface
@@ -45,6 +72,8 @@ struct gen_avc_surface
     dri_bo *dmv_top;
     dri_bo *dmv_bottom;
     int dmv_bottom_flag;
+    /* Set when the DMV buffers were taken from a pool */
+    GenBoPool *bo_pool;
 };
 
 extern void gen_free_avc_surface(void **data);
@@ -57,6 +86,7 @@ struct gen_hevc_surface
 {
     GenCodecSurface base;
     dri_bo *motion_vector_temporal_bo;
+    GenBoPool *bo_pool;
     //Encoding HEVC10:internal surface keep for P010->NV12 , this is only for hevc10 to save the P010->NV12
     struct object_surface *nv12_surface_obj;
     VASurfaceID nv12_surface_id;
@@ -31,32 +31,118 @@
 #include "intel_media.h"
 #include "i965_drv_video.h"
 
-static pthread_mutex_t free_avc_surface_lock = PTHREAD_MUTEX_INITIALIZER;
+void
+gen_bo_pool_init(GenBoPool *pool, dri_bufmgr *bufmgr)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->bufmgr = bufmgr;
+    _i965InitMutex(&pool->mutex);
+}
 
-void 
-gen_free_avc_surface(void **data)
+void
+gen_bo_pool_terminate(GenBoPool *pool)
+{
+    int i;
+
+    for (i = 0; i < pool->num_buffers; i++)
+        dri_bo_unreference(pool->buffers[i]);
+
+    pool->num_buffers = 0;
+    pool->total_size = 0;
+    _i965DestroyMutex(&pool->mutex);
+}
+
+/* Unlinks buffers[index] from the pool, the caller takes its reference */
+static dri_bo *
+gen_bo_pool_remove(GenBoPool *pool, int index)
+{
+    dri_bo *bo = pool->buffers[index];
+
+    pool->total_size -= bo->size;
+    pool->num_buffers--;
+    memmove(&pool->buffers[index], &pool->buffers[index + 1],
+            (pool->num_buffers - index) * sizeof(pool->buffers[0]));
+
+    return bo;
+}
+
+dri_bo *
+gen_bo_pool_alloc(GenBoPool *pool, const char *name,
+                  unsigned long size, unsigned int alignment)
 {
-    GenAvcSurface *avc_surface;
+    dri_bo *bo = NULL;
+    int i, best = -1;
+
+    _i965LockMutex(&pool->mutex);
+
+    /* Best fit, but do not hand out buffers much larger than needed */
+    for (i = 0; i < pool->num_buffers; i++) {
+        const unsigned long bo_size = pool->buffers[i]->size;
+
+        if (bo_size < size || bo_size - size > size / 4 + 4096)
+            continue;
+
+        if (best < 0 || bo_size < pool->buffers[best]->size)
+            best = i;
+    }
+
+    if (best >= 0)
+        bo = gen_bo_pool_remove(pool, best);
 
-    pthread_mutex_lock(&free_avc_surface_lock);
+    _i965UnlockMutex(&pool->mutex);
 
-    avc_surface = *data;
+    if (!bo)
+        bo = dri_bo_alloc(pool->bufmgr, name, size, alignment);
+
+    return bo;
+}
+
+void
+gen_bo_pool_release(GenBoPool *pool, dri_bo *bo)
+{
+    dri_bo *evicted[GEN_BO_POOL_MAX_BUFFERS];
+    int i, num_evicted = 0;
+
+    if (!bo)
+        return;
 
-    if (!avc_surface) {
-        pthread_mutex_unlock(&free_avc_surface_lock);
+    if (!pool || bo->size > GEN_BO_POOL_MAX_SIZE) {
+        dri_bo_unreference(bo);
         return;
     }
 
+    _i965LockMutex(&pool->mutex);
 
-    dri_bo_unreference(avc_surface->dmv_top);
+    /* Oldest buffers go first */
+    while (pool->num_buffers == GEN_BO_POOL_MAX_BUFFERS ||
+           (pool->num_buffers > 0 &&
+            pool->total_size + bo->size > GEN_BO_POOL_MAX_SIZE))
+        evicted[num_evicted++] = gen_bo_pool_remove(pool, 0);
+
+    pool->buffers[pool->num_buffers++] = bo;
+    pool->total_size += bo->size;
+
+    _i965UnlockMutex(&pool->mutex);
+
+    for (i = 0; i < num_evicted; i++)
+        dri_bo_unreference(evicted[i]);
+}
+
+void
+gen_free_avc_surface(void **data)
+{
+    GenAvcSurface *avc_surface = *data;
+
+    if (!avc_surface)
+        return;
+
+    gen_bo_pool_release(avc_surface->bo_pool, avc_surface->dmv_top);
     avc_surface->dmv_top = NULL;
-    dri_bo_unreference(avc_surface->dmv_bottom);
+    gen_bo_pool_release(avc_surface->bo_pool, avc_surface->dmv_bottom);
     avc_surface->dmv_bottom = NULL;
 
     free(avc_surface);
     *data = NULL;
-
-    pthread_mutex_unlock(&free_avc_surface_lock);
 }
 
 /* This is to convert one float to the given format interger.
@@ -84,23 +170,15 @@ int intel_format_convert(float src, int out_int_bits, int out_frac_bits,int out_
      return output_value;
 }
 
-static pthread_mutex_t free_hevc_surface_lock = PTHREAD_MUTEX_INITIALIZER;
-
 void
 gen_free_hevc_surface(void **data)
 {
-    GenHevcSurface *hevc_surface;
-
-    pthread_mutex_lock(&free_hevc_surface_lock);
+    GenHevcSurface *hevc_surface = *data;
 
-    hevc_surface = *data;
-
-    if (!hevc_surface) {
-        pthread_mutex_unlock(&free_hevc_surface_lock);
+    if (!hevc_surface)
         return;
-    }
 
-    dri_bo_unreference(hevc_surface->motion_vector_temporal_bo);
+    gen_bo_pool_release(hevc_surface->bo_pool, hevc_surface->motion_vector_temporal_bo);
     hevc_surface->motion_vector_temporal_bo = NULL;
 
     if (hevc_surface->nv12_surface_obj) {
@@ -111,29 +189,17 @@ gen_free_hevc_surface(void **data)
 
     free(hevc_surface);
     *data = NULL;
-
-    pthread_mutex_unlock(&free_hevc_surface_lock);
 }
 
-static pthread_mutex_t free_vp9_surface_lock = PTHREAD_MUTEX_INITIALIZER;
-
 void gen_free_vp9_surface(void **data)
 {
-    GenVP9Surface *vp9_surface;
+    GenVP9Surface *vp9_surface = *data;
 
-    pthread_mutex_lock(&free_vp9_surface_lock);
-
-    vp9_surface = *data;
-
-    if (!vp9_surface) {
-        pthread_mutex_unlock(&free_vp9_surface_lock);
+    if (!vp9_surface)
         return;
-    }
 
     free(vp9_surface);
     *data = NULL;
-
-    pthread_mutex_unlock(&free_vp9_surface_lock);
 }
 
 extern VAStatus
@@ -141,21 +207,13 @@ i965_DestroySurfaces(VADriverContextP ctx,
                      VASurfaceID *surface_list,
                      int num_surfaces);
 
-static pthread_mutex_t free_vdenc_avc_surface_lock = PTHREAD_MUTEX_INITIALIZER;
-
 void
 vdenc_free_avc_surface(void **data)
 {
-    VDEncAvcSurface *avc_surface;
-
-    pthread_mutex_lock(&free_vdenc_avc_surface_lock);
+    VDEncAvcSurface *avc_surface = *data;
 
-    avc_surface = *data;
-
-    if (!avc_surface) {
-        pthread_mutex_unlock(&free_vdenc_avc_surface_lock);
+    if (!avc_surface)
         return;
-    }
 
     if (avc_surface->scaled_4x_surface_obj) {
         i965_DestroySurfaces(avc_surface->ctx, &avc_surface->scaled_4x_surface_id, 1);
@@ -165,6 +223,4 @@ vdenc_free_avc_surface(void **data)
 
     free(avc_surface);
     *data = NULL;
-
-    pthread_mutex_unlock(&free_vdenc_avc_surface_lock);
 }
@@ -25,6 +25,7 @@
 #include "i965_avce_test_common.h"
 #include "i965_streamable.h"
 #include "i965_test_fixture.h"
+#include "test_utils.h"
 
 #include <map>
 #include <tuple>
@@ -258,6 +259,48 @@ TEST_P(AVCEContextTest, QualityRange)
     EXPECT_EQ(qranges.at(profile), hw_context->quality_range);
 }
 
+TEST_P(AVCEContextTest, CreationLatency)
+{
+    if (not IsSupported(profile, entrypoint)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+
+    ASSERT_NO_FAILURE(config = createConfig(profile, entrypoint));
+
+    // The first context uploads the kernels, the others share them
+    Timer timer;
+    ASSERT_NO_FAILURE(context = createContext(config, 1920, 1080));
+    const Timer::us::rep first_us(timer.elapsed());
+
+    const unsigned uploads(i965->kernel_cache.num_uploads);
+    const unsigned contexts(20);
+    std::vector<VAContextID> ids;
+
+    timer.reset();
+    for (unsigned i(0); i < contexts; ++i)
+        ids.push_back(createContext(config, 1920, 1080));
+    const Timer::us::rep many_us(timer.elapsed());
+
+    // The kernels come from the driver-wide cache, the other buffers
+    // wait for the first frame
+    EXPECT_EQ(uploads, i965->kernel_cache.num_uploads);
+
+    for (auto id : ids)
+        destroyContext(id);
+    destroyContext(context);
+    context = VA_INVALID_ID;
+
+    std::cout << "[ BENCHMARK] 1080p context creation: " << first_us
+        << "us for the first, " << double(many_us) / contexts
+        << "us each for " << contexts << " concurrent ones" << std::endl;
+}
+
 INSTANTIATE_TEST_CASE_P(
     AVCEncode, AVCEContextTest, ::testing::Values(
         std::make_tuple(VAProfileH264ConstrainedBaseline, VAEntrypointEncSlice),
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test.h"
+
+extern "C" {
+    #include "sysdeps.h"
+    #include "i965_drv_video.h"
+}
+
+#include <vector>
+
+namespace {
+
+class CodedBufferSliceTest
+    : public ::testing::Test
+{
+protected:
+    CodedBufferSliceTest()
+        : segment(new i965_coded_buffer_segment())
+        , slices(I965_CODEDBUFFER_MAX_SLICES - 1)
+        , data(0x10000)
+    {
+        segment->base.buf = data.data();
+    }
+
+    virtual ~CodedBufferSliceTest()
+    {
+        delete segment;
+    }
+
+    void record(const std::vector<unsigned> &ends, unsigned num_slices)
+    {
+        segment->num_slices = num_slices;
+        for (unsigned i(0); i < num_slices
+            && i < I965_CODEDBUFFER_MAX_SLICES; ++i)
+            segment->slice_end[i] = i < ends.size() ?
+                ends[i] : I965_CODEDBUFFER_SLICE_PENDING;
+    }
+
+    int split(unsigned max_size = 0x10000)
+    {
+        return i965_coded_buffer_split_slices(segment, slices.data(),
+            max_size);
+    }
+
+    i965_coded_buffer_segment *segment;
+    std::vector<VACodedBufferSegment> slices;
+    std::vector<unsigned char> data;
+};
+
+TEST_F(CodedBufferSliceTest, AllFinished)
+{
+    record({100, 250, 251}, 3);
+
+    EXPECT_EQ(3, split());
+
+    const VACodedBufferSegment *s = &segment->base;
+    EXPECT_EQ(data.data(), s->buf);
+    EXPECT_EQ(100u, s->size);
+
+    s = static_cast<const VACodedBufferSegment *>(s->next);
+    ASSERT_PTR(s);
+    EXPECT_EQ(data.data() + 100, s->buf);
+    EXPECT_EQ(150u, s->size);
+
+    s = static_cast<const VACodedBufferSegment *>(s->next);
+    ASSERT_PTR(s);
+    EXPECT_EQ(data.data() + 250, s->buf);
+    EXPECT_EQ(1u, s->size);
+    EXPECT_EQ(0u, s->status & VA_CODED_BUF_STATUS_INCOMPLETE_I965);
+    EXPECT_PTR_NULL(s->next);
+}
+
+TEST_F(CodedBufferSliceTest, Incomplete)
+{
+    record({}, 4);
+
+    EXPECT_EQ(0, split());
+    EXPECT_EQ(0u, segment->base.size);
+    EXPECT_NE(0u, segment->base.status & VA_CODED_BUF_STATUS_INCOMPLETE_I965);
+    EXPECT_PTR_NULL(segment->base.next);
+
+    record({64, 128}, 4);
+
+    EXPECT_EQ(2, split());
+    EXPECT_EQ(64u, segment->base.size);
+    EXPECT_EQ(0u, segment->base.status & VA_CODED_BUF_STATUS_INCOMPLETE_I965);
+
+    const VACodedBufferSegment *s =
+        static_cast<const VACodedBufferSegment *>(segment->base.next);
+    ASSERT_PTR(s);
+    EXPECT_EQ(64u, s->size);
+    EXPECT_NE(0u, s->status & VA_CODED_BUF_STATUS_INCOMPLETE_I965);
+    EXPECT_PTR_NULL(s->next);
+
+    // Mapped again once the picture is done, the chain starts over from
+    // the first slice
+    record({64, 128, 192, 200}, 4);
+
+    EXPECT_EQ(4, split());
+    EXPECT_EQ(64u, segment->base.size);
+    for (s = &segment->base; s->next;
+        s = static_cast<const VACodedBufferSegment *>(s->next))
+        EXPECT_EQ(0u, s->status & VA_CODED_BUF_STATUS_INCOMPLETE_I965);
+    EXPECT_EQ(8u, s->size);
+}
+
+TEST_F(CodedBufferSliceTest, Inconsistent)
+{
+    segment->base.size = 1234;
+
+    record({}, 0);
+    EXPECT_EQ(-1, split());
+
+    record({100, 50}, 2);
+    EXPECT_EQ(-1, split());
+
+    record({100, 300}, 2);
+    EXPECT_EQ(-1, split(200));
+
+    record({100}, I965_CODEDBUFFER_MAX_SLICES + 1);
+    EXPECT_EQ(-1, split());
+
+    // Nothing was touched
+    EXPECT_EQ(1234u, segment->base.size);
+    EXPECT_PTR_NULL(segment->base.next);
+}
+
+} // namespace
@@ -0,0 +1,575 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+#include "test_utils.h"
+
+extern "C" {
+    #include "intel_batchbuffer.h"
+    #include "i965_decoder_utils.h"
+    #include "intel_media.h"
+}
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Straight port of the original byte-by-byte EPB scan
+unsigned int countEPBReference(
+    const std::vector<uint8_t>& buf, unsigned int header_size)
+{
+    unsigned int i, j, n;
+    const unsigned int buf_size = buf.size();
+
+    for (i = 2, j = 2, n = 0; i < buf_size && j < header_size; i++, j++) {
+        if (buf[i] == 0x03 && buf[i - 1] == 0x00 && buf[i - 2] == 0x00)
+            i += 2, j++, n++;
+    }
+    return n;
+}
+
+// Random payload biased towards 0x00 and 0x03 so that EPBs are common
+std::vector<uint8_t> makeSliceHeader(size_t size)
+{
+    static const uint8_t values[] = { 0x00, 0x00, 0x00, 0x03, 0x01, 0xff };
+    RandomValueGenerator<unsigned> pick(0, sizeof(values));
+
+    std::vector<uint8_t> buf(size);
+    for (auto& b : buf) {
+        const unsigned k = pick();
+        b = k < sizeof(values) ? values[k] : std::rand() & 0xff;
+    }
+    return buf;
+}
+
+} // namespace
+
+TEST(DecoderUtilsTest, CountEPBNone)
+{
+    std::vector<uint8_t> buf(256, 0x55);
+
+    EXPECT_EQ(0u, intel_count_emulation_prevention_bytes(
+        buf.data(), buf.size(), buf.size()));
+    EXPECT_EQ(0u, intel_count_emulation_prevention_bytes(
+        buf.data(), 0, 0));
+}
+
+TEST(DecoderUtilsTest, CountEPBSequences)
+{
+    // 00 00 03 00 00 03 | 00 00 03 past header
+    const std::vector<uint8_t> buf = {
+        0x25, 0x00, 0x00, 0x03, 0x00, 0x00, 0x03, 0x01,
+        0x00, 0x00, 0x03, 0x01,
+    };
+
+    EXPECT_EQ(2u, intel_count_emulation_prevention_bytes(
+        buf.data(), buf.size(), 6));
+    EXPECT_EQ(countEPBReference(buf, 6),
+        intel_count_emulation_prevention_bytes(buf.data(), buf.size(), 6));
+    EXPECT_EQ(3u, intel_count_emulation_prevention_bytes(
+        buf.data(), buf.size(), buf.size()));
+}
+
+TEST(DecoderUtilsTest, CountEPBMatchesReference)
+{
+    for (unsigned size(3); size < 600; size += 7) {
+        const std::vector<uint8_t> buf = makeSliceHeader(size);
+
+        for (unsigned header_size(0); header_size <= size;
+                header_size += 1 + header_size / 8) {
+            SCOPED_TRACE(::testing::Message()
+                << "size=" << size << " header_size=" << header_size);
+            EXPECT_EQ(countEPBReference(buf, header_size),
+                intel_count_emulation_prevention_bytes(
+                    buf.data(), buf.size(), header_size));
+        }
+    }
+}
+
+TEST(DecoderUtilsTest, CountEPBBenchmark)
+{
+    // Typical slice header sizes for a many-slice-per-frame stream
+    const unsigned nslices(8160), header_size(48);
+    std::vector<std::vector<uint8_t> > headers;
+    std::vector<unsigned> expect;
+
+    for (unsigned i(0); i < 64; ++i) {
+        headers.push_back(makeSliceHeader(header_size * 3 / 2));
+        expect.push_back(countEPBReference(headers.back(), header_size));
+    }
+
+    Timer timer;
+    unsigned long total(0);
+    for (unsigned i(0); i < nslices; ++i)
+        total += countEPBReference(headers[i % headers.size()], header_size);
+    const auto reference_us = timer.elapsed();
+
+    timer.reset();
+    unsigned long fast_total(0);
+    for (unsigned i(0); i < nslices; ++i) {
+        const std::vector<uint8_t>& h = headers[i % headers.size()];
+        fast_total += intel_count_emulation_prevention_bytes(
+            h.data(), h.size(), header_size);
+    }
+    const auto fast_us = timer.elapsed();
+
+    EXPECT_EQ(total, fast_total);
+
+    std::cout << "[ BENCHMARK] " << nslices << " slice headers: reference "
+        << reference_us << "us, fast " << fast_us << "us" << std::endl;
+}
+
+class DecoderEmitSlicesTest
+    : public I965TestFixture
+{
+protected:
+    struct SliceRecord
+    {
+        int group;
+        int index;
+        std::atomic<int> count;
+    };
+
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+        memset(&decode_state, 0, sizeof(decode_state));
+
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+        target = dri_bo_alloc(i965->intel.bufmgr, "slice stores", 0x1000,
+            0x1000);
+        ASSERT_PTR(target);
+    }
+
+    virtual void TearDown()
+    {
+        for (auto store : stores)
+            free(store);
+        dri_bo_unreference(target);
+        I965TestFixture::TearDown();
+    }
+
+    // Synthetic slice groups with no backing buffers, callbacks only
+    // look at group/element counts
+    void makeSliceGroups(int groups, int slices_per_group)
+    {
+        slice_params.resize(groups);
+        slice_datas.resize(groups);
+        for (int j(0); j < groups; ++j) {
+            slice_params[j] = (struct buffer_store *)calloc(
+                1, sizeof(struct buffer_store));
+            slice_params[j]->num_elements = slices_per_group;
+            slice_datas[j] = (struct buffer_store *)calloc(
+                1, sizeof(struct buffer_store));
+            stores.push_back(slice_params[j]);
+            stores.push_back(slice_datas[j]);
+        }
+        decode_state.slice_params = slice_params.data();
+        decode_state.slice_datas = slice_datas.data();
+        decode_state.num_slice_params = groups;
+        decode_state.num_slice_datas = groups;
+
+        records = std::vector<SliceRecord>(groups * slices_per_group);
+        for (auto& r : records)
+            r.count = 0;
+    }
+
+    static void emitSliceGroup(VADriverContextP, struct decode_state *,
+        struct intel_batchbuffer *batch, int, int, int, void *)
+    {
+        BEGIN_BCS_BATCH(batch, 14);
+        for (int i(0); i < 14; ++i)
+            OUT_BCS_BATCH(batch, 0);
+        ADVANCE_BCS_BATCH(batch);
+    }
+
+    // Roughly the size of an HEVC slice: slice, ref idx, weights, bsd.
+    // Stores the slice position to the target buffer, at its slice number
+    static void emitSlice(VADriverContextP, struct decode_state *,
+        struct intel_batchbuffer *batch, int group, int index, int num,
+        void *data)
+    {
+        DecoderEmitSlicesTest *test(static_cast<DecoderEmitSlicesTest *>(data));
+        SliceRecord& r = test->records[num];
+        r.group = group;
+        r.index = index;
+        r.count++;
+
+        BEGIN_BCS_BATCH(batch, 116);
+        OUT_BCS_BATCH(batch, MI_STORE_DATA_IMM | (4 - 2));
+        OUT_BCS_RELOC64(batch, test->target,
+            I915_GEM_DOMAIN_RENDER, I915_GEM_DOMAIN_RENDER, num * 4);
+        OUT_BCS_BATCH(batch, group << 16 | index);
+        for (int i(0); i < 112; ++i)
+            OUT_BCS_BATCH(batch, MI_NOOP);
+        ADVANCE_BCS_BATCH(batch);
+    }
+
+    // Runs the batch on the GPU when submit is set
+    Timer::us::rep emit(int max_threads, bool submit = false)
+    {
+        struct i965_driver_data *i965(*this);
+        struct intel_decoder_slice_emitter emitter;
+        memset(&emitter, 0, sizeof(emitter));
+        emitter.emit_slice_group = emitSliceGroup;
+        emitter.emit_slice = emitSlice;
+        emitter.max_slice_size = 0x400;
+        emitter.max_threads = max_threads;
+
+        struct intel_batchbuffer *batch =
+            intel_batchbuffer_new(&i965->intel, I915_EXEC_BSD, 0);
+        EXPECT_PTR(batch);
+
+        Timer timer;
+        intel_decoder_emit_slices(*this, &decode_state, batch, &emitter,
+            this);
+        const auto elapsed = timer.elapsed();
+
+        // The slices are reachable from the main batch through the chain
+        EXPECT_TRUE(drm_intel_bo_references(batch->buffer, target));
+
+        if (submit) {
+            std::vector<uint32_t> zero(records.size(), 0);
+            dri_bo_subdata(target, 0, zero.size() * 4, zero.data());
+            intel_batchbuffer_flush(batch);
+        }
+
+        intel_batchbuffer_free(batch);
+        return elapsed;
+    }
+
+    void validate(int slices_per_group, int expect_count)
+    {
+        for (size_t n(0); n < records.size(); ++n) {
+            SCOPED_TRACE(::testing::Message() << "slice_num=" << n);
+            EXPECT_EQ(int(n) / slices_per_group, records[n].group);
+            EXPECT_EQ(int(n) % slices_per_group, records[n].index);
+            EXPECT_EQ(expect_count, records[n].count.load());
+        }
+    }
+
+    // What the submitted batches stored
+    void validateExecuted(int slices_per_group)
+    {
+        ASSERT_EQ(0, dri_bo_map(target, 0));
+        const uint32_t *stored(static_cast<const uint32_t *>(target->virtual));
+        for (size_t n(0); n < records.size(); ++n) {
+            SCOPED_TRACE(::testing::Message() << "slice_num=" << n);
+            EXPECT_EQ(uint32_t((n / slices_per_group) << 16 |
+                n % slices_per_group), stored[n]);
+        }
+        dri_bo_unmap(target);
+    }
+
+    struct decode_state decode_state;
+    std::vector<struct buffer_store *> slice_params;
+    std::vector<struct buffer_store *> slice_datas;
+    std::vector<struct buffer_store *> stores;
+    std::vector<SliceRecord> records;
+    dri_bo *target = NULL;
+};
+
+TEST_F(DecoderEmitSlicesTest, FewSlices)
+{
+    makeSliceGroups(3, 4);
+    emit(0);
+    validate(4, 1);
+}
+
+TEST_F(DecoderEmitSlicesTest, ManySlices)
+{
+    // 1080p H.264 with one slice per MB row, in one or several groups
+    makeSliceGroups(1, 68);
+    emit(0);
+    validate(68, 1);
+
+    makeSliceGroups(68, 1);
+    emit(0);
+    validate(1, 1);
+
+    makeSliceGroups(5, 37);
+    emit(0);
+    validate(37, 1);
+}
+
+TEST_F(DecoderEmitSlicesTest, Execute)
+{
+    struct i965_driver_data *i965(*this);
+
+    // The slice stores use the Gen8+ command layout
+    if (not i965->intel.has_bsd or not (IS_GEN8(i965->intel.device_info) or
+            IS_GEN9(i965->intel.device_info))) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    // Straight into the main batch
+    makeSliceGroups(3, 4);
+    emit(0, true);
+    validate(4, 1);
+    validateExecuted(4);
+
+    // Split into runs chained from the main batch
+    makeSliceGroups(5, 37);
+    emit(4, true);
+    validate(37, 1);
+    validateExecuted(37);
+}
+
+TEST_F(DecoderEmitSlicesTest, Benchmark)
+{
+    // One slice per MB row at 1080p, repeated over many frames
+    const unsigned frames(100);
+    Timer::us::rep serial_us(0), threaded_us(0);
+
+    makeSliceGroups(1, 68);
+    for (unsigned i(0); i < frames; ++i) {
+        serial_us += emit(1);
+        threaded_us += emit(0);
+    }
+    validate(68, int(frames * 2));
+
+    std::cout << "[ BENCHMARK] " << frames << " frames x 68 slices: serial "
+        << serial_us << "us, threaded " << threaded_us << "us" << std::endl;
+}
+
+class DecoderBoPoolTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+        gen_bo_pool_init(&pool, i965->intel.bufmgr);
+    }
+
+    virtual void TearDown()
+    {
+        gen_bo_pool_terminate(&pool);
+        I965TestFixture::TearDown();
+    }
+
+    GenBoPool pool;
+};
+
+TEST_F(DecoderBoPoolTest, Recycle)
+{
+    dri_bo *bo = gen_bo_pool_alloc(&pool, "test", 0x10000, 0x1000);
+    ASSERT_PTR(bo);
+    EXPECT_LE(0x10000ul, bo->size);
+
+    gen_bo_pool_release(&pool, bo);
+    EXPECT_EQ(1, pool.num_buffers);
+    EXPECT_EQ(bo->size, pool.total_size);
+
+    // Same size comes back from the pool, far smaller sizes do not
+    EXPECT_EQ(bo, gen_bo_pool_alloc(&pool, "test", 0x10000, 0x1000));
+    EXPECT_EQ(0, pool.num_buffers);
+    gen_bo_pool_release(&pool, bo);
+
+    dri_bo *small = gen_bo_pool_alloc(&pool, "test", 0x1000, 0x1000);
+    ASSERT_PTR(small);
+    EXPECT_NE(bo, small);
+    EXPECT_EQ(1, pool.num_buffers);
+
+    gen_bo_pool_release(&pool, small);
+    EXPECT_EQ(2, pool.num_buffers);
+}
+
+TEST_F(DecoderBoPoolTest, Limits)
+{
+    std::vector<dri_bo *> bos;
+
+    for (int i(0); i < GEN_BO_POOL_MAX_BUFFERS + 4; ++i) {
+        bos.push_back(gen_bo_pool_alloc(&pool, "test", 0x1000, 0x1000));
+        ASSERT_PTR(bos.back());
+    }
+
+    for (auto bo : bos)
+        gen_bo_pool_release(&pool, bo);
+
+    // The oldest buffers were dropped
+    EXPECT_EQ(GEN_BO_POOL_MAX_BUFFERS, pool.num_buffers);
+    EXPECT_EQ(bos.back(), pool.buffers[GEN_BO_POOL_MAX_BUFFERS - 1]);
+
+    // Buffers larger than the whole pool are never kept
+    dri_bo *huge = gen_bo_pool_alloc(
+        &pool, "test", GEN_BO_POOL_MAX_SIZE + 0x1000, 0x1000);
+    ASSERT_PTR(huge);
+    gen_bo_pool_release(&pool, huge);
+    EXPECT_EQ(GEN_BO_POOL_MAX_BUFFERS, pool.num_buffers);
+
+    // Without a pool the reference is simply dropped
+    gen_bo_pool_release(NULL, gen_bo_pool_alloc(&pool, "test", 0x1000, 0x1000));
+    EXPECT_EQ(GEN_BO_POOL_MAX_BUFFERS - 1, pool.num_buffers);
+}
+
+class DecoderSliceDataTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+
+        memset(&decode_state, 0, sizeof(decode_state));
+        memset(&store, 0, sizeof(store));
+
+        data.resize(I965_SLICE_DATA_SHADOW_SIZE * 2);
+        for (size_t i(0); i < data.size(); ++i)
+            data[i] = i * 7;
+
+        store.bo = dri_bo_alloc(i965->intel.bufmgr, "slice data",
+            data.size(), 0x1000);
+        ASSERT_PTR(store.bo);
+        dri_bo_subdata(store.bo, 0, data.size(), data.data());
+
+        // What vaCreateBuffer() keeps of the data
+        store.shadow = static_cast<unsigned char *>(
+            malloc(I965_SLICE_DATA_SHADOW_SIZE));
+        ASSERT_PTR(store.shadow);
+        memcpy(store.shadow, data.data(), I965_SLICE_DATA_SHADOW_SIZE);
+        store.shadow_size = I965_SLICE_DATA_SHADOW_SIZE;
+    }
+
+    virtual void TearDown()
+    {
+        dri_bo_unreference(store.bo);
+        free(store.shadow);
+        I965TestFixture::TearDown();
+    }
+
+    // Reads a slice through the helpers and checks its bytes
+    const uint8_t *read(unsigned int offset, unsigned int size)
+    {
+        const uint8_t *slice = intel_decoder_map_slice_data(
+            &decode_state, &store, offset, size);
+
+        EXPECT_PTR(slice);
+        if (slice)
+            EXPECT_EQ(0, memcmp(slice, &data[offset], size));
+        intel_decoder_unmap_slice_data(&store, slice);
+        return slice;
+    }
+
+    struct decode_state decode_state;
+    struct buffer_store store;
+    std::vector<uint8_t> data;
+};
+
+TEST_F(DecoderSliceDataTest, Shadowed)
+{
+    EXPECT_EQ(store.shadow, read(0, 64));
+    EXPECT_EQ(store.shadow + 100, read(100, 28));
+    EXPECT_EQ(store.shadow + store.shadow_size - 4,
+        read(store.shadow_size - 4, 4));
+
+    EXPECT_EQ(0u, decode_state.slice_data_readback_bytes);
+}
+
+TEST_F(DecoderSliceDataTest, EmptySliceAtShadowEnd)
+{
+    // Keep the bo mapped, a stray unmap would drop this mapping
+    ASSERT_EQ(0, dri_bo_map(store.bo, 0));
+    void *virt = store.bo->virtual;
+
+    EXPECT_EQ(store.shadow + store.shadow_size, read(store.shadow_size, 0));
+    EXPECT_EQ(virt, store.bo->virtual);
+    EXPECT_EQ(0u, decode_state.slice_data_readback_bytes);
+
+    dri_bo_unmap(store.bo);
+}
+
+TEST_F(DecoderSliceDataTest, ReadBack)
+{
+    // Crossing the end of the shadow
+    read(store.shadow_size - 4, 8);
+    EXPECT_EQ(8u, decode_state.slice_data_readback_bytes);
+
+    read(store.shadow_size + 16, 32);
+    EXPECT_EQ(40u, decode_state.slice_data_readback_bytes);
+
+    // Without a shadow everything comes from the bo
+    free(store.shadow);
+    store.shadow = NULL;
+    store.shadow_size = 0;
+    read(0, 16);
+    EXPECT_EQ(56u, decode_state.slice_data_readback_bytes);
+}
+
+TEST_F(DecoderSliceDataTest, CreateAndMapBuffer)
+{
+    struct i965_driver_data *i965(*this);
+
+    if (not HAS_MPEG2_DECODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    ASSERT_NO_FAILURE(
+        VAConfigID config = createConfig(VAProfileMPEG2Main, VAEntrypointVLD));
+    ASSERT_NO_FAILURE(
+        VAContextID context = createContext(config, 64, 64));
+
+    // The shadow holds the start of the data given at creation
+    ASSERT_NO_FAILURE(
+        VABufferID id = createBuffer(context, VASliceDataBufferType,
+            data.size(), 1, data.data()));
+    struct object_buffer *obj_buffer = BUFFER(id);
+    ASSERT_PTR(obj_buffer);
+
+    struct buffer_store *buffer_store = obj_buffer->buffer_store;
+    ASSERT_PTR(buffer_store->shadow);
+    EXPECT_EQ(unsigned(I965_SLICE_DATA_SHADOW_SIZE), buffer_store->shadow_size);
+    EXPECT_EQ(0, memcmp(buffer_store->shadow, data.data(),
+        buffer_store->shadow_size));
+
+    // and is refreshed by what the application writes to the mapping
+    ASSERT_NO_FAILURE(uint8_t *mapped = mapBuffer<uint8_t>(id));
+    mapped[10] = data[10] ^ 0xff;
+    unmapBuffer(id);
+    EXPECT_EQ(uint8_t(data[10] ^ 0xff), buffer_store->shadow[10]);
+
+    const uint8_t *slice = intel_decoder_map_slice_data(
+        &decode_state, buffer_store, 10, 1);
+    EXPECT_EQ(buffer_store->shadow + 10, slice);
+    intel_decoder_unmap_slice_data(buffer_store, slice);
+    EXPECT_EQ(0u, decode_state.slice_data_readback_bytes);
+
+    destroyBuffer(id);
+    destroyContext(context);
+    destroyConfig(config);
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+#include "test_utils.h"
+
+extern "C" {
+    #include "intel_driver.h"
+    #include "i965_encoder_analysis.h"
+}
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+class EncoderAnalysisTest
+    : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        analysis = intel_enc_analysis_create(8);
+        ASSERT_PTR(analysis);
+    }
+
+    virtual void TearDown()
+    {
+        intel_enc_analysis_destroy(analysis);
+    }
+
+    // A random texture, smooth enough for a motion search to lock on
+    static std::vector<uint8_t> texture(unsigned width, unsigned height)
+    {
+        RandomValueGenerator<int> value(0, 255);
+        std::vector<uint8_t> t(width * height);
+
+        for (size_t i(0); i < t.size(); ++i)
+            t[i] = value();
+        for (unsigned y(0); y < height; ++y)
+            for (unsigned x(1); x < width; ++x)
+                t[y * width + x] = (t[y * width + x] + t[y * width + x - 1]) / 2;
+
+        return t;
+    }
+
+    // Adds the width x height window at (dx, dy) of a texture as a picture
+    const intel_enc_frame_analysis *add(const std::vector<uint8_t> &t,
+        unsigned pitch, unsigned dx, unsigned dy)
+    {
+        uint8_t *plane = intel_enc_analysis_plane(analysis, width, height);
+
+        EXPECT_PTR(plane);
+        if (!plane)
+            return NULL;
+
+        for (unsigned y(0); y < height; ++y)
+            std::memcpy(plane + y * width, &t[(y + dy) * pitch + dx], width);
+
+        return intel_enc_analysis_add_frame(analysis);
+    }
+
+    intel_enc_analysis *analysis;
+    static const unsigned width = 64;
+    static const unsigned height = 48;
+};
+
+TEST(EncoderAnalysisCreateTest, Depth)
+{
+    intel_enc_analysis *analysis;
+
+    EXPECT_PTR_NULL(intel_enc_analysis_create(0));
+
+    analysis = intel_enc_analysis_create(1000);
+    ASSERT_PTR(analysis);
+    EXPECT_EQ(INTEL_ENC_ANALYSIS_MAX_DEPTH, analysis->depth);
+    intel_enc_analysis_destroy(analysis);
+
+    intel_enc_analysis_destroy(NULL);
+}
+
+TEST(EncoderAnalysisDownscaleTest, LinearMatchesYTiled)
+{
+    const unsigned w(256), h(64), pitch(256);
+    RandomValueGenerator<int> value(0, 255);
+    std::vector<uint8_t> linear(pitch * h), tiled(pitch * h);
+    std::vector<uint8_t> from_linear(w / 4 * h / 4), from_tiled(w / 4 * h / 4);
+
+    for (size_t i(0); i < linear.size(); ++i)
+        linear[i] = value();
+
+    for (unsigned y(0); y < h; ++y)
+        for (unsigned x(0); x < w; ++x)
+            tiled[Y_TILED_OFFSET(pitch, x, y)] = linear[y * pitch + x];
+
+    intel_enc_analysis_downscale(linear.data(), pitch, false,
+        from_linear.data(), w / 4, h / 4);
+    intel_enc_analysis_downscale(tiled.data(), pitch, true,
+        from_tiled.data(), w / 4, h / 4);
+
+    EXPECT_TRUE(from_linear == from_tiled);
+
+    unsigned sum(0);
+    for (unsigned y(0); y < 4; ++y)
+        for (unsigned x(0); x < 4; ++x)
+            sum += linear[(4 + y) * pitch + 8 + x];
+    EXPECT_EQ((sum + 8) / 16, from_linear[1 * (w / 4) + 2]);
+}
+
+TEST_F(EncoderAnalysisTest, StaticPictures)
+{
+    const std::vector<uint8_t> t(texture(width, height));
+    const intel_enc_frame_analysis *last;
+
+    last = add(t, width, 0, 0);
+    ASSERT_PTR(last);
+    EXPECT_GT(last->intra_cost, 0u);
+    EXPECT_EQ(last->intra_cost, last->inter_cost);
+    EXPECT_FALSE(last->scene_change);
+
+    last = add(t, width, 0, 0);
+    ASSERT_PTR(last);
+    EXPECT_EQ(0u, last->inter_cost);
+    EXPECT_FALSE(last->scene_change);
+}
+
+TEST_F(EncoderAnalysisTest, MotionSearch)
+{
+    const std::vector<uint8_t> t(texture(width + 16, height + 16));
+    const intel_enc_frame_analysis *last;
+    unsigned i;
+
+    // Panning by 2 downscaled pixels per picture stays in the search range
+    for (i = 0; i < 4; ++i) {
+        last = add(t, width + 16, 2 * i, i);
+        ASSERT_PTR(last);
+    }
+
+    // Only the blocks along the edges miss their match
+    EXPECT_LT(last->inter_cost * 2, last->intra_cost);
+    EXPECT_FALSE(last->scene_change);
+}
+
+TEST_F(EncoderAnalysisTest, SceneChange)
+{
+    const std::vector<uint8_t> t(texture(width + 16, height + 16));
+    const std::vector<uint8_t> other(texture(width, height));
+    const intel_enc_frame_analysis *last;
+    double extra;
+    unsigned i;
+
+    for (i = 0; i < 6; ++i) {
+        last = add(t, width + 16, i, 0);
+        ASSERT_PTR(last);
+        EXPECT_FALSE(last->scene_change) << "picture " << i;
+    }
+
+    last = add(other, width, 0, 0);
+    ASSERT_PTR(last);
+    EXPECT_TRUE(last->scene_change);
+
+    // A P picture starting a scene gets more bits, up to an eighth of
+    // the buffer
+    extra = intel_enc_analysis_extra_bits(analysis, 0, 10000, 1000000);
+    EXPECT_GT(extra, 0.0);
+    EXPECT_LE(extra, 30000.0);
+
+    extra = intel_enc_analysis_extra_bits(analysis, 0, 10000, 40000);
+    EXPECT_EQ(5000.0, extra);
+
+    // The next one is an ordinary picture of the new scene
+    last = add(other, width, 0, 0);
+    ASSERT_PTR(last);
+    EXPECT_FALSE(last->scene_change);
+    EXPECT_LT(intel_enc_analysis_extra_bits(analysis, 0, 10000, 1000000), 0.0);
+}
+
+TEST_F(EncoderAnalysisTest, ResizeDropsHistory)
+{
+    const std::vector<uint8_t> t(texture(width, height));
+
+    add(t, width, 0, 0);
+    add(t, width, 0, 0);
+    add(t, width, 0, 0);
+    EXPECT_EQ(3, analysis->history_count);
+
+    ASSERT_PTR(intel_enc_analysis_plane(analysis, width / 2, height / 2));
+    EXPECT_EQ(0, analysis->history_count);
+    EXPECT_EQ(0.0, intel_enc_analysis_extra_bits(analysis, 1, 10000, 1000000));
+}
+
+TEST_F(EncoderAnalysisTest, Benchmark)
+{
+    const unsigned w(1920), h(1080), frames(20);
+    const std::vector<uint8_t> t(texture(w + 64, h / 4 + 16));
+    std::vector<uint8_t> luma(w * h);
+    Timer::us::rep us(0);
+    Timer timer;
+
+    for (unsigned i(0); i < frames; ++i) {
+        for (unsigned y(0); y < h; ++y)
+            std::memcpy(&luma[y * w], &t[(y / 4 + i % 8) * (w + 64) + i], w);
+
+        timer.reset();
+        uint8_t *plane = intel_enc_analysis_plane(analysis, w / 4, h / 4);
+        ASSERT_PTR(plane);
+        intel_enc_analysis_downscale(luma.data(), w, false, plane, w / 4, h / 4);
+        ASSERT_PTR(intel_enc_analysis_add_frame(analysis));
+        us += timer.elapsed();
+    }
+
+    std::cout << "[ BENCHMARK] " << frames << " 1080p pictures analysed in "
+        << us << "us" << std::endl;
+}
+
+} // namespace
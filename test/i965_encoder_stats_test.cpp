@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+
+extern "C" {
+    #include "sysdeps.h"
+    #include "i965_drv_video.h"
+    #include "i965_encoder_stats.h"
+}
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+class EncoderStatsTest
+    : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        char name[] = "/tmp/i965_encoder_stats_XXXXXX";
+        const int fd(mkstemp(name));
+
+        ASSERT_NE(-1, fd);
+        close(fd);
+        path = name;
+    }
+
+    virtual void TearDown()
+    {
+        unlink(path.c_str());
+    }
+
+    // Runs a first pass of the given pictures into the stats file
+    void first_pass(const intel_enc_stats_record *frames, int num_frames)
+    {
+        intel_enc_stats *stats(
+            intel_enc_stats_create(CODEC_H264, path.c_str(), NULL));
+
+        ASSERT_PTR(stats);
+        for (int i(0); i < num_frames; ++i)
+            intel_enc_stats_frame_done(stats, frames[i].frame_type,
+                frames[i].qp, frames[i].frame_bits);
+        intel_enc_stats_destroy(stats);
+    }
+
+    intel_enc_stats *second_pass(int codec = CODEC_H264)
+    {
+        return intel_enc_stats_create(codec, NULL, path.c_str());
+    }
+
+    std::string path;
+};
+
+TEST_F(EncoderStatsTest, RoundTrip)
+{
+    const intel_enc_stats_record frames[] = {
+        { 400000, 22, INTEL_ENC_STATS_FRAME_I },
+        { 120000, 25, INTEL_ENC_STATS_FRAME_P },
+        { 40000, 28, INTEL_ENC_STATS_FRAME_B },
+        { 0x12345678, 51, INTEL_ENC_STATS_FRAME_P },
+    };
+
+    first_pass(frames, 4);
+
+    intel_enc_stats *stats(second_pass());
+
+    ASSERT_PTR(stats);
+    ASSERT_EQ(4, stats->num_frames);
+    for (int i(0); i < 4; ++i) {
+        EXPECT_EQ(frames[i].frame_bits, stats->frames[i].frame_bits);
+        EXPECT_EQ(frames[i].qp, stats->frames[i].qp);
+        EXPECT_EQ(frames[i].frame_type, stats->frames[i].frame_type);
+    }
+
+    intel_enc_stats_destroy(stats);
+}
+
+TEST_F(EncoderStatsTest, RejectBadFile)
+{
+    const intel_enc_stats_record frame = {
+        100000, 26, INTEL_ENC_STATS_FRAME_I
+    };
+
+    // The stats of another codec
+    first_pass(&frame, 1);
+    EXPECT_PTR_NULL(second_pass(CODEC_HEVC));
+
+    // A first pass without any picture
+    first_pass(&frame, 0);
+    EXPECT_PTR_NULL(second_pass());
+
+    // Not a stats file
+    FILE *f(fopen(path.c_str(), "wb"));
+    ASSERT_PTR(f);
+    fputs("not a stats file", f);
+    fclose(f);
+    EXPECT_PTR_NULL(second_pass());
+}
+
+TEST_F(EncoderStatsTest, DropTruncatedRecord)
+{
+    const intel_enc_stats_record frames[] = {
+        { 100000, 26, INTEL_ENC_STATS_FRAME_I },
+        { 50000, 28, INTEL_ENC_STATS_FRAME_P },
+    };
+
+    first_pass(frames, 2);
+
+    FILE *f(fopen(path.c_str(), "ab"));
+    ASSERT_PTR(f);
+    fwrite("\x01\x02\x03", 3, 1, f);
+    fclose(f);
+
+    intel_enc_stats *stats(second_pass());
+
+    ASSERT_PTR(stats);
+    EXPECT_EQ(2, stats->num_frames);
+    intel_enc_stats_destroy(stats);
+}
+
+TEST_F(EncoderStatsTest, PlanSpendsTheBudget)
+{
+    intel_enc_stats_record frames[60];
+
+    // Quiet pictures, then a much more complex scene at the same QP
+    for (int i(0); i < 60; ++i) {
+        frames[i].frame_bits = i < 30 ? 20000 : 160000;
+        frames[i].qp = 30;
+        frames[i].frame_type = i % 30 ? INTEL_ENC_STATS_FRAME_P :
+            INTEL_ENC_STATS_FRAME_I;
+    }
+
+    first_pass(frames, 60);
+
+    intel_enc_stats *stats(second_pass());
+    const double bits_per_frame(50000);
+    double sum(0);
+
+    ASSERT_PTR(stats);
+    intel_enc_stats_plan(stats, bits_per_frame);
+
+    for (int i(0); i < 60; ++i)
+        sum += intel_enc_stats_target_bits(stats, i);
+    EXPECT_NEAR(bits_per_frame * 60, sum, 1.0);
+
+    // The complex scene gets more bits, but less than in proportion to
+    // its complexity, so it is coded at a higher QP
+    const double quiet(intel_enc_stats_target_bits(stats, 1));
+    const double complex(intel_enc_stats_target_bits(stats, 31));
+    EXPECT_GT(complex, quiet);
+    EXPECT_LT(complex / quiet, 8.0);
+    EXPECT_NEAR(std::pow(8.0, INTEL_ENC_STATS_QCOMP), complex / quiet, 1e-6);
+
+    int qp_quiet, qp_complex;
+    stats->next_frame = 1;
+    ASSERT_TRUE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_P,
+        1, 51, &qp_quiet));
+    stats->next_frame = 31;
+    ASSERT_TRUE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_P,
+        1, 51, &qp_complex));
+    EXPECT_GT(qp_complex, qp_quiet);
+
+    intel_enc_stats_destroy(stats);
+}
+
+TEST_F(EncoderStatsTest, FrameQP)
+{
+    intel_enc_stats_record frames[10];
+
+    for (int i(0); i < 10; ++i) {
+        frames[i].frame_bits = 100000;
+        frames[i].qp = 30;
+        frames[i].frame_type = i ? INTEL_ENC_STATS_FRAME_P :
+            INTEL_ENC_STATS_FRAME_I;
+    }
+
+    first_pass(frames, 10);
+
+    intel_enc_stats *stats(second_pass());
+    int qp;
+
+    ASSERT_PTR(stats);
+
+    // Nothing is planned before the BRC gives the rate
+    EXPECT_FALSE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_I,
+        1, 51, &qp));
+
+    // The same budget as the first pass gives back the same QP, half of
+    // it one quantizer step octave more
+    intel_enc_stats_plan(stats, 100000);
+    ASSERT_TRUE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_I,
+        1, 51, &qp));
+    EXPECT_EQ(30, qp);
+
+    intel_enc_stats_plan(stats, 50000);
+    ASSERT_TRUE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_I,
+        1, 51, &qp));
+    EXPECT_EQ(36, qp);
+    ASSERT_TRUE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_I,
+        1, 33, &qp));
+    EXPECT_EQ(33, qp);
+
+    // A picture type the first pass did not have there
+    EXPECT_FALSE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_P,
+        1, 51, &qp));
+
+    // Going over the plan raises the QP of the following pictures
+    intel_enc_stats_plan(stats, 100000);
+    intel_enc_stats_frame_done(stats, INTEL_ENC_STATS_FRAME_I, 30, 1100000);
+    ASSERT_TRUE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_P,
+        1, 51, &qp));
+    EXPECT_GT(qp, 30);
+
+    // Past the end of the first pass
+    for (int i(1); i < 10; ++i)
+        intel_enc_stats_frame_done(stats, INTEL_ENC_STATS_FRAME_P, 30, 100000);
+    EXPECT_FALSE(intel_enc_stats_frame_qp(stats, INTEL_ENC_STATS_FRAME_P,
+        1, 51, &qp));
+
+    intel_enc_stats_destroy(stats);
+}
+
+} // namespace
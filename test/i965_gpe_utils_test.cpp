@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2026 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+#include "test_utils.h"
+
+extern "C" {
+    #include "intel_batchbuffer.h"
+    #include "i965_gpe_utils.h"
+}
+
+#include <cstring>
+#include <vector>
+
+class GPEStateRingTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+
+        supported = IS_GEN8(i965->intel.device_info) ||
+            IS_GEN9(i965->intel.device_info);
+        if (not supported)
+            return;
+
+        gpe = &i965->gpe_table;
+        batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
+        ASSERT_PTR(batch);
+
+        memset(&gpe_context, 0, sizeof(gpe_context));
+        gpe_context.surface_state_binding_table.length =
+            (SURFACE_STATE_PADDED_SIZE_GEN9 + sizeof(unsigned int)) * 64;
+        gpe_context.idrt.entry_size = 64;
+        gpe_context.idrt.max_entries = 4;
+        gpe_context.curbe.length = 1024;
+        gpe_context.vfe_state.max_num_threads = 60;
+        gpe_context.vfe_state.num_urb_entries = 16;
+        gpe_context.vfe_state.urb_entry_size = 16;
+        gpe_context.vfe_state.curbe_allocation_size = 32;
+    }
+
+    virtual void TearDown()
+    {
+        if (supported) {
+            gpe->context_destroy(&gpe_context);
+            intel_batchbuffer_free(batch);
+        }
+        I965TestFixture::TearDown();
+    }
+
+    bool skip()
+    {
+        if (not supported) {
+            RecordProperty("skipped", true);
+            std::cout << "[  SKIPPED ] " << getFullTestName()
+                << " is unsupported on this hardware" << std::endl;
+        }
+        return not supported;
+    }
+
+    // What a kernel dispatch does with its state buffers
+    void dispatch()
+    {
+        gpe->context_init(*this, &gpe_context);
+        gpe->pipeline_setup(*this, &gpe_context, batch);
+    }
+
+    // Drop the queued commands without running them on the GPU
+    void endFrame()
+    {
+        struct i965_driver_data *i965(*this);
+
+        intel_batchbuffer_free(batch);
+        batch = intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
+        ASSERT_PTR(batch);
+    }
+
+    bool supported = false;
+    struct i965_gpe_table *gpe = NULL;
+    struct intel_batchbuffer *batch = NULL;
+    struct i965_gpe_context gpe_context;
+};
+
+TEST_F(GPEStateRingTest, Reuse)
+{
+    if (skip())
+        return;
+
+    dispatch();
+    dri_bo *first = gpe_context.surface_state_binding_table.bo;
+    EXPECT_PTR(first);
+    EXPECT_EQ(gpe_context.dynamic_state.bo, gpe_context.curbe.bo);
+
+    // Still referenced from the pending batch
+    dispatch();
+    EXPECT_NE(first, gpe_context.surface_state_binding_table.bo);
+    EXPECT_EQ(2, gpe_context.state_ring.num_slots);
+
+    endFrame();
+    dispatch();
+    dispatch();
+    EXPECT_EQ(2, gpe_context.state_ring.num_slots);
+    EXPECT_EQ(4u, gpe_context.state_ring.num_allocations);
+
+    // A size change drops the old buffers
+    endFrame();
+    gpe_context.curbe.length *= 2;
+    dispatch();
+    EXPECT_EQ(1, gpe_context.state_ring.num_slots);
+    EXPECT_EQ(6u, gpe_context.state_ring.num_allocations);
+}
+
+TEST_F(GPEStateRingTest, BatchGone)
+{
+    if (skip())
+        return;
+
+    dispatch();
+    const struct i965_gpe_state_slot *slot(&gpe_context.state_ring.slots[0]);
+    EXPECT_EQ(batch, slot->queued.batch);
+    EXPECT_EQ(&slot->queued, batch->watches);
+
+    // Moving to another batch leaves nothing behind on the first one
+    struct i965_driver_data *i965(*this);
+    struct intel_batchbuffer *other =
+        intel_batchbuffer_new(&i965->intel, I915_EXEC_RENDER, 0);
+    ASSERT_PTR(other);
+    gpe->pipeline_setup(*this, &gpe_context, other);
+    EXPECT_EQ(other, slot->queued.batch);
+    EXPECT_PTR_NULL(batch->watches);
+
+    intel_batchbuffer_free(other);
+    EXPECT_PTR_NULL(slot->queued.batch);
+
+    // Not referenced from any batch anymore, so it is handed out again
+    dispatch();
+    EXPECT_EQ(1, gpe_context.state_ring.num_slots);
+    EXPECT_EQ(batch, slot->queued.batch);
+}
+
+TEST_F(GPEStateRingTest, Overflow)
+{
+    if (skip())
+        return;
+
+    for (int i(0); i < MAX_GPE_STATE_SLOTS + 2; ++i)
+        dispatch();
+
+    EXPECT_EQ(MAX_GPE_STATE_SLOTS, gpe_context.state_ring.num_slots);
+    EXPECT_EQ(2u * (MAX_GPE_STATE_SLOTS + 2),
+              gpe_context.state_ring.num_allocations);
+}
+
+TEST_F(GPEStateRingTest, Benchmark)
+{
+    if (skip())
+        return;
+
+    // Typical encoder frame: a handful of kernels sharing one context
+    const unsigned frames(200), kernels(10);
+    struct i965_driver_data *i965(*this);
+    Timer::us::rep ring_us(0);
+    Timer timer;
+
+    for (unsigned i(0); i < frames; ++i) {
+        for (unsigned k(0); k < kernels; ++k) {
+            timer.reset();
+            gpe->context_init(*this, &gpe_context);
+            ring_us += timer.elapsed();
+            gpe->pipeline_setup(*this, &gpe_context, batch);
+        }
+        endFrame();
+    }
+
+    // The previous behaviour: two fresh buffers per kernel dispatch
+    timer.reset();
+    for (unsigned i(0); i < frames * kernels; ++i) {
+        dri_bo *ss = dri_bo_alloc(i965->intel.bufmgr, "ss",
+                                  gpe_context.surface_state_binding_table.length, 4096);
+        dri_bo *ds = dri_bo_alloc(i965->intel.bufmgr, "ds",
+                                  gpe_context.state_ring.dynamic_state_size, 4096);
+        dri_bo_map(ss, 1);
+        dri_bo_map(ds, 1);
+        dri_bo_unmap(ss);
+        dri_bo_unmap(ds);
+        dri_bo_unreference(ss);
+        dri_bo_unreference(ds);
+    }
+    const Timer::us::rep fresh_us(timer.elapsed());
+
+    std::cout << "[ BENCHMARK] " << frames << " frames x " << kernels
+        << " kernels: " << 2.0 * kernels << " allocations/frame in "
+        << fresh_us << "us before, "
+        << double(gpe_context.state_ring.num_allocations) / frames
+        << " allocations/frame in " << ring_us << "us with the state ring"
+        << std::endl;
+
+    // Only the first frame allocates
+    EXPECT_EQ(2u * kernels, gpe_context.state_ring.num_allocations);
+}
+
+class GPEResourceTest
+    : public GPEStateRingTest
+{
+};
+
+TEST_F(GPEResourceTest, Renew)
+{
+    if (skip())
+        return;
+
+    struct i965_driver_data *i965(*this);
+    struct i965_gpe_resource res;
+
+    memset(&res, 0, sizeof(res));
+    EXPECT_FALSE(i965_renew_gpe_resource(i965->intel.bufmgr, &res, "test"));
+
+    ASSERT_TRUE(i965_allocate_gpe_resource(i965->intel.bufmgr, &res, 8192,
+                                           "test"));
+
+    // Idle, the same buffer is rewritten
+    dri_bo *bo = res.bo;
+    EXPECT_TRUE(i965_renew_gpe_resource(i965->intel.bufmgr, &res, "test"));
+    EXPECT_EQ(bo, res.bo);
+
+    // Written by a frame that may still run on the GPU
+    struct gpe_mi_store_data_imm_parameter params;
+    memset(&params, 0, sizeof(params));
+    params.bo = res.bo;
+    params.dw0 = 0x12345678;
+    gpe->mi_store_data_imm(*this, batch, &params);
+    intel_batchbuffer_flush(batch);
+
+    dri_bo_reference(bo);
+    EXPECT_TRUE(i965_renew_gpe_resource(i965->intel.bufmgr, &res, "test"));
+    if (drm_intel_bo_busy(bo))
+        EXPECT_NE(bo, res.bo);
+    EXPECT_EQ(8192u, res.size);
+    EXPECT_GE(res.bo->size, 8192u);
+
+    // The previous frame still gets its data
+    ASSERT_EQ(0, dri_bo_map(bo, 0));
+    EXPECT_EQ(0x12345678u, *static_cast<uint32_t *>(bo->virtual));
+    dri_bo_unmap(bo);
+    dri_bo_unreference(bo);
+
+    i965_free_gpe_resource(&res);
+}
+
+class KernelCacheTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+
+        i965_kernel_cache_init(&cache, i965->intel.bufmgr);
+
+        // Two fake kernel binaries, sizes not multiple of 64 bytes
+        binA.resize(1000 / sizeof(uint32_t[4]) * 4, 0xa5a5a5a5);
+        binB.resize(3000 / sizeof(uint32_t[4]) * 4, 0x5a5a5a5a);
+
+        memset(kernels, 0, sizeof(kernels));
+        setKernel(0, binA);
+        setKernel(1, binB);
+    }
+
+    virtual void TearDown()
+    {
+        i965_kernel_cache_terminate(&cache);
+        I965TestFixture::TearDown();
+    }
+
+    void setKernel(unsigned i, const std::vector<uint32_t>& bin)
+    {
+        kernels[i].name = const_cast<char *>("test kernel");
+        kernels[i].bin = reinterpret_cast<const uint32_t (*)[4]>(bin.data());
+        kernels[i].size = bin.size() * sizeof(uint32_t);
+    }
+
+    unsigned numEntries()
+    {
+        unsigned count(0);
+        for (struct i965_kernel_cache_entry *e(cache.entries); e; e = e->next)
+            ++count;
+        return count;
+    }
+
+    struct i965_kernel_cache cache;
+    struct i965_kernel kernels[2];
+    std::vector<uint32_t> binA, binB;
+};
+
+TEST_F(KernelCacheTest, Share)
+{
+    dri_bo *bo1 = i965_kernel_cache_get(&cache, "test", kernels, 2);
+    ASSERT_PTR(bo1);
+    EXPECT_EQ(0u, kernels[0].kernel_offset);
+    EXPECT_EQ(ALIGN(unsigned(kernels[0].size), 64), kernels[1].kernel_offset);
+
+    // Same binaries, same buffer and layout
+    kernels[1].kernel_offset = 0;
+    dri_bo *bo2 = i965_kernel_cache_get(&cache, "test", kernels, 2);
+    EXPECT_EQ(bo1, bo2);
+    EXPECT_EQ(ALIGN(unsigned(kernels[0].size), 64), kernels[1].kernel_offset);
+    EXPECT_EQ(1u, cache.num_uploads);
+
+    ASSERT_EQ(0, dri_bo_map(bo1, 0));
+    const unsigned char *data = static_cast<unsigned char *>(bo1->virtual);
+    EXPECT_EQ(0, memcmp(data, binA.data(), kernels[0].size));
+    EXPECT_EQ(0, memcmp(data + kernels[1].kernel_offset, binB.data(),
+                        kernels[1].size));
+    dri_bo_unmap(bo1);
+
+    // A different kernel list gets its own buffer
+    dri_bo *bo3 = i965_kernel_cache_get(&cache, "test", &kernels[1], 1);
+    ASSERT_PTR(bo3);
+    EXPECT_NE(bo1, bo3);
+    EXPECT_EQ(0u, kernels[1].kernel_offset);
+    EXPECT_EQ(2u, cache.num_uploads);
+    EXPECT_EQ(2u, numEntries());
+
+    i965_kernel_cache_put(&cache, bo1);
+    i965_kernel_cache_put(&cache, bo2);
+    i965_kernel_cache_put(&cache, bo3);
+}
+
+TEST_F(KernelCacheTest, Release)
+{
+    dri_bo *bo1 = i965_kernel_cache_get(&cache, "test", kernels, 2);
+    dri_bo *bo2 = i965_kernel_cache_get(&cache, "test", kernels, 2);
+    ASSERT_PTR(bo1);
+    EXPECT_EQ(1u, numEntries());
+
+    // The buffer lives until its last user is gone
+    i965_kernel_cache_put(&cache, bo1);
+    EXPECT_EQ(1u, numEntries());
+    i965_kernel_cache_put(&cache, bo2);
+    EXPECT_EQ(0u, numEntries());
+
+    dri_bo *bo3 = i965_kernel_cache_get(&cache, "test", kernels, 2);
+    ASSERT_PTR(bo3);
+    EXPECT_EQ(2u, cache.num_uploads);
+    i965_kernel_cache_put(&cache, bo3);
+}
+
+TEST_F(KernelCacheTest, Benchmark)
+{
+    struct i965_driver_data *i965(*this);
+
+    // Roughly the size of an encoder kernel set
+    std::vector<uint32_t> big(2 * 1024 * 1024 / sizeof(uint32_t), 0x12345678);
+    setKernel(0, big);
+
+    const unsigned contexts(50);
+    std::vector<dri_bo *> bos(contexts, NULL);
+    Timer timer;
+
+    for (unsigned i(0); i < contexts; ++i)
+        bos[i] = i965_kernel_cache_get(&cache, "test", kernels, 2);
+    const Timer::us::rep cached_us(timer.elapsed());
+
+    for (unsigned i(0); i < contexts; ++i)
+        i965_kernel_cache_put(&cache, bos[i]);
+
+    // The previous behaviour: every context uploads its own copy
+    unsigned kernel_size(ALIGN(unsigned(kernels[0].size), 64) +
+                         ALIGN(unsigned(kernels[1].size), 64));
+    timer.reset();
+    for (unsigned i(0); i < contexts; ++i) {
+        bos[i] = dri_bo_alloc(i965->intel.bufmgr, "test", kernel_size, 4096);
+        dri_bo_map(bos[i], 1);
+        memcpy(bos[i]->virtual, kernels[0].bin, kernels[0].size);
+        memcpy(static_cast<unsigned char *>(bos[i]->virtual) + ALIGN(kernels[0].size, 64),
+               kernels[1].bin, kernels[1].size);
+        dri_bo_unmap(bos[i]);
+    }
+    const Timer::us::rep private_us(timer.elapsed());
+
+    for (unsigned i(0); i < contexts; ++i)
+        dri_bo_unreference(bos[i]);
+
+    std::cout << "[ BENCHMARK] " << contexts << " contexts loading "
+        << kernel_size / 1024 << "KB of kernels: " << private_us
+        << "us with private copies, " << cached_us << "us shared" << std::endl;
+
+    EXPECT_EQ(1u, cache.num_uploads);
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test.h"
+#include "test_utils.h"
+
+extern "C" {
+    #include "sysdeps.h"
+    #include "i965_drv_video.h"
+    #include "gen9_mfc.h"
+}
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Layout of a VME output block as consumed by the CU record pass, in dwords
+const unsigned VME_BLOCK_DWS = 96;
+const unsigned VME_INTRA_RDO = 4;
+const unsigned VME_INTER_MSG = 8;
+const unsigned VME_INTER_RDO = 10;
+const unsigned VME_INTER_MV = VME_INTER_MSG + 4;
+
+class HevcCURecordTest
+    : public ::testing::Test
+{
+protected:
+    void setup(unsigned width, unsigned height, int log2_cu_size,
+        int log2_ctb_size, int is_intra)
+    {
+        const unsigned ctb_size(1 << log2_ctb_size);
+        const unsigned ctb_width_in_mb((ctb_size + 15) / 16);
+
+        width_in_ctb = (width + ctb_size - 1) / ctb_size;
+        num_ctbs = width_in_ctb * ((height + ctb_size - 1) / ctb_size);
+        width_in_mbs = (width + 15) / 16;
+
+        vme.assign(width_in_mbs * (num_ctbs / width_in_ctb)
+            * ctb_width_in_mb * VME_BLOCK_DWS, 0);
+        records.assign(num_ctbs * 64 * 64, 0xcd);
+        info.assign(num_ctbs, gen9_hcpe_ctb_cu_info());
+
+        std::memset(&params, 0, sizeof(params));
+        params.vme_output = reinterpret_cast<unsigned char *>(vme.data());
+        params.vme_block_size = VME_BLOCK_DWS * 4;
+        params.cu_records = records.data();
+        params.ref_index_in_mb[0] = 0x00000000;
+        params.ref_index_in_mb[1] = 0x01010101;
+        params.pic_width = width;
+        params.pic_height = height;
+        params.log2_cu_size = log2_cu_size;
+        params.log2_ctb_size = log2_ctb_size;
+        params.qp = 26;
+        params.is_intra = is_intra;
+    }
+
+    uint32_t *block(unsigned mb_x, unsigned mb_y)
+    {
+        return &vme[(mb_y * width_in_mbs + mb_x) * VME_BLOCK_DWS];
+    }
+
+    // Random VME output, with intra modes kept in the range of the
+    // AVC to HEVC mapping tables
+    void randomize()
+    {
+        RandomValueGenerator<uint32_t> value(0, 0xffff);
+
+        for (size_t i(0); i < vme.size(); ++i)
+            vme[i] = (value() << 16) | value();
+        for (size_t i(0); i < vme.size(); i += VME_BLOCK_DWS)
+            vme[i + 1] &= 0x33333333;
+    }
+
+    const uint32_t *record(unsigned ctb, unsigned cu) const
+    {
+        const unsigned num_cu_record(params.log2_ctb_size == 4 ? 4 :
+            params.log2_ctb_size == 5 ? 16 : 64);
+
+        return reinterpret_cast<const uint32_t *>(
+            &records[(ctb * num_cu_record + cu) * 64]);
+    }
+
+    void fill(int max_threads)
+    {
+        gen9_hcpe_hevc_fill_cu_records(&params, 0, num_ctbs, info.data(),
+            max_threads);
+    }
+
+    gen9_hcpe_cu_record_params params;
+    std::vector<uint32_t> vme;
+    std::vector<uint8_t> records;
+    std::vector<gen9_hcpe_ctb_cu_info> info;
+    unsigned width_in_ctb, num_ctbs, width_in_mbs;
+};
+
+TEST_F(HevcCURecordTest, Intra16x16)
+{
+    setup(32, 32, 3, 5, 1);
+
+    for (unsigned y(0); y < 2; ++y) {
+        for (unsigned x(0); x < 2; ++x) {
+            uint32_t *msg = block(x, y);
+            msg[0] = 0x00;          // AVC_INTRA_16X16
+            msg[1] = 0x2;           // -> HEVC DC
+            msg[3] = 0x1;           // -> intra_chroma_mode 4
+        }
+    }
+
+    fill(1);
+
+    EXPECT_EQ(4, info[0].cu_count);
+    EXPECT_EQ(0x00100000u, info[0].split_coding_unit_flag);
+
+    for (unsigned cu(0); cu < 4; ++cu) {
+        const uint32_t *r = record(0, cu);
+        EXPECT_EQ(0xff1a0401u, r[0]);
+        EXPECT_EQ(0x01010101u, r[1]);
+        for (unsigned i(2); i < 11; ++i)
+            EXPECT_EQ(0u, r[i]) << "DW" << i;
+        EXPECT_EQ(0x55u, r[11]);
+        EXPECT_EQ(0x30000000u, r[12]);
+        EXPECT_EQ(0u, r[13]);
+        EXPECT_EQ(0u, r[14]);
+        EXPECT_EQ(0u, r[15]);
+    }
+}
+
+TEST_F(HevcCURecordTest, Inter16x8)
+{
+    setup(32, 32, 3, 5, 0);
+
+    for (unsigned y(0); y < 2; ++y) {
+        for (unsigned x(0); x < 2; ++x) {
+            uint32_t *msg = block(x, y);
+            uint32_t *mv = msg + VME_INTER_MV;
+            msg[VME_INTRA_RDO] = 0xffff;
+            msg[VME_INTER_RDO] = 0x0000;
+            msg[VME_INTER_MSG] = 0x01; // AVC_INTER_16X8
+            mv[0] = 0x00020001;
+            mv[1] = 0xfffeffff;
+            mv[16] = 0x00040003;
+            mv[17] = 0x00080007;
+            mv[24] = 0x00060005;
+            mv[25] = 0x000a0009;
+        }
+    }
+
+    fill(1);
+
+    EXPECT_EQ(4, info[0].cu_count);
+
+    for (unsigned cu(0); cu < 4; ++cu) {
+        const uint32_t *r = record(0, cu);
+        EXPECT_EQ(0x001a0525u, r[0]);
+        EXPECT_EQ(0u, r[1]);
+        EXPECT_EQ(0x00010001u, r[2]);   // mvx_l0
+        EXPECT_EQ(0x00050003u, r[3]);
+        EXPECT_EQ(0x00020002u, r[4]);   // mvy_l0
+        EXPECT_EQ(0x00060004u, r[5]);
+        EXPECT_EQ(0xffffffffu, r[6]);   // mvx_l1
+        EXPECT_EQ(0x00090007u, r[7]);
+        EXPECT_EQ(0xfffefffeu, r[8]);   // mvy_l1
+        EXPECT_EQ(0x000a0008u, r[9]);
+        EXPECT_EQ(0x11110000u, r[10]);
+        EXPECT_EQ(0x55u, r[11]);
+        EXPECT_EQ(0x30000000u, r[12]);
+    }
+
+    // The VME output is left untouched
+    EXPECT_EQ(0x01u, block(0, 0)[VME_INTER_MSG]);
+    EXPECT_EQ(0x00000000u, block(0, 0)[VME_INTER_MV + 2]);
+}
+
+TEST_F(HevcCURecordTest, PictureEdge)
+{
+    // The second CTB only covers one MB column, cut in half, and the
+    // second MB row is cut in half as well
+    setup(40, 24, 3, 5, 1);
+
+    fill(1);
+
+    EXPECT_EQ(6, info[0].cu_count);
+    EXPECT_EQ(0x001c0000u, info[0].split_coding_unit_flag);
+
+    EXPECT_EQ(3, info[1].cu_count);
+    EXPECT_EQ(0x00150000u, info[1].split_coding_unit_flag);
+    for (unsigned cu(0); cu < 3; ++cu)
+        EXPECT_EQ(0u, record(1, cu)[0] & 0x3) << "cu " << cu;
+}
+
+TEST_F(HevcCURecordTest, ThreadedMatchesSerial)
+{
+    static const int configs[][3] = {
+        // log2_cu_size, log2_ctb_size, is_intra
+        { 3, 5, 0 },
+        { 3, 5, 1 },
+        { 3, 4, 0 },
+        { 4, 6, 0 },
+    };
+
+    for (size_t i(0); i < sizeof(configs) / sizeof(configs[0]); ++i) {
+        setup(1918, 1078, configs[i][0], configs[i][1], configs[i][2]);
+        randomize();
+
+        const std::vector<uint32_t> input(vme);
+
+        fill(1);
+
+        const std::vector<uint8_t> serial_records(records);
+        const std::vector<gen9_hcpe_ctb_cu_info> serial_info(info);
+
+        records.assign(records.size(), 0xcd);
+        info.assign(info.size(), gen9_hcpe_ctb_cu_info());
+        fill(GEN9_HCPE_CU_THREADS_MAX);
+
+        EXPECT_TRUE(input == vme) << "config " << i;
+        EXPECT_TRUE(serial_records == records) << "config " << i;
+        for (unsigned ctb(0); ctb < num_ctbs; ++ctb) {
+            EXPECT_EQ(serial_info[ctb].cu_count, info[ctb].cu_count);
+            EXPECT_EQ(serial_info[ctb].split_coding_unit_flag,
+                info[ctb].split_coding_unit_flag);
+        }
+    }
+}
+
+TEST_F(HevcCURecordTest, Benchmark)
+{
+    const unsigned frames(100);
+    Timer::us::rep serial_us(0), threaded_us(0);
+    Timer timer;
+
+    setup(1920, 1080, 3, 5, 0);
+    randomize();
+
+    for (unsigned i(0); i < frames; ++i) {
+        timer.reset();
+        fill(1);
+        serial_us += timer.elapsed();
+
+        timer.reset();
+        fill(0);
+        threaded_us += timer.elapsed();
+    }
+
+    std::cout << "[ BENCHMARK] " << frames << " 1080p P frames: serial "
+        << serial_us << "us, threaded " << threaded_us << "us" << std::endl;
+}
+
+} // namespace
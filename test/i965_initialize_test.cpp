@@ -23,8 +23,12 @@
  */
 
 #include "i965_test_fixture.h"
+#include "test_utils.h"
 
+#include <fcntl.h> // for O_RDWR
 #include <string>
+#include <unistd.h> // for close()
+#include <va/va_drm.h>
 
 class DriverTest : public I965TestFixture { };
 
@@ -64,3 +68,71 @@ TEST_F(DriverTest, Initialize)
 
     EXPECT_STREQ(ctx->str_vendor, i965->va_vendor);
 }
+
+/**
+ * Initializes a display of its own, separate from the one shared by the
+ * I965TestFixture tests, so that the driver starts from a clean state.
+ */
+class DriverStartupTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        handle = open("/dev/dri/renderD128", O_RDWR);
+        if (handle < 0)
+            handle = open("/dev/dri/card0", O_RDWR);
+        ASSERT_LE(0, handle);
+    }
+
+    virtual void TearDown()
+    {
+        if (handle >= 0)
+            close(handle);
+    }
+
+    int handle;
+};
+
+TEST_F(DriverStartupTest, LazyProcessingInit)
+{
+    VADisplay display = vaGetDisplayDRM(handle);
+    int major, minor;
+
+    ASSERT_PTR(display);
+    ASSERT_STATUS(vaInitialize(display, &major, &minor));
+
+    VADriverContextP ctx(((VADisplayContextP)display)->pDriverContext);
+    ASSERT_PTR(ctx);
+
+    struct i965_driver_data *i965(i965_driver_data(ctx));
+    ASSERT_PTR(i965);
+
+    EXPECT_PTR_NULL(i965->pp_context);
+    EXPECT_FALSE(i965->render_state.initialized);
+
+    EXPECT_STATUS(vaTerminate(display));
+}
+
+TEST_F(DriverStartupTest, InitializeTerminate)
+{
+    const unsigned iterations = 50;
+    Timer timer;
+    Timer::us::rep initTime(0), totalTime(0);
+
+    for (unsigned i(0); i < iterations; ++i) {
+        VADisplay display = vaGetDisplayDRM(handle);
+        int major, minor;
+
+        ASSERT_PTR(display);
+
+        timer.reset();
+        ASSERT_STATUS(vaInitialize(display, &major, &minor));
+        initTime += timer.elapsed();
+        ASSERT_STATUS(vaTerminate(display));
+        totalTime += timer.elapsed();
+    }
+
+    std::cout << "[ BENCHMARK] vaInitialize " << initTime / iterations
+        << "us, vaInitialize+vaTerminate " << totalTime / iterations
+        << "us (" << iterations << " iterations)" << std::endl;
+}
@@ -427,6 +427,78 @@ INSTANTIATE_TEST_CASE_P(
     )
 );
 
+// Inputs the encoder converts into a staging surface before encoding
+class JPEGEncodeStagingTest
+    : public JPEGEncodeInputTest
+{
+};
+
+TEST_P(JPEGEncodeStagingTest, Repeated)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+    if (not HAS_JPEG_ENCODING(i965)) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        return;
+    }
+
+    ASSERT_NO_FAILURE(SetUpSurfaces());
+    ASSERT_NO_FAILURE(SetUpConfig());
+    ASSERT_NO_FAILURE(SetUpContext());
+    ASSERT_NO_FAILURE(SetUpCodedBuffer());
+    ASSERT_NO_FAILURE(SetUpPicture());
+    ASSERT_NO_FAILURE(SetUpIQMatrix());
+    ASSERT_NO_FAILURE(SetUpHuffmanTables());
+    ASSERT_NO_FAILURE(SetUpSlice());
+    ASSERT_NO_FAILURE(SetUpHeader());
+    ASSERT_NO_FAILURE(Encode());
+
+    struct object_context const *obj_context = CONTEXT(context);
+    ASSERT_PTR(obj_context);
+
+    struct intel_encoder_context const *encoder_context =
+        reinterpret_cast<struct intel_encoder_context const *>(
+            obj_context->hw_context);
+    ASSERT_PTR(encoder_context);
+
+    // the input converted for the first picture is reused by the next one
+    const VASurfaceID staging = encoder_context->staging_yuv_surface;
+    ASSERT_NE(VA_INVALID_SURFACE, staging);
+    EXPECT_EQ(staging, encoder_context->input_yuv_surface);
+    const ByteData first(output);
+
+    ASSERT_NO_FAILURE(Encode());
+
+    EXPECT_EQ(staging, encoder_context->staging_yuv_surface);
+    EXPECT_TRUE(first == output);
+}
+
+// Only I420 surfaces are linear, the other formats are encoded in place
+INSTANTIATE_TEST_CASE_P(
+    Random, JPEGEncodeStagingTest,
+    ::testing::Combine(
+        ::testing::ValuesIn(
+            std::vector<TestInputCreator::SharedConst>(
+                5, TestInputCreator::SharedConst(new RandomSizeCreator))),
+        ::testing::Values("I420")
+    )
+);
+
+INSTANTIATE_TEST_CASE_P(
+    Common, JPEGEncodeStagingTest,
+    ::testing::Combine(
+        ::testing::Values(
+            TestInputCreator::Shared(new FixedSizeCreator({800, 600})),
+            TestInputCreator::Shared(new FixedSizeCreator({1366, 768})),
+            TestInputCreator::Shared(new FixedSizeCreator({1920, 1080})),
+            TestInputCreator::Shared(new FixedSizeCreator({3640, 2160}))
+        ),
+        ::testing::Values("I420")
+    )
+);
+
 InputCreators generateCommonInputs()
 {
     return {
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+
+extern "C" {
+    #include <va/va_backend_wayland.h>
+    #include "wayland-drm-client-protocol.h"
+    #include "i965_output_wayland.h"
+}
+
+#include <cstdarg>
+#include <cstring>
+#include <fcntl.h>
+
+/*
+ * Stand-in for the parts of libwayland-client and libEGL the driver uses.
+ * The symbols are exported from the test program and the driver resolves
+ * them from the global scope, so no compositor is needed.
+ */
+namespace {
+
+struct StandInProxy
+{
+    const struct wl_interface *interface;
+    void (**implementation)(void);
+    void *data;
+};
+
+struct StandIn
+{
+    StandInProxy *registry;
+    unsigned createdBuffers;
+    unsigned destroyedBuffers;
+    unsigned primeBuffers;
+    unsigned planarBuffers;
+    int handle;
+};
+
+StandIn standIn;
+
+} // namespace
+
+extern "C" {
+
+const struct wl_interface wl_buffer_interface = {
+    "wl_buffer", 1, 0, NULL, 0, NULL
+};
+
+const struct wl_interface wl_registry_interface = {
+    "wl_registry", 1, 0, NULL, 0, NULL
+};
+
+const struct wl_interface wl_drm_interface = {
+    "wl_drm", 2, 0, NULL, 0, NULL
+};
+
+struct wl_proxy *
+wl_proxy_create(struct wl_proxy *factory, const struct wl_interface *interface)
+{
+    StandInProxy *proxy = new StandInProxy();
+
+    proxy->interface = interface;
+    if (interface == &wl_registry_interface)
+        standIn.registry = proxy;
+    else if (interface == &wl_buffer_interface)
+        ++standIn.createdBuffers;
+
+    return reinterpret_cast<struct wl_proxy *>(proxy);
+}
+
+void
+wl_proxy_destroy(struct wl_proxy *p)
+{
+    StandInProxy *proxy = reinterpret_cast<StandInProxy *>(p);
+
+    if (proxy->interface == &wl_buffer_interface)
+        ++standIn.destroyedBuffers;
+    if (proxy == standIn.registry)
+        standIn.registry = NULL;
+
+    delete proxy;
+}
+
+void
+wl_proxy_marshal(struct wl_proxy *p, uint32_t opcode, ...)
+{
+    StandInProxy *proxy = reinterpret_cast<StandInProxy *>(p);
+    va_list args;
+
+    if (proxy->interface != &wl_drm_interface)
+        return;
+
+    va_start(args, opcode);
+    va_arg(args, struct wl_proxy *);
+    standIn.handle = va_arg(args, int);
+    va_end(args);
+
+    if (opcode == WL_DRM_CREATE_PRIME_BUFFER)
+        ++standIn.primeBuffers;
+    else if (opcode == WL_DRM_CREATE_PLANAR_BUFFER)
+        ++standIn.planarBuffers;
+}
+
+int
+wl_proxy_add_listener(struct wl_proxy *p,
+    void (**implementation)(void), void *data)
+{
+    StandInProxy *proxy = reinterpret_cast<StandInProxy *>(p);
+
+    proxy->implementation = implementation;
+    proxy->data = data;
+    return 0;
+}
+
+int
+wl_display_roundtrip(struct wl_display *)
+{
+    const struct wl_registry_listener *listener;
+
+    if (!standIn.registry || !standIn.registry->implementation)
+        return -1;
+
+    listener = reinterpret_cast<const struct wl_registry_listener *>(
+        standIn.registry->implementation);
+    listener->global(standIn.registry->data,
+        reinterpret_cast<struct wl_registry *>(standIn.registry),
+        1, "wl_drm", 2);
+    return 0;
+}
+
+} // extern "C"
+
+class OutputWaylandTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        VADriverContextP ctx(*this);
+
+        displayType = ctx->display_type;
+        nativeDisplay = ctx->native_dpy;
+        vtableWayland = ctx->vtable_wayland;
+
+        memset(&vtable, 0, sizeof(vtable));
+        memset(&standIn, 0, sizeof(standIn));
+        standIn.handle = -1;
+
+        ctx->display_type = VA_DISPLAY_WAYLAND;
+        ctx->native_dpy = &standIn;
+        ctx->vtable_wayland = &vtable;
+
+        ASSERT_TRUE(i965_output_wayland_init_from(ctx, NULL, NULL));
+        ASSERT_PTR(vtable.vaGetSurfaceBufferWl);
+
+        SurfaceAttribs attributes(1);
+        attributes.front().flags = VA_SURFACE_ATTRIB_SETTABLE;
+        attributes.front().type = VASurfaceAttribPixelFormat;
+        attributes.front().value.type = VAGenericValueTypeInteger;
+        attributes.front().value.value.i = VA_FOURCC_NV12;
+        surfaces = createSurfaces(64, 64, VA_RT_FORMAT_YUV420, 1, attributes);
+        ASSERT_EQ(1u, surfaces.size());
+    }
+
+    virtual void TearDown()
+    {
+        VADriverContextP ctx(*this);
+
+        if (!surfaces.empty())
+            destroySurfaces(surfaces);
+
+        i965_output_wayland_terminate(ctx);
+
+        ctx->display_type = displayType;
+        ctx->native_dpy = nativeDisplay;
+        ctx->vtable_wayland = vtableWayland;
+    }
+
+    struct wl_buffer *getSurfaceBuffer(unsigned flags)
+    {
+        VADriverContextP ctx(*this);
+        struct wl_buffer *buffer = NULL;
+
+        EXPECT_STATUS(vtable.vaGetSurfaceBufferWl(
+            ctx, surfaces.front(), flags, &buffer));
+        return buffer;
+    }
+
+    struct VADriverVTableWayland vtable;
+    Surfaces surfaces;
+
+private:
+    int displayType;
+    void *nativeDisplay;
+    struct VADriverVTableWayland *vtableWayland;
+};
+
+TEST_F(OutputWaylandTest, ExportOncePerSurface)
+{
+    vtable.has_prime_sharing = 1;
+
+    struct wl_buffer *first = getSurfaceBuffer(VA_FRAME_PICTURE);
+    int fd = standIn.handle;
+    struct wl_buffer *second = getSurfaceBuffer(VA_FRAME_PICTURE);
+
+    ASSERT_PTR(first);
+    ASSERT_PTR(second);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(2u, standIn.primeBuffers);
+    EXPECT_EQ(0u, standIn.planarBuffers);
+
+    /* Both buffers come from the same prime fd, kept open on the surface */
+    EXPECT_NE(-1, fd);
+    EXPECT_EQ(fd, standIn.handle);
+    EXPECT_NE(-1, fcntl(fd, F_GETFD));
+
+    /* Uncached buffers belong to the caller */
+    wl_proxy_destroy(reinterpret_cast<struct wl_proxy *>(first));
+    wl_proxy_destroy(reinterpret_cast<struct wl_proxy *>(second));
+    destroySurfaces(surfaces);
+    surfaces.clear();
+    EXPECT_EQ(2u, standIn.destroyedBuffers);
+    EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+}
+
+TEST_F(OutputWaylandTest, CachedBufferReused)
+{
+    vtable.has_prime_sharing = 1;
+
+    const unsigned flags = VA_FRAME_PICTURE | VA_SURFACE_BUFFER_WL_CACHED_I965;
+    struct wl_buffer *first = getSurfaceBuffer(flags);
+    struct wl_buffer *second = getSurfaceBuffer(flags);
+
+    ASSERT_PTR(first);
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(1u, standIn.createdBuffers);
+    EXPECT_EQ(0u, standIn.destroyedBuffers);
+
+    destroySurfaces(surfaces);
+    surfaces.clear();
+    EXPECT_EQ(1u, standIn.destroyedBuffers);
+}
+
+TEST_F(OutputWaylandTest, FlinkWithoutPrimeSharing)
+{
+    vtable.has_prime_sharing = 0;
+
+    const unsigned flags = VA_FRAME_PICTURE | VA_SURFACE_BUFFER_WL_CACHED_I965;
+    struct wl_buffer *buffer = getSurfaceBuffer(flags);
+
+    ASSERT_PTR(buffer);
+    EXPECT_EQ(1u, standIn.planarBuffers);
+    EXPECT_EQ(0u, standIn.primeBuffers);
+    EXPECT_NE(0, standIn.handle);
+}
+
+TEST_F(OutputWaylandTest, CachedBufferReleasedOnTerminate)
+{
+    const unsigned flags = VA_FRAME_PICTURE | VA_SURFACE_BUFFER_WL_CACHED_I965;
+
+    ASSERT_PTR(getSurfaceBuffer(flags));
+
+    i965_output_wayland_terminate(*this);
+    EXPECT_EQ(1u, standIn.destroyedBuffers);
+
+    ASSERT_TRUE(i965_output_wayland_init_from(*this, NULL, NULL));
+}
+
+TEST_F(OutputWaylandTest, InvalidFlags)
+{
+    VADriverContextP ctx(*this);
+    struct wl_buffer *buffer = NULL;
+
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_FLAG_NOT_SUPPORTED,
+        vtable.vaGetSurfaceBufferWl(ctx, surfaces.front(),
+            VA_TOP_FIELD, &buffer));
+}
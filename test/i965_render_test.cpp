@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2026 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "i965_test_fixture.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+class RenderTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+
+        // Linear BGRA destination, two 64x64 sources side by side
+        std::memset(&region, 0, sizeof(region));
+        region.width = 128;
+        region.height = 64;
+        region.cpp = 4;
+        region.pitch = region.width * region.cpp;
+        region.tiling = I915_TILING_NONE;
+        region.swizzle = I915_BIT_6_SWIZZLE_NONE;
+        region.bo = dri_bo_alloc(i965->intel.bufmgr, "test draw region",
+            region.pitch * region.height, 4096);
+        ASSERT_PTR(region.bo);
+
+        draw_region = i965->render_state.draw_region;
+        i965->render_state.draw_region = &region;
+    }
+
+    virtual void TearDown()
+    {
+        struct i965_driver_data *i965(*this);
+
+        if (i965 && region.bo) {
+            i965->render_state.draw_region = draw_region;
+            dri_bo_unreference(region.bo);
+        }
+
+        I965TestFixture::TearDown();
+    }
+
+    // Fills a NV12 surface with a single color
+    void fill(VASurfaceID id, uint8_t y, uint8_t u, uint8_t v)
+    {
+        VAImage image;
+
+        ASSERT_NO_FAILURE(deriveImage(id, image));
+        ASSERT_NO_FAILURE(
+            uint8_t *data = mapBuffer<uint8_t>(image.buf));
+
+        for (unsigned i(0); i < image.height; ++i)
+            std::memset(data + image.offsets[0] + i * image.pitches[0], y,
+                image.width);
+
+        for (unsigned i(0); i < image.height / 2; ++i) {
+            uint8_t *uv = data + image.offsets[1] + i * image.pitches[1];
+            for (unsigned j(0); j < image.width / 2; ++j) {
+                uv[2 * j] = u;
+                uv[2 * j + 1] = v;
+            }
+        }
+
+        unmapBuffer(image.buf);
+        destroyImage(image);
+    }
+
+    // B, G, R of the destination pixel
+    const uint8_t *pixel(unsigned x, unsigned y) const
+    {
+        return static_cast<const uint8_t *>(region.bo->virtual) +
+            y * region.pitch + x * region.cpp;
+    }
+
+    struct intel_region region;
+    struct intel_region *draw_region;
+};
+
+TEST_F(RenderTest, PutSurfaces)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+
+    Surfaces surfaces = createSurfaces(64, 64, VA_RT_FORMAT_YUV420, 2);
+    ASSERT_EQ(2u, surfaces.size());
+
+    // White and black
+    ASSERT_NO_FAILURE(fill(surfaces[0], 235, 128, 128));
+    ASSERT_NO_FAILURE(fill(surfaces[1], 16, 128, 128));
+
+    struct i965_render_source sources[2];
+    for (unsigned i(0); i < 2; ++i) {
+        sources[i].obj_surface = SURFACE(surfaces[i]);
+        ASSERT_PTR(sources[i].obj_surface);
+        sources[i].src_rect = { 0, 0, 64, 64 };
+        sources[i].dst_rect = { int16_t(64 * i), 0, 64, 64 };
+    }
+
+    const VAStatus status(
+        intel_render_put_surfaces(*this, sources, 2, VA_FRAME_PICTURE));
+    if (status == VA_STATUS_ERROR_UNIMPLEMENTED) {
+        RecordProperty("skipped", true);
+        std::cout << "[  SKIPPED ] " << getFullTestName()
+            << " is unsupported on this hardware" << std::endl;
+        destroySurfaces(surfaces);
+        return;
+    }
+    EXPECT_STATUS(status);
+
+    ASSERT_EQ(0, dri_bo_map(region.bo, 0));
+    for (unsigned y(0); y < 64; y += 9) {
+        for (unsigned x(0); x < 64; x += 9) {
+            for (unsigned c(0); c < 3; ++c) {
+                EXPECT_LE(0xf0u, unsigned(pixel(x, y)[c]))
+                    << "at " << x << "," << y;
+                EXPECT_GE(0x10u, unsigned(pixel(64 + x, y)[c]))
+                    << "at " << 64 + x << "," << y;
+            }
+        }
+    }
+    dri_bo_unmap(region.bo);
+
+    destroySurfaces(surfaces);
+}
+
+// What vaPutSurface() runs once the draw region is set up
+TEST_F(RenderTest, PutSurface)
+{
+    struct i965_driver_data *i965(*this);
+    ASSERT_PTR(i965);
+
+    Surfaces surfaces = createSurfaces(64, 64, VA_RT_FORMAT_YUV420);
+    ASSERT_EQ(1u, surfaces.size());
+    ASSERT_NO_FAILURE(fill(surfaces[0], 235, 128, 128));
+
+    std::vector<uint8_t> black(region.pitch * region.height, 0);
+    dri_bo_subdata(region.bo, 0, black.size(), black.data());
+
+    const VARectangle src_rect = { 0, 0, 64, 64 };
+    const VARectangle dst_rect = { 64, 0, 64, 64 };
+    intel_render_put_surface(*this, SURFACE(surfaces[0]), &src_rect,
+        &dst_rect, VA_FRAME_PICTURE | VA_SRC_BT601);
+
+    // White in the destination rectangle only
+    ASSERT_EQ(0, dri_bo_map(region.bo, 0));
+    for (unsigned y(0); y < 64; y += 9) {
+        for (unsigned x(0); x < 64; x += 9) {
+            for (unsigned c(0); c < 3; ++c) {
+                EXPECT_GE(0x10u, unsigned(pixel(x, y)[c]))
+                    << "at " << x << "," << y;
+                EXPECT_LE(0xf0u, unsigned(pixel(64 + x, y)[c]))
+                    << "at " << 64 + x << "," << y;
+            }
+        }
+    }
+    dri_bo_unmap(region.bo);
+
+    destroySurfaces(surfaces);
+}
+
+TEST_F(RenderTest, PutSurfacesLimits)
+{
+    struct i965_render_source source;
+
+    std::memset(&source, 0, sizeof(source));
+    EXPECT_NE(VA_STATUS_SUCCESS,
+        intel_render_put_surfaces(*this, &source, 0, VA_FRAME_PICTURE));
+    EXPECT_NE(VA_STATUS_SUCCESS,
+        intel_render_put_surfaces(*this, &source, MAX_RENDER_SOURCES + 1,
+            VA_FRAME_PICTURE));
+}
+
+} // namespace
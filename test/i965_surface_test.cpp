@@ -23,8 +23,10 @@
  */
 
 #include "i965_test_fixture.h"
+#include "test_utils.h"
 
 #include <algorithm>
+#include <cstring>
 #include <set>
 
 static const std::set<unsigned> pixelFormats = {
@@ -118,3 +120,218 @@ TEST_F(CreateSurfacesTest, UnsupportedPixelFormats)
             destroySurfaces(surfaces), "VA_STATUS_ERROR_INVALID_SURFACE");
     }
 }
+
+class SurfaceCacheTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        struct i965_driver_data *i965(*this);
+        ASSERT_PTR(i965);
+
+        maxSize = i965->surface_cache.max_size;
+        i965->surface_cache.max_size = I965_SURFACE_CACHE_DEFAULT_SIZE;
+
+        attributes.resize(1);
+        attributes.front().flags = VA_SURFACE_ATTRIB_SETTABLE;
+        attributes.front().type = VASurfaceAttribPixelFormat;
+        attributes.front().value.type = VAGenericValueTypeInteger;
+        attributes.front().value.value.i = VA_FOURCC_NV12;
+    }
+
+    virtual void TearDown()
+    {
+        struct i965_driver_data *i965(*this);
+        if (i965)
+            i965->surface_cache.max_size = maxSize;
+
+        I965TestFixture::TearDown();
+    }
+
+    unsigned long maxSize;
+    SurfaceAttribs attributes;
+};
+
+TEST_F(SurfaceCacheTest, ReuseSameLayout)
+{
+    struct i965_driver_data *i965(*this);
+    const unsigned hits = i965->surface_cache.num_hits;
+
+    Surfaces surfaces = createSurfaces(
+        1920, 1080, VA_RT_FORMAT_YUV420, 4, attributes);
+    destroySurfaces(surfaces);
+
+    EXPECT_LE(4, i965->surface_cache.num_entries);
+
+    surfaces = createSurfaces(1920, 1080, VA_RT_FORMAT_YUV420, 4, attributes);
+    EXPECT_EQ(hits + 4, i965->surface_cache.num_hits);
+
+    for (const VASurfaceID id : surfaces) {
+        struct object_surface *obj_surface = SURFACE(id);
+        ASSERT_PTR(obj_surface);
+        EXPECT_PTR(obj_surface->bo);
+    }
+
+    destroySurfaces(surfaces);
+}
+
+TEST_F(SurfaceCacheTest, NoReuseDifferentLayout)
+{
+    struct i965_driver_data *i965(*this);
+
+    Surfaces surfaces = createSurfaces(
+        1920, 1080, VA_RT_FORMAT_YUV420, 1, attributes);
+    destroySurfaces(surfaces);
+
+    const unsigned hits = i965->surface_cache.num_hits;
+
+    surfaces = createSurfaces(1280, 720, VA_RT_FORMAT_YUV420, 1, attributes);
+    destroySurfaces(surfaces);
+
+    attributes.front().value.value.i = VA_FOURCC_I420;
+    surfaces = createSurfaces(1920, 1080, VA_RT_FORMAT_YUV420, 1, attributes);
+    destroySurfaces(surfaces);
+
+    EXPECT_EQ(hits, i965->surface_cache.num_hits);
+}
+
+TEST_F(SurfaceCacheTest, Disabled)
+{
+    struct i965_driver_data *i965(*this);
+
+    i965_surface_cache_terminate(&i965->surface_cache);
+    i965_surface_cache_init(&i965->surface_cache, 0);
+
+    Surfaces surfaces = createSurfaces(
+        1920, 1080, VA_RT_FORMAT_YUV420, 2, attributes);
+    destroySurfaces(surfaces);
+
+    EXPECT_EQ(0, i965->surface_cache.num_entries);
+    EXPECT_EQ(0u, i965->surface_cache.total_size);
+
+    surfaces = createSurfaces(1920, 1080, VA_RT_FORMAT_YUV420, 2, attributes);
+    destroySurfaces(surfaces);
+
+    EXPECT_EQ(0u, i965->surface_cache.num_hits);
+}
+
+TEST_F(SurfaceCacheTest, SizeLimit)
+{
+    struct i965_driver_data *i965(*this);
+
+    i965->surface_cache.max_size = 8 * 1024 * 1024;
+
+    Surfaces surfaces = createSurfaces(
+        1920, 1080, VA_RT_FORMAT_YUV420, 8, attributes);
+    destroySurfaces(surfaces);
+
+    EXPECT_GE(i965->surface_cache.max_size, i965->surface_cache.total_size);
+}
+
+TEST_F(SurfaceCacheTest, Churn)
+{
+    struct i965_driver_data *i965(*this);
+    const unsigned iterations = 200;
+    const unsigned poolSize = 8;
+    Timer timer;
+
+    for (const unsigned long size : {0ul, maxSize ? maxSize :
+            (unsigned long)I965_SURFACE_CACHE_DEFAULT_SIZE}) {
+        i965_surface_cache_terminate(&i965->surface_cache);
+        i965_surface_cache_init(&i965->surface_cache, size);
+
+        timer.reset();
+        for (unsigned i(0); i < iterations; ++i) {
+            Surfaces surfaces = createSurfaces(
+                1920, 1080, VA_RT_FORMAT_YUV420, poolSize, attributes);
+            destroySurfaces(surfaces);
+        }
+        const auto elapsed = timer.elapsed();
+
+        std::cout << "[ BENCHMARK] surface churn " << poolSize << "x1080p"
+            << " cache=" << (size >> 20) << "MB: "
+            << elapsed / iterations << "us/iteration, "
+            << i965->surface_cache.num_hits << " hits" << std::endl;
+    }
+}
+
+class SurfaceBorderTest
+    : public I965TestFixture
+    , public ::testing::WithParamInterface<unsigned>
+{
+};
+
+TEST_P(SurfaceBorderTest, Clear)
+{
+    const unsigned fourcc = GetParam();
+    const unsigned format = fourcc == VA_FOURCC_P010 ?
+        VA_RT_FORMAT_YUV420_10BPP : VA_RT_FORMAT_YUV420;
+    const int bpp = fourcc == VA_FOURCC_P010 ? 2 : 1;
+
+    SurfaceAttribs attributes(1);
+    attributes.front().flags = VA_SURFACE_ATTRIB_SETTABLE;
+    attributes.front().type = VASurfaceAttribPixelFormat;
+    attributes.front().value.type = VAGenericValueTypeInteger;
+    attributes.front().value.value.i = fourcc;
+
+    Surfaces surfaces = createSurfaces(
+        330, 170, format, 1, attributes);
+    ASSERT_EQ(1u, surfaces.size());
+
+    struct i965_driver_data *i965(*this);
+    struct object_surface *obj_surface = SURFACE(surfaces.front());
+    ASSERT_PTR(obj_surface);
+    ASSERT_PTR(obj_surface->bo);
+
+    // make the whole surface dirty, through the detiled view
+    const int pitch = obj_surface->width;
+    const int rows = obj_surface->height + obj_surface->height / 2;
+
+    drm_intel_gem_bo_map_gtt(obj_surface->bo);
+    uint8_t *p = static_cast<uint8_t *>(obj_surface->bo->virtual);
+    ASSERT_PTR(p);
+    std::memset(p, 0xa5, pitch * rows);
+    drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+
+    obj_surface->border_cleared = false;
+    EXPECT_STATUS(i965_clear_surface_border(obj_surface));
+    EXPECT_TRUE(obj_surface->border_cleared);
+
+    drm_intel_gem_bo_map_gtt(obj_surface->bo);
+    p = static_cast<uint8_t *>(obj_surface->bo->virtual);
+    ASSERT_PTR(p);
+
+    const int width = obj_surface->orig_width * bpp;
+    const int heights[2] = {
+        (int)obj_surface->orig_height, (int)obj_surface->orig_height / 2 };
+    const int vstrides[2] = {
+        (int)obj_surface->height, (int)obj_surface->height / 2 };
+    const uint8_t *planes[2] = {
+        p, p + obj_surface->y_cb_offset * pitch };
+
+    for (int i(0); i < 2; ++i) {
+        unsigned visible(0), border(0);
+        for (int y(0); y < vstrides[i]; ++y) {
+            for (int x(0); x < pitch; ++x) {
+                const uint8_t v = planes[i][y * pitch + x];
+                if (x < width && y < heights[i])
+                    visible += (v != 0xa5);
+                else
+                    border += (v != 0);
+            }
+        }
+        EXPECT_EQ(0u, visible) << "plane " << i;
+        EXPECT_EQ(0u, border) << "plane " << i;
+    }
+
+    drm_intel_gem_bo_unmap_gtt(obj_surface->bo);
+
+    destroySurfaces(surfaces);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Formats, SurfaceBorderTest,
+    ::testing::Values(VA_FOURCC_NV12, VA_FOURCC_P010));
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2026 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "test.h"
+
+extern "C" {
+    #include "sysdeps.h"
+    #include "i965_drv_video.h"
+    #include "i965_encoder.h"
+    #include "gen9_vdenc.h"
+}
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+class VDEncBRCLayerTest
+    : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        std::memset(&encoder_context, 0, sizeof(encoder_context));
+        std::memset(&vdenc_context, 0, sizeof(vdenc_context));
+
+        encoder_context.mfc_context = &vdenc_context;
+        vdenc_context.internal_rate_mode = I965_BRC_CBR;
+
+        encoder_context.brc.hrd_buffer_size = 8000000;
+        encoder_context.brc.hrd_initial_buffer_fullness = 4000000;
+        encoder_context.brc.gop_size = 30;
+    }
+
+    // Bit rates and frame rates are given per layer, including the layers below
+    void setLayer(unsigned i, unsigned bits_per_second, unsigned num,
+        unsigned den = 1, unsigned target_percentage = 100)
+    {
+        encoder_context.brc.bits_per_second[i] = bits_per_second;
+        encoder_context.brc.framerate[i].num = num;
+        encoder_context.brc.framerate[i].den = den;
+        encoder_context.brc.target_percentage[i] = target_percentage;
+        encoder_context.layer.num_layers = i + 1;
+    }
+
+    const struct gen9_vdenc_brc_layer& layer(unsigned i) const
+    {
+        return vdenc_context.layer[i];
+    }
+
+    struct intel_encoder_context encoder_context;
+    struct gen9_vdenc_context vdenc_context;
+};
+
+TEST_F(VDEncBRCLayerTest, SingleLayer)
+{
+    setLayer(0, 4000000, 30);
+    encoder_context.layer.num_layers = 0;
+
+    gen9_vdenc_update_brc_layers(NULL, &encoder_context);
+
+    EXPECT_EQ(1u, vdenc_context.num_layers);
+    EXPECT_EQ(4000u, layer(0).max_bit_rate);
+    EXPECT_EQ(4000u, layer(0).target_bit_rate);
+    EXPECT_EQ(4000u, layer(0).min_bit_rate);
+    EXPECT_EQ(30u, layer(0).framerate.num);
+    EXPECT_EQ(1u, layer(0).framerate.den);
+    EXPECT_EQ(8000000u, layer(0).vbv_buffer_size_in_bit);
+    EXPECT_EQ(4000000u, layer(0).init_vbv_buffer_fullness_in_bit);
+    EXPECT_EQ(30u, layer(0).gop_size);
+}
+
+TEST_F(VDEncBRCLayerTest, ThreeLayers)
+{
+    setLayer(0, 1000000, 15, 2);
+    setLayer(1, 2000000, 15);
+    setLayer(2, 4000000, 30);
+
+    gen9_vdenc_update_brc_layers(NULL, &encoder_context);
+
+    ASSERT_EQ(3u, vdenc_context.num_layers);
+
+    // What each layer adds to the layers below
+    EXPECT_EQ(1000u, layer(0).max_bit_rate);
+    EXPECT_EQ(1000u, layer(1).max_bit_rate);
+    EXPECT_EQ(2000u, layer(2).max_bit_rate);
+
+    EXPECT_EQ(15u, layer(0).framerate.num);
+    EXPECT_EQ(2u, layer(0).framerate.den);
+    EXPECT_EQ(15u, layer(1).framerate.num);
+    EXPECT_EQ(2u, layer(1).framerate.den);
+    EXPECT_EQ(15u, layer(2).framerate.num);
+    EXPECT_EQ(1u, layer(2).framerate.den);
+
+    // The HRD buffer is shared in proportion of the bit rates
+    EXPECT_EQ(2000000u, layer(0).vbv_buffer_size_in_bit);
+    EXPECT_EQ(1000000u, layer(0).init_vbv_buffer_fullness_in_bit);
+    EXPECT_EQ(2000000u, layer(1).vbv_buffer_size_in_bit);
+    EXPECT_EQ(1000000u, layer(1).init_vbv_buffer_fullness_in_bit);
+    EXPECT_EQ(4000000u, layer(2).vbv_buffer_size_in_bit);
+    EXPECT_EQ(2000000u, layer(2).init_vbv_buffer_fullness_in_bit);
+
+    // The GOP is scaled to the frame rate of each layer, 7.5 rounded up
+    EXPECT_EQ(8u, layer(0).gop_size);
+    EXPECT_EQ(8u, layer(1).gop_size);
+    EXPECT_EQ(15u, layer(2).gop_size);
+
+    for (unsigned i(0); i < 3; ++i) {
+        EXPECT_EQ(layer(i).max_bit_rate, layer(i).target_bit_rate);
+        EXPECT_EQ(layer(i).max_bit_rate, layer(i).min_bit_rate);
+    }
+}
+
+TEST_F(VDEncBRCLayerTest, EmptyLayer)
+{
+    struct encode_state encode_state;
+    struct buffer_store tls_store, rc_store[2], fr_store[2];
+    VAEncMiscParameterTemporalLayerStructure *tls;
+    VAEncMiscParameterRateControl *rc[2];
+    std::vector<unsigned char> tls_data(
+        sizeof(VAEncMiscParameterBuffer) + sizeof(*tls));
+    std::vector<unsigned char> rc_data[2], fr_data[2];
+
+    std::memset(&encode_state, 0, sizeof(encode_state));
+    std::memset(&tls_store, 0, sizeof(tls_store));
+    std::memset(rc_store, 0, sizeof(rc_store));
+    std::memset(fr_store, 0, sizeof(fr_store));
+
+    tls_store.buffer = &tls_data[0];
+    encode_state.misc_param[VAEncMiscParameterTypeTemporalLayerStructure][0] = &tls_store;
+    tls = reinterpret_cast<VAEncMiscParameterTemporalLayerStructure *>(
+        reinterpret_cast<VAEncMiscParameterBuffer *>(&tls_data[0])->data);
+    tls->number_of_layers = 2;
+    tls->periodicity = 2;
+    tls->layer_id[1] = 1;
+
+    for (unsigned i(0); i < 2; ++i) {
+        rc_data[i].resize(sizeof(VAEncMiscParameterBuffer) + sizeof(*rc[i]));
+        fr_data[i].resize(sizeof(VAEncMiscParameterBuffer)
+            + sizeof(VAEncMiscParameterFrameRate));
+        rc_store[i].buffer = &rc_data[i][0];
+        fr_store[i].buffer = &fr_data[i][0];
+        encode_state.misc_param[VAEncMiscParameterTypeRateControl][i] = &rc_store[i];
+        encode_state.misc_param[VAEncMiscParameterTypeFrameRate][i] = &fr_store[i];
+        rc[i] = reinterpret_cast<VAEncMiscParameterRateControl *>(
+            reinterpret_cast<VAEncMiscParameterBuffer *>(&rc_data[i][0])->data);
+    }
+
+    encoder_context.is_new_sequence = 1;
+    encoder_context.rate_control_mode = VA_RC_CBR;
+    encoder_context.low_power_mode = 1;
+
+    // The upper layer must add bits to the base layer, or it would get no
+    // rate control of its own
+    rc[0]->bits_per_second = 2000000;
+    rc[1]->bits_per_second = 2000000;
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_INVALID_PARAMETER,
+        intel_encoder_check_temporal_layer_structure(
+            NULL, &encode_state, &encoder_context));
+
+    rc[1]->bits_per_second = 1000000;
+    EXPECT_STATUS_EQ(VA_STATUS_ERROR_INVALID_PARAMETER,
+        intel_encoder_check_temporal_layer_structure(
+            NULL, &encode_state, &encoder_context));
+
+    rc[1]->bits_per_second = 3000000;
+    EXPECT_STATUS(intel_encoder_check_temporal_layer_structure(
+        NULL, &encode_state, &encoder_context));
+    EXPECT_EQ(2u, encoder_context.layer.num_layers);
+
+    // The PAK based encoders share one BRC across the layers
+    encoder_context.low_power_mode = 0;
+    rc[1]->bits_per_second = 2000000;
+    EXPECT_STATUS(intel_encoder_check_temporal_layer_structure(
+        NULL, &encode_state, &encoder_context));
+}
+
+TEST_F(VDEncBRCLayerTest, VBR)
+{
+    vdenc_context.internal_rate_mode = I965_BRC_VBR;
+    setLayer(0, 1000000, 15, 1, 70);
+    setLayer(1, 3000000, 30, 1, 80);
+
+    gen9_vdenc_update_brc_layers(NULL, &encoder_context);
+
+    EXPECT_EQ(1000u, layer(0).max_bit_rate);
+    EXPECT_EQ(700u, layer(0).target_bit_rate);
+    EXPECT_EQ(400u, layer(0).min_bit_rate);
+    EXPECT_EQ(2000u, layer(1).max_bit_rate);
+    EXPECT_EQ(1600u, layer(1).target_bit_rate);
+    EXPECT_EQ(1200u, layer(1).min_bit_rate);
+}
+
+TEST_F(VDEncBRCLayerTest, Reset)
+{
+    setLayer(0, 1000000, 15);
+    setLayer(1, 2000000, 30);
+
+    gen9_vdenc_update_brc_layers(NULL, &encoder_context);
+    vdenc_context.layer[0].brc_initted = 1;
+
+    // New rates restart the running instances only
+    setLayer(1, 3000000, 30);
+    gen9_vdenc_update_brc_layers(NULL, &encoder_context);
+    EXPECT_EQ(1u, layer(0).brc_need_reset);
+    EXPECT_EQ(0u, layer(1).brc_need_reset);
+    EXPECT_EQ(2000u, layer(1).max_bit_rate);
+
+    // A different layer structure starts over
+    setLayer(2, 4000000, 60);
+    gen9_vdenc_update_brc_layers(NULL, &encoder_context);
+    EXPECT_EQ(3u, vdenc_context.num_layers);
+    EXPECT_EQ(0u, layer(0).brc_initted);
+    EXPECT_EQ(0u, layer(0).brc_need_reset);
+}
+
+} // namespace
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "i965_test_fixture.h"
+
+extern "C" {
+    #include "gen75_vpp_vebox.h"
+}
+
+#include <vector>
+
+namespace {
+
+/* Statistics buffer as VEBOX leaves it, for a 64x16 picture */
+class StatisticsBuffer
+{
+public:
+    StatisticsBuffer()
+        : block_size(64 * 16 / 4)
+        , data(I965_PROC_STATISTICS_HEADER_SIZE + block_size +
+            VEB_STATISTICS_NUM_SLICES *
+            (VEB_STATISTICS_FRAME_SIZE + VEB_STATISTICS_HISTOGRAM_SIZE), 0)
+    {
+        segment()->pending = 1;
+        segment()->frame_offset = block_size;
+        segment()->slice_pitch = VEB_STATISTICS_FRAME_SIZE;
+        segment()->histogram_offset = block_size +
+            VEB_STATISTICS_NUM_SLICES * VEB_STATISTICS_FRAME_SIZE;
+        segment()->histogram_pitch = VEB_STATISTICS_HISTOGRAM_SIZE;
+        segment()->num_slices = VEB_STATISTICS_NUM_SLICES;
+    }
+
+    struct i965_proc_statistics_segment *segment()
+    {
+        return reinterpret_cast<struct i965_proc_statistics_segment *>(&data[0]);
+    }
+
+    unsigned int *frame(unsigned int slice)
+    {
+        return reinterpret_cast<unsigned int *>(
+            &data[I965_PROC_STATISTICS_HEADER_SIZE + block_size +
+                slice * VEB_STATISTICS_FRAME_SIZE]);
+    }
+
+    unsigned int *histogram(unsigned int slice)
+    {
+        return reinterpret_cast<unsigned int *>(
+            &data[I965_PROC_STATISTICS_HEADER_SIZE + block_size +
+                VEB_STATISTICS_NUM_SLICES * VEB_STATISTICS_FRAME_SIZE +
+                slice * VEB_STATISTICS_HISTOGRAM_SIZE]);
+    }
+
+private:
+    const unsigned int block_size;
+    std::vector<unsigned char> data;
+};
+
+TEST(VEBoxStatisticsTest, SumSlices)
+{
+    StatisticsBuffer buffer;
+
+    buffer.segment()->flags = VA_PROC_STATISTICS_HISTOGRAM |
+        VA_PROC_STATISTICS_NOISE | VA_PROC_STATISTICS_FIELD_MOTION;
+
+    for (unsigned int i = 0; i < VEB_STATISTICS_NUM_SLICES; i++) {
+        for (unsigned int j = 0; j < 256; j++)
+            buffer.histogram(i)[j] = j + i;
+        for (unsigned int j = 0; j < 3; j++) {
+            buffer.frame(i)[VEB_STATISTICS_GNE_OFFSET / 4 + j] = 100 * (i + 1);
+            buffer.frame(i)[VEB_STATISTICS_GNE_OFFSET / 4 + 3 + j] = 10 * (i + 1);
+        }
+        for (unsigned int j = 0; j < 11; j++)
+            buffer.frame(i)[VEB_STATISTICS_FMD_OFFSET / 4 + j] = j;
+    }
+
+    gen75_vebox_get_statistics(NULL, buffer.segment());
+
+    const VAProcStatisticsI965& stats = buffer.segment()->base;
+
+    EXPECT_EQ(0u, buffer.segment()->pending);
+    for (unsigned int j = 0; j < 256; j++)
+        EXPECT_EQ(2 * j + 1, stats.histogram[j]);
+    for (unsigned int j = 0; j < 3; j++) {
+        EXPECT_EQ(300u, stats.noise_sum[j]);
+        EXPECT_EQ(30u, stats.noise_count[j]);
+    }
+    for (unsigned int j = 0; j < 11; j++)
+        EXPECT_EQ(2 * j, stats.field_motion[j]);
+}
+
+TEST(VEBoxStatisticsTest, OnlyEnabledStages)
+{
+    StatisticsBuffer buffer;
+
+    buffer.segment()->flags = VA_PROC_STATISTICS_HISTOGRAM;
+    buffer.histogram(0)[16] = 42;
+    buffer.frame(0)[VEB_STATISTICS_GNE_OFFSET / 4] = 1234;
+    buffer.frame(0)[VEB_STATISTICS_FMD_OFFSET / 4] = 5678;
+
+    gen75_vebox_get_statistics(NULL, buffer.segment());
+
+    const VAProcStatisticsI965& stats = buffer.segment()->base;
+
+    EXPECT_EQ(unsigned(VA_PROC_STATISTICS_HISTOGRAM), stats.flags);
+    EXPECT_EQ(42u, stats.histogram[16]);
+    EXPECT_EQ(0u, stats.noise_sum[0]);
+    EXPECT_EQ(0u, stats.field_motion[0]);
+}
+
+class VEBoxStatisticsBufferTest
+    : public I965TestFixture
+{ };
+
+TEST_F(VEBoxStatisticsBufferTest, NothingBeforeProcessing)
+{
+    VAConfigID config = createConfig(VAProfileNone, VAEntrypointVideoProc);
+    VAContextID context = createContext(config, 64, 64);
+    VABufferID buffer = createBuffer(context,
+        VAProcStatisticsBufferTypeI965, sizeof(VAProcStatisticsI965));
+
+    VAProcStatisticsI965 *stats = mapBuffer<VAProcStatisticsI965>(buffer);
+    EXPECT_EQ(0u, stats->flags);
+    unmapBuffer(buffer);
+
+    destroyBuffer(buffer);
+    destroyContext(context);
+    destroyConfig(config);
+}
+
+} // namespace
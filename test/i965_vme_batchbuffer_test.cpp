@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "i965_test_fixture.h"
+
+extern "C" {
+    #include "i965_encoder.h"
+    #include "gen6_vme.h"
+}
+
+#include <cstring>
+
+class VMEBatchbufferTest
+    : public I965TestFixture
+{
+protected:
+    virtual void SetUp()
+    {
+        I965TestFixture::SetUp();
+
+        std::memset(&vme_context, 0, sizeof(vme_context));
+        std::memset(&state, 0, sizeof(state));
+        std::memset(slice_params, 0, sizeof(slice_params));
+
+        for (unsigned i(0); i < 2; ++i) {
+            slice_stores[i].buffer = reinterpret_cast<unsigned char *>(&slice_params[i]);
+            slice_stores[i].num_elements = 1;
+            slice_store_ptrs[i] = &slice_stores[i];
+        }
+        slice_params[0].macroblock_address = 0;
+        slice_params[0].num_macroblocks = 16;
+        slice_params[1].macroblock_address = 16;
+        slice_params[1].num_macroblocks = 16;
+
+        state.slice_params_ext = slice_store_ptrs;
+        state.num_slice_params_ext = 2;
+
+        std::memset(&key, 0, sizeof(key));
+        key.codec = CODEC_H264;
+        key.mb_width = 8;
+        key.mb_height = 4;
+        key.mbs_per_unit = 1;
+        key.qp = 26;
+
+        intel_vme_batchbuffer_setup(*this, &vme_context, 8, 4);
+    }
+
+    virtual void TearDown()
+    {
+        intel_vme_batchbuffer_destroy(&vme_context);
+
+        I965TestFixture::TearDown();
+    }
+
+    bool reusable(const intel_vme_batch_key *k)
+    {
+        return intel_vme_batchbuffer_reusable(*this, &vme_context,
+            &state, k);
+    }
+
+    gen6_vme_context vme_context;
+    struct encode_state state;
+    buffer_store slice_stores[2];
+    buffer_store *slice_store_ptrs[2];
+    VAEncSliceParameterBufferH264 slice_params[2];
+    intel_vme_batch_key key;
+};
+
+TEST_F(VMEBatchbufferTest, Setup)
+{
+    dri_bo *bo = vme_context.vme_batchbuffer.bo;
+
+    ASSERT_PTR(bo);
+    EXPECT_EQ(33, vme_context.vme_batchbuffer.num_blocks);
+    EXPECT_EQ(33u * 64, bo->size);
+
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    // Same size keeps the buffer and its commands
+    intel_vme_batchbuffer_setup(*this, &vme_context, 8, 4);
+    EXPECT_EQ(bo, vme_context.vme_batchbuffer.bo);
+    EXPECT_TRUE(reusable(&key));
+
+    // A new size drops both
+    intel_vme_batchbuffer_setup(*this, &vme_context, 16, 4);
+    EXPECT_EQ(65, vme_context.vme_batchbuffer.num_blocks);
+    EXPECT_FALSE(reusable(&key));
+}
+
+TEST_F(VMEBatchbufferTest, KeyChanges)
+{
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    key.qp = 30;
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    key.kernel = 1;
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    key.flags = 1;
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    // Per MB data always refills, including the picture after it
+    EXPECT_FALSE(reusable(NULL));
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+}
+
+TEST_F(VMEBatchbufferTest, SliceLayoutChanges)
+{
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    slice_params[0].num_macroblocks = 8;
+    slice_params[1].macroblock_address = 8;
+    slice_params[1].num_macroblocks = 24;
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    state.num_slice_params_ext = 1;
+    slice_params[0].num_macroblocks = 32;
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    // Other slice fields do not matter to the VME batch
+    slice_params[0].slice_type = 1;
+    slice_params[0].slice_qp_delta = 4;
+    EXPECT_TRUE(reusable(&key));
+}
+
+TEST_F(VMEBatchbufferTest, WalkerWithoutSlices)
+{
+    // The MPEG-2 and VP8 walker batches cover the whole picture
+    key.codec = CODEC_VP8;
+    key.walker = 1;
+
+    EXPECT_FALSE(reusable(&key));
+    EXPECT_TRUE(reusable(&key));
+
+    slice_params[0].num_macroblocks = 8;
+    EXPECT_TRUE(reusable(&key));
+}
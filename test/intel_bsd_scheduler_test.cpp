@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2017 Intel Corporation. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL PRECISION INSIGHT AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "test.h"
+
+extern "C" {
+    #include "intel_bsd_scheduler.h"
+}
+
+#include <climits>
+#include <deque>
+#include <vector>
+
+namespace {
+
+/* Surfaces decoded by the fake GPU, one per resource */
+struct FakeSurface
+{
+    FakeSurface() { intel_bsd_fence_init(&fence); }
+
+    struct intel_bsd_fence fence;
+};
+
+/*
+ * Models the rings as FIFOs of submitted pictures. A surface is busy while
+ * any queued picture on any ring writes or reads it.
+ */
+class FakeBackend
+{
+public:
+    FakeBackend(int num_rings)
+        : rings(num_rings)
+    {
+        struct intel_bsd_backend backend;
+
+        backend.is_busy = is_busy;
+        backend.data = this;
+        intel_bsd_scheduler_init(&scheduler, num_rings, &backend);
+    }
+
+    ~FakeBackend()
+    {
+        intel_bsd_scheduler_terminate(&scheduler);
+    }
+
+    int decode(FakeSurface *target,
+               const std::vector<FakeSurface *>& refs = std::vector<FakeSurface *>())
+    {
+        std::vector<struct intel_bsd_dependency> deps;
+        std::vector<FakeSurface *> used(refs);
+        int ring;
+
+        used.push_back(target);
+        for (size_t i = 0; i < used.size(); i++) {
+            struct intel_bsd_dependency dep;
+
+            dep.fence = &used[i]->fence;
+            dep.resource = used[i];
+            deps.push_back(dep);
+        }
+
+        ring = intel_bsd_scheduler_submit(&scheduler, &target->fence,
+                                          deps.data(), deps.size());
+        EXPECT_LE(0, ring);
+        EXPECT_GT((int)rings.size(), ring);
+
+        rings[ring].push_back(used);
+        return ring;
+    }
+
+    void retire(int ring)
+    {
+        ASSERT_FALSE(rings[ring].empty());
+        rings[ring].pop_front();
+    }
+
+    void retire_all()
+    {
+        for (size_t i = 0; i < rings.size(); i++)
+            rings[i].clear();
+    }
+
+    size_t queued(int ring) const { return rings[ring].size(); }
+
+    struct intel_bsd_scheduler scheduler;
+
+private:
+    static int is_busy(void *resource, void *data)
+    {
+        const FakeBackend *self = static_cast<const FakeBackend *>(data);
+
+        for (size_t i = 0; i < self->rings.size(); i++) {
+            for (size_t j = 0; j < self->rings[i].size(); j++) {
+                const std::vector<FakeSurface *>& used = self->rings[i][j];
+
+                for (size_t k = 0; k < used.size(); k++) {
+                    if (used[k] == resource)
+                        return 1;
+                }
+            }
+        }
+        return 0;
+    }
+
+    std::vector<std::deque<std::vector<FakeSurface *> > > rings;
+};
+
+} // namespace
+
+TEST(BSDSchedulerTest, SingleRing)
+{
+    FakeBackend gpu(1);
+    FakeSurface surfaces[4];
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_EQ(0, gpu.decode(&surfaces[i]));
+
+    EXPECT_EQ(4u, gpu.queued(0));
+}
+
+TEST(BSDSchedulerTest, IndependentPicturesAlternate)
+{
+    FakeBackend gpu(2);
+    FakeSurface surfaces[8];
+
+    for (int i = 0; i < 8; i++) {
+        EXPECT_EQ(i & 1, gpu.decode(&surfaces[i]));
+        EXPECT_EQ(i & 1, surfaces[i].fence.ring);
+    }
+
+    EXPECT_EQ(4u, gpu.queued(0));
+    EXPECT_EQ(4u, gpu.queued(1));
+}
+
+TEST(BSDSchedulerTest, DependentPictureFollowsReference)
+{
+    FakeBackend gpu(2);
+    FakeSurface i_frame, p_frame, other;
+
+    EXPECT_EQ(0, gpu.decode(&i_frame));
+    EXPECT_EQ(0, gpu.decode(&p_frame, std::vector<FakeSurface *>(1, &i_frame)));
+
+    /* Ring 0 was used last, so independent work goes to ring 1 */
+    EXPECT_EQ(1, gpu.decode(&other));
+}
+
+TEST(BSDSchedulerTest, IdleReferenceDoesNotPin)
+{
+    FakeBackend gpu(2);
+    FakeSurface i_frame, p_frame;
+
+    EXPECT_EQ(0, gpu.decode(&i_frame));
+    gpu.retire(0);
+
+    EXPECT_EQ(1, gpu.decode(&p_frame, std::vector<FakeSurface *>(1, &i_frame)));
+}
+
+TEST(BSDSchedulerTest, NewestBusyReferenceWins)
+{
+    FakeBackend gpu(2);
+    FakeSurface fwd, bwd, b_frame;
+    std::vector<FakeSurface *> refs;
+
+    EXPECT_EQ(0, gpu.decode(&fwd));
+    EXPECT_EQ(1, gpu.decode(&bwd));
+
+    refs.push_back(&fwd);
+    refs.push_back(&bwd);
+    EXPECT_EQ(1, gpu.decode(&b_frame, refs));
+
+    /* Once the newer reference is done, the older busy one decides */
+    gpu.retire(1);
+    gpu.retire(1);
+    EXPECT_EQ(0, gpu.decode(&b_frame, refs));
+}
+
+TEST(BSDSchedulerTest, RenderTargetInFlight)
+{
+    FakeBackend gpu(2);
+    FakeSurface surface;
+
+    EXPECT_EQ(0, gpu.decode(&surface));
+    EXPECT_EQ(0, gpu.decode(&surface));
+    EXPECT_EQ(2u, gpu.queued(0));
+    EXPECT_EQ(0u, gpu.queued(1));
+}
+
+TEST(BSDSchedulerTest, IndependentStreamsUseBothRings)
+{
+    FakeBackend gpu(2);
+    FakeSurface a[16], b[16];
+
+    /* Two streams of P pictures, each referencing its previous picture */
+    EXPECT_EQ(0, gpu.decode(&a[0]));
+    EXPECT_EQ(1, gpu.decode(&b[0]));
+
+    for (int i = 1; i < 16; i++) {
+        EXPECT_EQ(0, gpu.decode(&a[i], std::vector<FakeSurface *>(1, &a[i - 1])));
+        EXPECT_EQ(1, gpu.decode(&b[i], std::vector<FakeSurface *>(1, &b[i - 1])));
+    }
+
+    EXPECT_EQ(16u, gpu.queued(0));
+    EXPECT_EQ(16u, gpu.queued(1));
+}
+
+TEST(BSDSchedulerTest, SequenceWrap)
+{
+    FakeBackend gpu(2);
+    FakeSurface fwd, bwd, b_frame;
+    std::vector<FakeSurface *> refs;
+
+    gpu.scheduler.seqno = UINT_MAX - 1;
+    gpu.scheduler.ring_seqno[0] = UINT_MAX - 2;
+    gpu.scheduler.ring_seqno[1] = UINT_MAX - 1;
+
+    EXPECT_EQ(0, gpu.decode(&fwd));
+    EXPECT_EQ(1, gpu.decode(&bwd));
+    EXPECT_EQ(0u, bwd.fence.seqno);
+
+    refs.push_back(&fwd);
+    refs.push_back(&bwd);
+    EXPECT_EQ(1, gpu.decode(&b_frame, refs));
+
+    gpu.retire_all();
+    EXPECT_EQ(0, gpu.decode(&fwd));
+}